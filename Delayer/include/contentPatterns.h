@@ -0,0 +1,82 @@
+#ifndef CONTENTPATTERNS_H
+#define CONTENTPATTERNS_H
+
+/**************************************************************************
+** Content Patterns
+** The payloads of a content sweep (unitExperimentSender ... S): one
+** train interleaves probes of many patterns, so a delay triggered by
+** content shows up as the patterns whose delays stand out, in one run.
+**
+** Sweep Probe Structure:
+**
+**    0       4   5       8                              16
+**    +-------+---+-------+-------------------------------+----------
+**    |  ID   |pat|  rsv  |  tx_time_ns (CLOCK_REALTIME)  | pattern
+**    +-------+---+-------+-------------------------------+----------
+**
+** The ID is where the entropy sender puts it. A pattern is a fill byte
+** with an optional signature at a fixed payload offset; offsets below
+** SWEEP_HEADER_LENGTH would be overwritten by the header and are not
+** used. The random pattern is read from /dev/urandom once per run.
+** Multi-byte fields are in host byte order.
+**************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+
+#define SWEEP_HEADER_LENGTH 16
+#define SWEEP_PATTERN_OFFSET 4
+#define SWEEP_TX_TIME_OFFSET 8
+
+//Fill of the random pattern, see content_pattern_fill
+#define PATTERN_FILL_RANDOM -1
+
+struct content_pattern
+{
+	const char* name;
+	int fill;
+	const char* signature;
+	int signature_length;
+	int signature_offset;
+};
+
+static const struct content_pattern content_patterns[] =
+{
+	{ "zeros",      0x00, NULL, 0, 0 },
+	{ "ones",       0xFF, NULL, 0, 0 },
+	{ "alternate",  0xAA, NULL, 0, 0 },
+	{ "ascii",      'A',  NULL, 0, 0 },
+	{ "random",     PATTERN_FILL_RANDOM, NULL, 0, 0 },
+	{ "http",       0x00, "GET / HTTP/1.1\r\nHost: ", 22, SWEEP_HEADER_LENGTH },
+	{ "bittorrent", 0x00, "\x13" "BitTorrent protocol", 20, SWEEP_HEADER_LENGTH },
+	{ "tls",        0x00, "\x16\x03\x01\x02\x00\x01\x00\x01\xfc\x03\x03", 11, SWEEP_HEADER_LENGTH },
+	{ "sip",        0x00, "INVITE sip:", 11, SWEEP_HEADER_LENGTH },
+	{ "skype",      0x00, "\x02\x01\x47\x49", 4, SWEEP_HEADER_LENGTH },
+	{ "edonkey",    0x00, "\xe3\x01\x00\x00\x00\x01", 6, SWEEP_HEADER_LENGTH },
+	{ "http_deep",  0x00, "GET / HTTP/1.1\r\nHost: ", 22, 64 },
+};
+
+#define NUM_CONTENT_PATTERNS ((int) (sizeof content_patterns / sizeof content_patterns[0]))
+
+/*
+ * Fill length bytes of payload with pattern; random_bytes (at least
+ * length bytes) is used for PATTERN_FILL_RANDOM. The header is left
+ * for the sender to write. Signatures that do not fit are cut short.
+ */
+static inline void content_pattern_fill(const struct content_pattern* pattern, uint8_t* payload, int length,
+	const uint8_t* random_bytes)
+{
+	if (pattern->fill == PATTERN_FILL_RANDOM)
+		memcpy(payload, random_bytes, length);
+	else
+		memset(payload, pattern->fill, length);
+
+	int copy = length - pattern->signature_offset;
+	if (pattern->signature == NULL || copy <= 0)
+		return;
+	if (copy > pattern->signature_length)
+		copy = pattern->signature_length;
+	memcpy(payload + pattern->signature_offset, pattern->signature, copy);
+}
+
+#endif
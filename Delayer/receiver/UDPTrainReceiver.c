@@ -6,6 +6,14 @@
 ** Receives datagrams from sender of sequenced packets that have a packet id
 ** and will time stamp these packets and store the id and the time stamp
 ** in a file at the end of the experiment
+**
+** Content Sweep (-s):
+** Probes of a content sweep (unitExperimentSender ... S) carry their
+** pattern id and send time. The receiver also keeps the one-way delay
+** of each and writes, next to the .raw file, a .patterns file with the
+** delay distribution of every pattern and how far its median lies
+** above the lowest median. Only differences between patterns matter,
+** so the clocks need not be synchronized.
 **************************************************************/
 
 #include <stdio.h>
@@ -20,6 +28,7 @@
 #include <signal.h>
 #include <pthread.h>
 #include "taracomConstants.h"
+#include "contentPatterns.h"
 #include <fcntl.h>
 #include <errno.h>
 #include <arpa/inet.h>
@@ -50,6 +59,101 @@ struct timespec diff(struct timespec start, struct timespec end)
 
 int recv_socket;
 
+//Most sweep probes whose delays are kept
+#define MAX_SWEEP_SAMPLES 65536
+
+struct sweep_sample
+{
+	int pattern;
+	int64_t delay_ns;
+};
+
+static struct sweep_sample sweep_samples[MAX_SWEEP_SAMPLES];
+static int num_sweep_samples = 0;
+
+static int compare_sweep_samples(const void* a, const void* b)
+{
+	const struct sweep_sample* left = (const struct sweep_sample*) a;
+	const struct sweep_sample* right = (const struct sweep_sample*) b;
+	if (left->pattern != right->pattern)
+		return left->pattern - right->pattern;
+	return left->delay_ns < right->delay_ns ? -1 : (left->delay_ns > right->delay_ns ? 1 : 0);
+}
+
+/*
+ * Keep the pattern and one-way delay of a received sweep probe
+ */
+void record_sweep_probe(const char* payload, int length)
+{
+	if (length < SWEEP_HEADER_LENGTH || num_sweep_samples >= MAX_SWEEP_SAMPLES)
+		return;
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	int64_t tx_time_ns;
+	memcpy(&tx_time_ns, payload + SWEEP_TX_TIME_OFFSET, sizeof tx_time_ns);
+
+	struct sweep_sample* sample = &sweep_samples[num_sweep_samples++];
+	sample->pattern = (uint8_t) payload[SWEEP_PATTERN_OFFSET];
+	sample->delay_ns = (int64_t) now.tv_sec * 1000000000LL + now.tv_nsec - tx_time_ns;
+}
+
+/*
+ * Nearest rank percentile of n > 0 ascending samples
+ */
+static int64_t sweep_percentile(const struct sweep_sample* sorted, int n, int percentile)
+{
+	int rank = (n * percentile + 99) / 100;
+	return sorted[rank > 0 ? rank - 1 : 0].delay_ns;
+}
+
+/*
+ * Write the delay distribution of every pattern to file_name
+ */
+error_t write_sweep_patterns(const char* file_name)
+{
+	qsort(sweep_samples, num_sweep_samples, sizeof(struct sweep_sample), compare_sweep_samples);
+
+	//Lowest median first: the excess of every pattern is relative to it
+	int64_t lowest_median = 0;
+	int have_median = 0;
+	int first, last;
+	for (first = 0; first < num_sweep_samples; first = last)
+	{
+		for (last = first; last < num_sweep_samples && sweep_samples[last].pattern == sweep_samples[first].pattern; last++)
+			;
+		int64_t median = sweep_percentile(sweep_samples + first, last - first, 50);
+		if (!have_median || median < lowest_median)
+			lowest_median = median;
+		have_median = 1;
+	}
+
+	FILE* file = fopen(file_name, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "ERROR #%d: File Open Failed", FILE_ERROR);
+		return FILE_ERROR;
+	}
+	fprintf(file, "#pattern\tname\treceived\tmin_owd_ns\tp50_owd_ns\tp90_owd_ns\tp99_owd_ns\tmax_owd_ns\t"
+		"excess_p50_ns\n");
+	for (first = 0; first < num_sweep_samples; first = last)
+	{
+		for (last = first; last < num_sweep_samples && sweep_samples[last].pattern == sweep_samples[first].pattern; last++)
+			;
+		const struct sweep_sample* group = sweep_samples + first;
+		int n = last - first;
+		int pattern = group->pattern;
+		fprintf(file, "%d\t%s\t%d\t%lld\t%lld\t%lld\t%lld\t%lld\t%lld\n", pattern,
+			pattern < NUM_CONTENT_PATTERNS ? content_patterns[pattern].name : "unknown", n,
+			(long long) group[0].delay_ns, (long long) sweep_percentile(group, n, 50),
+			(long long) sweep_percentile(group, n, 90), (long long) sweep_percentile(group, n, 99),
+			(long long) group[n - 1].delay_ns, (long long) (sweep_percentile(group, n, 50) - lowest_median));
+	}
+
+	error_t result = ferror(file) ? FWRITE_ERROR : SUCCESS;
+	fclose(file);
+	return result;
+}
+
 
 void handle_shutdown(int sig)
 {
@@ -59,7 +163,8 @@ void handle_shutdown(int sig)
 
 }
 
-error_t UDPTrainReceiver (char* buffer, int probe_packet_length, unsigned long initial_experiment_run_time, unsigned long later_experiment_run_time)
+error_t UDPTrainReceiver (char* buffer, int probe_packet_length, unsigned long initial_experiment_run_time, unsigned long later_experiment_run_time,
+	int sweep)
 {
 	
 	//Not sure what this does exactly
@@ -126,6 +231,9 @@ error_t UDPTrainReceiver (char* buffer, int probe_packet_length, unsigned long i
 	//Used to store the packet before writing to file
 	char packet_buffer[2000];
 
+	//Sweep probes are read whole, their header is longer
+	int recv_length = sweep ? (int) sizeof packet_buffer : probe_packet_length-1;
+
 	//Deliminator used to separate experiments in the output file
 	const char delim[4] = "*\n";
 	int delim_size = strlen(delim);
@@ -167,11 +275,11 @@ error_t UDPTrainReceiver (char* buffer, int probe_packet_length, unsigned long i
 		//receives
 		if (have_ip_address)
 		{
-			recv_bytes = recvfrom(recv_socket, packet_buffer, probe_packet_length-1, 0, NULL, NULL);
+			recv_bytes = recvfrom(recv_socket, packet_buffer, recv_length, 0, NULL, NULL);
 		}
 		else 
 		{
-			if ((recv_bytes = recvfrom(recv_socket, packet_buffer, probe_packet_length-1, 0, (struct sockaddr*) &from_addr, &from_len))>0)
+			if ((recv_bytes = recvfrom(recv_socket, packet_buffer, recv_length, 0, (struct sockaddr*) &from_addr, &from_len))>0)
 			{
 				have_ip_address = 1;
 			}
@@ -190,6 +298,8 @@ error_t UDPTrainReceiver (char* buffer, int probe_packet_length, unsigned long i
 
 			//Get the packet sequence number
 			current_seq_id = *((int*) (packet_buffer));
+			if (sweep)
+				record_sweep_probe(packet_buffer, recv_bytes);
 
 			//if(VERBOSE) printf("%d\n", current_seq_id);
 
@@ -250,7 +360,7 @@ error_t UDPTrainReceiver (char* buffer, int probe_packet_length, unsigned long i
 			experiment_run_time = later_experiment_run_time;  //which is half of the initial_experiment_run_time
 
 			//Variable to hold the output file name
-			char file_name[50] = "./temp/";
+			char file_name[MAX_FILENAME_SIZE] = "./temp/";
 
 			//If we know the sender ip address, set it to the beginning of the file name
 			//otherwise set the beginning of the file name to empty IP address 0.0.0.0
@@ -307,6 +417,17 @@ error_t UDPTrainReceiver (char* buffer, int probe_packet_length, unsigned long i
 			//Close output file
 			fclose(file);
 
+			//Per pattern delays go next to the .raw file
+			if (sweep)
+			{
+				strcpy(file_name + strlen(file_name) - strlen(extension), ".patterns");
+				if (write_sweep_patterns(file_name) != SUCCESS)
+				{
+					close (recv_socket);
+					return FWRITE_ERROR;
+				}
+			}
+
 			//Close Socket
 			close (recv_socket);
 
@@ -325,9 +446,11 @@ char send_buffer[MAX_SEND_BUFFER_SIZE]; //Hardcoded based on max number of probe
 int main(int argc, char *argv[])
 {
 
-  if(argc != 3){
+  //Content sweep: ./receiver experiment_run_time probe_packet_length -s
+  int sweep = argc == 4 && strcmp(argv[3], "-s") == 0;
+  if(argc != 3 && !sweep){
     fprintf(stderr,"ERROR #%d: INVALID NUMBER OF ARGUMENTS\n", INVALID_NUMBER_OF_ARGUMENTS);
-    fprintf(stderr, "Usage: ./receiver experiment_run_time probe_packet_length\n"); 
+    fprintf(stderr, "Usage: ./receiver experiment_run_time probe_packet_length [-s]\n"); 
     return INVALID_NUMBER_OF_ARGUMENTS;
   }
   
@@ -345,7 +468,7 @@ int main(int argc, char *argv[])
     send_buffer[i] = 0;
   }
 
-  if(UDPTrainReceiver(send_buffer, probe_packet_length, initial_experiment_run_time,  later_experiment_run_time)!= 0)
+  if(UDPTrainReceiver(send_buffer, probe_packet_length, initial_experiment_run_time,  later_experiment_run_time, sweep)!= 0)
   {
     fprintf(stderr, "ERROR #%d: UDP Train Receiver Error", UDP_TRAIN_RECEIVER_FAILED);
     return UDP_TRAIN_RECEIVER_FAILED;                    
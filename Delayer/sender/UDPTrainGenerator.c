@@ -16,9 +16,18 @@
 **    |  ID |        High or Low Entropy Data         |
 **    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 **
+** Content Sweep (entropy 'S'):
+** Instead of one payload for the whole train, interleave the payload
+** patterns of contentPatterns.h round robin (all of them, or the
+** comma separated pattern ids given after 'S'). Each probe carries its
+** pattern id and send time (see contentPatterns.h for the layout), so
+** the receiver (-s) can tell which content is delayed in one run.
+** payload_length must be at least SWEEP_HEADER_LENGTH.
+**
 ** How To Run Code:
-** ./sender num_packets payload_length compression_node_addr entropy
+** ./sender num_packets payload_length compression_node_addr entropy [pattern_ids]
 ** Example: ./sender 60000 1500 127.0.0.1 H
+**          ./sender 60000 1500 127.0.0.1 S 0,1,5,6
 ********************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
@@ -30,6 +39,7 @@
 #include <time.h>
 
 #include "taracomConstants.h"
+#include "contentPatterns.h"
 
 /***************************************************************
  * Function used to return a timespec that holds the difference
@@ -125,22 +135,161 @@ error_t UDPTrainGenerator (int num_of_packets,int probe_payload_length,char entr
   return SUCCESS;
 }
 
+/***************************************************************
+ * Parse a comma separated list of pattern ids, or take every
+ * pattern when pattern_list is NULL. Returns the number of ids,
+ * 0 on error.
+ ***************************************************************/
+int parse_pattern_ids(const char* pattern_list, int* pattern_ids)
+{
+  int num_patterns = 0;
+  if (pattern_list == NULL)
+  {
+    for (num_patterns = 0; num_patterns < NUM_CONTENT_PATTERNS; num_patterns++)
+      pattern_ids[num_patterns] = num_patterns;
+    return num_patterns;
+  }
+  while (*pattern_list != '\0' && num_patterns < NUM_CONTENT_PATTERNS)
+  {
+    char* end;
+    long id = strtol(pattern_list, &end, 10);
+    if (end == pattern_list || id < 0 || id >= NUM_CONTENT_PATTERNS || (*end != ',' && *end != '\0'))
+      return 0;
+    pattern_ids[num_patterns++] = (int) id;
+    pattern_list = *end == ',' ? end + 1 : end;
+  }
+  return *pattern_list == '\0' ? num_patterns : 0;
+}
+
+/***************************************************************
+ * Send a train that cycles through the given content patterns.
+ * One payload per pattern is built up front; only the header
+ * changes from probe to probe.
+ ***************************************************************/
+error_t UDPPatternSweepGenerator (int num_of_packets, int probe_payload_length, char* compression_node_addr,
+  const int* pattern_ids, int num_patterns)
+{
+  if (probe_payload_length < SWEEP_HEADER_LENGTH || probe_payload_length > MAX_PACKET_SIZE)
+  {
+    fprintf(stderr, "ERROR #%d: Sweep probes need %d to %d bytes\n", INVALID_NUMBER_OF_ARGUMENTS,
+      SWEEP_HEADER_LENGTH, MAX_PACKET_SIZE);
+    return INVALID_NUMBER_OF_ARGUMENTS;
+  }
+
+  // Set up send_socket
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  struct addrinfo* dest_addr_info;
+  int status = getaddrinfo(compression_node_addr, UDP_PROBE_PORT_NUMBER, &hints, &dest_addr_info);
+  if (status != 0)
+  {
+    fprintf(stderr, "ERROR #%d: Address Information Error\n", ADDRINFO_ERROR);
+    return ADDRINFO_ERROR;
+  }
+
+  int send_socket = socket(dest_addr_info->ai_family, dest_addr_info->ai_socktype, dest_addr_info->ai_protocol);
+  if (send_socket == -1)
+  {
+    freeaddrinfo(dest_addr_info);
+    fprintf(stderr, "ERROR #%d: Socket Setup Error\n", SOCKET_SETUP_ERROR);
+    return SOCKET_SETUP_ERROR;
+  }
+
+  //The random pattern is the same random bytes in every one of its probes
+  static uint8_t random_bytes[MAX_PACKET_SIZE];
+  FILE* urandom = fopen("/dev/urandom", "rb");
+  if (urandom == NULL)
+  {
+    freeaddrinfo(dest_addr_info);
+    close(send_socket);
+    fprintf(stderr, "ERROR #%d: Failed to open /dev/urandom\n", URANDOM_FILE_OPEN_FAILED);
+    return URANDOM_FILE_OPEN_FAILED;
+  }
+  size_t read_bytes = fread(random_bytes, 1, probe_payload_length, urandom);
+  fclose(urandom);
+  if (read_bytes != (size_t) probe_payload_length)
+  {
+    freeaddrinfo(dest_addr_info);
+    close(send_socket);
+    fprintf(stderr, "ERROR #%d: Failed to read /dev/urandom\n", URANDOM_READ_ERROR);
+    return URANDOM_READ_ERROR;
+  }
+
+  uint8_t* payloads = (uint8_t*) malloc((size_t) num_patterns * probe_payload_length);
+  if (payloads == NULL)
+  {
+    freeaddrinfo(dest_addr_info);
+    close(send_socket);
+    return FAILURE;
+  }
+  int p;
+  for (p = 0; p < num_patterns; p++)
+  {
+    uint8_t* payload = payloads + (size_t) p * probe_payload_length;
+    content_pattern_fill(&content_patterns[pattern_ids[p]], payload, probe_payload_length, random_bytes);
+    memset(payload, 0, SWEEP_HEADER_LENGTH);
+    payload[SWEEP_PATTERN_OFFSET] = (uint8_t) pattern_ids[p];
+  }
+
+  //Round robin, so every pattern sees the same path conditions
+  int packet_seq_id;
+  for (packet_seq_id = 0; packet_seq_id < num_of_packets; packet_seq_id++)
+  {
+    uint8_t* payload = payloads + (size_t) (packet_seq_id % num_patterns) * probe_payload_length;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t tx_time_ns = (int64_t) now.tv_sec * 1000000000LL + now.tv_nsec;
+    memcpy(payload, &packet_seq_id, sizeof packet_seq_id);
+    memcpy(payload + SWEEP_TX_TIME_OFFSET, &tx_time_ns, sizeof tx_time_ns);
+    sendto(send_socket, payload, probe_payload_length, 0,
+      dest_addr_info->ai_addr, dest_addr_info->ai_addrlen);
+  }
+
+  freeaddrinfo (dest_addr_info);
+  free (payloads);
+  close (send_socket);
+
+  return SUCCESS;
+}
+
 
 int main(int argc, char *argv[])
 {
 
-  //Sender takes in 4 arguments
-  //./unitExperimentSender num_of_packets probe_payload_length compression_node_addr entropy
-  if(argc != 5)
+  //Sender takes in 4 arguments, a sweep optionally a fifth
+  //./unitExperimentSender num_of_packets probe_payload_length compression_node_addr entropy [pattern_ids]
+  if(argc != 5 && !(argc == 6 && strcmp(argv[4], "S") == 0))
   {
     fprintf(stderr,"ERROR #%d: INVALID NUMBER OF ARGUMENTS\n", INVALID_NUMBER_OF_ARGUMENTS);
     fprintf(stderr, "Usage: ./unitExperimentSender num_of_packets probe_payload_length compression_node_addr entropy\n");
+    fprintf(stderr, "       ./unitExperimentSender num_of_packets probe_payload_length compression_node_addr S [pattern_ids]\n");
     return INVALID_NUMBER_OF_ARGUMENTS;
   }
   int num_of_packets = atoi(argv[1]); //Number of Packets [1,60000]
   int probe_payload_length = atoi(argv[2]); //[0,1500] in bytes
   char* compression_node_addr = argv[3]; //ip address of compression node X??.X??.X??.X??   TODO? must be IPv4 address?
-  char* entropy = argv[4];//entropy either 'H' or 'L'
+  char* entropy = argv[4];//entropy either 'H' or 'L', or 'S' for a content sweep
+
+  if(entropy[0] == 'S')
+  {
+    int pattern_ids[NUM_CONTENT_PATTERNS];
+    int num_patterns = parse_pattern_ids(argc == 6 ? argv[5] : NULL, pattern_ids);
+    if(num_patterns == 0)
+    {
+      fprintf(stderr,"ERROR #%d: Pattern ids are 0 to %d\n", INVALID_NUMBER_OF_ARGUMENTS, NUM_CONTENT_PATTERNS - 1);
+      return INVALID_NUMBER_OF_ARGUMENTS;
+    }
+    if(UDPPatternSweepGenerator(num_of_packets, probe_payload_length, compression_node_addr, pattern_ids,
+      num_patterns) != SUCCESS)
+    {
+      fprintf(stderr, "ERROR #%d: UDP Train Generator Error\n", UDP_TRAIN_GENERATOR_FAILED);
+      return UDP_TRAIN_GENERATOR_FAILED;
+    }
+    return SUCCESS;
+  }
 
   /*Call UDP Connection to Send Data to Receiver*/
   if(UDPTrainGenerator(num_of_packets, probe_payload_length,entropy[0],compression_node_addr) != SUCCESS)
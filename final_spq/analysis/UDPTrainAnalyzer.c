@@ -0,0 +1,252 @@
+/**************************************************************************
+** Campaign Analyzer
+** Analyze many .raw files in parallel and write one summary table of
+** per run statistics and verdicts (runAnalysis.h). An on disk index
+** (runIndex.h) remembers every run already analyzed, so re-running over
+** a growing output_raw/ only analyzes the new runs.
+**
+** Parameters:
+**  (1) index_file   = run index, created if it does not exist
+**  (2) summary_file = summary table to write, "-" for stdout
+**  (3) raw_file...  = the runs of the campaign
+**  Optional flags:
+**  -j threads       worker threads, default the number of processors
+**  -p names         the sender run of each phase, default "LH"
+**  -s initial_train_length seperation_train_length num_packet_trains
+**                   the sender schedule, so trailing losses are counted
+**  -n num_packets   without a schedule, expected probes per class
+**  -a alpha         significance of the sequential test, default 0.01
+**
+** How To Run Code:
+**   ./unitExperimentAnalyzer [-j threads] [-p names] [-s initial seperation trains]
+**   [-n num_packets] [-a alpha] index_file summary_file raw_file...
+**
+** Example:
+**   ./unitExperimentAnalyzer -s 2001 19 200 output_raw/index.txt summary.tsv output_raw/131.179.*.raw
+**************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "taracomConstants.h"
+#include "runAnalysis.h"
+#include "runIndex.h"
+#include "workStealingPool.h"
+#include "sequentialTest.h"
+
+struct analyzer_run
+{
+	const char* path;
+	long long size;
+	long long mtime_ns;
+
+	//Rows reused from the index, or produced by the analysis
+	const char* rows;
+	char* new_rows;
+	error_t status;
+};
+
+struct analyzer_context
+{
+	const struct analysis_params* params;
+	struct analyzer_run** pending;
+};
+
+static void analyze_task(int task, int worker, void* context)
+{
+	struct analyzer_context* analyzer = (struct analyzer_context*) context;
+	struct analyzer_run* run = analyzer->pending[task];
+	run->status = analyze_raw_file(run->path, analyzer->params, &run->new_rows);
+}
+
+static int compare_runs(const void* a, const void* b)
+{
+	return strcmp(((const struct analyzer_run*) a)->path, ((const struct analyzer_run*) b)->path);
+}
+
+/*
+ * Replace what entry holds with the new analysis of run
+ */
+static void fold_run(struct index_entry* entry, struct analyzer_run* run, const char* params_key)
+{
+	free(entry->params);
+	free(entry->rows);
+	entry->params = strdup(params_key);
+	entry->rows = run->new_rows;
+	entry->size = run->size;
+	entry->mtime_ns = run->mtime_ns;
+	run->new_rows = NULL;
+	run->rows = entry->rows;
+}
+
+int main(int argc, char *argv[])
+{
+  struct analysis_params params;
+  memset(&params, 0, sizeof params);
+  params.refine.phase_names = DEFAULT_PHASE_NAMES;
+  params.alpha = SEQUENTIAL_DEFAULT_ALPHA;
+  int num_workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+  int arg = 1;
+  while(arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0')
+  {
+    if(strcmp(argv[arg], "-j") == 0 && arg + 1 < argc)
+    {
+      num_workers = atoi(argv[arg + 1]);
+      arg += 2;
+    }
+    else if(strcmp(argv[arg], "-p") == 0 && arg + 1 < argc)
+    {
+      params.refine.phase_names = argv[arg + 1];
+      arg += 2;
+    }
+    else if(strcmp(argv[arg], "-s") == 0 && arg + 3 < argc)
+    {
+      params.refine.have_schedule = 1;
+      params.refine.initial_train_length = atoi(argv[arg + 1]);
+      params.refine.seperation_train_length = atoi(argv[arg + 2]);
+      params.refine.num_packet_trains = atoi(argv[arg + 3]);
+      arg += 4;
+    }
+    else if(strcmp(argv[arg], "-n") == 0 && arg + 1 < argc)
+    {
+      params.refine.num_packets = atoi(argv[arg + 1]);
+      arg += 2;
+    }
+    else if(strcmp(argv[arg], "-a") == 0 && arg + 1 < argc)
+    {
+      params.alpha = atof(argv[arg + 1]);
+      arg += 2;
+    }
+    else
+      break;
+  }
+
+  if(argc - arg < 3 || num_workers < 1 || params.alpha <= 0 || params.alpha >= 0.5)
+  {
+    fprintf(stderr,"ERROR #%d: INVALID NUMBER OF ARGUMENTS\n", INVALID_NUMBER_OF_ARGUMENTS);
+    fprintf(stderr, "Usage: ./unitExperimentAnalyzer [-j threads] [-p names] [-s initial seperation trains] [-n num_packets] [-a alpha] index_file summary_file raw_file...\n");
+    return INVALID_NUMBER_OF_ARGUMENTS;
+  }
+  const char* index_file = argv[arg++];
+  const char* summary_file = argv[arg++];
+
+  //Runs analyzed with other parameters are analyzed again
+  char params_key[MAX_FILENAME_SIZE];
+  snprintf(params_key, sizeof params_key, "names=%s;schedule=%d,%d,%d;packets=%d;alpha=%g",
+    params.refine.phase_names, params.refine.initial_train_length, params.refine.seperation_train_length,
+    params.refine.num_packet_trains, params.refine.num_packets, params.alpha);
+
+  struct run_index index;
+  if(run_index_load(&index, index_file) != SUCCESS)
+    return FREAD_ERROR;
+
+  int num_runs = argc - arg;
+  struct analyzer_run* runs = (struct analyzer_run*) calloc(num_runs, sizeof(struct analyzer_run));
+  struct analyzer_run** pending = (struct analyzer_run**) calloc(num_runs, sizeof(struct analyzer_run*));
+  if(runs == NULL || pending == NULL)
+    return FAILURE;
+
+  int i;
+  for(i = 0; i < num_runs; i++)
+    runs[i].path = argv[arg + i];
+  qsort(runs, num_runs, sizeof(struct analyzer_run), compare_runs);
+
+  //Reuse what the index already holds for unchanged runs
+  int num_pending = 0;
+  int num_reused = 0;
+  for(i = 0; i < num_runs; i++)
+  {
+    struct analyzer_run* run = &runs[i];
+    if(i > 0 && strcmp(run->path, runs[i - 1].path) == 0)
+      continue;
+    struct stat file_stat;
+    if(stat(run->path, &file_stat) != 0)
+    {
+      fprintf(stderr, "ERROR #%d: Could not open %s\n", FILE_ERROR, run->path);
+      run->status = FILE_ERROR;
+      continue;
+    }
+    run->size = (long long) file_stat.st_size;
+    run->mtime_ns = (long long) file_stat.st_mtim.tv_sec * 1000000000LL + file_stat.st_mtim.tv_nsec;
+
+    struct index_entry* entry = run_index_find(&index, run->path);
+    if(entry != NULL && entry->size == run->size && entry->mtime_ns == run->mtime_ns &&
+      strcmp(entry->params, params_key) == 0)
+    {
+      run->rows = entry->rows;
+      num_reused++;
+    }
+    else
+      pending[num_pending++] = run;
+  }
+
+  struct analyzer_context context = { &params, pending };
+  if(work_pool_run(num_pending, num_workers, analyze_task, &context) != SUCCESS)
+    return FAILURE;
+
+  //Fold the new results into the index. Runs already in it are looked
+  //up first: run_index_add leaves the index unsorted, and
+  //run_index_find only works on a sorted one
+  error_t result = SUCCESS;
+  int num_analyzed = 0;
+  for(i = 0; i < num_pending; i++)
+  {
+    struct analyzer_run* run = pending[i];
+    if(run->status != SUCCESS)
+    {
+      result = FAILURE;
+      continue;
+    }
+    struct index_entry* entry = run_index_find(&index, run->path);
+    if(entry != NULL)
+    {
+      fold_run(entry, run, params_key);
+      num_analyzed++;
+    }
+  }
+  for(i = 0; i < num_pending; i++)
+  {
+    struct analyzer_run* run = pending[i];
+    if(run->status != SUCCESS || run->rows != NULL)
+      continue;
+    struct index_entry* entry = run_index_add(&index, run->path);
+    if(entry == NULL)
+    {
+      result = FAILURE;
+      continue;
+    }
+    fold_run(entry, run, params_key);
+    num_analyzed++;
+  }
+  run_index_sort(&index);
+  if(run_index_save(&index, index_file) != SUCCESS)
+    result = FWRITE_ERROR;
+
+  //One table for every run asked for, whether new or reused
+  FILE* summary = strcmp(summary_file, "-") == 0 ? stdout : fopen(summary_file, "w");
+  if(summary == NULL)
+  {
+    fprintf(stderr, "ERROR #%d: Could not open %s\n", FILE_ERROR, summary_file);
+    result = FILE_ERROR;
+  }
+  else
+  {
+    fputs(RUN_SUMMARY_HEADER, summary);
+    for(i = 0; i < num_runs; i++)
+    {
+      if(runs[i].rows != NULL && (i == 0 || strcmp(runs[i].path, runs[i - 1].path) != 0))
+        fputs(runs[i].rows, summary);
+    }
+    if(summary != stdout && fclose(summary) != 0)
+      result = FWRITE_ERROR;
+  }
+
+  fprintf(stderr, "%d runs analyzed, %d reused from %s\n", num_analyzed, num_reused, index_file);
+  run_index_free(&index);
+  free(pending);
+  free(runs);
+  return result;
+}
@@ -0,0 +1,333 @@
+/*************************************************************
+** Differentiation Tests
+** See differentiationTest.h for the tests and the verdict.
+**************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "differentiationTest.h"
+#include "sequentialTest.h"
+#include "workStealingPool.h"
+
+struct bootstrap_context
+{
+	const double* high;
+	size_t num_high;
+	const double* low;
+	size_t num_low;
+	double percentile;
+	uint64_t seed;
+	int iterations;
+
+	//Per worker resample counts, num_high + num_low each
+	uint32_t* counts[MAX_POOL_WORKERS];
+
+	double* median_differences;
+	double* percentile_differences;
+};
+
+static int compare_doubles(const void* a, const void* b)
+{
+	double x = *(const double*) a;
+	double y = *(const double*) b;
+	return (x > y) - (x < y);
+}
+
+static inline uint64_t splitmix64(uint64_t* state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static inline size_t percentile_rank(size_t n, double percentile)
+{
+	size_t rank = (size_t) ceil(percentile / 100.0 * (double) n);
+	if (rank < 1)
+		rank = 1;
+	if (rank > n)
+		rank = n;
+	return rank;
+}
+
+void differentiation_default_config(struct differentiation_config* config)
+{
+	config->alpha = SEQUENTIAL_DEFAULT_ALPHA;
+	config->iterations = DIFFERENTIATION_DEFAULT_ITERATIONS;
+	config->percentile = DIFFERENTIATION_DEFAULT_PERCENTILE;
+	config->min_difference = DIFFERENTIATION_DEFAULT_MIN_DIFFERENCE;
+	config->num_workers = 1;
+	config->seed = DIFFERENTIATION_DEFAULT_SEED;
+}
+
+double sorted_percentile(const double* sorted, size_t n, double percentile)
+{
+	return sorted[percentile_rank(n, percentile) - 1];
+}
+
+void ks_two_sample(const double* high, size_t num_high, const double* low, size_t num_low,
+	struct ks_result* result)
+{
+	result->statistic = 0;
+	result->p_value = 1;
+	if (num_high == 0 || num_low == 0)
+		return;
+
+	//Walk both empirical distribution functions, stepping over ties together
+	size_t i = 0, j = 0;
+	double largest = 0;
+	while (i < num_high && j < num_low)
+	{
+		double value = high[i] < low[j] ? high[i] : low[j];
+		while (i < num_high && high[i] == value)
+			i++;
+		while (j < num_low && low[j] == value)
+			j++;
+		double distance = fabs((double) i / num_high - (double) j / num_low);
+		if (distance > largest)
+			largest = distance;
+	}
+	result->statistic = largest;
+
+	//Asymptotic Kolmogorov distribution with Stephens' small sample correction
+	double effective = sqrt((double) num_high * num_low / (num_high + num_low));
+	double lambda = (effective + 0.12 + 0.11 / effective) * largest;
+	if (lambda < 0.2)
+		return;
+	double sum = 0, sign = 1;
+	int k;
+	for (k = 1; k <= 100; k++)
+	{
+		double term = sign * exp(-2.0 * k * k * lambda * lambda);
+		sum += term;
+		if (fabs(term) < 1e-12 * sum)
+			break;
+		sign = -sign;
+	}
+	result->p_value = fmin(1.0, fmax(0.0, 2.0 * sum));
+}
+
+void mann_whitney_u(const double* high, size_t num_high, const double* low, size_t num_low,
+	struct rank_result* result)
+{
+	result->u = 0;
+	result->z = 0;
+	result->p_value = 1;
+	result->effect = 0.5;
+	if (num_high == 0 || num_low == 0)
+		return;
+
+	//Merge the sorted samples, giving each group of ties its average rank
+	size_t i = 0, j = 0, rank = 0;
+	double low_rank_sum = 0, tie_sum = 0;
+	while (i < num_high || j < num_low)
+	{
+		double value = j == num_low || (i < num_high && high[i] < low[j]) ? high[i] : low[j];
+		size_t tied_high = 0, tied_low = 0;
+		while (i < num_high && high[i] == value)
+		{
+			i++;
+			tied_high++;
+		}
+		while (j < num_low && low[j] == value)
+		{
+			j++;
+			tied_low++;
+		}
+		double tied = (double) (tied_high + tied_low);
+		low_rank_sum += tied_low * (rank + (tied + 1) / 2);
+		tie_sum += tied * tied * tied - tied;
+		rank += tied_high + tied_low;
+	}
+
+	double n1 = (double) num_high, n2 = (double) num_low, n = n1 + n2;
+	result->u = low_rank_sum - n2 * (n2 + 1) / 2;
+	result->effect = result->u / (n1 * n2);
+
+	double variance = n1 * n2 / 12.0 * ((n + 1) - tie_sum / (n * (n - 1)));
+	if (variance <= 0)
+		return;
+
+	//Normal approximation with continuity correction
+	double deviation = result->u - n1 * n2 / 2;
+	double corrected = fmax(0.0, fabs(deviation) - 0.5);
+	result->z = (deviation < 0 ? -corrected : corrected) / sqrt(variance);
+	result->p_value = erfc(fabs(result->z) / sqrt(2.0));
+}
+
+/*
+ * Values of rank median_rank and percentile_rank of a resample of the
+ * sorted values, drawn as counts per index so nothing is sorted again
+ */
+static void resample(const double* sorted, size_t n, uint32_t* counts, uint64_t* state,
+	size_t median_rank, size_t other_rank, double* median, double* other)
+{
+	memset(counts, 0, n * sizeof *counts);
+	size_t k;
+	for (k = 0; k < n; k++)
+		counts[(size_t) (((unsigned __int128) splitmix64(state) * n) >> 64)]++;
+
+	size_t seen = 0, index = 0;
+	size_t first_rank = median_rank < other_rank ? median_rank : other_rank;
+	size_t second_rank = median_rank < other_rank ? other_rank : median_rank;
+	while (seen + counts[index] < first_rank)
+		seen += counts[index++];
+	double first = sorted[index];
+	while (seen + counts[index] < second_rank)
+		seen += counts[index++];
+	double second = sorted[index];
+
+	*median = median_rank == first_rank ? first : second;
+	*other = median_rank == first_rank ? second : first;
+}
+
+static void bootstrap_task(int task, int worker, void* context)
+{
+	struct bootstrap_context* bootstrap = (struct bootstrap_context*) context;
+	uint32_t* high_counts = bootstrap->counts[worker];
+	uint32_t* low_counts = high_counts + bootstrap->num_high;
+	size_t high_median = percentile_rank(bootstrap->num_high, 50);
+	size_t high_other = percentile_rank(bootstrap->num_high, bootstrap->percentile);
+	size_t low_median = percentile_rank(bootstrap->num_low, 50);
+	size_t low_other = percentile_rank(bootstrap->num_low, bootstrap->percentile);
+
+	uint64_t state = bootstrap->seed ^ ((uint64_t) task * 0xd1b54a32d192ed03ULL);
+	int first = task * BOOTSTRAP_CHUNK;
+	int last = first + BOOTSTRAP_CHUNK < bootstrap->iterations ? first + BOOTSTRAP_CHUNK : bootstrap->iterations;
+	int iteration;
+	for (iteration = first; iteration < last; iteration++)
+	{
+		double high_median_value, high_other_value, low_median_value, low_other_value;
+		resample(bootstrap->high, bootstrap->num_high, high_counts, &state, high_median, high_other,
+			&high_median_value, &high_other_value);
+		resample(bootstrap->low, bootstrap->num_low, low_counts, &state, low_median, low_other,
+			&low_median_value, &low_other_value);
+		bootstrap->median_differences[iteration] = low_median_value - high_median_value;
+		bootstrap->percentile_differences[iteration] = low_other_value - high_other_value;
+	}
+}
+
+/*
+ * Percentile interval of the bootstrap differences, and how often they
+ * fall on either side of 0
+ */
+static void bootstrap_interval(double* differences, int iterations, double alpha, struct bootstrap_interval* interval)
+{
+	int at_most_zero = 0, at_least_zero = 0, i;
+	for (i = 0; i < iterations; i++)
+	{
+		at_most_zero += differences[i] <= 0;
+		at_least_zero += differences[i] >= 0;
+	}
+	qsort(differences, iterations, sizeof(double), compare_doubles);
+	interval->low = sorted_percentile(differences, iterations, 100.0 * alpha / 2);
+	interval->high = sorted_percentile(differences, iterations, 100.0 * (1 - alpha / 2));
+
+	int tail = at_most_zero < at_least_zero ? at_most_zero : at_least_zero;
+	interval->p_value = fmin(1.0, 2.0 * (tail + 1) / (iterations + 1));
+}
+
+error_t bootstrap_differences(const double* high, size_t num_high, const double* low, size_t num_low,
+	const struct differentiation_config* config, struct bootstrap_interval* median,
+	struct bootstrap_interval* percentile)
+{
+	memset(median, 0, sizeof *median);
+	memset(percentile, 0, sizeof *percentile);
+	median->p_value = percentile->p_value = 1;
+	if (num_high == 0 || num_low == 0)
+		return SUCCESS;
+	median->estimate = sorted_percentile(low, num_low, 50) - sorted_percentile(high, num_high, 50);
+	percentile->estimate = sorted_percentile(low, num_low, config->percentile) -
+		sorted_percentile(high, num_high, config->percentile);
+	median->low = median->high = median->estimate;
+	percentile->low = percentile->high = percentile->estimate;
+	if (config->iterations <= 0)
+		return SUCCESS;
+
+	int num_tasks = (config->iterations + BOOTSTRAP_CHUNK - 1) / BOOTSTRAP_CHUNK;
+	int num_workers = config->num_workers;
+	if (num_workers > num_tasks)
+		num_workers = num_tasks;
+	if (num_workers > MAX_POOL_WORKERS)
+		num_workers = MAX_POOL_WORKERS;
+	if (num_workers < 1)
+		num_workers = 1;
+
+	struct bootstrap_context* bootstrap = (struct bootstrap_context*) calloc(1, sizeof *bootstrap);
+	if (bootstrap == NULL)
+		return FAILURE;
+	bootstrap->high = high;
+	bootstrap->num_high = num_high;
+	bootstrap->low = low;
+	bootstrap->num_low = num_low;
+	bootstrap->percentile = config->percentile;
+	bootstrap->seed = config->seed;
+	bootstrap->iterations = config->iterations;
+	bootstrap->median_differences = (double*) malloc(config->iterations * sizeof(double));
+	bootstrap->percentile_differences = (double*) malloc(config->iterations * sizeof(double));
+
+	error_t status = bootstrap->median_differences != NULL && bootstrap->percentile_differences != NULL ?
+		SUCCESS : FAILURE;
+	int w;
+	for (w = 0; w < num_workers && status == SUCCESS; w++)
+	{
+		bootstrap->counts[w] = (uint32_t*) malloc((num_high + num_low) * sizeof(uint32_t));
+		if (bootstrap->counts[w] == NULL)
+			status = FAILURE;
+	}
+
+	if (status == SUCCESS)
+		status = work_pool_run(num_tasks, num_workers, bootstrap_task, bootstrap);
+	if (status == SUCCESS)
+	{
+		bootstrap_interval(bootstrap->median_differences, config->iterations, config->alpha, median);
+		bootstrap_interval(bootstrap->percentile_differences, config->iterations, config->alpha, percentile);
+	}
+
+	for (w = 0; w < num_workers; w++)
+		free(bootstrap->counts[w]);
+	free(bootstrap->median_differences);
+	free(bootstrap->percentile_differences);
+	free(bootstrap);
+	return status;
+}
+
+error_t differentiation_test(double* high, size_t num_high, double* low, size_t num_low,
+	const struct differentiation_config* config, struct differentiation_result* result)
+{
+	memset(result, 0, sizeof *result);
+	result->num_high = num_high;
+	result->num_low = num_low;
+	result->verdict = SEQUENTIAL_UNDECIDED;
+	result->p_value = 1;
+
+	qsort(high, num_high, sizeof(double), compare_doubles);
+	qsort(low, num_low, sizeof(double), compare_doubles);
+	if (num_high > 0)
+		result->median_high = sorted_percentile(high, num_high, 50);
+	if (num_low > 0)
+		result->median_low = sorted_percentile(low, num_low, 50);
+
+	ks_two_sample(high, num_high, low, num_low, &result->ks);
+	mann_whitney_u(high, num_high, low, num_low, &result->rank);
+	error_t status = bootstrap_differences(high, num_high, low, num_low, config,
+		&result->median_difference, &result->percentile_difference);
+	if (status != SUCCESS)
+		return status;
+	if (num_high < DIFFERENTIATION_MIN_SAMPLES || num_low < DIFFERENTIATION_MIN_SAMPLES)
+		return SUCCESS;
+
+	const struct bootstrap_interval* median = &result->median_difference;
+	result->p_value = fmax(result->rank.p_value, median->p_value);
+	int significant = result->rank.p_value < config->alpha && fabs(median->estimate) >= config->min_difference;
+	if (significant && median->low > 0)
+		result->verdict = SEQUENTIAL_HIGH_FAVOURED;
+	else if (significant && median->high < 0)
+		result->verdict = SEQUENTIAL_LOW_FAVOURED;
+	else
+		result->verdict = SEQUENTIAL_NEUTRAL;
+	return SUCCESS;
+}
@@ -0,0 +1,422 @@
+/*************************************************************
+** Run Analysis
+** See runAnalysis.h for what is computed.
+**************************************************************/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "runAnalysis.h"
+#include "sequenceTracker.h"
+#include "quantileHistogram.h"
+#include "sequentialTest.h"
+#include "captureArchive.h"
+#include "columnKernels.h"
+
+//Phases beyond this are folded into the last one
+#define MAX_RUN_PHASES 16
+
+struct class_state
+{
+	int used;
+	int have_previous;
+	int64_t previous_rx_ns;
+	struct sequence_tracker tracker;
+	struct quantile_histogram interarrival;
+};
+
+struct phase_state
+{
+	struct class_state classes[2];
+	struct sequential_test sequential;
+	int verdict_from_owd;
+};
+
+struct row_buffer
+{
+	char* data;
+	size_t used;
+	size_t capacity;
+};
+
+static int append_row(struct row_buffer* rows, const char* format, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static int append_row(struct row_buffer* rows, const char* format, ...)
+{
+	va_list args;
+	while (1)
+	{
+		size_t room = rows->capacity - rows->used;
+		va_start(args, format);
+		int length = vsnprintf(rows->data + rows->used, room, format, args);
+		va_end(args);
+		if (length < 0)
+			return 0;
+		if ((size_t) length < room)
+		{
+			rows->used += length;
+			return 1;
+		}
+		size_t capacity = rows->capacity * 2 + length;
+		char* grown = (char*) realloc(rows->data, capacity);
+		if (grown == NULL)
+			return 0;
+		rows->data = grown;
+		rows->capacity = capacity;
+	}
+}
+
+/*
+ * Probes the sender scheduled for class_index in a run of priority, or
+ * 0 to count losses up to the highest sequence id seen
+ */
+static int expected_probes(const struct refine_options* options, int class_index, char priority)
+{
+	if (options->have_schedule && (priority == 'H' || priority == 'L'))
+	{
+		int singles = options->num_packet_trains;
+		int runs = options->num_packet_trains * options->seperation_train_length;
+		if (class_index == 0)
+			return options->initial_train_length + (priority == 'L' ? runs : singles);
+		return priority == 'L' ? singles : runs;
+	}
+	return options->num_packets > 0 ? options->num_packets : 0;
+}
+
+static int write_phase_rows(struct row_buffer* rows, const char* raw_file, int phase,
+	struct phase_state* state, const struct analysis_params* params)
+{
+	const char* names = params->refine.phase_names;
+	char priority = phase < (int) strlen(names) ? names[phase] : '-';
+	const char class_names[2] = { 'H', 'L' };
+	int class_index;
+	for (class_index = 0; class_index < 2; class_index++)
+	{
+		struct class_state* class_state = &state->classes[class_index];
+		if (!class_state->used)
+			continue;
+
+		struct sequence_summary summary;
+		sequence_tracker_summarize(&class_state->tracker,
+			expected_probes(&params->refine, class_index, priority), &summary);
+		if (!append_row(rows, "%s\t%d\t%c\t%c\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%lld\t%lld\t%s\t%d\t%s\n",
+			raw_file, phase, priority, class_names[class_index], summary.expected, summary.received,
+			summary.lost, summary.loss_runs, summary.duplicates, summary.reordered,
+			summary.max_reorder_extent,
+			(long long) quantile_histogram_percentile(&class_state->interarrival, 50),
+			(long long) quantile_histogram_percentile(&class_state->interarrival, 99),
+			sequential_verdict_name(state->sequential.verdict), state->sequential.pairs,
+			state->verdict_from_owd ? "owd" : "arrival"))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Start a phase: trackers are reset on first use, the sequential test
+ * pairs around the run's priority ('L' when it is not known)
+ */
+static void begin_phase(struct phase_state* state, const struct analysis_params* params, int phase,
+	const struct sequential_test_config* config)
+{
+	const char* names = params->refine.phase_names;
+	state->classes[0].used = 0;
+	state->classes[1].used = 0;
+	state->verdict_from_owd = 0;
+	sequential_test_reset(&state->sequential, config,
+		phase < (int) strlen(names) && names[phase] == 'H' ? 0 : 1);
+}
+
+/*
+ * Run the sequential test of phase on the delays of the .owd file, whose
+ * lines ("phase seq class owd corrected") are in arrival order. Returns
+ * 0 if the phase has no delays there.
+ */
+static int observe_owd_phase(const struct raw_mapping* owd, int phase, struct sequential_test* test)
+{
+	int observed = 0;
+	const char* line = owd->data;
+	const char* end = owd->data + owd->size;
+	while (line < end)
+	{
+		const char* line_end = (const char*) memchr(line, '\n', end - line);
+		if (line_end == NULL)
+			line_end = end;
+
+		//Only the phase, class and uncorrected delay are needed; the
+		//offset and a constant skew do not change the sign of a pair
+		int line_phase, seq_id;
+		char priority;
+		long long owd_ns;
+		if (*line != '#' && sscanf(line, "%d\t%d\t%c\t%lld", &line_phase, &seq_id, &priority, &owd_ns) == 4 &&
+			line_phase == phase && (priority == 'H' || priority == 'L'))
+		{
+			sequential_test_observe(test, priority == 'H' ? 0 : 1, owd_ns);
+			observed++;
+		}
+		line = line_end + 1;
+	}
+	return observed > 0;
+}
+
+/*
+ * Switch the phase's sequential test to the .owd delays when there are any
+ */
+static void use_owd_verdict(struct phase_state* state, const struct raw_mapping* owd, int phase,
+	const struct sequential_test_config* config)
+{
+	if (owd->data == NULL)
+		return;
+	struct sequential_test test;
+	sequential_test_reset(&test, config, state->sequential.pair_class);
+	if (observe_owd_phase(owd, phase, &test))
+	{
+		state->sequential = test;
+		state->verdict_from_owd = 1;
+	}
+}
+
+/*
+ * Feed one received probe of a phase to everything but the inter-arrival
+ * histogram
+ */
+static struct class_state* observe_sequence(struct phase_state* state, int class_index, int seq_id, int64_t rx_ns)
+{
+	struct class_state* class_state = &state->classes[class_index];
+	if (!class_state->used)
+	{
+		sequence_tracker_reset(&class_state->tracker);
+		quantile_histogram_reset(&class_state->interarrival);
+		class_state->have_previous = 0;
+		class_state->used = 1;
+	}
+	sequence_tracker_update(&class_state->tracker, seq_id, rx_ns, 0, 0);
+	sequential_test_observe(&state->sequential, class_index, rx_ns);
+	return class_state;
+}
+
+/*
+ * Feed one received probe of a phase
+ */
+static void observe_probe(struct phase_state* state, int class_index, int seq_id, int64_t rx_ns)
+{
+	struct class_state* class_state = observe_sequence(state, class_index, seq_id, rx_ns);
+	if (class_state->have_previous)
+		quantile_histogram_record(&class_state->interarrival, rx_ns - class_state->previous_rx_ns);
+	class_state->have_previous = 1;
+	class_state->previous_rx_ns = rx_ns;
+}
+
+/*
+ * Probes of a run, as read from the file and handed to observe_probe
+ */
+struct run_reader
+{
+	const char* raw_file;
+	const struct analysis_params* params;
+	const struct sequential_test_config* config;
+	const struct raw_mapping* owd;
+	struct phase_state* state;
+	struct row_buffer* rows;
+	int phase;
+	int phase_probes;
+};
+
+/*
+ * Write the rows of the current phase and start the next one
+ */
+static int next_phase(struct run_reader* run)
+{
+	use_owd_verdict(run->state, run->owd, run->phase, run->config);
+	if (!write_phase_rows(run->rows, run->raw_file, run->phase, run->state, run->params))
+		return 0;
+	if (run->phase < MAX_RUN_PHASES - 1)
+		run->phase++;
+	run->phase_probes = 0;
+	begin_phase(run->state, run->params, run->phase, run->config);
+	return 1;
+}
+
+static error_t read_text_run(struct run_reader* run, const struct raw_mapping* raw)
+{
+	const char* line = raw->data;
+	const char* end = raw->data + raw->size;
+	while (line < end)
+	{
+		const char* line_end = (const char*) memchr(line, '\n', end - line);
+		if (line_end == NULL)
+			line_end = end;
+
+		if (*line == '*')
+		{
+			if (!next_phase(run))
+				return FAILURE;
+		}
+		else
+		{
+			int seq_id, class_index, length;
+			const char* arrival;
+			int64_t rx_ns;
+			if (raw_parse_probe_line(line, line_end, &seq_id, &class_index, &arrival, &length) &&
+				class_index < 2 && raw_arrival_ns(arrival, length, &rx_ns))
+			{
+				observe_probe(run->state, class_index, seq_id, rx_ns);
+				run->phase_probes++;
+			}
+		}
+		line = line_end + 1;
+	}
+	return SUCCESS;
+}
+
+/*
+ * Inter-arrivals of the probes of one class in a decoded block, recorded
+ * with the column kernels: the class's arrivals are gathered after its
+ * previous arrival, differenced and binned in one pass each.
+ */
+static void record_block_interarrivals(struct class_state* class_state, const struct archive_block* block,
+	char priority, int64_t start_time_ns, int64_t* arrivals, int64_t* differences)
+{
+	const struct column_kernels* kernels = column_kernels();
+	size_t first = class_state->have_previous ? 0 : 1;
+	arrivals[0] = class_state->previous_rx_ns + start_time_ns;
+	size_t count = kernels->select_int64(block->priority, block->arrival_ns, block->num_records, priority,
+		arrivals + 1);
+	if (count == 0)
+		return;
+
+	size_t num_values = count + 1 - first;
+	if (num_values > 1)
+	{
+		kernels->diff(arrivals + first, num_values, differences);
+		quantile_histogram_record_batch(&class_state->interarrival, differences, num_values - 1);
+	}
+	class_state->have_previous = 1;
+	class_state->previous_rx_ns = arrivals[count] - start_time_ns;
+}
+
+/*
+ * Read a .rawz archive block by block, without going through text.
+ * Arrivals are made relative to the start time as in the .raw file.
+ */
+static error_t read_archive_run(struct run_reader* run, const struct raw_mapping* raw)
+{
+	struct archive_reader reader;
+	error_t result = archive_reader_init(&reader, raw->data, raw->size);
+	if (result != SUCCESS)
+		return result;
+	struct archive_block* block = (struct archive_block*) malloc(sizeof *block);
+	int64_t* arrivals = (int64_t*) malloc((ARCHIVE_BLOCK_RECORDS + 1) * sizeof(int64_t));
+	int64_t* differences = (int64_t*) malloc(ARCHIVE_BLOCK_RECORDS * sizeof(int64_t));
+	if (block == NULL || arrivals == NULL || differences == NULL)
+	{
+		free(block);
+		free(arrivals);
+		free(differences);
+		return FAILURE;
+	}
+
+	const char class_names[2] = { 'H', 'L' };
+	int file_phase = 0;
+	int next;
+	while (result == SUCCESS && (next = archive_reader_next(&reader, block)) != 0)
+	{
+		if (next < 0)
+		{
+			fprintf(stderr, "ERROR #%d: Could not decode %s\n", DECOMPRESSION_ERROR, run->raw_file);
+			result = DECOMPRESSION_ERROR;
+			break;
+		}
+		for (; file_phase < block->phase && result == SUCCESS; file_phase++)
+			if (!next_phase(run))
+				result = FAILURE;
+
+		int i;
+		for (i = 0; i < block->num_records; i++)
+		{
+			char priority = block->priority[i];
+			if (priority != 'H' && priority != 'L')
+				continue;
+			int class_index = priority == 'H' ? 0 : 1;
+			observe_sequence(run->state, class_index, block->seq_id[i], block->arrival_ns[i] - reader.start_time_ns);
+			run->phase_probes++;
+		}
+
+		int class_index;
+		for (class_index = 0; class_index < 2; class_index++)
+			if (run->state->classes[class_index].used)
+				record_block_interarrivals(&run->state->classes[class_index], block, class_names[class_index],
+					reader.start_time_ns, arrivals, differences);
+	}
+	free(block);
+	free(arrivals);
+	free(differences);
+	return result;
+}
+
+error_t analyze_raw_file(const char* raw_file, const struct analysis_params* params, char** rows_out)
+{
+	*rows_out = NULL;
+	struct raw_mapping raw;
+	error_t result = raw_file_map_bytes(raw_file, &raw);
+	if (result != SUCCESS)
+		return result;
+
+	struct phase_state* state = (struct phase_state*) malloc(sizeof *state);
+	struct row_buffer rows = { (char*) malloc(1024), 0, 1024 };
+	if (state == NULL || rows.data == NULL)
+	{
+		free(state);
+		free(rows.data);
+		raw_file_unmap(&raw);
+		return FAILURE;
+	}
+
+	//The daemon writes <name>.owd next to <name>.raw or <name>.rawz
+	struct raw_mapping owd = { NULL, 0, 0 };
+	const char* extension = strrchr(raw_file, '.');
+	if (extension != NULL && (strcmp(extension, ".raw") == 0 || strcmp(extension, ".rawz") == 0))
+	{
+		char owd_file[MAX_FILENAME_SIZE];
+		snprintf(owd_file, sizeof owd_file, "%.*s.owd", (int) (extension - raw_file), raw_file);
+		if (access(owd_file, R_OK) == 0 && raw_file_map(owd_file, &owd) != SUCCESS)
+			owd.data = NULL;
+	}
+
+	struct sequential_test_config config = { params->alpha, params->alpha, SEQUENTIAL_DEFAULT_EFFECT, 0, 0 };
+	struct run_reader run = { raw_file, params, &config, &owd, state, &rows, 0, 0 };
+	begin_phase(state, params, 0, &config);
+
+	if (archive_is_archive(raw.data, raw.size))
+		result = read_archive_run(&run, &raw);
+	else
+		result = read_text_run(&run, &raw);
+
+	//A file that does not end on "*" still has its last phase open
+	if (result == SUCCESS && run.phase_probes > 0)
+	{
+		use_owd_verdict(state, &owd, run.phase, &config);
+		if (!write_phase_rows(&rows, raw_file, run.phase, state, params))
+			result = FAILURE;
+	}
+
+	//A run without a single probe still gets a row, so it is not redone
+	if (result == SUCCESS && rows.used == 0 &&
+		!append_row(&rows, "%s\t-\t-\t-\t0\t0\t0\t0\t0\t0\t0\t0\t0\tempty\t0\t-\n", raw_file))
+		result = FAILURE;
+
+	free(state);
+	raw_file_unmap(&owd);
+	raw_file_unmap(&raw);
+	if (result != SUCCESS)
+	{
+		free(rows.data);
+		return result;
+	}
+	*rows_out = rows.data;
+	return SUCCESS;
+}
@@ -0,0 +1,175 @@
+/*************************************************************
+** Run Index
+** See runIndex.h for the file format.
+**************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "runIndex.h"
+
+static int compare_entries(const void* a, const void* b)
+{
+	return strcmp(((const struct index_entry*) a)->path, ((const struct index_entry*) b)->path);
+}
+
+struct index_entry* run_index_add(struct run_index* index, const char* path)
+{
+	if (index->count == index->capacity)
+	{
+		int capacity = index->capacity > 0 ? index->capacity * 2 : 256;
+		struct index_entry* grown = (struct index_entry*) realloc(index->entries,
+			capacity * sizeof(struct index_entry));
+		if (grown == NULL)
+			return NULL;
+		index->entries = grown;
+		index->capacity = capacity;
+	}
+
+	struct index_entry* entry = &index->entries[index->count];
+	memset(entry, 0, sizeof *entry);
+	entry->path = strdup(path);
+	if (entry->path == NULL)
+		return NULL;
+	index->count++;
+	return entry;
+}
+
+error_t run_index_load(struct run_index* index, const char* index_file)
+{
+	memset(index, 0, sizeof *index);
+	FILE* file = fopen(index_file, "r");
+	if (file == NULL)
+		return SUCCESS;
+
+	char* line = NULL;
+	size_t line_capacity = 0;
+	ssize_t line_length;
+	error_t result = SUCCESS;
+	while (result == SUCCESS && (line_length = getline(&line, &line_capacity, file)) > 0)
+	{
+		if (line[0] != '@')
+			continue;
+		if (line[line_length - 1] == '\n')
+			line[--line_length] = '\0';
+
+		//@ path size mtime_ns params num_rows, split on tabs
+		char* fields[6];
+		int num_fields = 0;
+		char* cursor = line;
+		while (num_fields < 6 && cursor != NULL)
+		{
+			fields[num_fields++] = cursor;
+			cursor = strchr(cursor, '\t');
+			if (cursor != NULL)
+				*cursor++ = '\0';
+		}
+		if (num_fields != 6)
+		{
+			result = FREAD_ERROR;
+			break;
+		}
+
+		struct index_entry* entry = run_index_add(index, fields[1]);
+		if (entry == NULL)
+		{
+			result = FAILURE;
+			break;
+		}
+		entry->size = atoll(fields[2]);
+		entry->mtime_ns = atoll(fields[3]);
+		entry->params = strdup(fields[4]);
+		int num_rows = atoi(fields[5]);
+
+		//The rows are kept verbatim
+		size_t rows_used = 0;
+		entry->rows = strdup("");
+		while (entry->rows != NULL && num_rows-- > 0 &&
+			(line_length = getline(&line, &line_capacity, file)) > 0)
+		{
+			char* grown = (char*) realloc(entry->rows, rows_used + line_length + 1);
+			if (grown == NULL)
+				break;
+			memcpy(grown + rows_used, line, line_length + 1);
+			entry->rows = grown;
+			rows_used += line_length;
+		}
+		if (entry->params == NULL || entry->rows == NULL || num_rows >= 0)
+			result = FREAD_ERROR;
+	}
+
+	free(line);
+	fclose(file);
+	if (result != SUCCESS)
+	{
+		fprintf(stderr, "ERROR #%d: Run index %s is damaged\n", result, index_file);
+		run_index_free(index);
+		return result;
+	}
+	run_index_sort(index);
+	return SUCCESS;
+}
+
+void run_index_sort(struct run_index* index)
+{
+	qsort(index->entries, index->count, sizeof(struct index_entry), compare_entries);
+}
+
+struct index_entry* run_index_find(struct run_index* index, const char* path)
+{
+	struct index_entry key;
+	key.path = (char*) path;
+	return (struct index_entry*) bsearch(&key, index->entries, index->count, sizeof(struct index_entry),
+		compare_entries);
+}
+
+error_t run_index_save(const struct run_index* index, const char* index_file)
+{
+	char temp_file[MAX_FILENAME_SIZE + 8];
+	snprintf(temp_file, sizeof temp_file, "%s.tmp", index_file);
+	FILE* file = fopen(temp_file, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "ERROR #%d: Could not open %s\n", FILE_ERROR, temp_file);
+		return FILE_ERROR;
+	}
+
+	fprintf(file, "#unitExperimentAnalyzer run index\n");
+	int i;
+	for (i = 0; i < index->count; i++)
+	{
+		const struct index_entry* entry = &index->entries[i];
+		if (entry->rows == NULL)
+			continue;
+		int num_rows = 0;
+		const char* row;
+		for (row = entry->rows; *row != '\0'; row++)
+			num_rows += *row == '\n';
+		fprintf(file, "@\t%s\t%lld\t%lld\t%s\t%d\n%s", entry->path, entry->size, entry->mtime_ns,
+			entry->params, num_rows, entry->rows);
+	}
+
+	int failed = ferror(file);
+	if (fclose(file) != 0 || failed || rename(temp_file, index_file) != 0)
+	{
+		fprintf(stderr, "ERROR #%d: Could not write %s\n", FWRITE_ERROR, index_file);
+		remove(temp_file);
+		return FWRITE_ERROR;
+	}
+	return SUCCESS;
+}
+
+void run_index_free(struct run_index* index)
+{
+	int i;
+	for (i = 0; i < index->count; i++)
+	{
+		free(index->entries[i].path);
+		free(index->entries[i].params);
+		free(index->entries[i].rows);
+	}
+	free(index->entries);
+	memset(index, 0, sizeof *index);
+}
@@ -0,0 +1,145 @@
+/*************************************************************
+** Work Stealing Thread Pool
+** See workStealingPool.h. No task adds tasks, so a worker that
+** finds every deque empty can stop for good.
+**************************************************************/
+
+#include <stdlib.h>
+
+#include "workStealingPool.h"
+
+struct work_pool
+{
+	int num_workers;
+	struct task_deque deques[MAX_POOL_WORKERS];
+	pool_task task;
+	void* context;
+};
+
+struct worker_args
+{
+	struct work_pool* pool;
+	int worker;
+};
+
+//The owner works from the bottom of its deque
+static int pop_bottom(struct task_deque* deque, int* task)
+{
+	int found = 0;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->bottom > deque->top)
+	{
+		*task = deque->tasks[--deque->bottom];
+		found = 1;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+//Thieves take from the top, the end furthest from the owner
+static int steal_top(struct task_deque* deque, int* task)
+{
+	int found = 0;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->bottom > deque->top)
+	{
+		*task = deque->tasks[deque->top++];
+		found = 1;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+static void* run_worker(void* arg)
+{
+	struct worker_args* args = (struct worker_args*) arg;
+	struct work_pool* pool = args->pool;
+	unsigned seed = (unsigned) args->worker * 2654435761u + 1;
+	int task;
+
+	while (1)
+	{
+		if (pop_bottom(&pool->deques[args->worker], &task))
+		{
+			pool->task(task, args->worker, pool->context);
+			continue;
+		}
+
+		//Try every other worker once, starting from a random one
+		int stolen = 0;
+		int start = (int) (rand_r(&seed) % pool->num_workers);
+		int i;
+		for (i = 0; i < pool->num_workers && !stolen; i++)
+		{
+			int victim = (start + i) % pool->num_workers;
+			if (victim != args->worker)
+				stolen = steal_top(&pool->deques[victim], &task);
+		}
+		if (!stolen)
+			break;
+		pool->task(task, args->worker, pool->context);
+	}
+	return NULL;
+}
+
+error_t work_pool_run(int num_tasks, int num_workers, pool_task task, void* context)
+{
+	if (num_workers > MAX_POOL_WORKERS)
+		num_workers = MAX_POOL_WORKERS;
+	if (num_workers > num_tasks)
+		num_workers = num_tasks;
+	if (num_workers < 1)
+		return SUCCESS;
+
+	struct work_pool* pool = (struct work_pool*) calloc(1, sizeof *pool);
+	int* tasks = (int*) malloc(num_tasks * sizeof(int));
+	if (pool == NULL || tasks == NULL)
+	{
+		free(pool);
+		free(tasks);
+		return FAILURE;
+	}
+	pool->num_workers = num_workers;
+	pool->task = task;
+	pool->context = context;
+
+	//Worker w owns tasks [w*n/W, (w+1)*n/W); it pops the lowest first
+	int i, w;
+	for (i = 0; i < num_tasks; i++)
+		tasks[i] = num_tasks - 1 - i;
+	for (w = 0; w < num_workers; w++)
+	{
+		int first = (int) ((long long) w * num_tasks / num_workers);
+		int last = (int) ((long long) (w + 1) * num_tasks / num_workers);
+		pthread_mutex_init(&pool->deques[w].lock, NULL);
+		pool->deques[w].tasks = tasks + (num_tasks - last);
+		pool->deques[w].top = 0;
+		pool->deques[w].bottom = last - first;
+	}
+
+	pthread_t threads[MAX_POOL_WORKERS];
+	struct worker_args args[MAX_POOL_WORKERS];
+	int started = 0;
+	for (w = 1; w < num_workers; w++)
+	{
+		args[w].pool = pool;
+		args[w].worker = w;
+		if (pthread_create(&threads[w], NULL, run_worker, &args[w]) != 0)
+			break;
+		started = w;
+	}
+
+	//The calling thread is worker 0; workers that failed to start are
+	//robbed of their share by the others
+	args[0].pool = pool;
+	args[0].worker = 0;
+	run_worker(&args[0]);
+
+	for (w = 1; w <= started; w++)
+		pthread_join(threads[w], NULL);
+	for (w = 0; w < num_workers; w++)
+		pthread_mutex_destroy(&pool->deques[w].lock);
+	free(tasks);
+	free(pool);
+	return SUCCESS;
+}
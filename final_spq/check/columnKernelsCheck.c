@@ -0,0 +1,255 @@
+/**************************************************************************
+** Column Kernel Check
+** Runs every version of the column kernels (columnKernels.h) this CPU
+** supports against the scalar one and reports the first difference.
+** Each kernel gets every length from 0 to CHECK_SHORT_LENGTHS, which
+** covers 0, 1 and one below and above the vector widths and their
+** unrolled loops, and CHECK_LONG_RUNS random longer lengths. Every
+** length runs from each start offset up to CHECK_MAX_OFFSET elements
+** past a 64 byte boundary, over random values and over edge values
+** (the int64/int32 extremes, 0 and -1, runs of one class).
+** The output arrays carry a guard past the room the kernel is given,
+** so a vector tail that writes too far is caught too.
+**
+** How To Run Code:
+**   ./check/columnKernelsCheck [seed]
+**   (make check builds and runs it)
+**************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "taracomConstants.h"
+#include "columnKernels.h"
+
+#define CHECK_SHORT_LENGTHS 130
+#define CHECK_LONG_RUNS 200
+#define CHECK_LONG_LENGTH 5000
+#define CHECK_MAX_OFFSET 7
+#define CHECK_GUARD 64
+#define CHECK_GUARD_BYTE 0xA5
+
+//Room for the longest length at the largest offset, with its guard
+#define CHECK_CAPACITY (CHECK_LONG_LENGTH + CHECK_MAX_OFFSET + CHECK_GUARD)
+
+static uint64_t rng_state;
+
+static uint64_t next_random(void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+struct check_columns
+{
+  char* priority;
+  int64_t* values;
+  int64_t* deltas;
+  int32_t* seq;
+};
+
+struct check_outputs
+{
+  int64_t* out64;
+  int32_t* out32;
+  int32_t* buckets;
+};
+
+static void* aligned_buffer(size_t bytes)
+{
+  void* buffer = NULL;
+  if(posix_memalign(&buffer, 64, bytes) != 0)
+    return NULL;
+  return buffer;
+}
+
+/*
+ * Fill the columns with n random or edge values starting at offset
+ */
+static void fill_columns(struct check_columns* columns, size_t offset, size_t n, int edge)
+{
+  static const int64_t edge_values[] = { INT64_MIN, INT64_MIN + 1, -1, 0, 1, INT64_MAX - 1, INT64_MAX };
+  static const int32_t edge_seq[] = { INT32_MIN, -1, 0, 1, INT32_MAX };
+  static const char classes[] = { 'H', 'L', '*' };
+  int one_class = edge && (next_random() & 1);
+  char constant_class = classes[next_random() % 3];
+  int32_t seq = (int32_t) (next_random() % 1000);
+  size_t i;
+  for(i = 0; i < n; i++)
+  {
+    size_t at = offset + i;
+    uint64_t r = next_random();
+    columns->priority[at] = one_class ? constant_class : classes[r % 3];
+    if(edge)
+    {
+      columns->values[at] = edge_values[(r >> 8) % (sizeof edge_values / sizeof edge_values[0])];
+      columns->seq[at] = edge_seq[(r >> 16) % (sizeof edge_seq / sizeof edge_seq[0])];
+    }
+    else
+    {
+      //Magnitudes from a few ns up to the whole range, for every histogram bucket
+      columns->values[at] = (int64_t) (next_random() >> (r % 64));
+      if(r & 0x100)
+        columns->values[at] = -columns->values[at];
+
+      //Mostly in order, with losses, duplicates and jumps back
+      int step = (r >> 16) % 16;
+      seq += step < 11 ? 1 : (step < 13 ? (int) ((r >> 24) % 20) : (step < 14 ? 0 : -(int) ((r >> 24) % 20)));
+      columns->seq[at] = seq;
+    }
+
+    //Differences of the deltas stay within int64, as arrival times do
+    columns->deltas[at] = (int64_t) (next_random() >> 2) - (INT64_MAX >> 2);
+  }
+}
+
+static int guard_intact(const void* guard)
+{
+  const uint8_t* bytes = (const uint8_t*) guard;
+  int i;
+  for(i = 0; i < CHECK_GUARD; i++)
+    if(bytes[i] != CHECK_GUARD_BYTE)
+      return 0;
+  return 1;
+}
+
+/*
+ * Run the kernels of version on n values at offset and compare them
+ * with the scalar ones. Returns 0 and says why on the first difference.
+ */
+static int check_case(const struct column_kernels* version, const struct column_kernels* scalar,
+  const struct check_columns* columns, size_t offset, size_t n, struct check_outputs* expected,
+  struct check_outputs* actual, const char* kind)
+{
+  const char* priority = columns->priority + offset;
+  const int64_t* values = columns->values + offset;
+  const int64_t* deltas = columns->deltas + offset;
+  const int32_t* seq = columns->seq + offset;
+  const char* failed = NULL;
+  const char classes[] = { 'H', 'L', '*' };
+  int c;
+
+  memset(actual->out64, CHECK_GUARD_BYTE, (n + CHECK_GUARD) * sizeof(int64_t));
+  memset(actual->out32, CHECK_GUARD_BYTE, (n + CHECK_GUARD) * sizeof(int32_t));
+  for(c = 0; c < 3 && failed == NULL; c++)
+  {
+    size_t expected_count = scalar->select_int64(priority, values, n, classes[c], expected->out64);
+    size_t count = version->select_int64(priority, values, n, classes[c], actual->out64);
+    if(count != expected_count || memcmp(actual->out64, expected->out64, count * sizeof(int64_t)) != 0 ||
+      !guard_intact(actual->out64 + n))
+      failed = "select_int64";
+
+    expected_count = scalar->select_int32(priority, seq, n, classes[c], expected->out32);
+    count = version->select_int32(priority, seq, n, classes[c], actual->out32);
+    if(failed == NULL && (count != expected_count ||
+      memcmp(actual->out32, expected->out32, count * sizeof(int32_t)) != 0 || !guard_intact(actual->out32 + n)))
+      failed = "select_int32";
+  }
+
+  if(failed == NULL && n > 0)
+  {
+    memset(actual->out64, CHECK_GUARD_BYTE, (n + CHECK_GUARD) * sizeof(int64_t));
+    scalar->diff(deltas, n, expected->out64);
+    version->diff(deltas, n, actual->out64);
+    if(memcmp(actual->out64, expected->out64, (n - 1) * sizeof(int64_t)) != 0 || !guard_intact(actual->out64 + n - 1))
+      failed = "diff";
+  }
+
+  if(failed == NULL && n > 0)
+  {
+    int64_t expected_range[3], actual_range[3];
+    scalar->range(values, n, &expected_range[0], &expected_range[1], &expected_range[2]);
+    version->range(values, n, &actual_range[0], &actual_range[1], &actual_range[2]);
+    if(memcmp(actual_range, expected_range, sizeof expected_range) != 0)
+      failed = "range";
+  }
+
+  if(failed == NULL)
+  {
+    int64_t expected_missing, actual_missing;
+    size_t expected_gaps = scalar->count_gaps(seq, n, &expected_missing);
+    size_t gaps = version->count_gaps(seq, n, &actual_missing);
+    if(gaps != expected_gaps || actual_missing != expected_missing)
+      failed = "count_gaps";
+  }
+
+  if(failed == NULL)
+  {
+    memset(actual->buckets, CHECK_GUARD_BYTE, (n + CHECK_GUARD) * sizeof(int32_t));
+    scalar->bucket_indices(values, n, expected->buckets);
+    version->bucket_indices(values, n, actual->buckets);
+    if(memcmp(actual->buckets, expected->buckets, n * sizeof(int32_t)) != 0 || !guard_intact(actual->buckets + n))
+      failed = "bucket_indices";
+  }
+
+  if(failed != NULL)
+    printf("FAILED: %s %s differs from scalar on %zu %s values at offset %zu\n", version->name, failed, n, kind,
+      offset);
+  return failed == NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  rng_state = argc > 1 ? strtoull(argv[1], NULL, 10) : 0x5eed5eedULL;
+  if(rng_state == 0)
+    rng_state = 1;
+
+  struct check_columns columns;
+  columns.priority = (char*) aligned_buffer(CHECK_CAPACITY);
+  columns.values = (int64_t*) aligned_buffer(CHECK_CAPACITY * sizeof(int64_t));
+  columns.deltas = (int64_t*) aligned_buffer(CHECK_CAPACITY * sizeof(int64_t));
+  columns.seq = (int32_t*) aligned_buffer(CHECK_CAPACITY * sizeof(int32_t));
+  struct check_outputs expected, actual;
+  expected.out64 = (int64_t*) aligned_buffer(CHECK_CAPACITY * sizeof(int64_t));
+  expected.out32 = (int32_t*) aligned_buffer(CHECK_CAPACITY * sizeof(int32_t));
+  expected.buckets = (int32_t*) aligned_buffer(CHECK_CAPACITY * sizeof(int32_t));
+  actual.out64 = (int64_t*) aligned_buffer(CHECK_CAPACITY * sizeof(int64_t));
+  actual.out32 = (int32_t*) aligned_buffer(CHECK_CAPACITY * sizeof(int32_t));
+  actual.buckets = (int32_t*) aligned_buffer(CHECK_CAPACITY * sizeof(int32_t));
+  if(!columns.priority || !columns.values || !columns.deltas || !columns.seq || !expected.out64 ||
+    !expected.out32 || !expected.buckets || !actual.out64 || !actual.out32 || !actual.buckets)
+  {
+    fprintf(stderr, "ERROR #%d: Out of memory\n", FAILURE);
+    return FAILURE;
+  }
+
+  static const char* names[] = { "sse4.2", "avx2" };
+  const struct column_kernels* scalar = column_kernels_named("scalar");
+  int failures = 0;
+  int v;
+  for(v = 0; v < (int) (sizeof names / sizeof names[0]); v++)
+  {
+    const struct column_kernels* version = column_kernels_named(names[v]);
+    if(version == NULL)
+    {
+      printf("%s: not supported by this CPU, skipped\n", names[v]);
+      continue;
+    }
+
+    long cases = 0;
+    int passed = 1;
+    int run;
+    for(run = 0; run < CHECK_SHORT_LENGTHS + 1 + CHECK_LONG_RUNS && passed; run++)
+    {
+      size_t n = run <= CHECK_SHORT_LENGTHS ? (size_t) run : 1 + next_random() % CHECK_LONG_LENGTH;
+      size_t offset;
+      for(offset = 0; offset <= CHECK_MAX_OFFSET && passed; offset++)
+      {
+        int edge;
+        for(edge = 0; edge < 2 && passed; edge++)
+        {
+          fill_columns(&columns, offset, n, edge);
+          passed = check_case(version, scalar, &columns, offset, n, &expected, &actual, edge ? "edge" : "random");
+          cases++;
+        }
+      }
+    }
+    if(passed)
+      printf("%s: %ld cases match scalar\n", version->name, cases);
+    failures += !passed;
+  }
+  return failures > 0 ? FAILURE : SUCCESS;
+}
@@ -0,0 +1,54 @@
+#!/bin/sh
+# Regression check of the analyzer's run index (runIndex.h): a changed
+# run analyzed in the same pass as new runs must replace its entry, not
+# leave the stale one next to a second, fresh one.
+#
+#   ./check/runIndexCheck.sh [./unitExperimentAnalyzer]
+
+analyzer=${1:-./unitExperimentAnalyzer}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# Two phases of probes probes per class, as the receiver writes them
+raw() {
+	awk -v probes="$2" 'BEGIN {
+		for (phase = 0; phase < 2; phase++) {
+			if (phase > 0) print "*"
+			for (i = 0; i < probes; i++) {
+				printf "%d\tH\t0.%09d\n", i, 2000 * i
+				printf "%d\tL\t0.%09d\n", i, 2000 * i + 1000
+			}
+		}
+	}' > "$1"
+}
+
+fail() {
+	echo "runIndexCheck: FAILED: $*"
+	exit 1
+}
+
+raw "$dir/a.raw" 20
+raw "$dir/m.raw" 20
+"$analyzer" -j 2 "$dir/index.txt" "$dir/summary.tsv" "$dir/a.raw" "$dir/m.raw" 2>/dev/null ||
+	fail "first pass"
+
+raw "$dir/m.raw" 30
+raw "$dir/b.raw" 20
+raw "$dir/c.raw" 20
+raw "$dir/d.raw" 20
+"$analyzer" -j 2 "$dir/index.txt" "$dir/summary.tsv" "$dir/a.raw" "$dir/b.raw" "$dir/c.raw" "$dir/d.raw" \
+	"$dir/m.raw" 2>"$dir/log" || fail "second pass"
+grep -q "^4 runs analyzed, 1 reused" "$dir/log" || fail "$(cat "$dir/log")"
+
+entries=$(grep -c "^@	$dir/m.raw	" "$dir/index.txt")
+[ "$entries" -eq 1 ] || fail "$entries index entries for m.raw"
+size=$(wc -c < "$dir/m.raw" | tr -d ' ')
+grep -q "^@	$dir/m.raw	$size	" "$dir/index.txt" || fail "stale index entry for m.raw"
+[ "$(grep -c "^@" "$dir/index.txt")" -eq 5 ] || fail "index does not hold the 5 runs"
+
+# A third pass over the same files reuses every run
+"$analyzer" -j 2 "$dir/index.txt" "$dir/summary.tsv" "$dir/a.raw" "$dir/b.raw" "$dir/c.raw" "$dir/d.raw" \
+	"$dir/m.raw" 2>"$dir/log" || fail "third pass"
+grep -q "^0 runs analyzed, 5 reused" "$dir/log" || fail "$(cat "$dir/log")"
+
+echo "runIndexCheck: passed"
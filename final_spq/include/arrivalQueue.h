@@ -0,0 +1,67 @@
+#ifndef ARRIVALQUEUE_H
+#define ARRIVALQUEUE_H
+
+/**************************************************************************
+** Arrival Queue
+** High and low priority probes arrive on different sockets. Draining
+** the sockets one after the other hands probes to the capture slots out
+** of arrival order, which breaks anything that compares neighbouring
+** probes of different classes. The arrival queue drains every socket in
+** recvmmsg batches, orders the probes by kernel receive timestamp and
+** releases them only up to a watermark no later probe can precede: the
+** earliest time at which one of the sockets was seen empty.
+** With a pcapng writer attached, every probe is also handed to it as it
+** comes out of the kernel, before reordering (pcapngWriter.h).
+**************************************************************************/
+
+#include <time.h>
+#include <netinet/in.h>
+
+#include "probeHeader.h"
+#include "pcapngWriter.h"
+
+#define RECV_BATCH_SIZE 64
+#define MAX_PENDING_ARRIVALS 4096
+
+//Bytes of each datagram copied out of the kernel, enough for the header
+#define RECV_SNAP_LENGTH 64
+
+struct pending_arrival
+{
+	struct timespec arrival;
+	struct sockaddr_in from_addr;
+	struct probe_header header;
+	int length;
+};
+
+struct arrival_queue
+{
+	//Where the probe header starts in each datagram, after the
+	//application header of a probe template (probeTemplate.h)
+	int header_offset;
+
+	//Bytes copied out of the kernel per datagram, at least
+	//RECV_SNAP_LENGTH, and where to write them (NULL for nowhere)
+	int snap_length;
+	struct pcapng_writer* capture;
+
+	int count;
+	struct pending_arrival items[MAX_PENDING_ARRIVALS];
+};
+
+typedef void (*arrival_handler)(const struct pending_arrival* arrival, void* context);
+
+/*
+ * Drain the sockets into the queue and order it. Returns the watermark
+ * up to which arrivals may be released.
+ */
+struct timespec arrival_queue_receive(struct arrival_queue* queue, const int* sockets, int num_sockets);
+
+/*
+ * Hand every queued arrival up to watermark to handler, in arrival order.
+ * Pass a watermark far in the future to flush the queue.
+ */
+void arrival_queue_release(struct arrival_queue* queue, struct timespec watermark,
+	arrival_handler handler, void* context);
+
+#endif
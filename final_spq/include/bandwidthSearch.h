@@ -0,0 +1,100 @@
+#ifndef BANDWIDTHSEARCH_H
+#define BANDWIDTHSEARCH_H
+
+/**************************************************************************
+** Available Bandwidth Search
+** Receiver side of the adaptive rate probing mode (unitExperimentSender
+** -A), after pathload (Jain and Dovrolis, SIGCOMM 2002). The sender
+** sends fleets of periodic streams at a rate the receiver picks; the
+** receiver judges each stream's one-way delays for an upward trend,
+** which means the stream outran the available bandwidth of its class,
+** and moves the rate by binary search until the bracket is narrower
+** than the resolution.
+**
+** Stream trend: the delays (receive minus send time, so a constant
+** clock offset cancels) are split into about sqrt(K) groups of
+** consecutive probes and the group medians m_1..m_G tested with
+**   PCT = #{m_k > m_k-1} / (G - 1)               increasing above 0.66,
+**                                                 flat below 0.54
+**   PDT = (m_G - m_1) / sum |m_k - m_k-1|          increasing above 0.55,
+**                                                 flat below 0.45
+** A stream is increasing if one metric says so and the other does not
+** say flat, flat in the mirrored case, and grey otherwise. A stream that
+** lost more than RATE_STREAM_LOSS_LIMIT of its probes is increasing.
+**
+** Fleet: more than BANDWIDTH_FLEET_FRACTION of its streams increasing
+** puts the rate above the available bandwidth, as many flat ones below
+** it; anything else is a grey region, which is kept and probed around.
+**************************************************************************/
+
+#include <stdint.h>
+
+#define RATE_STREAM_MAX_PROBES 1000
+#define RATE_STREAM_LOSS_LIMIT 0.1
+
+#define TREND_PCT_INCREASING 0.66
+#define TREND_PCT_FLAT 0.54
+#define TREND_PDT_INCREASING 0.55
+#define TREND_PDT_FLAT 0.45
+
+#define BANDWIDTH_FLEET_FRACTION 0.7
+
+#define STREAM_INCREASING 'I'
+#define STREAM_FLAT 'N'
+#define STREAM_GREY 'G'
+
+struct rate_stream
+{
+	int expected;
+	int received;
+
+	//Delay of each probe by sequence id, INT64_MIN until it arrives
+	int64_t delay_ns[RATE_STREAM_MAX_PROBES];
+};
+
+struct bandwidth_search
+{
+	double low_bps;
+	double high_bps;
+	double resolution_bps;
+
+	//Rates that gave grey fleets, 0 while there are none
+	double grey_low_bps;
+	double grey_high_bps;
+
+	double rate_bps;
+	int fleet_streams;
+	int streams_judged;
+	int streams_increasing;
+	int streams_flat;
+	int fleets;
+	int converged;
+};
+
+void rate_stream_reset(struct rate_stream* stream, int expected);
+
+/*
+ * Keep the delay of the probe with seq_id; ids outside the stream are
+ * ignored
+ */
+void rate_stream_add(struct rate_stream* stream, int32_t seq_id, int64_t delay_ns);
+
+/*
+ * Judge the stream: STREAM_INCREASING, STREAM_FLAT or STREAM_GREY.
+ * pct and pdt get the metrics (0 if there were too few probes).
+ */
+char rate_stream_trend(const struct rate_stream* stream, double* pct, double* pdt);
+
+/*
+ * Search between min_bps and max_bps; the first rate is their midpoint
+ */
+void bandwidth_search_start(struct bandwidth_search* search, double min_bps, double max_bps,
+	double resolution_bps, int fleet_streams);
+
+/*
+ * Count the trend of a stream at the current rate. Returns 1 once the
+ * fleet is complete, with rate_bps set to the next rate or converged set.
+ */
+int bandwidth_search_add(struct bandwidth_search* search, char trend);
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef CAPTUREARCHIVE_H
+#define CAPTUREARCHIVE_H
+
+/**************************************************************************
+** Capture Archive (.rawz)
+** A compact replacement of the .raw text (~25 bytes per probe) holding
+** the same sequence id, class and arrival of every probe, phase by phase.
+**
+** File:   "SPQZ" | uint32 version | int64 start_time_ns | block...
+** Block:  uint32 num_records | uint32 class_bytes | uint32 exception_bytes
+**         | uint32 timestamp_bytes | int64 first_arrival_ns
+**         | int64 first_delta_ns | uint16 phase | uint16 reserved
+**         | classes | exceptions | timestamps
+**
+**  - classes:    runs of (class byte, varint run length). A train is one
+**                probe of one class then a run of the other, so a run of
+**                20 probes costs two bytes.
+**  - exceptions: the sequence id of a probe is predicted as the previous
+**                id of its class + 1 (-1 at the start of a block). Only
+**                the misses are stored, as a varint count followed by
+**                (varint index delta, zigzag varint id - prediction).
+**  - timestamps: delta-of-delta bit stream as in Gorilla (Pelkonen et
+**                al., VLDB 2015), with the buckets widened for ns:
+**                  0                 dod == 0
+**                  10    + 8 bits    zigzag(dod) < 2^8
+**                  110   + 14 bits   zigzag(dod) < 2^14
+**                  1110  + 20 bits   zigzag(dod) < 2^20
+**                  11110 + 32 bits   zigzag(dod) < 2^32
+**                  11111 + 64 bits   anything else
+**
+** Blocks never span phases and are decoded on their own, so a reader
+** can hand whole blocks of plain arrays to the analysis. Multi-byte
+** fields are in host byte order, as the probe header is.
+**************************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "taracomConstants.h"
+
+#define ARCHIVE_MAGIC "SPQZ"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_HEADER_LENGTH 16
+#define ARCHIVE_BLOCK_HEADER_LENGTH 36
+
+//Records per block
+#define ARCHIVE_BLOCK_RECORDS 4096
+
+struct archive_record
+{
+	int32_t seq_id;
+	char priority;
+	int64_t arrival_ns;
+};
+
+struct archive_writer
+{
+	FILE* file;
+	int phase;
+	int num_records;
+	struct archive_record* records;
+	uint8_t* scratch;
+};
+
+//One decoded block, as plain arrays
+struct archive_block
+{
+	int phase;
+	int num_records;
+	int32_t seq_id[ARCHIVE_BLOCK_RECORDS];
+	char priority[ARCHIVE_BLOCK_RECORDS];
+	int64_t arrival_ns[ARCHIVE_BLOCK_RECORDS];
+};
+
+struct archive_reader
+{
+	const uint8_t* data;
+	size_t size;
+	size_t offset;
+	int64_t start_time_ns;
+};
+
+/*
+ * Create file_name and write the archive header. start_time_ns is what
+ * arrivals are shown relative to when the archive is turned into text.
+ */
+error_t archive_writer_open(struct archive_writer* writer, const char* file_name, int64_t start_time_ns);
+
+/*
+ * Add one probe. Probes come in arrival order; a new phase ends the block.
+ */
+error_t archive_writer_append(struct archive_writer* writer, int phase, int32_t seq_id, char priority,
+	int64_t arrival_ns);
+
+/*
+ * Write the last block and close the file
+ */
+error_t archive_writer_close(struct archive_writer* writer);
+
+/*
+ * Whether data starts with the archive header
+ */
+int archive_is_archive(const void* data, size_t size);
+
+error_t archive_reader_init(struct archive_reader* reader, const void* data, size_t size);
+
+/*
+ * Decode the next block. Returns 1 for a block, 0 at the end of the
+ * archive and -1 if it is damaged.
+ */
+int archive_reader_next(struct archive_reader* reader, struct archive_block* block);
+
+/*
+ * Decode a whole archive to the .raw text the daemon would have written,
+ * into a buffer allocated with malloc (*text) of *text_length bytes.
+ */
+error_t archive_decode_text(const void* data, size_t size, char** text, size_t* text_length);
+
+#endif
@@ -0,0 +1,261 @@
+#ifndef CAPTURESLOT_H
+#define CAPTURESLOT_H
+
+/**************************************************************************
+** Capture Slots
+** A capture slot holds every probe received from one sender during one
+** experiment. A slot is keyed by the sender's address and the
+** experiment tag its probes and control requests carry (probeHeader.h),
+** so two experiments of one sender overlap in slots of their own.
+** Slots are allocated once when the receiver daemon starts and are
+** recycled between experiments, so starting an experiment never
+** allocates or clears memory.
+**
+** A phase is one run of unitExperimentSender (e.g. the 'L' run followed
+** by the 'H' run). Phases are separated in the raw output file by the
+** "*\n" delimiter, exactly as the single-shot receiver writes them.
+**************************************************************************/
+
+#include <stdint.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "taracomConstants.h"
+#include "probeHeader.h"
+#include "sequenceTracker.h"
+#include "quantileHistogram.h"
+#include "sequentialTest.h"
+#include "clockSkew.h"
+#include "resultStore.h"
+#include "controlChannel.h"
+
+//Number of experiments that can be captured at the same time
+#define NUM_CAPTURE_SLOTS 4
+
+//Max records per slot. Covers two phases of 2001 + 200*20 probes
+#define MAX_SLOT_RECORDS 32768
+
+//Max number of phases kept per experiment
+#define MAX_SLOT_PHASES 8
+
+//Probe classes tracked per phase ('H' and 'L')
+#define NUM_TRACKED_CLASSES 2
+
+//Width of the probe size buckets of the .stats file, bytes
+#define SIZE_BUCKET_BYTES 64
+
+struct capture_record
+{
+	int seq_id;
+	char priority;
+	uint8_t phase;
+
+	//Payload bytes as received
+	uint16_t length;
+	struct timespec arrival;
+
+	//Sender timestamp, 0 if the probe did not carry one
+	int64_t tx_time_ns;
+};
+
+//Streaming distributions of one class in one phase
+struct class_histograms
+{
+	int have_previous;
+	int64_t previous_rx_ns;
+	struct quantile_histogram interarrival;
+
+	//Only fed by probes that carry a sender timestamp
+	struct quantile_histogram one_way_delay;
+};
+
+//Train parameters announced by the sender in its HELLO request
+struct experiment_params
+{
+	int initial_train_length;
+	int seperation_train_length;
+	int num_packet_trains;
+	int probe_payload_length;
+	char priority;
+
+	//Set once PATTERN announced the layout of the run, which then
+	//overrides the classic schedule of the fields above
+	int have_layout;
+};
+
+//Layout of the compiled run (trainPattern.h) announced with PATTERN and
+//RUNS: the probes of each class and, in sequence id order, the runs of
+//consecutive probes that belong to one train
+struct train_layout
+{
+	int num_trains;
+	int class_counts[NUM_TRACKED_CLASSES];
+
+	//0 if the sender did not announce the runs of a class
+	int num_runs[NUM_TRACKED_CLASSES];
+	int32_t run_first_seq[NUM_TRACKED_CLASSES][MAX_PATTERN_RUNS];
+	int32_t run_train[NUM_TRACKED_CLASSES][MAX_PATTERN_RUNS];
+};
+
+struct capture_slot
+{
+	int in_use;
+	struct sockaddr_in sender_addr;
+	uint16_t experiment_tag;
+
+	//Arrival time of the first and the latest probe
+	struct timespec start_time;
+	struct timespec last_arrival;
+
+	//Wall clock time the experiment started, used for the file name
+	time_t start_wall_time;
+
+	int current_phase;
+	int phase_records;
+
+	//Set once the sender announces phases over the control channel,
+	//after which silences no longer split phases
+	int explicit_phases;
+	int have_params;
+	struct experiment_params params;
+
+	//Parameters of the HELLO that preceded each phase
+	unsigned phase_params_mask;
+	struct experiment_params phase_params[MAX_SLOT_PHASES];
+
+	//Layout of each phase whose params have_layout, and at
+	//MAX_SLOT_PHASES the one announced for the next phase
+	struct train_layout* layouts;
+
+	//Online metrics per phase and class, reset on first use
+	unsigned trackers_used_mask;
+	struct sequence_tracker* trackers;
+	struct class_histograms* histograms;
+
+	//H versus L verdict per phase, started with the phase's first probe
+	struct sequential_test_config sequential_config;
+	struct sequential_test sequential[MAX_SLOT_PHASES];
+
+	//Write the probes as a .rawz archive instead of .raw text, or
+	//append them to a result store when there is one
+	int archive_output;
+	struct result_store* store;
+
+	//Clock offset reported after START and after END of each phase
+	int clock_sync_count[MAX_SLOT_PHASES];
+	struct clock_sync_sample clock_sync[MAX_SLOT_PHASES][2];
+
+	int num_records;
+	int num_overflowed;
+	struct capture_record* records;
+};
+
+struct capture_slot_pool
+{
+	struct capture_slot slots[NUM_CAPTURE_SLOTS];
+	struct capture_record* record_storage;
+	struct sequence_tracker* tracker_storage;
+	struct class_histograms* histogram_storage;
+	struct train_layout* layout_storage;
+
+	//Handed to every experiment that starts in the pool
+	struct sequential_test_config sequential_config;
+	int archive_output;
+	struct result_store* store;
+};
+
+/*
+ * Map a probe class to its tracker index, -1 if it is not tracked
+ */
+static inline int tracked_class_index(char priority)
+{
+	return priority == 'H' ? 0 : (priority == 'L' ? 1 : -1);
+}
+
+static inline struct sequence_tracker* capture_slot_tracker(struct capture_slot* slot,
+	int phase, int class_index)
+{
+	return &slot->trackers[phase * NUM_TRACKED_CLASSES + class_index];
+}
+
+static inline struct class_histograms* capture_slot_histograms(struct capture_slot* slot,
+	int phase, int class_index)
+{
+	return &slot->histograms[phase * NUM_TRACKED_CLASSES + class_index];
+}
+
+error_t capture_slot_pool_init(struct capture_slot_pool* pool);
+void capture_slot_pool_free(struct capture_slot_pool* pool);
+
+/*
+ * Find the slot of an experiment in progress from sender_addr with
+ * experiment_tag, or start a new experiment in a free slot. Returns
+ * NULL if every slot is busy.
+ */
+struct capture_slot* capture_slot_acquire(struct capture_slot_pool* pool,
+	const struct sockaddr_in* sender_addr, uint16_t experiment_tag, struct timespec now);
+
+/*
+ * Find the slot of an experiment in progress from sender_addr with
+ * experiment_tag without starting a new one. Returns NULL if there is
+ * none.
+ */
+struct capture_slot* capture_slot_find(struct capture_slot_pool* pool,
+	const struct sockaddr_in* sender_addr, uint16_t experiment_tag);
+
+/*
+ * Append a probe of length payload bytes to the slot. A new phase is
+ * started when the probe arrives more than phase_gap_time seconds after
+ * the previous one.
+ */
+void capture_slot_append(struct capture_slot* slot, const struct probe_header* header, int length,
+	struct timespec arrival, unsigned long phase_gap_time);
+
+/*
+ * Start a new phase because the sender said so. The first call on an
+ * empty slot keeps phase 0.
+ */
+void capture_slot_begin_phase(struct capture_slot* slot);
+
+/*
+ * Layout of a phase, NULL if its sender announced none
+ */
+static inline struct train_layout* capture_slot_layout(struct capture_slot* slot, int phase)
+{
+	if (!(slot->phase_params_mask & (1u << phase)) || !slot->phase_params[phase].have_layout)
+		return NULL;
+	return &slot->layouts[phase];
+}
+
+/*
+ * Layout announced for the phase the next START begins
+ */
+static inline struct train_layout* capture_slot_next_layout(struct capture_slot* slot)
+{
+	return &slot->layouts[MAX_SLOT_PHASES];
+}
+
+/*
+ * Keep a clock offset measured by the sender for the current phase.
+ * The first and the latest report are kept.
+ */
+void capture_slot_add_clock_sync(struct capture_slot* slot, const struct clock_sync_sample* sample);
+
+/*
+ * Write the slot to <output_path><ip>_<date>.raw (<ip>_<date>_e<tag>.raw
+ * for a tagged experiment) in the format of the single-shot receiver
+ * (.rawz, see captureArchive.h, when the pool was set up with
+ * archive_output), write the loss/reordering/jitter summary
+ * and the delays per probe size bucket next to it as .stats, the skew
+ * corrected one-way delays and probe sizes as .owd, and
+ * return the slot to the pool. The name of the written probe file is
+ * copied to file_name if it is not NULL.
+ * With a result store the probes are appended to the store instead,
+ * the .stats and .owd files are written into the store directory in
+ * place of output_path with names ending in _<experiment id>, and the id
+ * is copied to experiment_id if it is not NULL (0 without a store).
+ */
+error_t capture_slot_finalize(struct capture_slot* slot, const char* output_path,
+	char* file_name, int64_t* experiment_id);
+
+#endif
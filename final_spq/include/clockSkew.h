@@ -0,0 +1,68 @@
+#ifndef CLOCKSKEW_H
+#define CLOCKSKEW_H
+
+/**************************************************************************
+** Clock Offset and Skew
+** A one-way delay measured as receiver arrival minus sender timestamp is
+**   owd(t) = delay(t) + offset + skew * t
+** where offset and skew are those of the receiver clock against the
+** sender's. Over a Delayer run of hundreds of seconds, a skew of a few
+** tens of ppm adds milliseconds of error.
+**
+** The skew is estimated as in Moon et al. ("Estimation and removal of
+** clock skew from network delay measurements", 1999): the line a*t + b
+** that lies below every (send time, owd) point and minimizes the sum of
+** the distances to them. That line is an edge of the lower convex hull
+** of the points, the one above the mean send time, so the fit is an
+** O(n log n) hull instead of a general LP solve.
+**
+** The offset comes from the NTP style exchange on the control channel
+** (controlChannel.h). Without it, corrected delays are given relative to
+** the fitted minimum, i.e. as the delay above the least queued probe.
+**************************************************************************/
+
+#include <stdint.h>
+
+struct delay_point
+{
+	int64_t tx_ns;
+	int64_t owd_ns;
+};
+
+//One OFFSET report from the sender
+struct clock_sync_sample
+{
+	int64_t offset_ns;
+	int64_t delay_ns;
+	int64_t at_ns;
+};
+
+struct clock_fit
+{
+	int num_points;
+
+	//Skew in ns per ns, and the fitted minimum delay at reference_ns
+	double skew;
+	int64_t reference_ns;
+	double min_delay_ns;
+};
+
+/*
+ * Fit the lower bounding line to num_points points, which are reordered.
+ * Returns 0 if there are fewer than two distinct send times.
+ */
+int clock_skew_fit(struct delay_point* points, int num_points, struct clock_fit* fit);
+
+/*
+ * One-way delay sent at tx_ns with skew removed. With an offset sample
+ * the result is absolute, otherwise it is relative to the fitted minimum.
+ */
+static inline double clock_corrected_delay(const struct clock_fit* fit, const struct clock_sync_sample* sync,
+	int64_t tx_ns, int64_t owd_ns)
+{
+	if (sync != NULL)
+		return (double) (owd_ns - sync->offset_ns) - fit->skew * (double) (tx_ns - sync->at_ns);
+	return (double) owd_ns - fit->min_delay_ns - fit->skew * (double) (tx_ns - fit->reference_ns);
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef COLUMNKERNELS_H
+#define COLUMNKERNELS_H
+
+/**************************************************************************
+** Column Kernels
+** The per probe loops of the analysis over captured columns (class
+** selection, inter-arrival differences, dispersion, sequence gaps and
+** histogram binning), in a scalar, an SSE4.2 and an AVX2 version. The
+** best version the CPU supports is picked once at run time; setting
+** SPQ_KERNELS=scalar|sse4.2|avx2 picks one by hand. make check runs
+** check/columnKernelsCheck, which compares every version the CPU runs
+** with the scalar one over random and edge lengths and values.
+**
+** Every version gives bit for bit the same results as the scalar one.
+** The vector versions are built with per function target attributes,
+** so the tools still run on CPUs without SSE4.2.
+**************************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct column_kernels
+{
+	const char* name;
+
+	/*
+	 * Copy the values whose priority is class_byte to out, in order.
+	 * Returns how many were copied; out must have room for n.
+	 */
+	size_t (*select_int64)(const char* priority, const int64_t* values, size_t n, char class_byte, int64_t* out);
+	size_t (*select_int32)(const char* priority, const int32_t* values, size_t n, char class_byte, int32_t* out);
+
+	/*
+	 * out[i] = values[i + 1] - values[i] for the n - 1 pairs
+	 */
+	void (*diff)(const int64_t* values, size_t n, int64_t* out);
+
+	/*
+	 * Smallest, largest and sum of n > 0 values. The sum wraps like
+	 * int64_t arithmetic.
+	 */
+	void (*range)(const int64_t* values, size_t n, int64_t* min, int64_t* max, int64_t* sum);
+
+	/*
+	 * Places where seq[i + 1] != seq[i] + 1. missing gets the ids skipped
+	 * by the forward jumps among them, i.e. the losses of an in order run.
+	 */
+	size_t (*count_gaps)(const int32_t* seq, size_t n, int64_t* missing);
+
+	/*
+	 * Quantile histogram bucket of each value (quantile_histogram_bucket):
+	 * the bucket for values >= 0, and -1 - the bucket of the magnitude for
+	 * negative values
+	 */
+	void (*bucket_indices)(const int64_t* values, size_t n, int32_t* out);
+};
+
+/*
+ * Kernels of the best version this CPU runs, or of the one named in
+ * SPQ_KERNELS
+ */
+const struct column_kernels* column_kernels(void);
+
+/*
+ * Kernels of the named version ("scalar", "sse4.2", "avx2"), or NULL
+ * if it is unknown or this CPU cannot run it
+ */
+const struct column_kernels* column_kernels_named(const char* name);
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef CONTROLCHANNEL_H
+#define CONTROLCHANNEL_H
+
+/**************************************************************************
+** Sender/Receiver Control Channel
+** A line based protocol over TCP that replaces the fixed timers
+** (udp_session_timeout, inter_experiment_sleep_time) used to guess
+** where an experiment starts and ends.
+**
+** On PRE_TCP_SERVER_PORT, once per sender run:
+**   HELLO <initial> <seperation> <trains> <length> <priority> [<tag>]
+**                                                              -> READY
+**   START                                                      -> OK
+**   ... probe train is sent over UDP ...
+**   END <packets_sent> <sent_H> <sent_L> <trains_sent>         -> RECEIVED <n>
+**
+** Between HELLO and START the sender announces the layout of the run it
+** compiled (trainPattern.h), so the receiver scores any pattern and not
+** only the classic schedule of the HELLO parameters:
+**   PATTERN <trains> <probes_H> <probes_L>                     -> OK
+**   RUNS <class> <first_seq>:<train> ...                       -> OK
+** RUNS lists, in sequence id order, where each run of consecutive probes
+** of class in one train begins; it may take several lines, and is left
+** out for a class with more than MAX_PATTERN_RUNS runs.
+**
+** tag is the sender's experiment tag (-E, probeHeader.h); the requests
+** of the connection go to the capture slot of that sender and tag.
+**
+** START begins a new phase in the receiver's capture slot. The reply to
+** END is held back until all packets_sent probes have arrived or the
+** path has been quiet for CONTROL_DRAIN_TIME_MS, so the next run can
+** begin right away without its probes leaking into this phase.
+**
+** While a train is being sent the receiver may push, unsolicited:
+**   STOP <verdict>
+** once its sequential H versus L test is significant (sequentialTest.h).
+** The sender then ends the train early and reports the probes it
+** actually sent in END.
+**
+** Right after START and again after END the sender measures the clock
+** offset between the hosts NTP style, over a few exchanges of
+**   TIME <t1>                                                  -> TIME <t1> <t2> <t3>
+** (t1 sender send, t2 receiver receive, t3 receiver send; t4 is the
+** sender's receive time) and reports the least delayed exchange with
+**   OFFSET <offset_ns> <delay_ns> <at_ns>                      -> OK
+** where offset = ((t2 - t1) + (t3 - t4)) / 2 is receiver minus sender
+** clock, delay = (t4 - t1) - (t3 - t2) and at = (t1 + t4) / 2. The
+** receiver uses it to turn one-way delays into absolute ones (clockSkew.h).
+**
+** On POST_TCP_SERVER_PORT, once per experiment:
+**   FINALIZE [<tag>]                                           -> DONE <file>
+** or, when the receiver keeps a result store (resultStore.h),
+**                                                              -> DONE <store> <experiment_id>
+**
+** Available bandwidth search (bandwidthSearch.h), on PRE_TCP_SERVER_PORT
+** without HELLO; rates are in bits per second:
+**   AVBW <class> <min> <max> <resolution> <fleet_streams>      -> RATE <rate>
+**   STREAM <probes>                                            -> OK
+**   ... probes of class, flagged PROBE_FLAG_RATE_STREAM, at rate ...
+**   TREND <probes_sent>          -> TREND <I|N|G> <received> <pct> <pdt>
+** TREND is answered once the stream has drained (RATE_STREAM_DRAIN_MS).
+** The last stream of a fleet gets " RATE <rate>" appended for the next
+** fleet, or " AVAILABLE <low> <high>" once the search has converged.
+**
+** Token bucket sweep (tokenBucket.h), the same way; packet_bytes counts
+** IP bytes:
+**   BUCKET <class> <packet_bytes>                              -> OK
+**   STREAM <probes>                                            -> OK
+**   ... probes of class, flagged PROBE_FLAG_RATE_STREAM, at rate ...
+**   PROFILE <probes_sent> <rate>
+**     -> PROFILE <P|S|C> <received> <first_loss> <loss_runs> <ramp_start> <ramp_slope_ns> <bucket_rate> <depth>
+** with the fitted bucket rate in bits per second and depth in bytes
+** (0 for a conforming stream).
+**
+** Each port serves only its own requests: FINALIZE on POST_TCP_SERVER_PORT,
+** everything else on PRE_TCP_SERVER_PORT. Any request that cannot be
+** served, or reaches the other port, is answered with ERROR <code>.
+**************************************************************************/
+
+#include "taracomConstants.h"
+
+#define CONTROL_LINE_LENGTH 256
+#define MAX_CONTROL_CLIENTS 8
+
+//How long the receiver waits for stragglers before answering END
+#define CONTROL_DRAIN_TIME_MS 2000
+
+//How long a rate stream may be quiet before TREND or PROFILE is answered
+#define RATE_STREAM_DRAIN_MS 200
+
+//Most runs of one class a PATTERN announcement can carry
+#define MAX_PATTERN_RUNS 2048
+
+//TIME exchanges per clock offset measurement
+#define CLOCK_SYNC_EXCHANGES 8
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef CONTROLCLIENT_H
+#define CONTROLCLIENT_H
+
+#include <stddef.h>
+
+#include "controlChannel.h"
+
+//How long the sender waits for any reply, in seconds
+#define CONTROL_REPLY_TIMEOUT 30
+
+/*
+ * Open a control connection to receiver_address:port.
+ * Returns the socket or -1 on failure.
+ */
+int control_connect(const char* receiver_address, int port);
+
+/*
+ * Send one request line and wait for the one line reply (without the
+ * trailing newline). Returns CONTROL_PROTOCOL_ERROR if the receiver
+ * answered ERROR or the connection failed. Unsolicited STOP lines
+ * are skipped.
+ */
+error_t control_request(int control_socket, const char* request, char* reply, size_t reply_size);
+
+/*
+ * Measure the receiver's clock offset over CLOCK_SYNC_EXCHANGES TIME
+ * exchanges and report the least delayed one with OFFSET.
+ */
+error_t control_sync_clock(int control_socket);
+
+/*
+ * Without blocking, check whether the receiver pushed STOP. Returns 1
+ * and consumes the line if it did.
+ */
+int control_stop_requested(int control_socket);
+
+#endif
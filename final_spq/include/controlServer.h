@@ -0,0 +1,91 @@
+#ifndef CONTROLSERVER_H
+#define CONTROLSERVER_H
+
+#include <poll.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "controlChannel.h"
+#include "captureSlot.h"
+#include "bandwidthSearch.h"
+#include "tokenBucket.h"
+
+struct control_client
+{
+	int fd;
+	struct sockaddr_in peer_addr;
+	char line[CONTROL_LINE_LENGTH];
+	int line_len;
+
+	//Accepted on POST_TCP_SERVER_PORT, which only serves FINALIZE
+	int post;
+
+	//Experiment tag from HELLO or FINALIZE, picks the capture slot
+	uint16_t experiment_tag;
+
+	//Set between START and END, and once STOP has been pushed
+	int in_train;
+	int stop_sent;
+
+	//Set while an END request waits for the train to drain
+	int awaiting_drain;
+	int drain_target;
+	struct timespec drain_start;
+
+	//Available bandwidth search of one class, from AVBW on
+	int searching;
+	char search_class;
+	struct bandwidth_search search;
+
+	//Token bucket sweep of one class, from BUCKET on (search_class)
+	int profiling;
+	int packet_bytes;
+
+	//Set between STREAM and TREND or PROFILE, and while either waits
+	//for the stream
+	int in_stream;
+	int awaiting_trend;
+	int awaiting_profile;
+	double profile_rate_bps;
+	int trend_target;
+	struct timespec trend_start;
+	struct timespec last_stream_arrival;
+	struct rate_stream stream;
+};
+
+struct control_server
+{
+	int pre_listen_fd;
+	int post_listen_fd;
+	struct control_client clients[MAX_CONTROL_CLIENTS];
+	const char* output_path;
+};
+
+/*
+ * Listen on PRE_TCP_SERVER_PORT and POST_TCP_SERVER_PORT. A port that
+ * cannot be bound is reported and left closed.
+ */
+error_t control_server_open(struct control_server* server, const char* output_path);
+void control_server_close(struct control_server* server);
+
+/*
+ * Fill fds with the sockets to poll. Returns the number of entries used.
+ */
+int control_server_fill_pollfds(struct control_server* server, struct pollfd* fds);
+
+/*
+ * Hand a probe flagged PROBE_FLAG_RATE_STREAM to the stream its sender
+ * is running. Returns 0 if there is none.
+ */
+int control_server_take_rate_probe(struct control_server* server, const struct sockaddr_in* from,
+	const struct probe_header* header, struct timespec arrival);
+
+/*
+ * Serve the sockets reported ready in fds (as filled by
+ * control_server_fill_pollfds) and answer END requests whose
+ * train has drained.
+ */
+void control_server_process(struct control_server* server, struct pollfd* fds, int num_fds,
+	struct capture_slot_pool* pool);
+
+#endif
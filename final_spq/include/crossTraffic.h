@@ -0,0 +1,127 @@
+#ifndef CROSSTRAFFIC_H
+#define CROSSTRAFFIC_H
+
+/**************************************************************************
+** Cross Traffic
+** Background load the sender runs next to its probe trains, so the
+** bottleneck queue is occupied on purpose instead of by whatever other
+** traffic happens to be there. Strict priority only shows once a queue
+** stands; the initial burst alone builds one for a moment.
+**
+** The load is a list of key=value settings:
+**
+**   rate=50M,class=L,threads=2,size=1400,on=pareto:20ms,off=exp:10ms
+**
+**   rate=<bits/s>[k|M|G]   sending rate while on (required)
+**   class=H|L              goes to that class's probe port, default L
+**   port=<port>            another destination port on the receiver
+**   threads=<n>            independent sources, 1 to CROSS_MAX_THREADS,
+**                          each with its own socket and rate/n
+**   size=<bytes>           payload length, default 1400
+**   on=<dist>:<time>       on period: const, exp or pareto (shape 1.5)
+**   off=<dist>:<time>      with that mean, given together; without
+**                          them a source never pauses. Times take ns,
+**                          us, ms or s
+**   lead=<time>            how long the load runs before the first probe
+**                          leaves, default 100ms
+**
+** Each source paces its packets on the clock and hands them to the
+** kernel in sendmmsg batches. Its packets carry the probe header with
+** class PROBE_CLASS_CROSS, which the receiver drops, so the load fills
+** the queue without ending up in the capture. A reflector echoes it
+** like any probe. At the end the achieved
+** rate is printed against the target.
+**************************************************************************/
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netdb.h>
+
+#include "taracomConstants.h"
+
+#define CROSS_MAX_THREADS 8
+
+//Packets handed to the kernel per sendmmsg call
+#define CROSS_BATCH_SIZE 16
+
+//Longest sleep between checks of the stop flag
+#define CROSS_MAX_SLEEP_NS 10000000
+
+#define CROSS_DEFAULT_SIZE 1400
+#define CROSS_DEFAULT_LEAD_NS 100000000
+
+enum cross_distribution
+{
+	CROSS_CONSTANT,
+	CROSS_EXPONENTIAL,
+	CROSS_PARETO
+};
+
+struct cross_period
+{
+	int distribution;
+	int64_t mean_ns;
+};
+
+struct cross_traffic_config
+{
+	double rate_bps;
+	char priority;
+
+	//Empty for the class's probe port
+	char port[8];
+	int num_threads;
+	int payload_length;
+
+	//off.mean_ns == 0: always on
+	struct cross_period on;
+	struct cross_period off;
+	int64_t lead_ns;
+
+	//Where the receiver looks for the class, set by the sender (probeTemplate.h)
+	int header_offset;
+};
+
+struct cross_source
+{
+	struct cross_traffic* traffic;
+	pthread_t thread;
+	int socket;
+	uint64_t random_state;
+
+	//Written by the source's thread, read after it is joined
+	long long packets;
+	long long bytes;
+	long long send_errors;
+	int64_t on_ns;
+};
+
+struct cross_traffic
+{
+	struct cross_traffic_config config;
+	struct addrinfo* destination;
+	int stopping;
+	int64_t start_ns;
+	int64_t stop_ns;
+	int num_sources;
+	struct cross_source sources[CROSS_MAX_THREADS];
+};
+
+/*
+ * Parse a load description. Errors are reported on stderr.
+ */
+error_t cross_traffic_parse(const char* text, struct cross_traffic_config* config);
+
+/*
+ * Resolve the destination on receiver_address and start the sources.
+ * Returns once the load has run for its lead time.
+ */
+error_t cross_traffic_start(struct cross_traffic* traffic, const struct cross_traffic_config* config,
+	const char* receiver_address);
+
+/*
+ * Stop and join the sources and print the achieved rate
+ */
+void cross_traffic_stop(struct cross_traffic* traffic);
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef DIFFERENTIATIONTEST_H
+#define DIFFERENTIATIONTEST_H
+
+/**************************************************************************
+** Differentiation Tests
+** Offline two sample tests of a finished experiment: are the delays (or
+** inter-arrival times) of the 'H' probes and the 'L' probes drawn from
+** the same distribution?
+**
+**  - two sample Kolmogorov-Smirnov, sensitive to any difference in shape
+**    (a shaper that only stretches the tail)
+**  - Mann-Whitney U with tie correction, sensitive to one class being
+**    shifted against the other (a priority queue)
+**  - percentile bootstrap confidence intervals of the differences of the
+**    medians and of one more percentile, resampling both classes
+**
+** Differences are always 'L' minus 'H', so a positive difference means
+** the 'L' probes were slower. The verdict (SEQUENTIAL_* of
+** sequentialTest.h) favours a class only if the rank test is significant,
+** the median interval excludes 0 and the median difference is at least
+** min_difference; its p-value is the larger of the rank and the
+** bootstrap p-value. The lone probe of a train trails the other class
+** in every run, which alone moves medians by a few hundred nanoseconds
+** on loopback, hence the default of 1 us.
+**
+** Bootstrap iterations run in chunks on the work stealing pool
+** (workStealingPool.h). Every chunk has its own generator seeded from
+** the seed and the chunk number, so results do not depend on the number
+** of threads. Percentiles are nearest rank: the value of rank
+** ceil(percentile / 100 * n) in ascending order.
+**************************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "taracomConstants.h"
+
+#define DIFFERENTIATION_DEFAULT_ITERATIONS 10000
+#define DIFFERENTIATION_DEFAULT_PERCENTILE 90.0
+#define DIFFERENTIATION_DEFAULT_MIN_DIFFERENCE 1000.0
+#define DIFFERENTIATION_DEFAULT_SEED 0x5350512d42535452ULL
+
+//Bootstrap iterations per pool task
+#define BOOTSTRAP_CHUNK 256
+
+//Fewer probes per class than this never favour a class
+#define DIFFERENTIATION_MIN_SAMPLES 8
+
+struct differentiation_config
+{
+	//Significance of the tests; the intervals have confidence 1 - alpha
+	double alpha;
+
+	int iterations;
+	double percentile;
+
+	//Smallest median difference that favours a class, in sample units
+	double min_difference;
+
+	int num_workers;
+	uint64_t seed;
+};
+
+struct ks_result
+{
+	double statistic;
+	double p_value;
+};
+
+struct rank_result
+{
+	double u;
+	double z;
+	double p_value;
+
+	//P(L > H) + P(L = H) / 2, 0.5 when neither class is slower
+	double effect;
+};
+
+struct bootstrap_interval
+{
+	double estimate;
+	double low;
+	double high;
+
+	//Two sided bootstrap p-value of a difference of 0
+	double p_value;
+};
+
+struct differentiation_result
+{
+	size_t num_high;
+	size_t num_low;
+	double median_high;
+	double median_low;
+
+	struct ks_result ks;
+	struct rank_result rank;
+	struct bootstrap_interval median_difference;
+	struct bootstrap_interval percentile_difference;
+
+	int verdict;
+	double p_value;
+};
+
+void differentiation_default_config(struct differentiation_config* config);
+
+/*
+ * Value of nearest rank percentile of the n > 0 ascending values
+ */
+double sorted_percentile(const double* sorted, size_t n, double percentile);
+
+/*
+ * The tests take both samples sorted ascending
+ */
+void ks_two_sample(const double* high, size_t num_high, const double* low, size_t num_low,
+	struct ks_result* result);
+void mann_whitney_u(const double* high, size_t num_high, const double* low, size_t num_low,
+	struct rank_result* result);
+error_t bootstrap_differences(const double* high, size_t num_high, const double* low, size_t num_low,
+	const struct differentiation_config* config, struct bootstrap_interval* median,
+	struct bootstrap_interval* percentile);
+
+/*
+ * Sort both samples in place and run every test on them
+ */
+error_t differentiation_test(double* high, size_t num_high, double* low, size_t num_low,
+	const struct differentiation_config* config, struct differentiation_result* result);
+
+#endif
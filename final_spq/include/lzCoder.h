@@ -0,0 +1,47 @@
+#ifndef LZCODER_H
+#define LZCODER_H
+
+/**************************************************************************
+** LZ Coder
+** A small byte oriented LZ77 coder for single datagrams, in the spirit
+** of LZ4: sequences of literals followed by a back reference into the
+** bytes already decoded.
+**
+**    token        [literal length+]  literals  offset   [match length+]
+**    +----+----+  +------------------+--------+--------+----------------+
+**    |lit |mat |  | 255 ... 255 n    | bytes  | 16 bit | 255 ... 255 n  |
+**    +----+----+  +------------------+--------+--------+----------------+
+**
+** A nibble of 15 continues in the following bytes, each added to it
+** until one is below 255. Matches are at least LZ_MIN_MATCH bytes long
+** and their nibble holds the length minus LZ_MIN_MATCH. The last
+** sequence carries literals only and ends the input. Offsets are little
+** endian and reach back at most 65535 bytes, more than a datagram.
+**
+** Zero filled probes shrink to a few bytes, random ones grow by a few,
+** which is what a compressing link does to the two probe classes.
+**************************************************************************/
+
+#include <stdint.h>
+
+#define LZ_MIN_MATCH 4
+
+//Positions remembered by the compressor, a power of two
+#define LZ_HASH_BITS 12
+
+//Largest output of lz_compress for length input bytes
+#define LZ_MAX_COMPRESSED_LENGTH(length) ((length) + (length) / 255 + 16)
+
+/*
+ * Compress length bytes of input into output. Returns the compressed
+ * length, or -1 if it does not fit into capacity bytes.
+ */
+int lz_compress(const uint8_t* input, int length, uint8_t* output, int capacity);
+
+/*
+ * Decompress length bytes of input into output. Returns the original
+ * length, or -1 if the input is corrupt or does not fit into capacity.
+ */
+int lz_decompress(const uint8_t* input, int length, uint8_t* output, int capacity);
+
+#endif
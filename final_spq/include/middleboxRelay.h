@@ -0,0 +1,111 @@
+#ifndef MIDDLEBOXRELAY_H
+#define MIDDLEBOXRELAY_H
+
+/**************************************************************************
+** Middlebox Relay
+** The middleboxes of middleboxSimulator.h on real sockets. The relay
+** owns both probe ports on one address and forwards every probe to the
+** same port on another, so a sender aimed at the relay reaches the
+** receiver through it:
+**
+**   sender --> listen_address:ports --> [queue(s)] --bottleneck-->
+**              [delay line] --> forward_address:ports --> receiver
+**
+** Probes are read in recvmmsg batches with their kernel receive time and
+** TOS byte, and written in sendmmsg batches with the TOS they came with.
+** Each behaviour is switched on by the configuration, any combination
+** of them at once:
+**
+**  bottleneck   the queues are served one packet at a time at
+**               bottleneck_bps (0 serves at once), each dropping
+**               arrivals beyond buffer_packets. A packet takes its
+**               serialization time of 28 header bytes plus its payload.
+**  priority     RELAY_CLASSIFY_PORT puts probes to the 'H' port, and
+**               RELAY_CLASSIFY_DSCP probes marked with high_dscp, in a
+**               queue that is always served first (final_spq). Without
+**               classification there is one FIFO queue.
+**  compression  payloads are compressed with lzCoder.h on the way in and
+**               decompressed on the way out, so a packet is serialized
+**               at its compressed size (Compression)
+**  trigger      probes carrying pattern at pattern_offset (anywhere with
+**               RELAY_PATTERN_ANYWHERE) are held trigger_delay_ns after
+**               the bottleneck before they leave (Delayer)
+**
+** The relay runs on one thread: it drains the sockets, serves the
+** bottleneck up to the current time, releases what is due, then sleeps
+** until the next departure or arrival, whichever comes first.
+**************************************************************************/
+
+#include <stdint.h>
+
+#include "taracomConstants.h"
+
+#define RELAY_CLASSIFY_NONE 0
+#define RELAY_CLASSIFY_PORT 1
+#define RELAY_CLASSIFY_DSCP 2
+
+#define RELAY_PATTERN_ANYWHERE -1
+#define RELAY_MAX_PATTERN_LENGTH 64
+
+//Datagrams per recvmmsg/sendmmsg call
+#define RELAY_BATCH_SIZE 64
+
+//IP and UDP headers serialized with every payload
+#define RELAY_PACKET_OVERHEAD 28
+
+//Packets held after the bottleneck, triggered or not
+#define RELAY_DELAY_LINE_PACKETS 16384
+
+//Closer than this the relay spins instead of sleeping for a departure
+#define RELAY_SPIN_NS 20000
+
+struct relay_config
+{
+	const char* listen_address;
+	const char* forward_address;
+
+	int classify;
+	int high_dscp;
+
+	double bottleneck_bps;
+	int buffer_packets;
+
+	int compress;
+
+	uint8_t pattern[RELAY_MAX_PATTERN_LENGTH];
+	int pattern_length;
+	int pattern_offset;
+	int64_t trigger_delay_ns;
+};
+
+//Per class counters: 0 = the 'H' port or high_dscp, 1 = the rest
+struct relay_counters
+{
+	unsigned long long received[2];
+	unsigned long long forwarded[2];
+	unsigned long long dropped[2];
+	unsigned long long triggered[2];
+	unsigned long long payload_bytes[2];
+	unsigned long long serialized_bytes[2];
+	unsigned long long send_errors;
+};
+
+/*
+ * Defaults: no classification, no bottleneck, 1000 packets of buffer
+ * per queue, no compression and no trigger
+ */
+void relay_default_config(struct relay_config* config);
+
+/*
+ * Parse a hex string ("ffff0000") into the trigger pattern. Returns 0
+ * if it is not whole bytes of hex or longer than RELAY_MAX_PATTERN_LENGTH.
+ */
+int relay_parse_pattern(struct relay_config* config, const char* hex);
+
+/*
+ * Relay until SIGINT or SIGTERM, then fill counters. Fails if a probe
+ * port cannot be bound on the listen address.
+ */
+error_t middlebox_relay_run(const struct relay_config* config, struct relay_counters* counters);
+
+#endif
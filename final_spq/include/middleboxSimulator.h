@@ -0,0 +1,157 @@
+#ifndef MIDDLEBOXSIMULATOR_H
+#define MIDDLEBOXSIMULATOR_H
+
+/**************************************************************************
+** Middlebox Simulator
+** A discrete event simulation of one experiment: the sender's runs, in
+** the order of trainSchedule.h, crossing a bottleneck link and arriving
+** at a receiver with a perfect clock. It needs no sockets, so detectors
+** can be scored over millions of experiments instead of a handful of
+** real ones.
+**
+**   sender --access link--> [queue(s)] --bottleneck--> middlebox --> receiver
+**
+** The sender sends back to back at the access rate, plus an exponential
+** extra gap per probe for host jitter. Poisson cross traffic of fixed
+** size shares the queues while a run is being sent. The bottleneck
+** serves one packet at a time, never preempted; each queue drops
+** arrivals beyond buffer_packets. Probes served are then lost at
+** random with loss_probability.
+**
+** Scenarios, each the middlebox of one experiment tree:
+**  SIM_NEUTRAL      one FIFO queue
+**  SIM_PRIORITY     strict priority (final_spq): affected_class has its
+**                   own queue, always served before the other
+**  SIM_COMPRESSION  a compressing link (Compression): payloads of
+**                   affected_class (zero filled) are serialized at
+**                   compressed_fraction of their size, the probe header
+**                   excepted
+**  SIM_DELAYER      a content based delayer (Delayer): probes of
+**                   affected_class (the 0xFF payload) are held back
+**                   trigger_delay_ns after the bottleneck
+**
+** Captures hold every probe received, per run in arrival order, with
+** arrivals and send times relative to the first send of the experiment.
+**************************************************************************/
+
+#include <stdint.h>
+
+#include "taracomConstants.h"
+#include "sequentialTest.h"
+#include "differentiationTest.h"
+
+#define SIM_NEUTRAL 0
+#define SIM_PRIORITY 1
+#define SIM_COMPRESSION 2
+#define SIM_DELAYER 3
+#define SIM_NUM_SCENARIOS 4
+
+//IP and UDP headers carried on the bottleneck with every payload
+#define SIM_PACKET_OVERHEAD 28
+
+//Runs of one experiment, one per phase name
+#define SIM_MAX_PHASES 8
+
+struct middlebox_config
+{
+	int scenario;
+
+	double bottleneck_bps;
+	int buffer_packets;
+	int64_t propagation_ns;
+	double loss_probability;
+
+	double access_bps;
+	int64_t send_jitter_ns;
+
+	double cross_bps;
+	double cross_high_fraction;
+	int cross_length;
+
+	//The class the middlebox treats differently: served first,
+	//compressed or delayed, after the scenario
+	char affected_class;
+	double compressed_fraction;
+	int64_t trigger_delay_ns;
+};
+
+struct sim_experiment
+{
+	int initial_train_length;
+	int seperation_train_length;
+	int num_packet_trains;
+	int probe_length;
+
+	//The sender run of each phase, e.g. "LH"
+	const char* phase_names;
+
+	//Idle time between the last arrival of a run and the next run
+	int64_t phase_gap_ns;
+};
+
+struct sim_record
+{
+	int64_t arrival_ns;
+	int64_t tx_time_ns;
+	int32_t seq_id;
+	char priority;
+	uint8_t phase;
+};
+
+struct sim_capture
+{
+	int num_records;
+	int capacity;
+	struct sim_record* records;
+	int num_phases;
+
+	//Probes sent per phase and class (0 = 'H', 1 = 'L')
+	int sent[SIM_MAX_PHASES][2];
+};
+
+/*
+ * Defaults of the scenario: 100 Mbit/s bottleneck with 1000 packets of
+ * buffer, 1 Gbit/s access link with 500 ns of mean send jitter, 10 ms
+ * propagation delay, no cross traffic or loss
+ */
+void middlebox_default_config(struct middlebox_config* config, int scenario);
+
+/*
+ * Scenario called name ("neutral", "priority", "compression",
+ * "delayer"), -1 if there is none
+ */
+int middlebox_scenario(const char* name);
+const char* middlebox_scenario_name(int scenario);
+
+/*
+ * Simulate one experiment into capture, whose records are reused from
+ * earlier calls. The same seed gives the same capture.
+ */
+error_t simulate_experiment(const struct middlebox_config* config, const struct sim_experiment* experiment,
+	uint64_t seed, struct sim_capture* capture);
+void sim_capture_free(struct sim_capture* capture);
+
+/*
+ * Write the capture as the receiver daemon does: a .raw file and the
+ * .owd delays next to it (raw_file with its extension replaced)
+ */
+error_t sim_capture_write(const struct sim_capture* capture, const char* raw_file);
+
+/*
+ * Verdict of the receiver's sequential test on each phase, fed the
+ * one-way delays in arrival order and paired around the run's priority
+ * as unitExperimentAnalyzer does. pairs gets the pairs each one used.
+ */
+void sim_capture_verdicts(const struct sim_capture* capture, const struct sim_experiment* experiment,
+	const struct sequential_test_config* config, int* verdicts, int* pairs);
+
+/*
+ * Verdict of differentiation_test on each phase's 'H' and 'L' delays
+ * past the initial train, as unitExperimentVerdict -i gives it for the
+ * .owd file. The initial train meets a queue that is still filling up,
+ * so keeping it makes 'H' look favoured behind any bottleneck.
+ */
+error_t sim_capture_rank_verdicts(const struct sim_capture* capture, const struct sim_experiment* experiment,
+	const struct differentiation_config* config, int* verdicts);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef PCAPTRACE_H
+#define PCAPTRACE_H
+
+/**************************************************************************
+** pcap Trace Replay
+** Turn a captured application trace into a run the sender replays with
+** the trace's timing and sizes: every IPv4 or IPv6 UDP or TCP packet
+** that carries a payload becomes one probe, leaving at its capture time
+** from the start of the trace, at its original payload length.
+**
+** The reader understands classic pcap files (microsecond and nanosecond
+** timestamps, either byte order) with Ethernet (VLAN tagged or not),
+** BSD loopback, raw IP and Linux cooked (v1 and v2) link layers; no
+** libpcap is needed. pcapng files are refused.
+**
+** Trace probes carry the captured payload bytes, zero padded where the
+** capture was cut short. With rewrite the first bytes are replaced by a
+** probe header (probeHeader.h), so the receiver can measure the trace
+** flow itself; without it only the control flow is measured. The
+** control flow is a probe of the other class every control_interval_ns,
+** interleaved for the length of the trace.
+**************************************************************************/
+
+#include <stdint.h>
+
+#include "taracomConstants.h"
+#include "trainPattern.h"
+
+//payload_offsets entry of probes without trace payload (control flow)
+#define PCAP_NO_PAYLOAD UINT32_MAX
+
+struct replay_options
+{
+	const char* path;
+	int rewrite;
+	int64_t control_interval_ns;
+};
+
+struct pcap_trace
+{
+	//Captured payload bytes of every trace probe, back to back
+	uint8_t* payloads;
+	uint32_t* payload_offsets;
+	int rewrite;
+
+	//What was read: replayed, skipped (not UDP/TCP or without
+	//payload, or later fragments), clamped to MAX_PACKET_SIZE and
+	//padded up to PROBE_HEADER_MIN_LENGTH to fit the probe header
+	long long packets;
+	long long replayed;
+	long long skipped;
+	long long clamped;
+	long long padded;
+	int64_t duration_ns;
+};
+
+/*
+ * Read the trace and compile it into pattern: trace probes of
+ * class_index (0 for 'H', 1 for 'L') interleaved with the control flow
+ * of the other class. Errors are reported on stderr.
+ */
+error_t pcap_trace_load(const struct replay_options* options, int class_index, struct train_pattern* pattern,
+	struct pcap_trace* trace);
+
+/*
+ * Safe on a trace that was never loaded, if it was zeroed
+ */
+void pcap_trace_free(struct pcap_trace* trace);
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef PCAPNGWRITER_H
+#define PCAPNGWRITER_H
+
+/**************************************************************************
+** pcapng Writer
+** Streams the probes the receiver daemon captures to a pcapng file that
+** Wireshark, tshark or tcpdump read directly, with the same kernel
+** receive timestamps the experiment uses, so no tcpdump has to run next
+** to the daemon.
+**
+** Every probe socket is one interface (one Interface Description Block,
+** raw IPv4, nanosecond timestamps); each probe is an Enhanced Packet
+** Block holding an IPv4 and UDP header rebuilt from its addresses and
+** the first snap_length bytes of its payload. By default only the
+** probe header is kept (header-only snippets); probes can be selected
+** by class. At close an Interface Statistics Block per socket records
+** how many probes were offered and how many were dropped.
+**
+** The capture loop only copies each probe into a single producer,
+** single consumer ring; a writer thread formats the blocks and does the
+** file I/O. When the ring is full the probe is dropped from the file
+** and counted, so a slow disk never stalls capture.
+**************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "taracomConstants.h"
+
+#define PCAPNG_MAX_INTERFACES 2
+
+//Bytes of ring between the capture loop and the writer thread, a power of two
+#define PCAPNG_RING_BYTES (1 << 23)
+
+//How long the writer thread sleeps when the ring is empty
+#define PCAPNG_IDLE_SLEEP_NS 1000000
+
+//snap_length of header-only snippets: the probe header and what precedes it
+#define PCAPNG_SNAP_HEADER -1
+
+//What the receiver daemon writes (unitExperimentReceiver -d -w ...)
+struct pcapng_options
+{
+	const char* path;
+	int snap_length;
+	unsigned class_mask;
+};
+
+struct pcapng_writer
+{
+	FILE* file;
+	pthread_t thread;
+	int running;
+
+	//Payload bytes kept per probe, and the classes kept ('H' bit 0, 'L' bit 1)
+	int snap_length;
+	unsigned class_mask;
+	int header_offset;
+
+	int num_interfaces;
+	uint16_t ports[PCAPNG_MAX_INTERFACES];
+
+	//Written by the capture loop only
+	uint64_t head;
+	long long offered[PCAPNG_MAX_INTERFACES];
+	long long dropped[PCAPNG_MAX_INTERFACES];
+
+	//Written by the writer thread only
+	uint64_t tail;
+	long long written;
+
+	uint8_t* ring;
+};
+
+/*
+ * Create path, write the section and interface blocks, one interface
+ * per probe port (host byte order), and start the writer thread. A
+ * snap_length of 0 keeps whole probes.
+ */
+error_t pcapng_writer_open(struct pcapng_writer* writer, const char* path, int snap_length,
+	unsigned class_mask, int header_offset, const uint16_t* ports, int num_interfaces);
+
+/*
+ * Queue one probe received on interface for the writer thread. payload
+ * holds captured bytes of a datagram of original_length bytes; local is
+ * the address it was sent to. Never blocks.
+ */
+void pcapng_writer_capture(struct pcapng_writer* writer, int interface, const uint8_t* payload, int captured,
+	int original_length, struct timespec arrival, const struct sockaddr_in* from, struct in_addr local);
+
+/*
+ * Let the writer thread drain the ring, write the statistics blocks and
+ * close the file
+ */
+error_t pcapng_writer_close(struct pcapng_writer* writer);
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef PROBEHEADER_H
+#define PROBEHEADER_H
+
+/**************************************************************************
+** Probe Packet Header
+** The first bytes of every probe payload. The layout keeps the sequence
+** id and class where older senders put them, so probes from those
+** senders still parse (their zero padding reads as "no flags").
+**
+**    0       4   5   6       8                              16
+**    +-------+---+---+-------+-------------------------------+---------
+**    |seq_id |cls|flg|  tag  |  tx_time_ns (if flg & TX_TS)  | payload
+**    +-------+---+---+-------+-------------------------------+---------
+**
+** tag is the experiment tag the sender was given (-E), 0 for none. The
+** receiver daemon keeps experiments of one sender with different tags
+** in slots of their own, so they can overlap.
+**
+** A reflector (unitExperimentReceiver -r) echoes the probe back and
+** fills in its own receive and send times after the sender's stamp:
+**
+**   16                              24                              32
+**    +-------------------------------+-------------------------------+
+**    |  reflector_rx_ns              |  reflector_tx_ns              |
+**    +-------------------------------+-------------------------------+
+**
+** Multi-byte fields are in host byte order, as seq_id always was.
+**************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+
+//Set when tx_time_ns holds the sender's CLOCK_REALTIME at send time
+#define PROBE_FLAG_TX_TIMESTAMP 0x01
+
+//Set by the reflector on the echo, with both reflector times filled in
+#define PROBE_FLAG_REFLECTED 0x02
+
+//Probe of an available bandwidth stream (bandwidthSearch.h), not captured
+#define PROBE_FLAG_RATE_STREAM 0x04
+
+//Class of cross traffic packets (crossTraffic.h), dropped by the receiver
+#define PROBE_CLASS_CROSS 'X'
+
+#define PROBE_HEADER_MIN_LENGTH 5
+#define PROBE_HEADER_LENGTH 16
+#define PROBE_REFLECTED_HEADER_LENGTH 32
+
+struct probe_header
+{
+	int32_t seq_id;
+	char priority;
+	uint8_t flags;
+	uint16_t experiment_tag;
+	int64_t tx_time_ns;
+	int64_t reflector_rx_ns;
+	int64_t reflector_tx_ns;
+};
+
+/*
+ * Parse the header from a received payload of length bytes.
+ * Returns 0 if the payload is too short to be a probe.
+ */
+static inline int probe_header_read(const char* payload, int length, struct probe_header* header)
+{
+	if (length < PROBE_HEADER_MIN_LENGTH)
+		return 0;
+
+	memcpy(&header->seq_id, payload, sizeof header->seq_id);
+	header->priority = payload[4];
+	header->flags = 0;
+	header->experiment_tag = 0;
+	header->tx_time_ns = 0;
+	header->reflector_rx_ns = 0;
+	header->reflector_tx_ns = 0;
+
+	if (length >= PROBE_HEADER_LENGTH)
+	{
+		header->flags = (uint8_t) payload[5];
+		memcpy(&header->experiment_tag, payload + 6, sizeof header->experiment_tag);
+		if (header->flags & PROBE_FLAG_TX_TIMESTAMP)
+			memcpy(&header->tx_time_ns, payload + 8, sizeof header->tx_time_ns);
+	}
+	if (length >= PROBE_REFLECTED_HEADER_LENGTH && (header->flags & PROBE_FLAG_REFLECTED))
+	{
+		memcpy(&header->reflector_rx_ns, payload + 16, sizeof header->reflector_rx_ns);
+		memcpy(&header->reflector_tx_ns, payload + 24, sizeof header->reflector_tx_ns);
+	}
+	return 1;
+}
+
+/*
+ * Stamp the send time into a payload built by the sender. Payloads
+ * shorter than PROBE_HEADER_LENGTH are left without a timestamp.
+ */
+static inline void probe_header_stamp(uint8_t* payload, int length, int64_t tx_time_ns)
+{
+	if (length < PROBE_HEADER_LENGTH)
+		return;
+	payload[5] |= PROBE_FLAG_TX_TIMESTAMP;
+	memcpy(payload + 8, &tx_time_ns, sizeof tx_time_ns);
+}
+
+/*
+ * Stamp the reflector's receive and send times into a probe being
+ * echoed. Returns 0 if the probe is too short to carry them.
+ */
+static inline int probe_header_reflect(char* payload, int length, int64_t rx_ns, int64_t tx_ns)
+{
+	if (length < PROBE_REFLECTED_HEADER_LENGTH)
+		return 0;
+	payload[5] |= PROBE_FLAG_REFLECTED;
+	memcpy(payload + 16, &rx_ns, sizeof rx_ns);
+	memcpy(payload + 24, &tx_ns, sizeof tx_ns);
+	return 1;
+}
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef PROBETEMPLATE_H
+#define PROBETEMPLATE_H
+
+/**************************************************************************
+** Probe Templates
+** Probe payloads that look like an application protocol to a DPI
+** classifier instead of zero filled blobs. A template file gives the
+** fixed bytes of the application header, where the probe header
+** (probeHeader.h) goes after it, and the fields that change from probe
+** to probe:
+**
+**   # RTP, payload type 96, 20 ms of 8 kHz audio per packet
+**   name rtp
+**   bytes 0 80 60 00 00 00 00 00 00 5e ed 00 01
+**   probe_offset 12
+**   field 2 2 be counter
+**   field 4 4 be clock 8000
+**
+**   bytes <offset> <hex> ...         fixed bytes from offset on, outside
+**                                    the probe header
+**   probe_offset <bytes>             start of the probe header, at most
+**                                    PROBE_TEMPLATE_MAX_OFFSET
+**   field <offset> <width> <be|le> <source> [argument]
+**     width is 1, 2, 4 or 8 bytes, the value is truncated to it:
+**     seq [step]        the probe's sequence id in its class, times step
+**     counter [step]    probes sent before it in the run, times step
+**     clock <hz>        its send time in ticks of hz
+**     random            a fresh pseudo random value
+**
+** Anything after '#' is a comment. Templates are parsed once; per probe
+** probe_template_apply only stores integers at fixed offsets, without
+** allocating or formatting anything. The receiver daemon has to be told
+** the probe_offset (unitExperimentReceiver -d -T offset ...).
+** Templates ship in templates/.
+**************************************************************************/
+
+#include <stdint.h>
+
+#include "taracomConstants.h"
+#include "probeHeader.h"
+
+//The receiver reads this far into each probe (arrivalQueue.h)
+#define PROBE_TEMPLATE_MAX_OFFSET 48
+#define PROBE_TEMPLATE_MAX_BYTES 256
+#define PROBE_TEMPLATE_MAX_FIELDS 16
+#define PROBE_TEMPLATE_NAME_LENGTH 32
+
+enum template_source
+{
+	TEMPLATE_SOURCE_SEQ,
+	TEMPLATE_SOURCE_COUNTER,
+	TEMPLATE_SOURCE_CLOCK,
+	TEMPLATE_SOURCE_RANDOM
+};
+
+struct template_field
+{
+	uint16_t offset;
+	uint8_t width;
+	uint8_t big_endian;
+	uint8_t source;
+
+	//step of seq and counter, hz of clock
+	uint64_t argument;
+};
+
+struct probe_template
+{
+	char name[PROBE_TEMPLATE_NAME_LENGTH];
+
+	//Fixed bytes; bytes past length are zero
+	int length;
+	uint8_t bytes[PROBE_TEMPLATE_MAX_BYTES];
+
+	int probe_offset;
+	int num_fields;
+	struct template_field fields[PROBE_TEMPLATE_MAX_FIELDS];
+
+	//State of the random source
+	uint64_t random_state;
+};
+
+/*
+ * Read a template file. Errors are reported with their line on stderr
+ * and return FILE_ERROR or INVALID_NUMBER_OF_ARGUMENTS.
+ */
+error_t probe_template_load(const char* path, struct probe_template* probe_template);
+
+/*
+ * Copy the fixed bytes into a payload of length bytes, before the probe
+ * header is written at probe_offset
+ */
+void probe_template_fill(const struct probe_template* probe_template, uint8_t* payload, int length);
+
+static inline void template_store(uint8_t* at, int width, int big_endian, uint64_t value)
+{
+	int i;
+	for (i = 0; i < width; i++)
+	{
+		int shift = 8 * (big_endian ? width - 1 - i : i);
+		at[i] = (uint8_t) (value >> shift);
+	}
+}
+
+/*
+ * Write the per probe fields of a payload of length bytes. Fields that
+ * do not fit are skipped.
+ */
+static inline void probe_template_apply(struct probe_template* probe_template, uint8_t* payload, int length,
+	int32_t seq_id, int64_t counter, int64_t tx_time_ns)
+{
+	int f;
+	for (f = 0; f < probe_template->num_fields; f++)
+	{
+		const struct template_field* field = &probe_template->fields[f];
+		if (field->offset + field->width > length)
+			continue;
+		uint64_t value;
+		switch (field->source)
+		{
+		case TEMPLATE_SOURCE_SEQ:
+			value = (uint64_t) seq_id * field->argument;
+			break;
+		case TEMPLATE_SOURCE_COUNTER:
+			value = (uint64_t) counter * field->argument;
+			break;
+		case TEMPLATE_SOURCE_CLOCK:
+			value = (uint64_t) (tx_time_ns / 1000000000) * field->argument +
+				(uint64_t) (tx_time_ns % 1000000000) * field->argument / 1000000000;
+			break;
+		default:
+			//xorshift64
+			probe_template->random_state ^= probe_template->random_state << 13;
+			probe_template->random_state ^= probe_template->random_state >> 7;
+			probe_template->random_state ^= probe_template->random_state << 17;
+			value = probe_template->random_state;
+			break;
+		}
+		template_store(payload + field->offset, field->width, field->big_endian, value);
+	}
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef QUANTILEHISTOGRAM_H
+#define QUANTILEHISTOGRAM_H
+
+/**************************************************************************
+** Quantile Histogram
+** A fixed size log-linear (HDR style) histogram of nanosecond values.
+** Each power of two is split into HISTOGRAM_SUB_BUCKETS/2 linear
+** buckets, so any percentile read back is within 1/64 (~1.6%) of a
+** value that was recorded, at O(1) cost per value and constant memory.
+**
+** Values may be negative (one-way delays between unsynchronized clocks
+** are): their magnitudes go into a mirrored set of buckets.
+** Magnitudes above 2^HISTOGRAM_MAX_BITS ns (~18 minutes) are clamped.
+**************************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HISTOGRAM_SUB_BUCKET_BITS 7
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_MAX_BITS 40
+#define HISTOGRAM_NUM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BUCKET_BITS + 2) * (HISTOGRAM_SUB_BUCKETS / 2))
+
+#define HISTOGRAM_MAX_MAGNITUDE ((1ULL << HISTOGRAM_MAX_BITS) - 1)
+
+struct quantile_histogram
+{
+	uint64_t count;
+	int64_t min;
+	int64_t max;
+	double sum;
+	uint32_t positive[HISTOGRAM_NUM_BUCKETS];
+	uint32_t negative[HISTOGRAM_NUM_BUCKETS];
+};
+
+/*
+ * Bucket of a magnitude: exact below HISTOGRAM_SUB_BUCKETS, then
+ * HISTOGRAM_SUB_BUCKETS/2 linear buckets per power of two
+ */
+static inline int quantile_histogram_bucket(uint64_t magnitude)
+{
+	if (magnitude > HISTOGRAM_MAX_MAGNITUDE)
+		magnitude = HISTOGRAM_MAX_MAGNITUDE;
+	if (magnitude < HISTOGRAM_SUB_BUCKETS)
+		return (int) magnitude;
+
+	int msb = 63 - __builtin_clzll(magnitude);
+	int shift = msb - HISTOGRAM_SUB_BUCKET_BITS + 1;
+	return shift * (HISTOGRAM_SUB_BUCKETS / 2) + (int) (magnitude >> shift);
+}
+
+void quantile_histogram_reset(struct quantile_histogram* histogram);
+
+void quantile_histogram_record(struct quantile_histogram* histogram, int64_t value);
+
+/*
+ * Record n values at once with the column kernels (columnKernels.h).
+ * Same buckets, count, min and max as recording them one by one; the
+ * sum is added per batch of integers, so it is exact where the one by
+ * one double sum may round.
+ */
+void quantile_histogram_record_batch(struct quantile_histogram* histogram, const int64_t* values, size_t n);
+
+/*
+ * Value at percentile (0-100), or 0 if nothing was recorded
+ */
+int64_t quantile_histogram_percentile(const struct quantile_histogram* histogram, double percentile);
+
+/*
+ * Add every value recorded in source to target
+ */
+void quantile_histogram_merge(struct quantile_histogram* target, const struct quantile_histogram* source);
+
+#endif
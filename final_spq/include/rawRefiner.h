@@ -0,0 +1,90 @@
+#ifndef RAWREFINER_H
+#define RAWREFINER_H
+
+/**************************************************************************
+** Raw File Refiner
+** Native replacement of refine_live_experiment_outputfile(). A .raw file
+** holds one phase (sender run) after another, separated by "*\n", with a
+** "seq<TAB>class<TAB>arrival" line per received probe (older receivers
+** wrote "seq<TAB>arrival"). Each phase becomes its own .dat file with,
+** per class, one line per sequence number in order: its arrival, or -1
+** if the probe never arrived. Losses are placed at their true gap in
+** the sequence instead of being appended at the end.
+**
+** The file is mapped and parsed in place: arrival times are copied as
+** text straight from the mapping, so the output matches the input to
+** the nanosecond and nothing is converted to floating point.
+**************************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "taracomConstants.h"
+
+//Phases are named after the sender runs that produced them, in order
+#define DEFAULT_PHASE_NAMES "LH"
+
+//Sequence numbers above this are treated as corrupt lines
+#define MAX_REFINE_SEQ (1 << 24)
+
+//Output is staged in a buffer of this size between writes
+#define REFINE_OUTPUT_BUFFER (1 << 20)
+
+//Index of the class column: 'H', 'L', or none for two column files
+#define REFINE_NUM_CLASSES 3
+
+struct refine_options
+{
+	const char* phase_names;
+
+	//Sender schedule, used to count the trailing losses of each class
+	int have_schedule;
+	int initial_train_length;
+	int seperation_train_length;
+	int num_packet_trains;
+
+	//Fixed number of lines per class, when there is no schedule
+	int num_packets;
+};
+
+//A .raw file mapped read only
+struct raw_mapping
+{
+	const char* data;
+	size_t size;
+
+	//Set when data is text decoded from a .rawz archive
+	int decoded;
+};
+
+/*
+ * Map raw_file. A .rawz archive (captureArchive.h) is recognised by its
+ * header and decoded to the text it replaces, so callers see .raw text.
+ */
+error_t raw_file_map(const char* raw_file, struct raw_mapping* mapping);
+
+/*
+ * Map raw_file as it is on disk, for readers that decode archives themselves
+ */
+error_t raw_file_map_bytes(const char* raw_file, struct raw_mapping* mapping);
+void raw_file_unmap(struct raw_mapping* mapping);
+
+/*
+ * Parse the probe line [line, line_end). The arrival is left as text
+ * in the mapping. Returns 0 if the line is not a probe.
+ */
+int raw_parse_probe_line(const char* line, const char* line_end, int* seq_id, int* class_index,
+	const char** arrival, int* arrival_length);
+
+/*
+ * Convert an arrival written as "<sec>.<9 digit nsec>" to nanoseconds.
+ * Returns 0 if it is not in that form.
+ */
+int raw_arrival_ns(const char* arrival, int arrival_length, int64_t* arrival_ns);
+
+/*
+ * Refine raw_file into <output_path><name>_<phase name>.dat files
+ */
+error_t refine_raw_file(const char* raw_file, const char* output_path, const struct refine_options* options);
+
+#endif
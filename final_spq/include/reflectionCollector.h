@@ -0,0 +1,107 @@
+#ifndef REFLECTIONCOLLECTOR_H
+#define REFLECTIONCOLLECTOR_H
+
+/**************************************************************************
+** Reflection Collector
+** Sender side of round trip mode (udpReflector.h). While the train is
+** being sent, a thread collects the echoes on the send socket and keeps,
+** per probe, the four times of its round trip:
+**
+**   tx        sender send time        (sender clock)
+**   refl_rx   reflector receive time  (reflector clock)
+**   refl_tx   reflector send time     (reflector clock)
+**   rx        sender receive time     (sender clock, kernel stamped)
+**
+** from which it reports
+**
+**   rtt        = (rx - tx) - (refl_tx - refl_rx)
+**   forward    = refl_rx - tx     (includes the clock offset)
+**   reverse    = rx - refl_tx     (includes minus the clock offset)
+**   turnaround = refl_tx - refl_rx
+**
+** The offset cancels in rtt and in the spread of forward and reverse,
+** so their percentiles above the minimum are meaningful as they stand.
+**************************************************************************/
+
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "taracomConstants.h"
+#include "quantileHistogram.h"
+
+//Echoes read per recvmmsg call
+#define ECHO_BATCH_SIZE 64
+
+//How long to wait for echoes still in flight once the train is sent
+#define ECHO_DRAIN_TIME_MS 1000
+
+struct reflection_record
+{
+	//0 until the echo arrives
+	int64_t rx_ns;
+	int64_t tx_ns;
+	int64_t reflector_rx_ns;
+	int64_t reflector_tx_ns;
+};
+
+struct reflection_class
+{
+	int capacity;
+	int sent;
+	int refused;
+	int echoed;
+	int duplicates;
+
+	//Echoes that left the reflector before one that arrived earlier
+	int reverse_reordered;
+	int64_t latest_reflector_tx_ns;
+
+	struct reflection_record* records;
+
+	//1 for the seq ids the kernel refused to send
+	uint8_t* refused_seq;
+};
+
+struct reflection_collector
+{
+	int socket;
+	pthread_t thread;
+	int sending_done;
+	struct timespec done_time;
+
+	//Index 0 = 'H', 1 = 'L'
+	struct reflection_class classes[2];
+};
+
+/*
+ * Enable receive timestamps on the send socket and start collecting
+ * echoes for up to capacity_high/capacity_low probes of each class.
+ */
+error_t reflection_collector_start(struct reflection_collector* collector, int send_socket,
+	int capacity_high, int capacity_low);
+
+/*
+ * Note a probe the kernel refused, so it is not reported as lost.
+ * Called from the sending thread before reflection_collector_finish.
+ */
+void reflection_collector_refuse(struct reflection_collector* collector, int class_index, int32_t seq_id);
+
+/*
+ * Record how many probes of each class the kernel accepted and wait
+ * until all of them were echoed or ECHO_DRAIN_TIME_MS passed without
+ * them.
+ */
+void reflection_collector_finish(struct reflection_collector* collector, int sent_high, int sent_low);
+
+/*
+ * Write the per probe times to <output_path><receiver>_<date>_<priority>.rtt
+ * and print a per class summary. Every seq id handed to the kernel gets
+ * a line, refused ones marked as such.
+ */
+error_t reflection_collector_report(struct reflection_collector* collector, const char* output_path,
+	const char* receiver_address, char priority);
+
+void reflection_collector_free(struct reflection_collector* collector);
+
+#endif
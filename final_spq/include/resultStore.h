@@ -0,0 +1,201 @@
+#ifndef RESULTSTORE_H
+#define RESULTSTORE_H
+
+/**************************************************************************
+** Result Store
+** Every finalized experiment appended to one store directory instead of
+** a ./temp/<ip>_<date>.raw file per experiment, whose names collide as
+** soon as two experiments of one sender overlap in the same second.
+**
+**   <store>/index            "SPQI" | uint32 version | entry...
+**   <store>/segment_<n>.seg  run...
+**
+** A run is a copy of its index entry followed by its probes as columns,
+** widest first so every column is aligned for its type, and the run
+** padded to an 8 byte boundary:
+**
+**   entry | arrival_ns[n] | tx_time_ns[n] | seq_id[n] | length[n] | priority[n] | phase[n]
+**
+** length is the payload length of each probe, which a pattern with
+** probe sizes (trainPattern.h) varies within a run. A mapped segment
+** hands out the columns of any run as plain arrays, without parsing.
+** The index is an array of fixed size entries; the experiment id of an
+** entry is its position + 1, so a run is found by id directly and by
+** sender, receiver, date or parameters with one pass over the mapped
+** entries. Its copy in the segment lets the index be rebuilt from the
+** segments alone.
+**
+** Writers take an exclusive lock on the index for the length of an
+** append and write the run before its index entry, so readers never see
+** an entry whose probes are not there yet. Multi-byte fields are in host
+** byte order, as the probe header is.
+**************************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "taracomConstants.h"
+
+#define RESULT_STORE_MAGIC "SPQI"
+#define RESULT_STORE_VERSION 2
+#define RESULT_INDEX_HEADER_LENGTH 8
+#define RESULT_ENTRY_LENGTH 128
+
+//A segment is closed once the next run would take it past this size
+#define RESULT_SEGMENT_SIZE (64 << 20)
+
+//Segments a reader keeps mapped at the same time
+#define RESULT_MAX_MAPPED_SEGMENTS 16
+
+//Bits of result_entry.class_set
+#define RESULT_CLASS_HIGH 0x1
+#define RESULT_CLASS_LOW 0x2
+#define RESULT_CLASS_OTHER 0x4
+
+#define RESULT_HOST_LENGTH 32
+#define RESULT_MAX_PHASES 8
+
+struct result_entry
+{
+	int64_t experiment_id;
+
+	//CLOCK_REALTIME of the first probe, which arrivals are relative to
+	int64_t start_time_ns;
+	int64_t start_wall_time;
+	int64_t finalize_wall_time;
+
+	//Where the columns of the run start
+	int64_t segment_offset;
+	uint32_t segment;
+	uint32_t num_records;
+
+	uint32_t num_phases;
+	uint32_t class_set;
+
+	//IPv4 address of the sender, network byte order
+	uint32_t sender_addr;
+
+	//Experiment tag of the sender (-E), 0 for none
+	uint16_t experiment_tag;
+	uint16_t reserved_tag;
+
+	//Parameters announced by the sender, 0 when it did not announce any
+	int32_t probe_length;
+	int32_t initial_train_length;
+	int32_t seperation_train_length;
+	int32_t num_packet_trains;
+
+	//Priority of the sender run of each phase, '-' when not announced
+	char phase_priorities[RESULT_MAX_PHASES];
+
+	char receiver[RESULT_HOST_LENGTH];
+	char reserved[8];
+};
+
+_Static_assert(sizeof(struct result_entry) == RESULT_ENTRY_LENGTH, "result_entry is part of the file format");
+
+//The columns of one run, in arrival order
+struct result_columns
+{
+	int num_records;
+	int64_t* arrival_ns;
+	int64_t* tx_time_ns;
+	int32_t* seq_id;
+	uint16_t* length;
+	char* priority;
+	uint8_t* phase;
+};
+
+struct result_store
+{
+	char path[MAX_FILENAME_SIZE];
+	int index_fd;
+	char receiver[RESULT_HOST_LENGTH];
+
+	//Staging area of the run being appended, laid out as on disk
+	uint8_t* run_buffer;
+	size_t run_capacity;
+	struct result_columns columns;
+};
+
+//Filter of result_store_match; zero or NULL fields match anything
+struct result_query
+{
+	int64_t experiment_id;
+	const char* sender;
+	const char* receiver;
+
+	//Local date of the start, "YYYY-MM-DD"
+	const char* date;
+
+	int probe_length;
+	int initial_train_length;
+	int seperation_train_length;
+	int num_packet_trains;
+
+	//RESULT_CLASS_* bits the run must have exactly
+	uint32_t class_set;
+};
+
+struct result_segment_mapping
+{
+	uint32_t segment;
+	const uint8_t* data;
+	size_t size;
+};
+
+struct result_store_reader
+{
+	char path[MAX_FILENAME_SIZE];
+	const uint8_t* index_data;
+	size_t index_size;
+	const struct result_entry* entries;
+	size_t num_entries;
+
+	int num_mapped;
+	struct result_segment_mapping mapped[RESULT_MAX_MAPPED_SEGMENTS];
+};
+
+/*
+ * Open (and create if needed) the store in directory path for appending
+ */
+error_t result_store_open(struct result_store* store, const char* path);
+void result_store_close(struct result_store* store);
+
+/*
+ * Columns to fill with the num_records probes of the next run. They stay
+ * valid until result_store_commit_run.
+ */
+struct result_columns* result_store_begin_run(struct result_store* store, int num_records);
+
+/*
+ * Append the run staged by result_store_begin_run. The id, location and
+ * receiver of entry are filled in here; the id is also copied to
+ * experiment_id.
+ */
+error_t result_store_commit_run(struct result_store* store, struct result_entry* entry,
+	int64_t* experiment_id);
+
+/*
+ * Map the index of the store in directory path. Runs appended later are
+ * only seen after reopening.
+ */
+error_t result_store_open_reader(struct result_store_reader* reader, const char* path);
+void result_store_close_reader(struct result_store_reader* reader);
+
+/*
+ * Entry of experiment_id, NULL if there is none
+ */
+const struct result_entry* result_store_entry(const struct result_store_reader* reader, int64_t experiment_id);
+
+int result_store_match(const struct result_entry* entry, const struct result_query* query);
+
+/*
+ * Point columns at the probes of entry in its mapped segment. The arrays
+ * are read only, and stay valid until the reader is closed or another
+ * RESULT_MAX_MAPPED_SEGMENTS segments have been mapped.
+ */
+error_t result_store_columns(struct result_store_reader* reader, const struct result_entry* entry,
+	struct result_columns* columns);
+
+#endif
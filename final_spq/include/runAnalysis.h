@@ -0,0 +1,45 @@
+#ifndef RUNANALYSIS_H
+#define RUNANALYSIS_H
+
+/**************************************************************************
+** Run Analysis
+** Per run statistics of one .raw file, computed with the receiver's own
+** online metrics (sequenceTracker.h, quantileHistogram.h) and its
+** sequential H versus L test (sequentialTest.h).
+**
+** The sequential test is fed the one-way delays of the .owd file the
+** receiver daemon writes next to the .raw when probes carry sender
+** timestamps (verdict_from "owd"). Otherwise it falls back to arrival
+** times (verdict_from "arrival"): probes of a train leave back to back,
+** so arrival differences of bracketing neighbours are delay differences
+** up to the sender's send gaps, which biases the verdict when the gap
+** before and after the pairing probe differ.
+**
+** Each run becomes one row per phase and class:
+**   file phase run class expected received lost loss_runs duplicates
+**   reordered max_reorder_extent interarrival_p50_ns interarrival_p99_ns
+**   verdict pairs verdict_from
+**************************************************************************/
+
+#include "taracomConstants.h"
+#include "rawRefiner.h"
+
+#define RUN_SUMMARY_HEADER "#file\tphase\trun\tclass\texpected\treceived\tlost\tloss_runs\tduplicates\t" \
+	"reordered\tmax_reorder_extent\tinterarrival_p50_ns\tinterarrival_p99_ns\tverdict\tpairs\tverdict_from\n"
+
+struct analysis_params
+{
+	//Phase names and sender schedule, as for the refiner
+	struct refine_options refine;
+
+	//Significance of the sequential test
+	double alpha;
+};
+
+/*
+ * Analyze raw_file and return its summary rows in a malloc'd string
+ * (set to NULL on failure).
+ */
+error_t analyze_raw_file(const char* raw_file, const struct analysis_params* params, char** rows);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef RUNINDEX_H
+#define RUNINDEX_H
+
+/**************************************************************************
+** Run Index
+** On disk record of the runs the analyzer has already processed, so a
+** campaign is only ever analyzed once. A run is keyed by its path, and
+** is redone when its size or modification time changed or when it was
+** analyzed with other parameters.
+**
+** The index is a text file, one entry after the other:
+**   @<TAB>path<TAB>size<TAB>mtime_ns<TAB>params<TAB>num_rows
+**   <num_rows summary rows, as in runAnalysis.h>
+** It is rewritten whole to a temporary file and renamed over the old
+** one, so an interrupted run never leaves a truncated index behind.
+**************************************************************************/
+
+#include "taracomConstants.h"
+
+struct index_entry
+{
+	char* path;
+	long long size;
+	long long mtime_ns;
+	char* params;
+
+	//Summary rows of the run, newline terminated
+	char* rows;
+};
+
+struct run_index
+{
+	int count;
+	int capacity;
+	struct index_entry* entries;
+};
+
+/*
+ * Load index_file. A missing file gives an empty index.
+ */
+error_t run_index_load(struct run_index* index, const char* index_file);
+
+/*
+ * Entry of path, or NULL if it was never analyzed. The index must be
+ * sorted (run_index_sort) first.
+ */
+struct index_entry* run_index_find(struct run_index* index, const char* path);
+
+/*
+ * Add an empty entry for path; its fields are freed with the index.
+ * The index is left unsorted. Returns NULL if it cannot grow.
+ */
+struct index_entry* run_index_add(struct run_index* index, const char* path);
+
+void run_index_sort(struct run_index* index);
+
+error_t run_index_save(const struct run_index* index, const char* index_file);
+
+void run_index_free(struct run_index* index);
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef SCHEDULEOPTIMIZER_H
+#define SCHEDULEOPTIMIZER_H
+
+/**************************************************************************
+** Schedule Optimizer
+** The smallest sender schedule that still tells a differentiating
+** middlebox from a neutral one. A schedule (initial train, seperation
+** train, number of trains, probe length) is scored on simulated
+** experiments (middleboxSimulator.h):
+**
+**  power           share of experiments through the differentiating
+**                  middlebox whose verdict favours the class it favours,
+**                  in at least one phase and against it in none
+**  false_positive  share of experiments through a neutral FIFO with the
+**                  same bottleneck, loss and cross traffic where any
+**                  phase favours a class
+**
+** Every evaluation simulates the same seeds, so two schedules are
+** compared on the same loss and cross traffic draws and the power of
+** one shape grows with its number of trains about as smoothly as it
+** can. schedule_optimizer_minimize searches that number by bisection.
+**************************************************************************/
+
+#include <stdint.h>
+
+#include "taracomConstants.h"
+#include "middleboxSimulator.h"
+#include "sequentialTest.h"
+#include "differentiationTest.h"
+
+#define OPTIMIZER_DETECTOR_RANK 0
+#define OPTIMIZER_DETECTOR_SEQUENTIAL 1
+
+#define OPTIMIZER_OBJECTIVE_BYTES 0
+#define OPTIMIZER_OBJECTIVE_PACKETS 1
+#define OPTIMIZER_OBJECTIVE_SECONDS 2
+
+struct optimizer_target
+{
+	double power;
+	double false_positive;
+	int experiments;
+	int detector;
+	double alpha;
+	int iterations;
+	int max_trains;
+};
+
+struct schedule_evaluation
+{
+	struct sim_experiment experiment;
+	double power;
+	double false_positive;
+
+	//Cost of one experiment: probes of every phase, their bytes with IP
+	//and UDP headers, and the mean time from the first send to the last
+	//arrival of each phase, summed over the phases
+	long long packets;
+	long long bytes;
+	double seconds;
+
+	int feasible;
+};
+
+struct optimizer_worker
+{
+	struct sim_capture capture;
+	int detected;
+	int false_positives;
+	double seconds;
+	error_t status;
+};
+
+struct schedule_optimizer
+{
+	struct middlebox_config differentiated;
+	struct middlebox_config neutral;
+	struct optimizer_target target;
+	struct sequential_test_config sequential_config;
+	struct differentiation_config rank_config;
+	int expected_verdict;
+	int num_workers;
+	uint64_t seed;
+
+	//Set for the evaluation in progress
+	const struct sim_experiment* experiment;
+	struct optimizer_worker* workers;
+};
+
+/*
+ * Defaults: power 0.9 at a false positive rate of at most 0.05 over
+ * 200 experiments each, rank detector at alpha 0.01 without bootstrap,
+ * at most 400 trains
+ */
+void optimizer_default_target(struct optimizer_target* target);
+
+/*
+ * Set up an optimizer for a differentiating scenario (not SIM_NEUTRAL);
+ * its neutral counterpart is the same config with a FIFO queue
+ */
+error_t schedule_optimizer_init(struct schedule_optimizer* optimizer, const struct middlebox_config* config,
+	const struct optimizer_target* target, int num_workers, uint64_t seed);
+void schedule_optimizer_free(struct schedule_optimizer* optimizer);
+
+/*
+ * Score one schedule; evaluation->feasible tells whether it meets the
+ * target
+ */
+error_t schedule_optimizer_evaluate(struct schedule_optimizer* optimizer, const struct sim_experiment* experiment,
+	struct schedule_evaluation* evaluation);
+
+/*
+ * Smallest num_packet_trains up to target.max_trains that meets the
+ * target with the other fields of shape. If none does, evaluation is
+ * the one at max_trains and not feasible.
+ */
+error_t schedule_optimizer_minimize(struct schedule_optimizer* optimizer, const struct sim_experiment* shape,
+	struct schedule_evaluation* evaluation);
+
+/*
+ * The cost an objective minimizes
+ */
+double schedule_cost(const struct schedule_evaluation* evaluation, int objective);
+
+#endif
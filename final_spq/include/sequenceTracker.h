@@ -0,0 +1,107 @@
+#ifndef SEQUENCETRACKER_H
+#define SEQUENCETRACKER_H
+
+/**************************************************************************
+** Sequence Tracker
+** Online loss, duplication, reordering and delay variation metrics for
+** the probes of one class in one phase, updated as each probe arrives.
+**
+**  - duplicates:  a bitmap of seen sequence ids
+**  - reordering:  RFC 4737. A probe is reordered when its sequence id is
+**                 below the next expected one. Its extent is the number
+**                 of arrivals since the first probe with a higher id.
+**  - IPDV/jitter: RFC 5481 IPDV between consecutive arrivals and the
+**                 RFC 3550 interarrival jitter estimate. Only computed
+**                 when the probes carry sender timestamps.
+**  - loss:        sequence ids never seen below the expected count,
+**                 counted by gap runs when the tracker is summarized.
+**************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "taracomConstants.h"
+
+//Highest sequence id + 1 the bitmap can hold
+#define MAX_TRACKED_SEQ 32768
+
+//Arrivals remembered to measure reordering extent
+#define REORDER_WINDOW 256
+
+struct reorder_entry
+{
+	int seq_id;
+	int arrival_index;
+};
+
+struct sequence_tracker
+{
+	uint64_t seen_bitmap[MAX_TRACKED_SEQ / 64];
+
+	int arrival_index;
+	int next_expected;
+	int max_seq_id;
+
+	int received;
+	int duplicates;
+	int out_of_range;
+	int reordered;
+	int max_reorder_extent;
+	struct reorder_entry window[REORDER_WINDOW];
+
+	//Delay variation, nanoseconds
+	int have_previous;
+	int64_t previous_rx_ns;
+	int64_t previous_tx_ns;
+	int ipdv_count;
+	double sum_abs_ipdv_ns;
+	int64_t max_abs_ipdv_ns;
+	double jitter_ns;
+};
+
+//End of run summary of a tracker
+struct sequence_summary
+{
+	int expected;
+	int received;
+	int lost;
+	int loss_runs;
+	int max_loss_run;
+	int duplicates;
+	int reordered;
+	int max_reorder_extent;
+
+	//Probes with an id past MAX_TRACKED_SEQ, left out of every count above
+	int out_of_range;
+
+	//Negative when no sender timestamps were seen
+	double jitter_ns;
+	double mean_abs_ipdv_ns;
+	int64_t max_abs_ipdv_ns;
+};
+
+void sequence_tracker_reset(struct sequence_tracker* tracker);
+
+/*
+ * Account for one arriving probe. tx_ns is ignored when have_tx is 0.
+ */
+void sequence_tracker_update(struct sequence_tracker* tracker, int seq_id,
+	int64_t rx_ns, int have_tx, int64_t tx_ns);
+
+/*
+ * Whether seq_id has been received
+ */
+static inline int sequence_tracker_seen(const struct sequence_tracker* tracker, int seq_id)
+{
+	return seq_id >= 0 && seq_id < MAX_TRACKED_SEQ &&
+		((tracker->seen_bitmap[seq_id >> 6] >> (seq_id & 63)) & 1);
+}
+
+/*
+ * Summarize the tracker assuming expected probes (ids 0..expected-1)
+ * were sent. Pass expected <= 0 to use the highest id seen.
+ */
+void sequence_tracker_summarize(const struct sequence_tracker* tracker, int expected,
+	struct sequence_summary* summary);
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef SEQUENTIALTEST_H
+#define SEQUENTIALTEST_H
+
+/**************************************************************************
+** Sequential H versus L Test
+** A two-sided Wald SPRT on the sign of paired one-way delay differences
+** (a sequential sign test), updated as probes arrive so an experiment
+** can stop as soon as its verdict is significant.
+**
+** Pairing: each probe of the pairing class (the single probe of every
+** train, i.e. the run's priority) is compared with the mean delay of the
+** other-class probes just before and just after it. Bracketing cancels
+** the drift of a queue that builds or drains during the train.
+**
+** With X = 1 when the 'L' probe was slower, a neutral path has
+** P(X=1) = 0.5. The test runs two SPRTs against P(X=1) = effect
+** ('H' favoured) and P(X=1) = 1 - effect ('L' favoured) with Wald's
+** boundaries for the configured alpha and beta.
+**
+** A pair whose |L - H| difference is not above min_effect_ns counts as
+** a tie, so delay noise smaller than any effect worth reporting does
+** not drive the test to a verdict.
+**************************************************************************/
+
+#include <stdint.h>
+
+#define SEQUENTIAL_UNDECIDED 0
+#define SEQUENTIAL_NEUTRAL 1
+#define SEQUENTIAL_HIGH_FAVOURED 2
+#define SEQUENTIAL_LOW_FAVOURED 3
+
+//Significance used when the daemon is not given one
+#define SEQUENTIAL_DEFAULT_ALPHA 0.01
+
+//Default size of the effect the test is tuned to detect
+#define SEQUENTIAL_DEFAULT_EFFECT 0.75
+
+//Pairs required before any verdict is accepted
+#define SEQUENTIAL_MIN_PAIRS 20
+
+struct sequential_test_config
+{
+	double alpha;
+	double beta;
+	double effect;
+
+	//Ask the sender to stop once a verdict is reached
+	int early_stop;
+
+	//Smallest |L - H| delay difference that counts as a pair, 0 for any
+	int64_t min_effect_ns;
+};
+
+struct sequential_test
+{
+	double upper_bound;
+	double lower_bound;
+	double step_slower;
+	double step_faster;
+	double llr_high_favoured;
+	double llr_low_favoured;
+	int64_t min_effect_ns;
+
+	//Class index (0 = 'H', 1 = 'L') whose probes form the pairs
+	int pair_class;
+	int have_before;
+	int64_t before_delay_ns;
+	int have_pending;
+	int64_t pending_delay_ns;
+	int64_t pending_before_ns;
+
+	int pairs;
+	int ties;
+	int verdict;
+	int decided_at_pair;
+};
+
+void sequential_test_reset(struct sequential_test* test, const struct sequential_test_config* config,
+	int pair_class);
+
+/*
+ * Feed the one-way delay of a probe of class_index (0 = 'H', 1 = 'L').
+ * Returns the verdict, which no longer changes once decided.
+ */
+int sequential_test_observe(struct sequential_test* test, int class_index, int64_t delay_ns);
+
+const char* sequential_verdict_name(int verdict);
+
+#endif
@@ -11,6 +11,9 @@
 #define UDP_PROBE_PORT_NUMBER_HIGH "9876"
 #define UDP_PROBE_PORT_NUMBER_LOW "48698"
 
+//Kernel receive buffer requested for the probe sockets
+#define PROBE_SOCKET_RCVBUF (8*1024*1024)
+
 
 
 //Set to 0 to turn off debugging and 1
@@ -58,6 +61,7 @@ typedef int error_t;
 #define FREAD_ERROR                 114
 #define FWRITE_ERROR				115
 #define FILE_ERROR			      	116
+#define CONTROL_PROTOCOL_ERROR		117
 
 //Sender Specific Errors
 #define URANDOM_FILE_OPEN_FAILED 	201 /*Failed to open the dev/random file*/
@@ -67,5 +71,8 @@ typedef int error_t;
 
 //RECEIVER SPECIFIC ERRORS
 #define HOST_BINDING_ERROR			301 /*Failed to bind host to socket*/
+#define SLOT_ALLOCATION_ERROR		302 /*Failed to allocate the capture slot pool*/
+#define NO_FREE_CAPTURE_SLOT		303 /*Every capture slot is in use*/
+#define UNKNOWN_EXPERIMENT			304 /*No experiment in progress for this sender*/
 
 #endif
@@ -0,0 +1,64 @@
+#ifndef TIMEUTIL_H
+#define TIMEUTIL_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#define NSEC_PER_SEC 1000000000LL
+
+/*
+ * Convert a timespec to a signed count of nanoseconds
+ */
+static inline int64_t timespec_to_ns(struct timespec ts)
+{
+	return (int64_t) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * Convert a count of nanoseconds back to a timespec
+ */
+static inline struct timespec ns_to_timespec(int64_t ns)
+{
+	struct timespec ts;
+	ts.tv_sec = ns / NSEC_PER_SEC;
+	ts.tv_nsec = ns % NSEC_PER_SEC;
+	if (ts.tv_nsec < 0)
+	{
+		ts.tv_sec--;
+		ts.tv_nsec += NSEC_PER_SEC;
+	}
+	return ts;
+}
+
+/*
+ * Nanoseconds elapsed from start to end
+ */
+static inline int64_t elapsed_ns(struct timespec start, struct timespec end)
+{
+	return timespec_to_ns(end) - timespec_to_ns(start);
+}
+
+/*
+ * Kernel receive timestamp (SO_TIMESTAMPNS) of a received msg, or the
+ * current time if the socket did not supply one
+ */
+static inline struct timespec kernel_receive_timestamp(struct msghdr* msg)
+{
+	struct cmsghdr* cmsg;
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
+	{
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+		{
+			struct timespec ts;
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof ts);
+			return ts;
+		}
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return now;
+}
+
+#endif
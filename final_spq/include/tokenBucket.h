@@ -0,0 +1,73 @@
+#ifndef TOKENBUCKET_H
+#define TOKENBUCKET_H
+
+/**************************************************************************
+** Token Bucket Detection
+** Receiver side of the policer/shaper sweep (unitExperimentSender -B).
+** The sender sends each class periodic streams over a ladder of rates
+** and burst lengths, with the rate stream machinery of bandwidthSearch.h;
+** for every stream the receiver reads the profile of its one-way delays
+** and losses and fits a token bucket (rate r, depth b) to it.
+**
+** A stream of packets of S bytes at rate R > r drains the bucket by
+** (R - r) per second, so it runs dry after k = b / (S (1 - r/R)) packets.
+** From then on
+**   a policer drops: the probes keep their delay and only r/R of them
+**     get through, so r = R * received / sent after the first loss and
+**     b = k S (1 - r/R) with k the first lost probe
+**   a shaper queues: the delay grows by d = S/r - S/R per packet, so
+**     r = R * T / (T + d) with T the packet time at R, and b as above
+**     with k where the delay ramp starts
+** A stream whose delays ramp over at least TOKEN_RAMP_MIN_PROBES probes
+** before its first loss is shaped (a shaper's queue may overflow later
+** on), one that loses more than TOKEN_LOSS_FRACTION of its tail without
+** such a ramp is policed, and anything else conformed to the bucket.
+**************************************************************************/
+
+#include "bandwidthSearch.h"
+
+//The delay baseline is the least delay of this many first probes
+#define TOKEN_BASE_PROBES 10
+
+//A ramp starts once this many probes in a row sit this far above the baseline
+#define TOKEN_RAMP_THRESHOLD_NS 100000
+#define TOKEN_RAMP_CONFIRM 3
+
+#define TOKEN_RAMP_MIN_PROBES 16
+#define TOKEN_LOSS_FRACTION 0.02
+
+#define TOKEN_POLICER 'P'
+#define TOKEN_SHAPER 'S'
+#define TOKEN_CONFORMING 'C'
+
+struct stream_profile
+{
+	int expected;
+	int received;
+
+	//Sequence id of the first lost probe, expected if none was lost
+	int first_loss;
+	int loss_runs;
+	int received_after_loss;
+
+	//Where the delay starts to grow, expected if it does not; the ramp
+	//runs for ramp_probes probes up to the first loss after it
+	int ramp_start;
+	int ramp_probes;
+	double ramp_slope_ns;
+};
+
+/*
+ * Read the losses and the delay ramp of a stream
+ */
+void rate_stream_profile(const struct rate_stream* stream, struct stream_profile* profile);
+
+/*
+ * Fit a token bucket to the profile of a stream sent at rate_bps in
+ * packets of packet_bytes (IP bytes). Returns TOKEN_POLICER, TOKEN_SHAPER
+ * or TOKEN_CONFORMING; the rate and depth are only set for the first two.
+ */
+char token_bucket_infer(const struct stream_profile* profile, double rate_bps, int packet_bytes,
+	double* bucket_rate_bps, double* depth_bytes);
+
+#endif
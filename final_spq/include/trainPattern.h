@@ -0,0 +1,94 @@
+#ifndef TRAINPATTERN_H
+#define TRAINPATTERN_H
+
+/**************************************************************************
+** Train Pattern
+** A small language for the order and timing of the probes of one run,
+** compiled once into a flat array the sender walks without deciding
+** anything per probe:
+**
+**   2001H (1L 19H)x200         the final_spq 'L' run
+**   2001H (1H 19L)x200         the final_spq 'H' run
+**   500H +2ms (1L 4H 1L 4H)x50 two lone probes per train, after a pause
+**   2001H (1L@64 9H 1L@1400 9H)x100
+**                              small and large lone probes in one run
+**   (1L 19H)x64@64-1472        one size per train, from 64 up to 1472
+**
+**   sequence := item*
+**   item     := [count] class [size] count probes of class 'H' or 'L'
+**             | '(' sequence ')' ['x' count] [size]
+**             | '+' count unit       pause before the next probe, unit
+**                                    ns, us, ms or s
+**   size     := '@' bytes ['-' bytes]
+**
+** A size sets the payload length of the probes it follows; a range
+** steps evenly from the first to the last probe of a run, or from the
+** first to the last repetition of a group. Sizes inside a group win over
+** the group's. Probes without one have length 0 and go out at the run's
+** probe_payload_length.
+**
+** Probes follow each other back to back unless a pause separates them;
+** departure_ns is a probe's earliest send time from the start of the
+** run. Sequence ids count up per class from 0 in send order. Each
+** repetition of a group at the top level is one train, numbered from 1;
+** probes outside such groups belong to train 0. The last probe of every
+** train and of every top level run ends its train.
+**************************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "taracomConstants.h"
+#include "probeHeader.h"
+
+//Bound on the probes of one compiled run
+#define TRAIN_PATTERN_MAX_PROBES 50000000
+
+//Bounds on a probe size given in a pattern, bytes of UDP payload
+#define TRAIN_PATTERN_MIN_LENGTH PROBE_HEADER_MIN_LENGTH
+#define TRAIN_PATTERN_MAX_LENGTH MAX_PACKET_SIZE
+
+struct pattern_probe
+{
+	int64_t departure_ns;
+	int32_t seq_id;
+	int32_t train;
+
+	//Payload bytes, 0 for the run's probe_payload_length
+	uint16_t length;
+
+	//0 for 'H', 1 for 'L'
+	uint8_t class_index;
+	uint8_t ends_train;
+};
+
+struct train_pattern
+{
+	int length;
+	int capacity;
+	struct pattern_probe* probes;
+
+	int num_trains;
+	int class_counts[2];
+
+	//Longest size given in the pattern, 0 if it gives none
+	int max_length;
+};
+
+/*
+ * Compile text into pattern. On a syntax error the offending position
+ * is reported on stderr and INVALID_NUMBER_OF_ARGUMENTS returned.
+ */
+error_t train_pattern_compile(const char* text, struct train_pattern* pattern);
+void train_pattern_free(struct train_pattern* pattern);
+
+/*
+ * The pattern of the classic schedule: initial_train_length 'H' probes,
+ * then num_packet_trains trains of one probe of priority followed by
+ * seperation_train_length of the other class. Returns 0 if it does not
+ * fit into size bytes.
+ */
+int train_pattern_format(char* text, size_t size, int initial_train_length, int seperation_train_length,
+	int num_packet_trains, char priority);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef TRAINSCHEDULE_H
+#define TRAINSCHEDULE_H
+
+/**************************************************************************
+** Train Schedule
+** The order in which UDPTrainGenerator sends the probes of one run:
+** initial_train_length 'H' probes, then num_packet_trains trains of one
+** probe of the run's priority followed by seperation_train_length probes
+** of the other class. Sequence ids count up per class from 0.
+**
+** The schedule is the train pattern (trainPattern.h) of these three
+** numbers, so a run given by them and a run given as a pattern are
+** sent the same way. The sender executes compiled patterns directly;
+** the simulator (middleboxSimulator.h) walks the same array through
+** train_schedule_next, so simulated runs see exactly the probes a real
+** run sends.
+**************************************************************************/
+
+#include <stdint.h>
+
+#include "taracomConstants.h"
+#include "trainPattern.h"
+
+struct scheduled_probe
+{
+	int32_t seq_id;
+	char priority;
+
+	//0 for the initial train, 1..num_packet_trains for the others
+	int train;
+
+	//Set on the last probe of its train
+	int ends_train;
+
+	//Payload bytes, 0 for the run's probe length
+	int length;
+};
+
+struct train_schedule
+{
+	struct train_pattern pattern;
+	int position;
+
+	//Next sequence id of 'H' (0) and 'L' (1), i.e. the probes sent so far
+	int32_t next_seq_id[2];
+};
+
+/*
+ * Compile the schedule of a run. Negative lengths count as 0.
+ */
+error_t train_schedule_init(struct train_schedule* schedule, int initial_train_length,
+	int seperation_train_length, int num_packet_trains, char priority);
+void train_schedule_free(struct train_schedule* schedule);
+
+/*
+ * Step to the next probe. Returns 0 once the run is over.
+ */
+int train_schedule_next(struct train_schedule* schedule, struct scheduled_probe* probe);
+
+/*
+ * Probes of the run in total
+ */
+int train_schedule_length(const struct train_schedule* schedule);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef UDPREFLECTOR_H
+#define UDPREFLECTOR_H
+
+/**************************************************************************
+** UDP Reflector
+** Round trip mode of the receiver. Every probe that reaches a probe port
+** is sent straight back to its source, full length and on the same
+** port, with the reflector's kernel receive time and its send time
+** stamped into the header (probeHeader.h). The sender subtracts the
+** reflector's own turnaround, so RTT is measured without synchronized
+** clocks; the reverse path delay is exact up to the clock offset.
+**
+** Probes are echoed in recvmmsg/sendmmsg batches: a batch is sent back
+** as soon as the socket runs dry, so nothing waits for a batch to fill.
+**************************************************************************/
+
+#include "taracomConstants.h"
+
+//Probes echoed per recvmmsg/sendmmsg call
+#define REFLECT_BATCH_SIZE 32
+
+/*
+ * Create a non-blocking UDP socket bound to port that records
+ * kernel receive timestamps. Returns -1 on failure.
+ * (Defined in UDPTrainReceiver.c)
+ */
+int open_probe_socket(const char* port);
+
+/*
+ * Echo probes on both probe ports until SIGINT or SIGTERM.
+ */
+error_t UDPReflector (void);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef WORKSTEALINGPOOL_H
+#define WORKSTEALINGPOOL_H
+
+/**************************************************************************
+** Work Stealing Thread Pool
+** Runs a fixed set of independent tasks (numbered 0..num_tasks-1) on
+** num_workers threads. Each worker starts with a contiguous share of
+** the tasks in its own deque and takes them from the bottom; a worker
+** whose deque runs dry steals from the top of another's. Runs vary a
+** lot in size, so static shares alone would leave most threads idle
+** behind the one that drew the long runs.
+**************************************************************************/
+
+#include <pthread.h>
+
+#include "taracomConstants.h"
+
+//Upper bound on worker threads
+#define MAX_POOL_WORKERS 64
+
+typedef void (*pool_task)(int task, int worker, void* context);
+
+struct task_deque
+{
+	pthread_mutex_t lock;
+	int* tasks;
+	int top;
+	int bottom;
+};
+
+/*
+ * Run every task once and return when all are done. Tasks must not
+ * depend on each other.
+ */
+error_t work_pool_run(int num_tasks, int num_workers, pool_task task, void* context);
+
+#endif
@@ -0,0 +1,210 @@
+/**************************************************************************
+** Schedule Optimizer
+** Find the cheapest sender schedule that detects a middlebox with a
+** target power at a bounded false positive rate, on a path with a given
+** bottleneck rate and loss (scheduleOptimizer.h). Probe bytes cost money
+** on metered paths; the hand picked 2001 19 200 of
+** experimentReceiver.config is rarely the cheapest that works.
+**
+** Every combination of the candidate initial train lengths, seperation
+** train lengths and probe lengths gets the fewest trains that reach the
+** target, found by bisection over simulated experiments.
+**
+** Parameters:
+**  (1) scenario = priority, compression or delayer, the middlebox to
+**                 detect; false positives are counted on a FIFO queue
+**                 with the same bottleneck, loss and cross traffic
+**  Optional flags:
+**  -I lengths       candidate initial train lengths, default 0,500,1000,2001
+**  -S lengths       candidate seperation train lengths, default 4,9,19,39
+**  -l lengths       candidate probe lengths, default 100
+**  -M trains        most trains tried, default 400
+**  -P power         target power, default 0.9
+**  -F rate          highest false positive rate, default 0.05
+**  -n experiments   simulated experiments per scenario and schedule,
+**                   default 200
+**  -k detector      rank (unitExperimentVerdict -i) or sequential (the
+**                   receiver's test), default rank
+**  -m objective     bytes, packets or seconds, default bytes
+**  -p names         the sender run of each phase, default "LH"
+**  -b -q -d -e -A -J -x -X -y -c -z -t -a -B -j -r
+**                   as for unitExperimentSimulator
+**
+** One row per combination with its fewest trains, cost, power and false
+** positive rate is printed; the cheapest feasible one is marked "best".
+**
+** How To Run Code:
+**   ./unitExperimentOptimizer [options] scenario
+**
+** Example:
+**   ./unitExperimentOptimizer -b 20 -e 0.01 -x 15 priority
+**************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "taracomConstants.h"
+#include "scheduleOptimizer.h"
+#include "rawRefiner.h"
+
+//Candidates per list
+#define MAX_CANDIDATES 32
+#define MAX_CANDIDATE_LENGTH 1000000
+
+static const char* objective_names[3] = { "bytes", "packets", "seconds" };
+static const char* detector_names[2] = { "rank", "sequential" };
+
+/*
+ * Parse a comma separated list of positive lengths, or non-negative ones
+ * with allow_zero. Returns the number parsed, 0 on error.
+ */
+static int parse_lengths(const char* text, int allow_zero, int* lengths)
+{
+  int count = 0;
+  while(*text != '\0' && count < MAX_CANDIDATES)
+  {
+    char* end;
+    long value = strtol(text, &end, 10);
+    if(end == text || value < (allow_zero ? 0 : 1) || value > MAX_CANDIDATE_LENGTH)
+      return 0;
+    lengths[count++] = (int) value;
+    text = *end == ',' ? end + 1 : end;
+    if(*end != ',' && *end != '\0')
+      return 0;
+  }
+  return *text == '\0' ? count : 0;
+}
+
+static int lookup(const char* name, const char** names, int num_names)
+{
+  int i;
+  for(i = 0; i < num_names; i++)
+  {
+    if(strcmp(name, names[i]) == 0)
+      return i;
+  }
+  return -1;
+}
+
+int main(int argc, char *argv[])
+{
+  struct middlebox_config config;
+  middlebox_default_config(&config, SIM_NEUTRAL);
+  struct optimizer_target target;
+  optimizer_default_target(&target);
+  struct sim_experiment shape = { 0, 0, 0, 0, DEFAULT_PHASE_NAMES, 1000000000LL };
+  int initial_lengths[MAX_CANDIDATES] = { 0, 500, 1000, 2001 };
+  int seperation_lengths[MAX_CANDIDATES] = { 4, 9, 19, 39 };
+  int probe_lengths[MAX_CANDIDATES] = { 100 };
+  int num_initial = 4, num_seperation = 4, num_probe = 1;
+  int objective = OPTIMIZER_OBJECTIVE_BYTES;
+  int num_workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  uint64_t seed = 1;
+  char affected_class = 0;
+  int valid = 1;
+
+  int arg = 1;
+  while(arg + 1 < argc && argv[arg][0] == '-' && argv[arg][1] != '\0' && argv[arg][2] == '\0' && valid)
+  {
+    const char* value = argv[arg + 1];
+    switch(argv[arg][1])
+    {
+    case 'I': valid = (num_initial = parse_lengths(value, 1, initial_lengths)) > 0; break;
+    case 'S': valid = (num_seperation = parse_lengths(value, 0, seperation_lengths)) > 0; break;
+    case 'l': valid = (num_probe = parse_lengths(value, 0, probe_lengths)) > 0; break;
+    case 'M': target.max_trains = atoi(value); break;
+    case 'P': target.power = atof(value); break;
+    case 'F': target.false_positive = atof(value); break;
+    case 'n': target.experiments = atoi(value); break;
+    case 'k': valid = (target.detector = lookup(value, detector_names, 2)) >= 0; break;
+    case 'm': valid = (objective = lookup(value, objective_names, 3)) >= 0; break;
+    case 'p': shape.phase_names = value; break;
+    case 'b': config.bottleneck_bps = atof(value) * 1e6; break;
+    case 'q': config.buffer_packets = atoi(value); break;
+    case 'd': config.propagation_ns = (int64_t) (atof(value) * 1e6); break;
+    case 'e': config.loss_probability = atof(value); break;
+    case 'A': config.access_bps = atof(value) * 1e6; break;
+    case 'J': config.send_jitter_ns = atoll(value); break;
+    case 'x': config.cross_bps = atof(value) * 1e6; break;
+    case 'X': config.cross_high_fraction = atof(value); break;
+    case 'y': config.cross_length = atoi(value); break;
+    case 'c': affected_class = value[0]; break;
+    case 'z': config.compressed_fraction = atof(value); break;
+    case 't': config.trigger_delay_ns = (int64_t) (atof(value) * 1e3); break;
+    case 'a': target.alpha = atof(value); break;
+    case 'B': target.iterations = atoi(value); break;
+    case 'j': num_workers = atoi(value); break;
+    case 'r': seed = strtoull(value, NULL, 0); break;
+    default: valid = 0; break;
+    }
+    arg += 2;
+  }
+
+  int scenario = valid && argc - arg == 1 ? middlebox_scenario(argv[arg]) : -1;
+  if(scenario <= SIM_NEUTRAL || target.max_trains < 1 || target.experiments < 1 || target.power <= 0 ||
+    target.power > 1 || target.false_positive < 0 || target.alpha <= 0 || target.alpha >= 0.5 ||
+    target.iterations < 0 || num_workers < 1 || config.bottleneck_bps <= 0 || config.access_bps <= 0 ||
+    strlen(shape.phase_names) == 0 || strlen(shape.phase_names) > SIM_MAX_PHASES)
+  {
+    fprintf(stderr,"ERROR #%d: INVALID NUMBER OF ARGUMENTS\n", INVALID_NUMBER_OF_ARGUMENTS);
+    fprintf(stderr, "Usage: ./unitExperimentOptimizer [-I lengths] [-S lengths] [-l lengths] [-M trains] [-P power] [-F rate] [-n experiments] [-k rank|sequential] [-m bytes|packets|seconds] [-p names] [simulator options] priority|compression|delayer\n");
+    return INVALID_NUMBER_OF_ARGUMENTS;
+  }
+
+  //Scenario defaults first, then what was given on the command line
+  struct middlebox_config defaults;
+  middlebox_default_config(&defaults, scenario);
+  config.scenario = scenario;
+  config.affected_class = affected_class != 0 ? affected_class : defaults.affected_class;
+
+  struct schedule_optimizer optimizer;
+  if(schedule_optimizer_init(&optimizer, &config, &target, num_workers, seed) != SUCCESS)
+  {
+    schedule_optimizer_free(&optimizer);
+    return FAILURE;
+  }
+
+  printf("#scenario\tinitial\tseperation\ttrains\tprobe_length\tpackets\tbytes\tseconds\tpower\tfalse_positive\tstatus\n");
+  struct schedule_evaluation best;
+  int have_best = 0;
+  error_t result = SUCCESS;
+  int i, s, l;
+  for(i = 0; i < num_initial && result == SUCCESS; i++)
+    for(s = 0; s < num_seperation && result == SUCCESS; s++)
+      for(l = 0; l < num_probe && result == SUCCESS; l++)
+      {
+        shape.initial_train_length = initial_lengths[i];
+        shape.seperation_train_length = seperation_lengths[s];
+        shape.probe_length = probe_lengths[l];
+        struct schedule_evaluation evaluation;
+        result = schedule_optimizer_minimize(&optimizer, &shape, &evaluation);
+        if(result != SUCCESS)
+          break;
+        printf("%s\t%d\t%d\t%d\t%d\t%lld\t%lld\t%.3f\t%.3f\t%.3f\t%s\n", middlebox_scenario_name(scenario),
+          shape.initial_train_length, shape.seperation_train_length, evaluation.experiment.num_packet_trains,
+          shape.probe_length, evaluation.packets, evaluation.bytes, evaluation.seconds, evaluation.power,
+          evaluation.false_positive, evaluation.feasible ? "feasible" : "infeasible");
+        fflush(stdout);
+        if(evaluation.feasible && (!have_best || schedule_cost(&evaluation, objective) < schedule_cost(&best, objective)))
+        {
+          best = evaluation;
+          have_best = 1;
+        }
+      }
+  schedule_optimizer_free(&optimizer);
+  if(result != SUCCESS)
+    return result;
+
+  if(!have_best)
+  {
+    fprintf(stderr, "No schedule reaches power %.2f at a false positive rate of %.2f within %d trains\n",
+      target.power, target.false_positive, target.max_trains);
+    return FAILURE;
+  }
+  printf("%s\t%d\t%d\t%d\t%d\t%lld\t%lld\t%.3f\t%.3f\t%.3f\tbest\n", middlebox_scenario_name(scenario),
+    best.experiment.initial_train_length, best.experiment.seperation_train_length,
+    best.experiment.num_packet_trains, best.experiment.probe_length, best.packets, best.bytes, best.seconds,
+    best.power, best.false_positive);
+  return SUCCESS;
+}
@@ -0,0 +1,227 @@
+/*************************************************************
+** Schedule Optimizer
+** See scheduleOptimizer.h for what is optimized.
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scheduleOptimizer.h"
+#include "workStealingPool.h"
+#include "timeUtil.h"
+
+void optimizer_default_target(struct optimizer_target* target)
+{
+	target->power = 0.9;
+	target->false_positive = 0.05;
+	target->experiments = 200;
+	target->detector = OPTIMIZER_DETECTOR_RANK;
+	target->alpha = SEQUENTIAL_DEFAULT_ALPHA;
+	target->iterations = 0;
+	target->max_trains = 400;
+}
+
+/*
+ * The verdict a middlebox of the scenario should produce: priority and
+ * compression favour the affected class, the delayer the other one
+ */
+static int expected_verdict(const struct middlebox_config* config)
+{
+	char favoured = config->affected_class;
+	if (config->scenario == SIM_DELAYER)
+		favoured = favoured == 'H' ? 'L' : 'H';
+	return favoured == 'H' ? SEQUENTIAL_HIGH_FAVOURED : SEQUENTIAL_LOW_FAVOURED;
+}
+
+error_t schedule_optimizer_init(struct schedule_optimizer* optimizer, const struct middlebox_config* config,
+	const struct optimizer_target* target, int num_workers, uint64_t seed)
+{
+	memset(optimizer, 0, sizeof *optimizer);
+	if (config->scenario == SIM_NEUTRAL)
+		return FAILURE;
+	optimizer->differentiated = *config;
+	optimizer->neutral = *config;
+	optimizer->neutral.scenario = SIM_NEUTRAL;
+	optimizer->target = *target;
+	optimizer->expected_verdict = expected_verdict(config);
+
+	optimizer->sequential_config.alpha = target->alpha;
+	optimizer->sequential_config.beta = target->alpha;
+	optimizer->sequential_config.effect = SEQUENTIAL_DEFAULT_EFFECT;
+	optimizer->sequential_config.early_stop = 0;
+	optimizer->sequential_config.min_effect_ns = 0;
+
+	//Experiments already run in parallel, the bootstrap of each stays on its worker
+	differentiation_default_config(&optimizer->rank_config);
+	optimizer->rank_config.alpha = target->alpha;
+	optimizer->rank_config.iterations = target->iterations;
+
+	optimizer->num_workers = num_workers < MAX_POOL_WORKERS ? num_workers : MAX_POOL_WORKERS;
+	optimizer->seed = seed;
+	optimizer->workers = (struct optimizer_worker*) calloc(optimizer->num_workers, sizeof(struct optimizer_worker));
+	return optimizer->workers != NULL ? SUCCESS : FAILURE;
+}
+
+void schedule_optimizer_free(struct schedule_optimizer* optimizer)
+{
+	int w;
+	for (w = 0; w < optimizer->num_workers && optimizer->workers != NULL; w++)
+		sim_capture_free(&optimizer->workers[w].capture);
+	free(optimizer->workers);
+	optimizer->workers = NULL;
+}
+
+/*
+ * Time from the first send to the last arrival of every phase, summed
+ */
+static double capture_seconds(const struct sim_capture* capture)
+{
+	int64_t first_send[SIM_MAX_PHASES], last_arrival[SIM_MAX_PHASES];
+	int phase, i;
+	for (phase = 0; phase < SIM_MAX_PHASES; phase++)
+	{
+		first_send[phase] = INT64_MAX;
+		last_arrival[phase] = INT64_MIN;
+	}
+	for (i = 0; i < capture->num_records; i++)
+	{
+		const struct sim_record* record = &capture->records[i];
+		if (record->tx_time_ns < first_send[record->phase])
+			first_send[record->phase] = record->tx_time_ns;
+		if (record->arrival_ns > last_arrival[record->phase])
+			last_arrival[record->phase] = record->arrival_ns;
+	}
+
+	double seconds = 0;
+	for (phase = 0; phase < capture->num_phases; phase++)
+	{
+		if (last_arrival[phase] > first_send[phase])
+			seconds += (last_arrival[phase] - first_send[phase]) / (double) NSEC_PER_SEC;
+	}
+	return seconds;
+}
+
+/*
+ * Tasks below target.experiments go through the differentiating
+ * middlebox, the rest through the neutral one, with the same seeds
+ */
+static void evaluate_task(int task, int worker, void* context)
+{
+	struct schedule_optimizer* optimizer = (struct schedule_optimizer*) context;
+	struct optimizer_worker* state = &optimizer->workers[worker];
+	int neutral = task >= optimizer->target.experiments;
+	int index = neutral ? task - optimizer->target.experiments : task;
+	uint64_t seed = optimizer->seed ^ ((uint64_t) (index + 1) * 0x9e3779b97f4a7c15ULL);
+	const struct middlebox_config* config = neutral ? &optimizer->neutral : &optimizer->differentiated;
+	if (simulate_experiment(config, optimizer->experiment, seed, &state->capture) != SUCCESS)
+	{
+		state->status = FAILURE;
+		return;
+	}
+
+	int verdicts[SIM_MAX_PHASES], pairs[SIM_MAX_PHASES];
+	if (optimizer->target.detector == OPTIMIZER_DETECTOR_SEQUENTIAL)
+		sim_capture_verdicts(&state->capture, optimizer->experiment, &optimizer->sequential_config, verdicts, pairs);
+	else if (sim_capture_rank_verdicts(&state->capture, optimizer->experiment, &optimizer->rank_config, verdicts) != SUCCESS)
+	{
+		state->status = FAILURE;
+		return;
+	}
+
+	int favoured = 0, opposed = 0, phase;
+	for (phase = 0; phase < state->capture.num_phases; phase++)
+	{
+		if (verdicts[phase] != SEQUENTIAL_HIGH_FAVOURED && verdicts[phase] != SEQUENTIAL_LOW_FAVOURED)
+			continue;
+		if (verdicts[phase] == optimizer->expected_verdict)
+			favoured = 1;
+		else
+			opposed = 1;
+	}
+	if (neutral)
+		state->false_positives += favoured || opposed;
+	else
+	{
+		state->detected += favoured && !opposed;
+		state->seconds += capture_seconds(&state->capture);
+	}
+}
+
+error_t schedule_optimizer_evaluate(struct schedule_optimizer* optimizer, const struct sim_experiment* experiment,
+	struct schedule_evaluation* evaluation)
+{
+	int w;
+	for (w = 0; w < optimizer->num_workers; w++)
+	{
+		optimizer->workers[w].detected = 0;
+		optimizer->workers[w].false_positives = 0;
+		optimizer->workers[w].seconds = 0;
+		optimizer->workers[w].status = SUCCESS;
+	}
+	optimizer->experiment = experiment;
+	error_t status = work_pool_run(2 * optimizer->target.experiments, optimizer->num_workers, evaluate_task, optimizer);
+
+	long long detected = 0, false_positives = 0;
+	double seconds = 0;
+	for (w = 0; w < optimizer->num_workers; w++)
+	{
+		if (optimizer->workers[w].status != SUCCESS)
+			status = optimizer->workers[w].status;
+		detected += optimizer->workers[w].detected;
+		false_positives += optimizer->workers[w].false_positives;
+		seconds += optimizer->workers[w].seconds;
+	}
+
+	int num_phases = (int) strlen(experiment->phase_names);
+	long long run_length = experiment->initial_train_length +
+		(long long) experiment->num_packet_trains * (experiment->seperation_train_length + 1);
+	evaluation->experiment = *experiment;
+	evaluation->power = (double) detected / optimizer->target.experiments;
+	evaluation->false_positive = (double) false_positives / optimizer->target.experiments;
+	evaluation->packets = num_phases * run_length;
+	evaluation->bytes = evaluation->packets * (experiment->probe_length + SIM_PACKET_OVERHEAD);
+	evaluation->seconds = seconds / optimizer->target.experiments;
+	evaluation->feasible = evaluation->power >= optimizer->target.power &&
+		evaluation->false_positive <= optimizer->target.false_positive;
+	return status;
+}
+
+error_t schedule_optimizer_minimize(struct schedule_optimizer* optimizer, const struct sim_experiment* shape,
+	struct schedule_evaluation* evaluation)
+{
+	struct sim_experiment experiment = *shape;
+	struct schedule_evaluation candidate;
+
+	//Nothing to search if even the longest schedule misses the target
+	experiment.num_packet_trains = optimizer->target.max_trains;
+	error_t status = schedule_optimizer_evaluate(optimizer, &experiment, evaluation);
+	if (status != SUCCESS || !evaluation->feasible)
+		return status;
+
+	int low = 1, high = optimizer->target.max_trains;
+	while (low < high)
+	{
+		experiment.num_packet_trains = low + (high - low) / 2;
+		status = schedule_optimizer_evaluate(optimizer, &experiment, &candidate);
+		if (status != SUCCESS)
+			return status;
+		if (candidate.feasible)
+		{
+			high = experiment.num_packet_trains;
+			*evaluation = candidate;
+		}
+		else
+			low = experiment.num_packet_trains + 1;
+	}
+	return SUCCESS;
+}
+
+double schedule_cost(const struct schedule_evaluation* evaluation, int objective)
+{
+	if (objective == OPTIMIZER_OBJECTIVE_PACKETS)
+		return (double) evaluation->packets;
+	if (objective == OPTIMIZER_OBJECTIVE_SECONDS)
+		return evaluation->seconds;
+	return (double) evaluation->bytes;
+}
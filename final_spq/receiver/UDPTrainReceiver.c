@@ -6,6 +6,36 @@
 ** Receives datagrams from sender of sequenced packets that have a packet id
 ** and will time stamp these packets and store the id and the time stamp
 ** in a file at the end of the experiment
+**
+** Options are read with getopt and go before the positional arguments.
+**
+** Daemon Mode (-d):
+** Keep the probe sockets bound across experiments and capture into
+** preallocated slots, one per sender. An experiment is finalized
+** (written to ./temp/) when its sender has been idle for
+** idle_finalize_time seconds, or on demand with a command on stdin:
+**   finalize [ip]   write and recycle one or all open experiments
+**   status          print the open experiments
+**   quit            finalize everything and exit
+** With early_stop_alpha, a sender on the control channel is told to
+** stop its train once the phase's sequential H versus L test reaches a
+** verdict at that significance level. With -e min_effect_ns, pairs
+** whose L - H delay difference is that small count as ties in the test.
+** With -T offset, the probe header is read at that offset instead of
+** at the start of each probe, for senders using a probe template
+** (probeTemplate.h, unitExperimentSender -T).
+** With -w file.pcapng, the probes are also streamed to a pcapng file by
+** a writer thread (pcapngWriter.h): header-only snippets unless -s gives
+** a snap length (0 for whole probes), both classes unless -k names one.
+** With -z, experiments are written as .rawz archives (captureArchive.h)
+** instead of .raw text. With -S store, they are appended to the result
+** store in that directory (resultStore.h) under an experiment id.
+** The daemon also serves the TCP control channel (controlChannel.h),
+** which lets the sender mark phases and finalize explicitly.
+**
+** Reflector Mode (-r):
+** Echo every probe back to its sender instead of capturing it, for
+** round trip measurements (udpReflector.h, unitExperimentSender -R).
 **************************************************************/
 
 #include <stdio.h>
@@ -23,6 +53,13 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <arpa/inet.h>
+#include <poll.h>
+#include "captureSlot.h"
+#include "controlServer.h"
+#include "probeHeader.h"
+#include "arrivalQueue.h"
+#include "timeUtil.h"
+#include "udpReflector.h"
 
 
 //Set to 0 to turn off debugging and 1
@@ -59,7 +96,338 @@ void handle_shutdown(int sig)
 
 }
 
-error_t UDPTrainReceiver (char* buffer, int probe_packet_length, unsigned long initial_experiment_run_time, 
+/*
+ * Create a non-blocking UDP socket bound to port that records
+ * kernel receive timestamps. Returns -1 on failure.
+ */
+int open_probe_socket(const char* port)
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_PASSIVE;
+	struct addrinfo* my_addr_info;
+
+	if (getaddrinfo(NULL, port, &hints, &my_addr_info) != 0)
+	{
+		fprintf(stderr, "ERROR #%d: Address Information Error\n", ADDRINFO_ERROR);
+		return -1;
+	}
+
+	int sock = socket(my_addr_info->ai_family, my_addr_info->ai_socktype, my_addr_info->ai_protocol);
+	if (sock == -1)
+	{
+		fprintf(stderr, "ERROR #%d: Socket Setup Error\n", SOCKET_SETUP_ERROR);
+		freeaddrinfo(my_addr_info);
+		return -1;
+	}
+	fcntl(sock, F_SETFL, O_NONBLOCK);
+
+	int enable = 1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *)&enable, sizeof(int));
+	setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, (char *)&enable, sizeof(int));
+
+	//The initial burst arrives back to back, give the kernel room to queue it
+	int recv_buffer_size = PROBE_SOCKET_RCVBUF;
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char *)&recv_buffer_size, sizeof(int));
+
+	if (bind(sock, my_addr_info->ai_addr, my_addr_info->ai_addrlen) == -1)
+	{
+		fprintf(stderr, "ERROR #%d: Binding Error\n", BIND_ERROR);
+		close(sock);
+		freeaddrinfo(my_addr_info);
+		return -1;
+	}
+	freeaddrinfo(my_addr_info);
+	return sock;
+}
+
+volatile sig_atomic_t daemon_running = 1;
+
+void handle_daemon_shutdown(int sig)
+{
+	daemon_running = 0;
+}
+
+/*
+ * Finalize every open slot, or only the one from ip_filter if given
+ */
+void finalize_slots(struct capture_slot_pool* pool, const char* ip_filter)
+{
+	int i;
+	for (i = 0; i < NUM_CAPTURE_SLOTS; i++)
+	{
+		struct capture_slot* slot = &pool->slots[i];
+		if (!slot->in_use)
+			continue;
+		if (ip_filter != NULL && *ip_filter != '\0')
+		{
+			char ip_string[INET_ADDRSTRLEN];
+			inet_ntop(AF_INET, &(slot->sender_addr.sin_addr), ip_string, sizeof ip_string);
+			if (strcmp(ip_string, ip_filter) != 0)
+				continue;
+		}
+		capture_slot_finalize(slot, "./temp/", NULL, NULL);
+	}
+}
+
+/*
+ * Handle a single command line read from stdin
+ */
+void handle_daemon_command(struct capture_slot_pool* pool, char* command)
+{
+	command[strcspn(command, "\r\n")] = '\0';
+
+	if (strncmp(command, "finalize", 8) == 0)
+	{
+		char* ip_filter = command + 8;
+		while (*ip_filter == ' ')
+			ip_filter++;
+		finalize_slots(pool, ip_filter);
+	}
+	else if (strcmp(command, "status") == 0)
+	{
+		int i;
+		for (i = 0; i < NUM_CAPTURE_SLOTS; i++)
+		{
+			struct capture_slot* slot = &pool->slots[i];
+			if (!slot->in_use)
+				continue;
+			char ip_string[INET_ADDRSTRLEN];
+			inet_ntop(AF_INET, &(slot->sender_addr.sin_addr), ip_string, sizeof ip_string);
+			printf("%s\tphase %d\t%d probes\n", ip_string, slot->current_phase, slot->num_records);
+
+			//Live metrics of the current phase
+			int class_index;
+			for (class_index = 0; class_index < NUM_TRACKED_CLASSES; class_index++)
+			{
+				unsigned tracker_bit = 1u << (slot->current_phase * NUM_TRACKED_CLASSES + class_index);
+				if (!(slot->trackers_used_mask & tracker_bit))
+					continue;
+				const struct sequence_tracker* tracker =
+					capture_slot_tracker(slot, slot->current_phase, class_index);
+				const struct class_histograms* histograms =
+					capture_slot_histograms(slot, slot->current_phase, class_index);
+				printf("\t%c\treceived %d\tduplicates %d\treordered %d\tjitter_ns %.0f\t"
+					"interarrival_ns p50 %lld p99 %lld\towd_ns p50 %lld p99 %lld\n",
+					class_index == 0 ? 'H' : 'L', tracker->received, tracker->duplicates,
+					tracker->reordered, tracker->jitter_ns,
+					(long long) quantile_histogram_percentile(&histograms->interarrival, 50),
+					(long long) quantile_histogram_percentile(&histograms->interarrival, 99),
+					(long long) quantile_histogram_percentile(&histograms->one_way_delay, 50),
+					(long long) quantile_histogram_percentile(&histograms->one_way_delay, 99));
+			}
+		}
+		fflush(stdout);
+	}
+	else if (strcmp(command, "quit") == 0)
+	{
+		daemon_running = 0;
+	}
+	else if (*command != '\0')
+	{
+		fprintf(stderr, "Unknown command: %s\n", command);
+	}
+}
+
+struct daemon_context
+{
+	struct capture_slot_pool* pool;
+	struct control_server* control;
+	unsigned long phase_gap_time;
+};
+
+/*
+ * Hand one probe, in arrival order, to the slot of its sender
+ */
+void capture_arrival(const struct pending_arrival* arrival, void* context)
+{
+	struct daemon_context* daemon = (struct daemon_context*) context;
+
+	//Streams of the available bandwidth search only feed its trend test
+	if (arrival->header.flags & PROBE_FLAG_RATE_STREAM)
+	{
+		control_server_take_rate_probe(daemon->control, &arrival->from_addr, &arrival->header, arrival->arrival);
+		return;
+	}
+	struct capture_slot* slot = capture_slot_acquire(daemon->pool, &arrival->from_addr, arrival->header.experiment_tag,
+		arrival->arrival);
+	if (slot != NULL)
+		capture_slot_append(slot, &arrival->header, arrival->length, arrival->arrival, daemon->phase_gap_time);
+}
+
+/*
+ * Long running receiver. See the file header for the commands it accepts.
+ */
+error_t UDPTrainReceiverDaemon (unsigned long phase_gap_time, unsigned long idle_finalize_time,
+	double early_stop_alpha, int64_t min_effect_ns, int archive_output, const char* store_path, int header_offset,
+	const struct pcapng_options* pcapng)
+{
+	signal(SIGINT, handle_daemon_shutdown);
+	signal(SIGTERM, handle_daemon_shutdown);
+
+	//High and low priority probes arrive on different ports
+	const char* probe_ports[2] = { UDP_PROBE_PORT_NUMBER_HIGH, UDP_PROBE_PORT_NUMBER_LOW };
+	struct pollfd poll_fds[3 + 2 + MAX_CONTROL_CLIENTS];
+	int num_sockets = 0;
+	int i;
+	for (i = 0; i < 2; i++)
+	{
+		if (i > 0 && strcmp(probe_ports[i], probe_ports[0]) == 0)
+			continue;
+		int sock = open_probe_socket(probe_ports[i]);
+		if (sock == -1)
+			return SOCKET_SETUP_ERROR;
+		poll_fds[num_sockets].fd = sock;
+		poll_fds[num_sockets].events = POLLIN;
+		num_sockets++;
+	}
+	poll_fds[num_sockets].fd = STDIN_FILENO;
+	poll_fds[num_sockets].events = POLLIN;
+
+	struct capture_slot_pool pool;
+	error_t status = capture_slot_pool_init(&pool);
+	if (status != SUCCESS)
+		return status;
+
+	//The verdict is always computed; senders are only stopped early
+	//when a significance level was given
+	pool.sequential_config.alpha = early_stop_alpha > 0 ? early_stop_alpha : SEQUENTIAL_DEFAULT_ALPHA;
+	pool.sequential_config.beta = pool.sequential_config.alpha;
+	pool.sequential_config.effect = SEQUENTIAL_DEFAULT_EFFECT;
+	pool.sequential_config.early_stop = early_stop_alpha > 0;
+	pool.sequential_config.min_effect_ns = min_effect_ns;
+	pool.archive_output = archive_output;
+
+	//The store outlives every slot that points at it
+	static struct result_store store;
+	if (store_path != NULL)
+	{
+		status = result_store_open(&store, store_path);
+		if (status != SUCCESS)
+		{
+			capture_slot_pool_free(&pool);
+			return status;
+		}
+		pool.store = &store;
+	}
+
+	//Without a control channel experiments are still split by silences
+	struct control_server control;
+	control_server_open(&control, "./temp/");
+
+	char command[128];
+	int command_len = 0;
+
+	int probe_sockets[2];
+	for (i = 0; i < num_sockets; i++)
+		probe_sockets[i] = poll_fds[i].fd;
+
+	static struct arrival_queue arrivals;
+	arrivals.header_offset = header_offset;
+
+	//The capture loop only queues probes, the writer thread formats and writes them
+	static struct pcapng_writer capture;
+	if (pcapng->path != NULL)
+	{
+		uint16_t ports[2];
+		int enable = 1;
+		for (i = 0; i < num_sockets; i++)
+		{
+			setsockopt(probe_sockets[i], IPPROTO_IP, IP_PKTINFO, (char *)&enable, sizeof(int));
+			ports[i] = (uint16_t) atoi(probe_ports[i]);
+		}
+		int snap_length = pcapng->snap_length == PCAPNG_SNAP_HEADER ? header_offset + PROBE_HEADER_LENGTH :
+			pcapng->snap_length;
+		status = pcapng_writer_open(&capture, pcapng->path, snap_length, pcapng->class_mask, header_offset,
+			ports, num_sockets);
+		if (status != SUCCESS)
+		{
+			control_server_close(&control);
+			capture_slot_pool_free(&pool);
+			if (pool.store != NULL)
+				result_store_close(pool.store);
+			for (i = 0; i < num_sockets; i++)
+				close(poll_fds[i].fd);
+			return status;
+		}
+		arrivals.capture = &capture;
+		arrivals.snap_length = capture.snap_length;
+	}
+	struct daemon_context daemon = { &pool, &control, phase_gap_time };
+
+	if(VERBOSE) printf("daemon waiting for data...\n");
+
+	while (daemon_running)
+	{
+		int num_control_fds = control_server_fill_pollfds(&control, poll_fds + num_sockets + 1);
+		if (poll(poll_fds, num_sockets + 1 + num_control_fds, 100) < 0 && errno != EINTR)
+			break;
+
+		//Probes of both sockets are merged into arrival order
+		struct timespec watermark = arrival_queue_receive(&arrivals, probe_sockets, num_sockets);
+		arrival_queue_release(&arrivals, watermark, capture_arrival, &daemon);
+
+		if (poll_fds[num_sockets].revents & (POLLIN | POLLHUP))
+		{
+			ssize_t read_bytes = read(STDIN_FILENO, command + command_len, sizeof command - 1 - command_len);
+			if (read_bytes <= 0)
+			{
+				poll_fds[num_sockets].fd = -1;
+			}
+			else
+			{
+				command_len += read_bytes;
+				command[command_len] = '\0';
+
+				//Run every complete line, keep a trailing partial one
+				char* line_start = command;
+				char* line_end;
+				while ((line_end = strchr(line_start, '\n')) != NULL)
+				{
+					*line_end = '\0';
+					handle_daemon_command(&pool, line_start);
+					line_start = line_end + 1;
+				}
+				command_len = strlen(line_start);
+				memmove(command, line_start, command_len + 1);
+				if (command_len == sizeof command - 1)
+					command_len = 0;
+			}
+		}
+
+		control_server_process(&control, poll_fds + num_sockets + 1, num_control_fds, &pool);
+
+		//Finalize experiments whose sender went quiet
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		for (i = 0; i < NUM_CAPTURE_SLOTS; i++)
+		{
+			struct capture_slot* slot = &pool.slots[i];
+			if (slot->in_use &&
+				elapsed_ns(slot->last_arrival, now) >= (int64_t) idle_finalize_time * NSEC_PER_SEC)
+			{
+				capture_slot_finalize(slot, "./temp/", NULL, NULL);
+			}
+		}
+	}
+
+	arrival_queue_release(&arrivals, ns_to_timespec(INT64_MAX), capture_arrival, &daemon);
+	if (arrivals.capture != NULL)
+		pcapng_writer_close(arrivals.capture);
+	finalize_slots(&pool, NULL);
+	control_server_close(&control);
+	capture_slot_pool_free(&pool);
+	if (pool.store != NULL)
+		result_store_close(pool.store);
+	for (i = 0; i < num_sockets; i++)
+		close(poll_fds[i].fd);
+
+	return SUCCESS;
+}
+
+error_t UDPTrainReceiver (char* buffer, unsigned long initial_experiment_run_time, 
 	unsigned long later_experiment_run_time, unsigned long inter_experiment_sleep_time)
 {
 	
@@ -124,8 +492,8 @@ error_t UDPTrainReceiver (char* buffer, int probe_packet_length, unsigned long i
 	//Used to receive packets
 	char temp[100];
 
-	//Used to store the packet before writing to file
-	char packet_buffer[2000];
+	//Used to store the packet before writing to file, whatever its size
+	char packet_buffer[MAX_PACKET_SIZE];
 
 	//Deliminator used to separate experiments in the output file
 	const char delim[4] = "*\n";
@@ -169,11 +537,11 @@ error_t UDPTrainReceiver (char* buffer, int probe_packet_length, unsigned long i
 		//receives
 		if (have_ip_address)
 		{
-			recv_bytes = recvfrom(recv_socket, packet_buffer, probe_packet_length-1, 0, NULL, NULL);
+			recv_bytes = recvfrom(recv_socket, packet_buffer, sizeof packet_buffer, 0, NULL, NULL);
 		}
 		else 
 		{
-			if ((recv_bytes = recvfrom(recv_socket, packet_buffer, probe_packet_length-1, 0, (struct sockaddr*) &from_addr, &from_len))>0)
+			if ((recv_bytes = recvfrom(recv_socket, packet_buffer, sizeof packet_buffer, 0, (struct sockaddr*) &from_addr, &from_len))>0)
 			{
 				have_ip_address = 1;
 			}
@@ -341,17 +709,117 @@ char send_buffer[MAX_SEND_BUFFER_SIZE]; //Hardcoded based on max number of probe
 int main(int argc, char *argv[])
 {
 
-  if(argc != 4){
+  //Options are read with getopt and go before the arguments:
+  //  ./receiver experiment_run_time probe_packet_length inter_experiment_sleep_time
+  //  ./receiver -d [-e min_effect_ns] [-z] [-S store] [-T offset] [-w file.pcapng [-s snap_length] [-k H|L]]
+  //    phase_gap_time idle_finalize_time [early_stop_alpha]
+  //  ./receiver -r
+  int reflector_mode = 0;
+  int daemon_mode = 0;
+  int daemon_options = 0;
+  int archive_output = 0;
+  struct pcapng_options pcapng = { NULL, PCAPNG_SNAP_HEADER, 3 };
+  const char* store_path = NULL;
+  int header_offset = 0;
+  long long min_effect_ns = 0;
+  int valid = 1;
+  int option;
+  while((option = getopt(argc, argv, "rdze:S:T:w:s:k:")) != -1)
+  {
+    daemon_options |= option != 'r' && option != 'd';
+    switch(option)
+    {
+    case 'r':
+      reflector_mode = 1;
+      break;
+    case 'd':
+      daemon_mode = 1;
+      break;
+    case 'z':
+      archive_output = 1;
+      break;
+    case 'S':
+      store_path = optarg;
+      break;
+    case 'w':
+      pcapng.path = optarg;
+      break;
+    case 's':
+      pcapng.snap_length = atoi(optarg);
+      if(pcapng.snap_length < 0 || pcapng.snap_length > MAX_PACKET_SIZE)
+      {
+        fprintf(stderr, "ERROR #%d: -s snap_length is 0 to %d\n", INVALID_NUMBER_OF_ARGUMENTS, MAX_PACKET_SIZE);
+        return INVALID_NUMBER_OF_ARGUMENTS;
+      }
+      break;
+    case 'k':
+      pcapng.class_mask = (strchr(optarg, 'H') != NULL ? 1 : 0) | (strchr(optarg, 'L') != NULL ? 2 : 0);
+      if(pcapng.class_mask == 0)
+      {
+        fprintf(stderr, "ERROR #%d: -k keeps H, L or HL\n", INVALID_NUMBER_OF_ARGUMENTS);
+        return INVALID_NUMBER_OF_ARGUMENTS;
+      }
+      break;
+    case 'e':
+      min_effect_ns = atoll(optarg);
+      if(min_effect_ns < 0)
+      {
+        fprintf(stderr, "ERROR #%d: -e min_effect_ns is 0 or more\n", INVALID_NUMBER_OF_ARGUMENTS);
+        return INVALID_NUMBER_OF_ARGUMENTS;
+      }
+      break;
+    case 'T':
+      header_offset = atoi(optarg);
+      if(header_offset < 0 || header_offset > RECV_SNAP_LENGTH - PROBE_HEADER_LENGTH)
+      {
+        fprintf(stderr, "ERROR #%d: -T offset is 0 to %d\n", INVALID_NUMBER_OF_ARGUMENTS,
+          RECV_SNAP_LENGTH - PROBE_HEADER_LENGTH);
+        return INVALID_NUMBER_OF_ARGUMENTS;
+      }
+      break;
+    default:
+      valid = 0;
+    }
+  }
+  char** arguments = argv + optind;
+  int num_arguments = argc - optind;
+
+  //Reflector mode
+  if(valid && reflector_mode && !daemon_mode && !daemon_options && num_arguments == 0){
+    if(UDPReflector() != SUCCESS)
+    {
+      fprintf(stderr, "ERROR #%d: UDP Train Receiver Error", UDP_TRAIN_RECEIVER_FAILED);
+      return UDP_TRAIN_RECEIVER_FAILED;
+    }
+    return 0;
+  }
+
+  //Daemon mode
+  if(valid && daemon_mode && !reflector_mode && (num_arguments == 2 || num_arguments == 3)){
+    double early_stop_alpha = num_arguments == 3 ? atof(arguments[2]) : 0;
+    if(UDPTrainReceiverDaemon(atoi(arguments[0]), atoi(arguments[1]), early_stop_alpha, (int64_t) min_effect_ns,
+      archive_output, store_path, header_offset, &pcapng) != SUCCESS)
+    {
+      fprintf(stderr, "ERROR #%d: UDP Train Receiver Error", UDP_TRAIN_RECEIVER_FAILED);
+      return UDP_TRAIN_RECEIVER_FAILED;
+    }
+    return 0;
+  }
+
+  if(!valid || reflector_mode || daemon_mode || daemon_options || num_arguments != 3){
     fprintf(stderr,"ERROR #%d: INVALID NUMBER OF ARGUMENTS\n", INVALID_NUMBER_OF_ARGUMENTS);
     fprintf(stderr, "Usage: ./receiver experiment_run_time probe_packet_length inter_experiment_sleep_time\n"); 
+    fprintf(stderr, "       ./receiver -d [-e min_effect_ns] [-z] [-S store] [-T offset] [-w file.pcapng [-s snap_length] [-k H|L]] phase_gap_time idle_finalize_time [early_stop_alpha]\n"); 
+    fprintf(stderr, "       ./receiver -r\n"); 
     return INVALID_NUMBER_OF_ARGUMENTS;
   }
   
-  unsigned long initial_experiment_run_time = atoi(argv[1]);
+  unsigned long initial_experiment_run_time = atoi(arguments[0]);
 
-  int probe_packet_length = atoi(argv[2]);
+  //arguments[1], the probe length, is still accepted but no longer needed:
+  //probes of any size up to MAX_PACKET_SIZE are received whole
 
-  unsigned long inter_experiment_sleep_time = atoi(argv[3]);
+  unsigned long inter_experiment_sleep_time = atoi(arguments[2]);
 
   //int                num_of_packets;  //TODO should be an argument?
 
@@ -363,7 +831,7 @@ int main(int argc, char *argv[])
     send_buffer[i] = 0;
   }
 
-  if(UDPTrainReceiver(send_buffer, probe_packet_length, initial_experiment_run_time,  
+  if(UDPTrainReceiver(send_buffer, initial_experiment_run_time,  
   	later_experiment_run_time, inter_experiment_sleep_time)!= 0)
   {
     fprintf(stderr, "ERROR #%d: UDP Train Receiver Error", UDP_TRAIN_RECEIVER_FAILED);
@@ -0,0 +1,133 @@
+/*************************************************************
+** Arrival Queue
+** See arrivalQueue.h for why probes are reordered here.
+**************************************************************/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "arrivalQueue.h"
+#include "timeUtil.h"
+
+/*
+ * Address a datagram was sent to, from IP_PKTINFO when the socket has it
+ */
+static struct in_addr local_address(struct msghdr* msg)
+{
+	struct in_addr local = { 0 };
+	struct cmsghdr* cmsg;
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
+	{
+		if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO)
+		{
+			struct in_pktinfo info;
+			memcpy(&info, CMSG_DATA(cmsg), sizeof info);
+			return info.ipi_addr;
+		}
+	}
+	return local;
+}
+
+static int compare_arrivals(const void* a, const void* b)
+{
+	int64_t delta = elapsed_ns(((const struct pending_arrival*) b)->arrival,
+		((const struct pending_arrival*) a)->arrival);
+	return delta < 0 ? -1 : (delta > 0 ? 1 : 0);
+}
+
+struct timespec arrival_queue_receive(struct arrival_queue* queue, const int* sockets, int num_sockets)
+{
+	static char snap_buffers[RECV_BATCH_SIZE][MAX_PACKET_SIZE];
+	static char control_buffers[RECV_BATCH_SIZE][CMSG_SPACE(sizeof(struct timespec)) +
+		CMSG_SPACE(sizeof(struct in_pktinfo))];
+	static struct sockaddr_in from_addrs[RECV_BATCH_SIZE];
+	struct iovec iovs[RECV_BATCH_SIZE];
+	struct mmsghdr msgs[RECV_BATCH_SIZE];
+
+	struct timespec watermark = ns_to_timespec(INT64_MAX);
+	struct timespec pass_start;
+	clock_gettime(CLOCK_REALTIME, &pass_start);
+	int snap_length = queue->snap_length > RECV_SNAP_LENGTH ? queue->snap_length : RECV_SNAP_LENGTH;
+	int s, i;
+	for (s = 0; s < num_sockets; s++)
+	{
+		struct timespec socket_watermark;
+		struct timespec last_read = pass_start;
+		while (true)
+		{
+			//Stop short of overflowing. What the socket still holds was stamped
+			//after the last datagram read from it in this pass; when the queue
+			//filled before it could be read, the start of the pass stands in
+			int room = MAX_PENDING_ARRIVALS - queue->count;
+			if (room < RECV_BATCH_SIZE)
+			{
+				socket_watermark = last_read;
+				break;
+			}
+
+			memset(msgs, 0, sizeof msgs);
+			for (i = 0; i < RECV_BATCH_SIZE; i++)
+			{
+				iovs[i].iov_base = snap_buffers[i];
+				iovs[i].iov_len = snap_length;
+				msgs[i].msg_hdr.msg_name = &from_addrs[i];
+				msgs[i].msg_hdr.msg_namelen = sizeof from_addrs[i];
+				msgs[i].msg_hdr.msg_iov = &iovs[i];
+				msgs[i].msg_hdr.msg_iovlen = 1;
+				msgs[i].msg_hdr.msg_control = control_buffers[i];
+				msgs[i].msg_hdr.msg_controllen = sizeof control_buffers[i];
+			}
+
+			//MSG_TRUNC makes msg_len the full datagram length
+			int received = recvmmsg(sockets[s], msgs, RECV_BATCH_SIZE, MSG_DONTWAIT | MSG_TRUNC, NULL);
+			if (received <= 0)
+			{
+				//Anything that reaches this socket from now on is stamped later
+				clock_gettime(CLOCK_REALTIME, &socket_watermark);
+				break;
+			}
+			last_read = kernel_receive_timestamp(&msgs[received - 1].msg_hdr);
+
+			for (i = 0; i < received; i++)
+			{
+				struct pending_arrival* pending = &queue->items[queue->count];
+				int captured = msgs[i].msg_len < (unsigned) snap_length ? (int) msgs[i].msg_len : snap_length;
+				//Cross traffic only loads the path, it is not captured
+				if (!probe_header_read(snap_buffers[i] + queue->header_offset, captured - queue->header_offset,
+					&pending->header) || pending->header.priority == PROBE_CLASS_CROSS)
+					continue;
+				pending->arrival = kernel_receive_timestamp(&msgs[i].msg_hdr);
+				if (queue->capture != NULL)
+					pcapng_writer_capture(queue->capture, s, (const uint8_t*) snap_buffers[i], captured,
+						(int) msgs[i].msg_len, pending->arrival, &from_addrs[i], local_address(&msgs[i].msg_hdr));
+				pending->from_addr = from_addrs[i];
+				pending->length = (int) msgs[i].msg_len;
+				queue->count++;
+			}
+		}
+		if (elapsed_ns(socket_watermark, watermark) > 0)
+			watermark = socket_watermark;
+	}
+
+	qsort(queue->items, queue->count, sizeof(struct pending_arrival), compare_arrivals);
+	return watermark;
+}
+
+void arrival_queue_release(struct arrival_queue* queue, struct timespec watermark,
+	arrival_handler handler, void* context)
+{
+	int released = 0;
+	while (released < queue->count && elapsed_ns(queue->items[released].arrival, watermark) >= 0)
+	{
+		handler(&queue->items[released], context);
+		released++;
+	}
+
+	queue->count -= released;
+	if (released > 0 && queue->count > 0)
+		memmove(queue->items, queue->items + released, queue->count * sizeof(struct pending_arrival));
+}
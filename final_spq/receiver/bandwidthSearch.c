@@ -0,0 +1,148 @@
+/*************************************************************
+** Available Bandwidth Search
+** See bandwidthSearch.h for the trend metrics and the search.
+**************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "bandwidthSearch.h"
+
+//Fleets after which the search stops even if the bracket is still wide
+#define BANDWIDTH_MAX_FLEETS 32
+
+void rate_stream_reset(struct rate_stream* stream, int expected)
+{
+	stream->expected = expected < RATE_STREAM_MAX_PROBES ? expected : RATE_STREAM_MAX_PROBES;
+	stream->received = 0;
+	int i;
+	for (i = 0; i < stream->expected; i++)
+		stream->delay_ns[i] = INT64_MIN;
+}
+
+void rate_stream_add(struct rate_stream* stream, int32_t seq_id, int64_t delay_ns)
+{
+	if (seq_id < 0 || seq_id >= stream->expected || stream->delay_ns[seq_id] != INT64_MIN)
+		return;
+	stream->delay_ns[seq_id] = delay_ns;
+	stream->received++;
+}
+
+static int compare_delays(const void* a, const void* b)
+{
+	int64_t x = *(const int64_t*) a, y = *(const int64_t*) b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+char rate_stream_trend(const struct rate_stream* stream, double* pct, double* pdt)
+{
+	*pct = *pdt = 0;
+	if (stream->expected == 0)
+		return STREAM_GREY;
+	if (stream->expected - stream->received > RATE_STREAM_LOSS_LIMIT * stream->expected)
+		return STREAM_INCREASING;
+
+	//Received delays in sending order
+	int64_t delays[RATE_STREAM_MAX_PROBES];
+	int n = 0, i;
+	for (i = 0; i < stream->expected; i++)
+		if (stream->delay_ns[i] != INT64_MIN)
+			delays[n++] = stream->delay_ns[i];
+
+	int num_groups = (int) sqrt((double) n);
+	if (num_groups < 3)
+		return STREAM_GREY;
+	int group_size = n / num_groups;
+
+	double medians[RATE_STREAM_MAX_PROBES];
+	for (i = 0; i < num_groups; i++)
+	{
+		int64_t* group = delays + i * group_size;
+		qsort(group, group_size, sizeof *group, compare_delays);
+		medians[i] = group_size % 2 ? (double) group[group_size / 2] :
+			0.5 * ((double) group[group_size / 2 - 1] + (double) group[group_size / 2]);
+	}
+
+	int rises = 0;
+	double path = 0;
+	for (i = 1; i < num_groups; i++)
+	{
+		rises += medians[i] > medians[i - 1];
+		path += fabs(medians[i] - medians[i - 1]);
+	}
+	*pct = (double) rises / (num_groups - 1);
+	*pdt = path > 0 ? (medians[num_groups - 1] - medians[0]) / path : 0;
+
+	int pct_trend = *pct > TREND_PCT_INCREASING ? 1 : (*pct < TREND_PCT_FLAT ? -1 : 0);
+	int pdt_trend = *pdt > TREND_PDT_INCREASING ? 1 : (*pdt < TREND_PDT_FLAT ? -1 : 0);
+	if ((pct_trend == 1 && pdt_trend != -1) || (pdt_trend == 1 && pct_trend != -1))
+		return STREAM_INCREASING;
+	if ((pct_trend == -1 && pdt_trend != 1) || (pdt_trend == -1 && pct_trend != 1))
+		return STREAM_FLAT;
+	return STREAM_GREY;
+}
+
+void bandwidth_search_start(struct bandwidth_search* search, double min_bps, double max_bps,
+	double resolution_bps, int fleet_streams)
+{
+	memset(search, 0, sizeof *search);
+	search->low_bps = min_bps;
+	search->high_bps = max_bps;
+	search->resolution_bps = resolution_bps;
+	search->fleet_streams = fleet_streams;
+	search->rate_bps = 0.5 * (min_bps + max_bps);
+}
+
+int bandwidth_search_add(struct bandwidth_search* search, char trend)
+{
+	search->streams_judged++;
+	search->streams_increasing += trend == STREAM_INCREASING;
+	search->streams_flat += trend == STREAM_FLAT;
+	if (search->streams_judged < search->fleet_streams)
+		return 0;
+
+	double rate = search->rate_bps;
+	double fraction_increasing = (double) search->streams_increasing / search->fleet_streams;
+	double fraction_flat = (double) search->streams_flat / search->fleet_streams;
+	if (fraction_increasing > BANDWIDTH_FLEET_FRACTION)
+	{
+		//Above the available bandwidth; a grey region can only lie below it
+		search->high_bps = rate;
+		if (search->grey_high_bps >= rate)
+			search->grey_high_bps = search->grey_low_bps < rate ? search->grey_low_bps : 0;
+	}
+	else if (fraction_flat > BANDWIDTH_FLEET_FRACTION)
+	{
+		search->low_bps = rate;
+		if (search->grey_low_bps <= rate && search->grey_high_bps > 0)
+			search->grey_low_bps = search->grey_high_bps > rate ? search->grey_high_bps : 0;
+	}
+	else
+	{
+		if (search->grey_high_bps == 0 || rate < search->grey_low_bps)
+			search->grey_low_bps = rate;
+		if (rate > search->grey_high_bps)
+			search->grey_high_bps = rate;
+	}
+	if (search->grey_low_bps == 0 || search->grey_high_bps == 0)
+		search->grey_low_bps = search->grey_high_bps = 0;
+
+	search->fleets++;
+	search->streams_judged = search->streams_increasing = search->streams_flat = 0;
+
+	//Bisect the bracket, or the wider gap next to the grey region
+	double below = search->grey_high_bps > 0 ? search->grey_low_bps - search->low_bps :
+		search->high_bps - search->low_bps;
+	double above = search->grey_high_bps > 0 ? search->high_bps - search->grey_high_bps : 0;
+	if ((below <= search->resolution_bps && above <= search->resolution_bps) ||
+		search->fleets >= BANDWIDTH_MAX_FLEETS)
+		search->converged = 1;
+	else if (search->grey_high_bps == 0)
+		search->rate_bps = 0.5 * (search->low_bps + search->high_bps);
+	else if (below >= above)
+		search->rate_bps = 0.5 * (search->low_bps + search->grey_low_bps);
+	else
+		search->rate_bps = 0.5 * (search->grey_high_bps + search->high_bps);
+	return 1;
+}
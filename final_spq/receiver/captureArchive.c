@@ -0,0 +1,551 @@
+/*************************************************************
+** Capture Archive
+** Encoder and block decoder of the .rawz format described in
+** captureArchive.h.
+**************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+
+#include "captureArchive.h"
+
+//Worst case encoded size of a block, header included
+#define ARCHIVE_BLOCK_BOUND (ARCHIVE_BLOCK_HEADER_LENGTH + ARCHIVE_BLOCK_RECORDS * 32 + 16)
+
+static inline uint64_t zigzag_encode(int64_t value)
+{
+	return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t value)
+{
+	return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+static inline uint8_t* put_varint(uint8_t* out, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		*out++ = (uint8_t) (value | 0x80);
+		value >>= 7;
+	}
+	*out++ = (uint8_t) value;
+	return out;
+}
+
+static inline const uint8_t* get_varint(const uint8_t* in, const uint8_t* end, uint64_t* value)
+{
+	uint64_t result = 0;
+	int shift = 0;
+	while (in < end && shift < 64)
+	{
+		uint8_t byte = *in++;
+		result |= (uint64_t) (byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+		{
+			*value = result;
+			return in;
+		}
+		shift += 7;
+	}
+	return NULL;
+}
+
+/*
+ * Most significant bit first, through a 64 bit accumulator
+ */
+struct bit_writer
+{
+	uint8_t* out;
+	uint64_t accumulator;
+	int bits;
+};
+
+static inline void put_bits(struct bit_writer* writer, uint64_t value, int num_bits)
+{
+	if (num_bits > 32)
+	{
+		put_bits(writer, value >> 32, num_bits - 32);
+		value &= 0xffffffffu;
+		num_bits = 32;
+	}
+	writer->accumulator = (writer->accumulator << num_bits) | (value & ((1ull << num_bits) - 1));
+	writer->bits += num_bits;
+	while (writer->bits >= 8)
+	{
+		writer->bits -= 8;
+		*writer->out++ = (uint8_t) (writer->accumulator >> writer->bits);
+	}
+}
+
+static inline void flush_bits(struct bit_writer* writer)
+{
+	if (writer->bits > 0)
+		*writer->out++ = (uint8_t) (writer->accumulator << (8 - writer->bits));
+	writer->bits = 0;
+}
+
+struct bit_reader
+{
+	const uint8_t* data;
+	size_t length;
+	size_t bit_position;
+};
+
+/*
+ * The next 64 bits of the stream, most significant first. At least 57
+ * of them are real; past the end of the stream zeros are read, and the
+ * record count keeps a decoder from ever relying on them.
+ */
+static inline uint64_t peek_bits(const struct bit_reader* reader)
+{
+	size_t byte = reader->bit_position >> 3;
+	uint64_t word;
+	if (byte + 8 <= reader->length)
+	{
+		memcpy(&word, reader->data + byte, 8);
+		word = be64toh(word);
+	}
+	else
+	{
+		int i;
+		word = 0;
+		for (i = 0; i < 8; i++)
+			word = (word << 8) | (byte + i < reader->length ? reader->data[byte + i] : 0);
+	}
+	return word << (reader->bit_position & 7);
+}
+
+static inline void put_dod(struct bit_writer* writer, int64_t dod)
+{
+	uint64_t value = zigzag_encode(dod);
+	if (dod == 0)
+		put_bits(writer, 0x0, 1);
+	else if (value < (1ull << 8))
+	{
+		put_bits(writer, 0x2, 2);
+		put_bits(writer, value, 8);
+	}
+	else if (value < (1ull << 14))
+	{
+		put_bits(writer, 0x6, 3);
+		put_bits(writer, value, 14);
+	}
+	else if (value < (1ull << 20))
+	{
+		put_bits(writer, 0xe, 4);
+		put_bits(writer, value, 20);
+	}
+	else if (value < (1ull << 32))
+	{
+		put_bits(writer, 0x1e, 5);
+		put_bits(writer, value, 32);
+	}
+	else
+	{
+		put_bits(writer, 0x1f, 5);
+		put_bits(writer, value >> 32, 32);
+		put_bits(writer, value & 0xffffffffu, 32);
+	}
+}
+
+static inline int64_t get_dod(struct bit_reader* reader)
+{
+	static const int value_bits[5] = { 8, 14, 20, 32, 64 };
+	uint64_t word = peek_bits(reader);
+
+	//The prefix is a run of up to five ones, ended by a zero below five
+	int ones = (word >> 59) == 0x1f ? 5 : __builtin_clzll(~word);
+	if (ones == 0)
+	{
+		reader->bit_position++;
+		return 0;
+	}
+	int prefix_bits = ones < 5 ? ones + 1 : 5;
+	int num_bits = value_bits[ones - 1];
+	uint64_t value;
+	if (num_bits < 64)
+	{
+		value = (word << prefix_bits) >> (64 - num_bits);
+		reader->bit_position += prefix_bits + num_bits;
+	}
+	else
+	{
+		reader->bit_position += prefix_bits;
+		value = peek_bits(reader) >> 32 << 32;
+		reader->bit_position += 32;
+		value |= peek_bits(reader) >> 32;
+		reader->bit_position += 32;
+	}
+	return zigzag_decode(value);
+}
+
+error_t archive_writer_open(struct archive_writer* writer, const char* file_name, int64_t start_time_ns)
+{
+	memset(writer, 0, sizeof *writer);
+	writer->records = (struct archive_record*) malloc(ARCHIVE_BLOCK_RECORDS * sizeof(struct archive_record));
+	writer->scratch = (uint8_t*) malloc(ARCHIVE_BLOCK_BOUND);
+	if (writer->records == NULL || writer->scratch == NULL)
+	{
+		free(writer->records);
+		free(writer->scratch);
+		return FAILURE;
+	}
+
+	writer->file = fopen(file_name, "w");
+	if (writer->file == NULL)
+	{
+		fprintf(stderr, "ERROR #%d: File Open Failed\n", FILE_ERROR);
+		free(writer->records);
+		free(writer->scratch);
+		return FILE_ERROR;
+	}
+
+	uint8_t header[ARCHIVE_HEADER_LENGTH];
+	uint32_t version = ARCHIVE_VERSION;
+	memcpy(header, ARCHIVE_MAGIC, 4);
+	memcpy(header + 4, &version, 4);
+	memcpy(header + 8, &start_time_ns, 8);
+	fwrite(header, 1, sizeof header, writer->file);
+	return SUCCESS;
+}
+
+/*
+ * Encode the buffered records as one block and write it out
+ */
+static void write_block(struct archive_writer* writer)
+{
+	int n = writer->num_records;
+	if (n == 0)
+		return;
+	const struct archive_record* records = writer->records;
+	uint8_t* block = writer->scratch;
+
+	//Runs of classes
+	uint8_t* classes = block + ARCHIVE_BLOCK_HEADER_LENGTH;
+	uint8_t* out = classes;
+	int i = 0;
+	while (i < n)
+	{
+		int run = 1;
+		while (i + run < n && records[i + run].priority == records[i].priority)
+			run++;
+		*out++ = (uint8_t) records[i].priority;
+		out = put_varint(out, (uint64_t) run);
+		i += run;
+	}
+	uint32_t class_bytes = (uint32_t) (out - classes);
+
+	//Sequence ids that are not their class's previous + 1. The count
+	//goes first, so the misses are gathered before they are written.
+	uint8_t* exceptions = out;
+	int32_t next_seq[256];
+	for (i = 0; i < 256; i++)
+		next_seq[i] = 0;
+	int num_exceptions = 0;
+	for (i = 0; i < n; i++)
+	{
+		uint8_t class_byte = (uint8_t) records[i].priority;
+		num_exceptions += records[i].seq_id != next_seq[class_byte];
+		next_seq[class_byte] = records[i].seq_id + 1;
+	}
+	out = put_varint(out, (uint64_t) num_exceptions);
+	for (i = 0; i < 256; i++)
+		next_seq[i] = 0;
+	int last_exception = 0;
+	for (i = 0; i < n; i++)
+	{
+		uint8_t class_byte = (uint8_t) records[i].priority;
+		if (records[i].seq_id != next_seq[class_byte])
+		{
+			out = put_varint(out, (uint64_t) (i - last_exception));
+			out = put_varint(out, zigzag_encode((int64_t) records[i].seq_id - next_seq[class_byte]));
+			last_exception = i;
+		}
+		next_seq[class_byte] = records[i].seq_id + 1;
+	}
+	uint32_t exception_bytes = (uint32_t) (out - exceptions);
+
+	//Arrivals: the first and the first delta go in the header
+	uint8_t* timestamps = out;
+	struct bit_writer bits = { out, 0, 0 };
+	int64_t first_delta = n > 1 ? records[1].arrival_ns - records[0].arrival_ns : 0;
+	int64_t previous_delta = first_delta;
+	for (i = 2; i < n; i++)
+	{
+		int64_t delta = records[i].arrival_ns - records[i - 1].arrival_ns;
+		put_dod(&bits, delta - previous_delta);
+		previous_delta = delta;
+	}
+	flush_bits(&bits);
+	uint32_t timestamp_bytes = (uint32_t) (bits.out - timestamps);
+
+	uint32_t num_records = (uint32_t) n;
+	uint16_t phase = (uint16_t) writer->phase;
+	uint16_t reserved = 0;
+	memcpy(block, &num_records, 4);
+	memcpy(block + 4, &class_bytes, 4);
+	memcpy(block + 8, &exception_bytes, 4);
+	memcpy(block + 12, &timestamp_bytes, 4);
+	memcpy(block + 16, &records[0].arrival_ns, 8);
+	memcpy(block + 24, &first_delta, 8);
+	memcpy(block + 32, &phase, 2);
+	memcpy(block + 34, &reserved, 2);
+
+	fwrite(block, 1, bits.out - block, writer->file);
+	writer->num_records = 0;
+}
+
+error_t archive_writer_append(struct archive_writer* writer, int phase, int32_t seq_id, char priority,
+	int64_t arrival_ns)
+{
+	if (writer->num_records == ARCHIVE_BLOCK_RECORDS || (writer->num_records > 0 && phase != writer->phase))
+		write_block(writer);
+
+	writer->phase = phase;
+	struct archive_record* record = &writer->records[writer->num_records++];
+	record->seq_id = seq_id;
+	record->priority = priority;
+	record->arrival_ns = arrival_ns;
+	return SUCCESS;
+}
+
+error_t archive_writer_close(struct archive_writer* writer)
+{
+	write_block(writer);
+	error_t result = ferror(writer->file) ? FWRITE_ERROR : SUCCESS;
+	if (fclose(writer->file) != 0)
+		result = FWRITE_ERROR;
+	free(writer->records);
+	free(writer->scratch);
+	writer->records = NULL;
+	writer->scratch = NULL;
+	return result;
+}
+
+int archive_is_archive(const void* data, size_t size)
+{
+	return size >= ARCHIVE_HEADER_LENGTH && memcmp(data, ARCHIVE_MAGIC, 4) == 0;
+}
+
+error_t archive_reader_init(struct archive_reader* reader, const void* data, size_t size)
+{
+	uint32_t version;
+	if (!archive_is_archive(data, size))
+		return DECOMPRESSION_ERROR;
+	memcpy(&version, (const uint8_t*) data + 4, 4);
+	if (version != ARCHIVE_VERSION)
+		return DECOMPRESSION_ERROR;
+
+	reader->data = (const uint8_t*) data;
+	reader->size = size;
+	reader->offset = ARCHIVE_HEADER_LENGTH;
+	memcpy(&reader->start_time_ns, reader->data + 8, 8);
+	return SUCCESS;
+}
+
+int archive_reader_next(struct archive_reader* reader, struct archive_block* block)
+{
+	if (reader->offset == reader->size)
+		return 0;
+	if (reader->size - reader->offset < ARCHIVE_BLOCK_HEADER_LENGTH)
+		return -1;
+
+	const uint8_t* header = reader->data + reader->offset;
+	uint32_t num_records, class_bytes, exception_bytes, timestamp_bytes;
+	int64_t first_arrival, first_delta;
+	uint16_t phase;
+	memcpy(&num_records, header, 4);
+	memcpy(&class_bytes, header + 4, 4);
+	memcpy(&exception_bytes, header + 8, 4);
+	memcpy(&timestamp_bytes, header + 12, 4);
+	memcpy(&first_arrival, header + 16, 8);
+	memcpy(&first_delta, header + 24, 8);
+	memcpy(&phase, header + 32, 2);
+
+	size_t body_bytes = (size_t) class_bytes + exception_bytes + timestamp_bytes;
+	if (num_records == 0 || num_records > ARCHIVE_BLOCK_RECORDS ||
+		reader->size - reader->offset - ARCHIVE_BLOCK_HEADER_LENGTH < body_bytes)
+		return -1;
+	const uint8_t* classes = header + ARCHIVE_BLOCK_HEADER_LENGTH;
+	const uint8_t* exceptions = classes + class_bytes;
+	const uint8_t* timestamps = exceptions + exception_bytes;
+	int n = (int) num_records;
+	block->phase = phase;
+	block->num_records = n;
+
+	//Classes
+	const uint8_t* in = classes;
+	int i = 0;
+	while (i < n)
+	{
+		uint64_t run;
+		if (in >= exceptions)
+			return -1;
+		char priority = (char) *in++;
+		in = get_varint(in, exceptions, &run);
+		if (in == NULL || run == 0 || run > (uint64_t) (n - i))
+			return -1;
+		memset(block->priority + i, priority, run);
+		i += (int) run;
+	}
+
+	//Sequence ids: predictions, corrected at the exceptions
+	uint64_t num_exceptions, value;
+	in = get_varint(exceptions, timestamps, &num_exceptions);
+	if (in == NULL)
+		return -1;
+	int next_exception = -1;
+	if (num_exceptions > 0)
+	{
+		in = get_varint(in, timestamps, &value);
+		if (in == NULL)
+			return -1;
+		next_exception = (int) value;
+	}
+	int32_t next_seq[256];
+	for (i = 0; i < 256; i++)
+		next_seq[i] = 0;
+	for (i = 0; i < n; i++)
+	{
+		uint8_t class_byte = (uint8_t) block->priority[i];
+		int32_t seq_id = next_seq[class_byte];
+		if (i == next_exception)
+		{
+			in = get_varint(in, timestamps, &value);
+			if (in == NULL)
+				return -1;
+			seq_id += (int32_t) zigzag_decode(value);
+			next_exception = -1;
+			if (--num_exceptions > 0)
+			{
+				in = get_varint(in, timestamps, &value);
+				if (in == NULL)
+					return -1;
+				next_exception = i + (int) value;
+			}
+		}
+		block->seq_id[i] = seq_id;
+		next_seq[class_byte] = seq_id + 1;
+	}
+
+	//Arrivals
+	struct bit_reader bits = { timestamps, timestamp_bytes, 0 };
+	block->arrival_ns[0] = first_arrival;
+	if (n > 1)
+		block->arrival_ns[1] = first_arrival + first_delta;
+	int64_t delta = first_delta;
+	for (i = 2; i < n; i++)
+	{
+		delta += get_dod(&bits);
+		block->arrival_ns[i] = block->arrival_ns[i - 1] + delta;
+	}
+
+	reader->offset += ARCHIVE_BLOCK_HEADER_LENGTH + body_bytes;
+	return 1;
+}
+
+static char* format_decimal(char* out, int64_t value)
+{
+	char digits[24];
+	int num_digits = 0;
+	uint64_t magnitude = value < 0 ? -(uint64_t) value : (uint64_t) value;
+	if (value < 0)
+		*out++ = '-';
+	do
+	{
+		digits[num_digits++] = (char) ('0' + magnitude % 10);
+		magnitude /= 10;
+	} while (magnitude > 0);
+	while (num_digits > 0)
+		*out++ = digits[--num_digits];
+	return out;
+}
+
+/*
+ * Append "<sec>.<9 digit nsec>" of a non negative time in ns
+ */
+static char* format_arrival(char* out, int64_t ns)
+{
+	int64_t nanoseconds = ns % 1000000000;
+	out = format_decimal(out, ns / 1000000000);
+	*out++ = '.';
+	int i;
+	for (i = 8; i >= 0; i--)
+	{
+		out[i] = (char) ('0' + nanoseconds % 10);
+		nanoseconds /= 10;
+	}
+	return out + 9;
+}
+
+error_t archive_decode_text(const void* data, size_t size, char** text, size_t* text_length)
+{
+	struct archive_reader reader;
+	error_t status = archive_reader_init(&reader, data, size);
+	if (status != SUCCESS)
+		return status;
+
+	struct archive_block* block = (struct archive_block*) malloc(sizeof *block);
+	size_t capacity = size * 4 + 4096;
+	char* buffer = (char*) malloc(capacity);
+	if (block == NULL || buffer == NULL)
+	{
+		free(block);
+		free(buffer);
+		return FAILURE;
+	}
+
+	//Longest line: 11 digit id, class, 20 digit seconds, 9 digit ns
+	const size_t max_line = 48;
+	size_t length = 0;
+	int phase = 0;
+	int next;
+	while ((next = archive_reader_next(&reader, block)) == 1)
+	{
+		size_t needed = length + (size_t) (block->phase - phase) * 2 + (size_t) block->num_records * max_line;
+		if (needed > capacity)
+		{
+			capacity = needed * 2;
+			char* grown = (char*) realloc(buffer, capacity);
+			if (grown == NULL)
+			{
+				free(block);
+				free(buffer);
+				return FAILURE;
+			}
+			buffer = grown;
+		}
+
+		char* out = buffer + length;
+		while (phase < block->phase)
+		{
+			*out++ = '*';
+			*out++ = '\n';
+			phase++;
+		}
+		int i;
+		for (i = 0; i < block->num_records; i++)
+		{
+			int64_t arrival = block->arrival_ns[i] - reader.start_time_ns;
+			out = format_decimal(out, block->seq_id[i]);
+			*out++ = '\t';
+			*out++ = block->priority[i];
+			*out++ = '\t';
+			out = format_arrival(out, arrival > 0 ? arrival : 0);
+			*out++ = '\n';
+		}
+		length = (size_t) (out - buffer);
+	}
+	free(block);
+
+	if (next < 0)
+	{
+		free(buffer);
+		return DECOMPRESSION_ERROR;
+	}
+	*text = buffer;
+	*text_length = length;
+	return SUCCESS;
+}
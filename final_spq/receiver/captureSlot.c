@@ -0,0 +1,894 @@
+/*************************************************************
+** Capture Slot Pool
+** Preallocated storage for the probes of concurrent experiments.
+** All slot memory is allocated once by capture_slot_pool_init;
+** acquiring and finalizing a slot only resets its counters.
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "captureSlot.h"
+#include "timeUtil.h"
+#include "captureArchive.h"
+
+error_t capture_slot_pool_init(struct capture_slot_pool* pool)
+{
+	memset(pool, 0, sizeof *pool);
+
+	//One allocation for all slots. calloc hands back zeroed pages
+	//without touching every byte up front.
+	pool->record_storage = (struct capture_record*) calloc(
+		(size_t) NUM_CAPTURE_SLOTS * MAX_SLOT_RECORDS, sizeof(struct capture_record));
+	if (pool->record_storage == NULL)
+	{
+		fprintf(stderr, "ERROR #%d: Capture Slot Allocation Failed\n", SLOT_ALLOCATION_ERROR);
+		return SLOT_ALLOCATION_ERROR;
+	}
+
+	pool->tracker_storage = (struct sequence_tracker*) calloc(
+		(size_t) NUM_CAPTURE_SLOTS * MAX_SLOT_PHASES * NUM_TRACKED_CLASSES, sizeof(struct sequence_tracker));
+	if (pool->tracker_storage == NULL)
+	{
+		free(pool->record_storage);
+		fprintf(stderr, "ERROR #%d: Capture Slot Allocation Failed\n", SLOT_ALLOCATION_ERROR);
+		return SLOT_ALLOCATION_ERROR;
+	}
+
+	pool->histogram_storage = (struct class_histograms*) calloc(
+		(size_t) NUM_CAPTURE_SLOTS * MAX_SLOT_PHASES * NUM_TRACKED_CLASSES, sizeof(struct class_histograms));
+	if (pool->histogram_storage == NULL)
+	{
+		free(pool->record_storage);
+		free(pool->tracker_storage);
+		fprintf(stderr, "ERROR #%d: Capture Slot Allocation Failed\n", SLOT_ALLOCATION_ERROR);
+		return SLOT_ALLOCATION_ERROR;
+	}
+
+	pool->layout_storage = (struct train_layout*) calloc(
+		(size_t) NUM_CAPTURE_SLOTS * (MAX_SLOT_PHASES + 1), sizeof(struct train_layout));
+	if (pool->layout_storage == NULL)
+	{
+		free(pool->record_storage);
+		free(pool->tracker_storage);
+		free(pool->histogram_storage);
+		fprintf(stderr, "ERROR #%d: Capture Slot Allocation Failed\n", SLOT_ALLOCATION_ERROR);
+		return SLOT_ALLOCATION_ERROR;
+	}
+
+	int i;
+	for (i = 0; i < NUM_CAPTURE_SLOTS; i++)
+	{
+		size_t first_metric = (size_t) i * MAX_SLOT_PHASES * NUM_TRACKED_CLASSES;
+		pool->slots[i].records = pool->record_storage + (size_t) i * MAX_SLOT_RECORDS;
+		pool->slots[i].trackers = pool->tracker_storage + first_metric;
+		pool->slots[i].histograms = pool->histogram_storage + first_metric;
+		pool->slots[i].layouts = pool->layout_storage + (size_t) i * (MAX_SLOT_PHASES + 1);
+	}
+	return SUCCESS;
+}
+
+void capture_slot_pool_free(struct capture_slot_pool* pool)
+{
+	free(pool->record_storage);
+	free(pool->tracker_storage);
+	free(pool->histogram_storage);
+	free(pool->layout_storage);
+	pool->record_storage = NULL;
+	pool->tracker_storage = NULL;
+	pool->histogram_storage = NULL;
+	pool->layout_storage = NULL;
+}
+
+struct capture_slot* capture_slot_find(struct capture_slot_pool* pool,
+	const struct sockaddr_in* sender_addr, uint16_t experiment_tag)
+{
+	int i;
+	for (i = 0; i < NUM_CAPTURE_SLOTS; i++)
+	{
+		struct capture_slot* slot = &pool->slots[i];
+		if (slot->in_use && slot->sender_addr.sin_addr.s_addr == sender_addr->sin_addr.s_addr &&
+			slot->experiment_tag == experiment_tag)
+			return slot;
+	}
+	return NULL;
+}
+
+struct capture_slot* capture_slot_acquire(struct capture_slot_pool* pool,
+	const struct sockaddr_in* sender_addr, uint16_t experiment_tag, struct timespec now)
+{
+	struct capture_slot* free_slot = NULL;
+	int i;
+	for (i = 0; i < NUM_CAPTURE_SLOTS; i++)
+	{
+		struct capture_slot* slot = &pool->slots[i];
+		if (slot->in_use)
+		{
+			if (slot->sender_addr.sin_addr.s_addr == sender_addr->sin_addr.s_addr &&
+				slot->experiment_tag == experiment_tag)
+				return slot;
+		}
+		else if (free_slot == NULL)
+		{
+			free_slot = slot;
+		}
+	}
+
+	if (free_slot == NULL)
+		return NULL;
+
+	free_slot->in_use = 1;
+	free_slot->sender_addr = *sender_addr;
+	free_slot->experiment_tag = experiment_tag;
+	free_slot->start_time = now;
+	free_slot->last_arrival = now;
+	free_slot->start_wall_time = time(NULL);
+	free_slot->current_phase = 0;
+	free_slot->phase_records = 0;
+	free_slot->explicit_phases = 0;
+	free_slot->have_params = 0;
+	free_slot->phase_params_mask = 0;
+	free_slot->trackers_used_mask = 0;
+	memset(free_slot->clock_sync_count, 0, sizeof free_slot->clock_sync_count);
+	free_slot->sequential_config = pool->sequential_config;
+	free_slot->archive_output = pool->archive_output;
+	free_slot->store = pool->store;
+	free_slot->num_records = 0;
+	free_slot->num_overflowed = 0;
+	return free_slot;
+}
+
+void capture_slot_append(struct capture_slot* slot, const struct probe_header* header, int length,
+	struct timespec arrival, unsigned long phase_gap_time)
+{
+	//A long silence means the sender script moved on to the next run
+	if (!slot->explicit_phases && slot->num_records > 0 && slot->current_phase < MAX_SLOT_PHASES - 1 &&
+		elapsed_ns(slot->last_arrival, arrival) >= (int64_t) phase_gap_time * NSEC_PER_SEC)
+	{
+		slot->current_phase++;
+		slot->phase_records = 0;
+	}
+	slot->last_arrival = arrival;
+	slot->phase_records++;
+
+	int class_index = tracked_class_index(header->priority);
+	if (class_index >= 0)
+	{
+		//First probe of the phase starts its sequential test. Pairs are
+		//formed around the single probe of each train, the run's priority.
+		unsigned phase_bits = ((1u << NUM_TRACKED_CLASSES) - 1) << (slot->current_phase * NUM_TRACKED_CLASSES);
+		if (!(slot->trackers_used_mask & phase_bits))
+		{
+			int pair_class = 1;
+			if (slot->phase_params_mask & (1u << slot->current_phase))
+				pair_class = tracked_class_index(slot->phase_params[slot->current_phase].priority);
+			sequential_test_reset(&slot->sequential[slot->current_phase], &slot->sequential_config,
+				pair_class < 0 ? 1 : pair_class);
+		}
+
+		unsigned tracker_bit = 1u << (slot->current_phase * NUM_TRACKED_CLASSES + class_index);
+		struct sequence_tracker* tracker = capture_slot_tracker(slot, slot->current_phase, class_index);
+		struct class_histograms* histograms = capture_slot_histograms(slot, slot->current_phase, class_index);
+		if (!(slot->trackers_used_mask & tracker_bit))
+		{
+			sequence_tracker_reset(tracker);
+			histograms->have_previous = 0;
+			quantile_histogram_reset(&histograms->interarrival);
+			quantile_histogram_reset(&histograms->one_way_delay);
+			slot->trackers_used_mask |= tracker_bit;
+		}
+
+		int64_t rx_ns = timespec_to_ns(arrival);
+		int have_tx = header->flags & PROBE_FLAG_TX_TIMESTAMP;
+		sequence_tracker_update(tracker, header->seq_id, rx_ns, have_tx, header->tx_time_ns);
+
+		if (histograms->have_previous)
+			quantile_histogram_record(&histograms->interarrival, rx_ns - histograms->previous_rx_ns);
+		histograms->have_previous = 1;
+		histograms->previous_rx_ns = rx_ns;
+		if (have_tx)
+		{
+			int64_t delay_ns = rx_ns - header->tx_time_ns;
+			quantile_histogram_record(&histograms->one_way_delay, delay_ns);
+			sequential_test_observe(&slot->sequential[slot->current_phase], class_index, delay_ns);
+		}
+	}
+
+	if (slot->num_records >= MAX_SLOT_RECORDS)
+	{
+		slot->num_overflowed++;
+		return;
+	}
+
+	struct capture_record* record = &slot->records[slot->num_records++];
+	record->seq_id = header->seq_id;
+	record->priority = header->priority;
+	record->phase = (uint8_t) slot->current_phase;
+	record->length = (uint16_t) (length < UINT16_MAX ? length : UINT16_MAX);
+	record->arrival = arrival;
+	record->tx_time_ns = header->tx_time_ns;
+}
+
+void capture_slot_begin_phase(struct capture_slot* slot)
+{
+	if ((slot->explicit_phases || slot->num_records > 0) && slot->current_phase < MAX_SLOT_PHASES - 1)
+	{
+		slot->current_phase++;
+	}
+	slot->explicit_phases = 1;
+	slot->phase_records = 0;
+
+	if (slot->have_params)
+	{
+		slot->phase_params[slot->current_phase] = slot->params;
+		slot->phase_params_mask |= 1u << slot->current_phase;
+		if (slot->params.have_layout)
+			slot->layouts[slot->current_phase] = *capture_slot_next_layout(slot);
+	}
+}
+
+void capture_slot_add_clock_sync(struct capture_slot* slot, const struct clock_sync_sample* sample)
+{
+	int* count = &slot->clock_sync_count[slot->current_phase];
+	slot->clock_sync[slot->current_phase][*count > 0 ? 1 : 0] = *sample;
+	if (*count < 2)
+		(*count)++;
+}
+
+/*
+ * Offset sample the delays of phase are corrected with: the least
+ * delayed of the reports, or NULL if the sender sent none
+ */
+static const struct clock_sync_sample* phase_clock_sync(const struct capture_slot* slot, int phase)
+{
+	int count = slot->clock_sync_count[phase];
+	if (count == 0)
+		return NULL;
+	const struct clock_sync_sample* best = &slot->clock_sync[phase][0];
+	if (count == 2 && slot->clock_sync[phase][1].delay_ns < best->delay_ns)
+		best = &slot->clock_sync[phase][1];
+	return best;
+}
+
+/*
+ * Fit the clock skew of every phase to the probes that carry a sender
+ * timestamp. Phases without enough of them keep num_points below 2.
+ */
+static void fit_phase_clocks(const struct capture_slot* slot, struct clock_fit* fits)
+{
+	struct delay_point* points = (struct delay_point*) malloc(
+		(slot->num_records > 0 ? slot->num_records : 1) * sizeof(struct delay_point));
+	int phase, i;
+	for (phase = 0; phase <= slot->current_phase; phase++)
+	{
+		int num_points = 0;
+		for (i = 0; points != NULL && i < slot->num_records; i++)
+		{
+			const struct capture_record* record = &slot->records[i];
+			if (record->phase != phase || record->tx_time_ns == 0)
+				continue;
+			points[num_points].tx_ns = record->tx_time_ns;
+			points[num_points].owd_ns = timespec_to_ns(record->arrival) - record->tx_time_ns;
+			num_points++;
+		}
+		if (!clock_skew_fit(points, num_points, &fits[phase]))
+			fits[phase].num_points = 0;
+	}
+	free(points);
+}
+
+/*
+ * Write the one-way delay of every timestamped probe, raw and with the
+ * clock skew (and offset, when known) of its phase removed
+ */
+static error_t write_slot_delays(const struct capture_slot* slot, const struct clock_fit* fits,
+	const char* file_name)
+{
+	FILE* file = fopen(file_name, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "ERROR #%d: File Open Failed\n", FILE_ERROR);
+		return FILE_ERROR;
+	}
+
+	fprintf(file, "#phase\tseq\tclass\towd_ns\tcorrected_owd_ns\tlength\n");
+	int i;
+	for (i = 0; i < slot->num_records; i++)
+	{
+		const struct capture_record* record = &slot->records[i];
+		if (record->tx_time_ns == 0 || fits[record->phase].num_points < 2)
+			continue;
+		int64_t owd_ns = timespec_to_ns(record->arrival) - record->tx_time_ns;
+		fprintf(file, "%d\t%d\t%c\t%lld\t%.0f\t%d\n", record->phase, record->seq_id, record->priority,
+			(long long) owd_ns, clock_corrected_delay(&fits[record->phase],
+			phase_clock_sync(slot, record->phase), record->tx_time_ns, owd_ns), record->length);
+	}
+
+	error_t result = ferror(file) ? FWRITE_ERROR : SUCCESS;
+	fclose(file);
+	return result;
+}
+
+/*
+ * Probes of class_index the sender sends in one run: those of the
+ * announced layout, or without one those of the classic schedule of
+ * UDPTrainGenerator, an initial train of 'H' probes, then
+ * num_packet_trains trains of one probe of the run's priority followed
+ * by seperation_train_length probes of the other class.
+ */
+static int expected_probes(const struct experiment_params* params, const struct train_layout* layout,
+	int class_index)
+{
+	if (layout != NULL)
+		return layout->class_counts[class_index];
+	int singles = params->num_packet_trains;
+	int runs = params->num_packet_trains * params->seperation_train_length;
+	if (class_index == 0)
+		return params->initial_train_length + (params->priority == 'L' ? runs : singles);
+	return params->priority == 'L' ? singles : runs;
+}
+
+/*
+ * Trains of a run, not counting train 0
+ */
+static int num_trains(const struct experiment_params* params, const struct train_layout* layout)
+{
+	return layout != NULL ? layout->num_trains : params->num_packet_trains;
+}
+
+/*
+ * Train a probe belongs to in the layout or the schedule above, -1 if
+ * the layout has no runs for its class. Train 0 is the initial train
+ * (probes outside the repeated groups of a pattern), trains
+ * 1..num_trains follow it.
+ */
+static int train_of_probe(const struct experiment_params* params, const struct train_layout* layout,
+	int class_index, int seq_id)
+{
+	if (layout != NULL)
+	{
+		//Last run that starts at or before seq_id
+		int low = 0, high = layout->num_runs[class_index];
+		if (high == 0 || seq_id < layout->run_first_seq[class_index][0])
+			return -1;
+		while (high - low > 1)
+		{
+			int middle = (low + high) / 2;
+			if (layout->run_first_seq[class_index][middle] <= seq_id)
+				low = middle;
+			else
+				high = middle;
+		}
+		return layout->run_train[class_index][low];
+	}
+	int seperation = params->seperation_train_length > 0 ? params->seperation_train_length : 1;
+	if (class_index == 0)
+	{
+		if (seq_id < params->initial_train_length)
+			return 0;
+		seq_id -= params->initial_train_length;
+		return 1 + (params->priority == 'L' ? seq_id / seperation : seq_id);
+	}
+	return 1 + (params->priority == 'L' ? seq_id : seq_id / seperation);
+}
+
+static void write_histogram_percentiles(FILE* file, int phase, char class_name, const char* metric,
+	const struct quantile_histogram* histogram)
+{
+	if (histogram->count == 0)
+		return;
+	fprintf(file, "percentiles\t%d\t%c\t%s\t%llu\t%lld\t%.0f\t%lld\t%lld\t%lld\t%lld\t%lld\n",
+		phase, class_name, metric, (unsigned long long) histogram->count, (long long) histogram->min,
+		histogram->sum / histogram->count,
+		(long long) quantile_histogram_percentile(histogram, 50),
+		(long long) quantile_histogram_percentile(histogram, 90),
+		(long long) quantile_histogram_percentile(histogram, 99),
+		(long long) quantile_histogram_percentile(histogram, 99.9),
+		(long long) histogram->max);
+}
+
+struct size_sample
+{
+	//Phase, class and size bucket, in the order they are written
+	int key;
+	int timed;
+	int64_t delay_ns;
+};
+
+static int compare_size_samples(const void* a, const void* b)
+{
+	return ((const struct size_sample*) a)->key - ((const struct size_sample*) b)->key;
+}
+
+/*
+ * Received probes and one-way delay percentiles per phase, class and
+ * SIZE_BUCKET_BYTES wide probe size bucket, so a run that mixes probe
+ * sizes shows whether the path treats them differently
+ */
+static void write_size_buckets(FILE* file, const struct capture_slot* slot)
+{
+	const char class_names[NUM_TRACKED_CLASSES] = { 'H', 'L' };
+	const int num_buckets = UINT16_MAX / SIZE_BUCKET_BYTES + 1;
+	fprintf(file, "#size\tphase\tclass\tmin_length\tmax_length\treceived\ttimed\towd_p50_ns\towd_p90_ns\t"
+		"owd_p99_ns\n");
+
+	struct size_sample* samples = (struct size_sample*) malloc(
+		(slot->num_records > 0 ? slot->num_records : 1) * sizeof(struct size_sample));
+	struct quantile_histogram* histogram = (struct quantile_histogram*) malloc(sizeof(struct quantile_histogram));
+	if (samples == NULL || histogram == NULL)
+	{
+		free(samples);
+		free(histogram);
+		return;
+	}
+
+	int num_samples = 0;
+	int i;
+	for (i = 0; i < slot->num_records; i++)
+	{
+		const struct capture_record* record = &slot->records[i];
+		int class_index = tracked_class_index(record->priority);
+		if (class_index < 0)
+			continue;
+		struct size_sample* sample = &samples[num_samples++];
+		sample->key = (record->phase * NUM_TRACKED_CLASSES + class_index) * num_buckets +
+			record->length / SIZE_BUCKET_BYTES;
+		sample->timed = record->tx_time_ns != 0;
+		sample->delay_ns = timespec_to_ns(record->arrival) - record->tx_time_ns;
+	}
+	qsort(samples, num_samples, sizeof(struct size_sample), compare_size_samples);
+
+	int first = 0;
+	while (first < num_samples)
+	{
+		int key = samples[first].key;
+		int timed = 0;
+		quantile_histogram_reset(histogram);
+		for (i = first; i < num_samples && samples[i].key == key; i++)
+		{
+			if (!samples[i].timed)
+				continue;
+			quantile_histogram_record(histogram, samples[i].delay_ns);
+			timed++;
+		}
+
+		int bucket = key % num_buckets;
+		int group = key / num_buckets;
+		fprintf(file, "size\t%d\t%c\t%d\t%d\t%d\t%d\t%lld\t%lld\t%lld\n", group / NUM_TRACKED_CLASSES,
+			class_names[group % NUM_TRACKED_CLASSES], bucket * SIZE_BUCKET_BYTES,
+			(bucket + 1) * SIZE_BUCKET_BYTES - 1, i - first, timed,
+			(long long) (timed > 0 ? quantile_histogram_percentile(histogram, 50) : 0),
+			(long long) (timed > 0 ? quantile_histogram_percentile(histogram, 90) : 0),
+			(long long) (timed > 0 ? quantile_histogram_percentile(histogram, 99) : 0));
+		first = i;
+	}
+	free(samples);
+	free(histogram);
+}
+
+struct train_metrics
+{
+	int received;
+	int lost;
+	int duplicates;
+	int reordered;
+	int ipdv_count;
+	double sum_abs_ipdv_ns;
+	int64_t max_abs_ipdv_ns;
+};
+
+/*
+ * Bucket the probes of phase by train with train_of_probe, as the
+ * losses are: duplicates, RFC 4737 reordering against the next id
+ * expected of the class, and RFC 5481 IPDV between consecutive
+ * arrivals of a class within one train. metrics holds trains + 1
+ * entries per class and seen a zeroed MAX_TRACKED_SEQ bitmap per class.
+ */
+static void bucket_train_metrics(const struct capture_slot* slot, int phase, const struct experiment_params* params,
+	const struct train_layout* layout, int trains, struct train_metrics* metrics, uint64_t* seen)
+{
+	int next_expected[NUM_TRACKED_CLASSES] = { 0, 0 };
+	int previous_train[NUM_TRACKED_CLASSES] = { -1, -1 };
+	int64_t previous_rx_ns[NUM_TRACKED_CLASSES], previous_tx_ns[NUM_TRACKED_CLASSES];
+
+	int i;
+	for (i = 0; i < slot->num_records; i++)
+	{
+		const struct capture_record* record = &slot->records[i];
+		int class_index = record->priority == 'H' ? 0 : (record->priority == 'L' ? 1 : -1);
+		int seq_id = record->seq_id;
+		if (record->phase != phase || class_index < 0 || seq_id < 0 || seq_id >= MAX_TRACKED_SEQ)
+			continue;
+		int train = train_of_probe(params, layout, class_index, seq_id);
+		struct train_metrics* train_metrics = train >= 0 && train <= trains ?
+			&metrics[class_index * (trains + 1) + train] : NULL;
+
+		uint64_t bit = 1ULL << (seq_id & 63);
+		uint64_t* word = &seen[class_index * (MAX_TRACKED_SEQ / 64) + (seq_id >> 6)];
+		if (*word & bit)
+		{
+			if (train_metrics != NULL)
+				train_metrics->duplicates++;
+			continue;
+		}
+		*word |= bit;
+		int reordered = seq_id < next_expected[class_index];
+		if (!reordered)
+			next_expected[class_index] = seq_id + 1;
+		if (train_metrics == NULL)
+		{
+			previous_train[class_index] = -1;
+			continue;
+		}
+		train_metrics->received++;
+		train_metrics->reordered += reordered;
+
+		if (record->tx_time_ns == 0)
+		{
+			previous_train[class_index] = -1;
+			continue;
+		}
+		int64_t rx_ns = timespec_to_ns(record->arrival);
+		if (previous_train[class_index] == train)
+		{
+			int64_t ipdv = (rx_ns - previous_rx_ns[class_index]) - (record->tx_time_ns - previous_tx_ns[class_index]);
+			int64_t abs_ipdv = ipdv < 0 ? -ipdv : ipdv;
+			train_metrics->ipdv_count++;
+			train_metrics->sum_abs_ipdv_ns += abs_ipdv;
+			if (abs_ipdv > train_metrics->max_abs_ipdv_ns)
+				train_metrics->max_abs_ipdv_ns = abs_ipdv;
+		}
+		previous_train[class_index] = train;
+		previous_rx_ns[class_index] = rx_ns;
+		previous_tx_ns[class_index] = record->tx_time_ns;
+	}
+}
+
+/*
+ * Write the per phase and per train metrics of the slot to file_name
+ */
+static error_t write_slot_stats(struct capture_slot* slot, const struct clock_fit* fits,
+	const char* file_name)
+{
+	FILE* file = fopen(file_name, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "ERROR #%d: File Open Failed\n", FILE_ERROR);
+		return FILE_ERROR;
+	}
+
+	const char class_names[NUM_TRACKED_CLASSES] = { 'H', 'L' };
+	int phase, class_index;
+
+	fprintf(file, "#phase\tclass\texpected\treceived\tlost\tloss_runs\tmax_loss_run\tduplicates\t"
+		"reordered\tmax_reorder_extent\tjitter_ns\tmean_abs_ipdv_ns\tmax_abs_ipdv_ns\tout_of_range\n");
+	for (phase = 0; phase <= slot->current_phase; phase++)
+	{
+		for (class_index = 0; class_index < NUM_TRACKED_CLASSES; class_index++)
+		{
+			unsigned tracker_bit = 1u << (phase * NUM_TRACKED_CLASSES + class_index);
+			if (!(slot->trackers_used_mask & tracker_bit))
+				continue;
+
+			int expected = 0;
+			if (slot->phase_params_mask & (1u << phase))
+				expected = expected_probes(&slot->phase_params[phase], capture_slot_layout(slot, phase),
+					class_index);
+
+			struct sequence_summary summary;
+			sequence_tracker_summarize(capture_slot_tracker(slot, phase, class_index), expected, &summary);
+			fprintf(file, "%d\t%c\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%.0f\t%.0f\t%lld\t%d\n",
+				phase, class_names[class_index], summary.expected, summary.received, summary.lost,
+				summary.loss_runs, summary.max_loss_run, summary.duplicates, summary.reordered,
+				summary.max_reorder_extent, summary.jitter_ns, summary.mean_abs_ipdv_ns,
+				(long long) summary.max_abs_ipdv_ns, summary.out_of_range);
+
+			//Their losses, reordering and delays are missing from every count
+			if (summary.out_of_range > 0)
+				fprintf(stderr, "%s: %d probes of phase %d class %c have ids past %d and were not tracked\n",
+					file_name, summary.out_of_range, phase, class_names[class_index], MAX_TRACKED_SEQ);
+		}
+	}
+
+	//Percentiles of the streaming histograms, nanoseconds
+	fprintf(file, "#percentiles\tphase\tclass\tmetric\tcount\tmin\tmean\tp50\tp90\tp99\tp99.9\tmax\n");
+	for (phase = 0; phase <= slot->current_phase; phase++)
+	{
+		for (class_index = 0; class_index < NUM_TRACKED_CLASSES; class_index++)
+		{
+			unsigned tracker_bit = 1u << (phase * NUM_TRACKED_CLASSES + class_index);
+			if (!(slot->trackers_used_mask & tracker_bit))
+				continue;
+
+			struct class_histograms* histograms = capture_slot_histograms(slot, phase, class_index);
+			write_histogram_percentiles(file, phase, class_names[class_index], "interarrival",
+				&histograms->interarrival);
+			write_histogram_percentiles(file, phase, class_names[class_index], "one_way_delay",
+				&histograms->one_way_delay);
+		}
+	}
+
+	write_size_buckets(file, slot);
+
+	//Sequential H versus L verdict of each phase
+	fprintf(file, "#verdict\tphase\tverdict\tpairs\tties\tdecided_at_pair\tllr_high_favoured\tllr_low_favoured\n");
+	for (phase = 0; phase <= slot->current_phase; phase++)
+	{
+		unsigned phase_bits = ((1u << NUM_TRACKED_CLASSES) - 1) << (phase * NUM_TRACKED_CLASSES);
+		if (!(slot->trackers_used_mask & phase_bits))
+			continue;
+		const struct sequential_test* test = &slot->sequential[phase];
+		fprintf(file, "verdict\t%d\t%s\t%d\t%d\t%d\t%.3f\t%.3f\n", phase,
+			sequential_verdict_name(test->verdict), test->pairs, test->ties, test->decided_at_pair,
+			test->llr_high_favoured, test->llr_low_favoured);
+	}
+
+	//Clock skew fitted to each phase's delays, and the offset reported by
+	//the sender. exchange_skew is the drift between the two offset reports,
+	//a cross check of the fit. corrected_to is what .owd delays are relative to
+	fprintf(file, "#clock\tphase\tpoints\tskew_ppm\tmin_owd_ns\toffset_ns\toffset_delay_ns\t"
+		"exchange_skew_ppm\tcorrected_to\n");
+	for (phase = 0; phase <= slot->current_phase; phase++)
+	{
+		if (fits[phase].num_points < 2)
+			continue;
+		const struct clock_sync_sample* sync = phase_clock_sync(slot, phase);
+		double exchange_skew_ppm = 0;
+		if (slot->clock_sync_count[phase] == 2 &&
+			slot->clock_sync[phase][1].at_ns != slot->clock_sync[phase][0].at_ns)
+		{
+			exchange_skew_ppm = 1e6 * (double) (slot->clock_sync[phase][1].offset_ns -
+				slot->clock_sync[phase][0].offset_ns) /
+				(double) (slot->clock_sync[phase][1].at_ns - slot->clock_sync[phase][0].at_ns);
+		}
+		fprintf(file, "clock\t%d\t%d\t%.3f\t%.0f\t%lld\t%lld\t%.3f\t%s\n", phase,
+			fits[phase].num_points, fits[phase].skew * 1e6, fits[phase].min_delay_ns,
+			(long long) (sync != NULL ? sync->offset_ns : 0), (long long) (sync != NULL ? sync->delay_ns : 0),
+			exchange_skew_ppm, sync != NULL ? "offset" : "minimum");
+	}
+
+	//Metrics per train, for every train of a class in the phases whose
+	//schedule was announced over the control channel
+	fprintf(file, "#train\tphase\tclass\ttrain_index\treceived\tlost\tduplicates\treordered\t"
+		"mean_abs_ipdv_ns\tmax_abs_ipdv_ns\n");
+	uint64_t* seen = (uint64_t*) malloc(NUM_TRACKED_CLASSES * (MAX_TRACKED_SEQ / 64) * sizeof(uint64_t));
+	for (phase = 0; phase <= slot->current_phase && seen != NULL; phase++)
+	{
+		if (!(slot->phase_params_mask & (1u << phase)))
+			continue;
+		const struct experiment_params* params = &slot->phase_params[phase];
+		const struct train_layout* layout = capture_slot_layout(slot, phase);
+		int trains = num_trains(params, layout);
+
+		struct train_metrics* metrics = (struct train_metrics*) calloc(
+			(size_t) NUM_TRACKED_CLASSES * (trains + 1), sizeof(struct train_metrics));
+		if (metrics == NULL)
+			break;
+		memset(seen, 0, NUM_TRACKED_CLASSES * (MAX_TRACKED_SEQ / 64) * sizeof(uint64_t));
+		bucket_train_metrics(slot, phase, params, layout, trains, metrics, seen);
+
+		for (class_index = 0; class_index < NUM_TRACKED_CLASSES; class_index++)
+		{
+			unsigned tracker_bit = 1u << (phase * NUM_TRACKED_CLASSES + class_index);
+			if (!(slot->trackers_used_mask & tracker_bit))
+				continue;
+			const struct sequence_tracker* tracker = capture_slot_tracker(slot, phase, class_index);
+			struct train_metrics* class_metrics = metrics + class_index * (trains + 1);
+
+			int expected = expected_probes(params, layout, class_index);
+			int seq_id;
+			for (seq_id = 0; seq_id < expected && seq_id < MAX_TRACKED_SEQ; seq_id++)
+			{
+				if (sequence_tracker_seen(tracker, seq_id))
+					continue;
+				int train = train_of_probe(params, layout, class_index, seq_id);
+				if (train >= 0 && train <= trains)
+					class_metrics[train].lost++;
+			}
+
+			int train;
+			for (train = 0; train <= trains; train++)
+			{
+				const struct train_metrics* train_metrics = &class_metrics[train];
+				if (train_metrics->received + train_metrics->lost + train_metrics->duplicates == 0)
+					continue;
+				fprintf(file, "train\t%d\t%c\t%d\t%d\t%d\t%d\t%d\t%.0f\t%lld\n", phase,
+					class_names[class_index], train, train_metrics->received, train_metrics->lost,
+					train_metrics->duplicates, train_metrics->reordered,
+					train_metrics->ipdv_count > 0 ? train_metrics->sum_abs_ipdv_ns / train_metrics->ipdv_count : -1,
+					(long long) (train_metrics->ipdv_count > 0 ? train_metrics->max_abs_ipdv_ns : -1));
+			}
+		}
+		free(metrics);
+	}
+	free(seen);
+
+	error_t result = ferror(file) ? FWRITE_ERROR : SUCCESS;
+	fclose(file);
+	return result;
+}
+
+/*
+ * Write the probes as text, one "seq\tclass\tarrival" line each
+ */
+static error_t write_slot_raw(const struct capture_slot* slot, const char* file_name)
+{
+	FILE* file = fopen(file_name, "a");
+	if (file == NULL)
+	{
+		fprintf(stderr, "ERROR #%d: File Open Failed\n", FILE_ERROR);
+		return FILE_ERROR;
+	}
+
+	int i;
+	int phase = 0;
+	for (i = 0; i < slot->num_records; i++)
+	{
+		const struct capture_record* record = &slot->records[i];
+		while (phase < record->phase)
+		{
+			fputs("*\n", file);
+			phase++;
+		}
+		struct timespec ts = ns_to_timespec(elapsed_ns(slot->start_time, record->arrival));
+		fprintf(file, "%d\t%c\t%d.%.9ld\n", record->seq_id, record->priority,
+			(int) ts.tv_sec, ts.tv_nsec);
+	}
+
+	error_t result = SUCCESS;
+	if (ferror(file))
+	{
+		fprintf(stderr, "ERROR #%d: File Write Failed\n", FWRITE_ERROR);
+		result = FWRITE_ERROR;
+	}
+	fclose(file);
+	return result;
+}
+
+/*
+ * Write the probes through the archive encoder. Arrivals stay absolute;
+ * readers show them relative to the slot's start time from the header.
+ */
+static error_t write_slot_archive(const struct capture_slot* slot, const char* file_name)
+{
+	struct archive_writer writer;
+	error_t status = archive_writer_open(&writer, file_name, timespec_to_ns(slot->start_time));
+	if (status != SUCCESS)
+		return status;
+
+	int i;
+	for (i = 0; i < slot->num_records; i++)
+	{
+		const struct capture_record* record = &slot->records[i];
+		archive_writer_append(&writer, record->phase, record->seq_id, record->priority,
+			timespec_to_ns(record->arrival));
+	}
+
+	status = archive_writer_close(&writer);
+	if (status != SUCCESS)
+		fprintf(stderr, "ERROR #%d: File Write Failed\n", FWRITE_ERROR);
+	return status;
+}
+
+/*
+ * Append the probes to the slot's result store as one run
+ */
+static error_t append_slot_run(const struct capture_slot* slot, int64_t* experiment_id)
+{
+	struct result_columns* columns = result_store_begin_run(slot->store, slot->num_records);
+	if (columns == NULL)
+		return FAILURE;
+
+	struct result_entry entry;
+	memset(&entry, 0, sizeof entry);
+	entry.start_time_ns = timespec_to_ns(slot->start_time);
+	entry.start_wall_time = (int64_t) slot->start_wall_time;
+	entry.finalize_wall_time = (int64_t) time(NULL);
+	entry.sender_addr = slot->sender_addr.sin_addr.s_addr;
+	entry.experiment_tag = slot->experiment_tag;
+	entry.num_phases = slot->current_phase + 1;
+	if (slot->have_params)
+	{
+		entry.probe_length = slot->params.probe_payload_length;
+		entry.initial_train_length = slot->params.initial_train_length;
+		entry.seperation_train_length = slot->params.seperation_train_length;
+		entry.num_packet_trains = slot->params.num_packet_trains;
+	}
+
+	int i;
+	for (i = 0; i < RESULT_MAX_PHASES; i++)
+		entry.phase_priorities[i] = i < MAX_SLOT_PHASES && (slot->phase_params_mask & (1u << i)) ?
+			slot->phase_params[i].priority : '-';
+
+	for (i = 0; i < slot->num_records; i++)
+	{
+		const struct capture_record* record = &slot->records[i];
+		columns->arrival_ns[i] = elapsed_ns(slot->start_time, record->arrival);
+		columns->tx_time_ns[i] = record->tx_time_ns;
+		columns->seq_id[i] = record->seq_id;
+		columns->length[i] = record->length;
+		columns->priority[i] = record->priority;
+		columns->phase[i] = record->phase;
+		entry.class_set |= record->priority == 'H' ? RESULT_CLASS_HIGH :
+			(record->priority == 'L' ? RESULT_CLASS_LOW : RESULT_CLASS_OTHER);
+	}
+	return result_store_commit_run(slot->store, &entry, experiment_id);
+}
+
+error_t capture_slot_finalize(struct capture_slot* slot, const char* output_path,
+	char* file_name_out, int64_t* experiment_id_out)
+{
+	//Build <output_path><ip>_<date>.raw like the single-shot receiver does,
+	//with the tag of a tagged experiment after the date
+	char ip_string[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &(slot->sender_addr.sin_addr), ip_string, sizeof ip_string);
+
+	struct tm file_time_tm;
+	localtime_r(&slot->start_wall_time, &file_time_tm);
+	char time_string[48];
+	strftime(time_string, 21, "_%Y-%m-%d_%H:%M:%S", &file_time_tm);
+	if (slot->experiment_tag != 0)
+		snprintf(time_string + strlen(time_string), sizeof time_string - strlen(time_string), "_e%u",
+			(unsigned) slot->experiment_tag);
+
+	char file_name[MAX_FILENAME_SIZE];
+	const char* separator = "";
+	int64_t experiment_id = 0;
+	error_t result;
+	if (slot->store != NULL)
+	{
+		//A run's .stats and .owd go next to the run, in the store
+		output_path = slot->store->path;
+		separator = "/";
+		result = append_slot_run(slot, &experiment_id);
+		if (result != SUCCESS)
+		{
+			slot->in_use = 0;
+			return result;
+		}
+		snprintf(time_string + strlen(time_string), sizeof time_string - strlen(time_string), "_%lld",
+			(long long) experiment_id);
+		if (file_name_out != NULL)
+			strcpy(file_name_out, slot->store->path);
+	}
+	else
+	{
+		snprintf(file_name, sizeof file_name, "%s%s%s.%s", output_path, ip_string, time_string,
+			slot->archive_output ? "rawz" : "raw");
+		if (file_name_out != NULL)
+			strcpy(file_name_out, file_name);
+
+		result = slot->archive_output ? write_slot_archive(slot, file_name) : write_slot_raw(slot, file_name);
+		if (result == FILE_ERROR)
+		{
+			slot->in_use = 0;
+			return FILE_ERROR;
+		}
+	}
+	if (experiment_id_out != NULL)
+		*experiment_id_out = experiment_id;
+
+	struct clock_fit fits[MAX_SLOT_PHASES];
+	fit_phase_clocks(slot, fits);
+
+	//Metrics were kept up to date while capturing, writing them is cheap.
+	//A name cut short would land in another file, so it counts as a failure
+	if ((snprintf(file_name, sizeof file_name, "%s%s%s%s.stats", output_path, separator, ip_string,
+		time_string) >= (int) sizeof file_name || write_slot_stats(slot, fits, file_name) != SUCCESS) &&
+		result == SUCCESS)
+		result = FWRITE_ERROR;
+
+	if ((snprintf(file_name, sizeof file_name, "%s%s%s%s.owd", output_path, separator, ip_string,
+		time_string) >= (int) sizeof file_name || write_slot_delays(slot, fits, file_name) != SUCCESS) &&
+		result == SUCCESS)
+		result = FWRITE_ERROR;
+
+	if (slot->num_overflowed > 0)
+		fprintf(stderr, "Capture slot for %s dropped %d probes past %d records\n",
+			ip_string, slot->num_overflowed, MAX_SLOT_RECORDS);
+
+	slot->in_use = 0;
+	return result;
+}
@@ -0,0 +1,76 @@
+/*************************************************************
+** Clock Skew Estimation
+** Lower convex hull fit of clockSkew.h.
+**************************************************************/
+
+#include <stdlib.h>
+
+#include "clockSkew.h"
+
+static int compare_points(const void* a, const void* b)
+{
+	const struct delay_point* first = (const struct delay_point*) a;
+	const struct delay_point* second = (const struct delay_point*) b;
+	if (first->tx_ns != second->tx_ns)
+		return first->tx_ns < second->tx_ns ? -1 : 1;
+	return first->owd_ns < second->owd_ns ? -1 : (first->owd_ns > second->owd_ns ? 1 : 0);
+}
+
+/*
+ * Positive when o, a, b turn counter clockwise. Long double keeps the
+ * products of ~1e11 ns spans exact enough to get the sign right.
+ */
+static long double cross(const struct delay_point* o, const struct delay_point* a,
+	const struct delay_point* b)
+{
+	return (long double) (a->tx_ns - o->tx_ns) * (long double) (b->owd_ns - o->owd_ns) -
+		(long double) (a->owd_ns - o->owd_ns) * (long double) (b->tx_ns - o->tx_ns);
+}
+
+int clock_skew_fit(struct delay_point* points, int num_points, struct clock_fit* fit)
+{
+	fit->num_points = num_points;
+	fit->skew = 0;
+	fit->reference_ns = 0;
+	fit->min_delay_ns = 0;
+	if (num_points < 2)
+		return 0;
+
+	qsort(points, num_points, sizeof(struct delay_point), compare_points);
+
+	//Times are taken relative to the first send to keep them small
+	int64_t origin_ns = points[0].tx_ns;
+	long double mean_tx = 0;
+	int i;
+	for (i = 0; i < num_points; i++)
+		mean_tx += (long double) (points[i].tx_ns - origin_ns);
+	mean_tx /= num_points;
+
+	//Lower hull by Andrew's monotone chain, built in place: the hull
+	//never has more points than have been read, so it fits in front.
+	//Only the least delayed point of each send time can be on it.
+	int hull_size = 0;
+	for (i = 0; i < num_points; i++)
+	{
+		if (hull_size > 0 && points[hull_size - 1].tx_ns == points[i].tx_ns)
+			continue;
+		struct delay_point point = points[i];
+		while (hull_size >= 2 && cross(&points[hull_size - 2], &points[hull_size - 1], &point) <= 0)
+			hull_size--;
+		points[hull_size++] = point;
+	}
+	if (hull_size < 2)
+		return 0;
+
+	//The edge over the mean send time minimizes the summed distance
+	int edge = 0;
+	while (edge < hull_size - 2 && (long double) (points[edge + 1].tx_ns - origin_ns) < mean_tx)
+		edge++;
+
+	const struct delay_point* left = &points[edge];
+	const struct delay_point* right = &points[edge + 1];
+	fit->skew = (double) (right->owd_ns - left->owd_ns) / (double) (right->tx_ns - left->tx_ns);
+	fit->reference_ns = left->tx_ns;
+	fit->min_delay_ns = (double) left->owd_ns;
+	return 1;
+}
@@ -0,0 +1,468 @@
+/*************************************************************
+** Column Kernels
+** Scalar, SSE4.2 and AVX2 versions of the kernels declared in
+** columnKernels.h, and the run time choice between them.
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <immintrin.h>
+
+#include "columnKernels.h"
+#include "quantileHistogram.h"
+
+/*
+ * Scalar
+ */
+
+static size_t select_int64_scalar(const char* priority, const int64_t* values, size_t n, char class_byte,
+	int64_t* out)
+{
+	size_t i, count = 0;
+	for (i = 0; i < n; i++)
+	{
+		out[count] = values[i];
+		count += priority[i] == class_byte;
+	}
+	return count;
+}
+
+static size_t select_int32_scalar(const char* priority, const int32_t* values, size_t n, char class_byte,
+	int32_t* out)
+{
+	size_t i, count = 0;
+	for (i = 0; i < n; i++)
+	{
+		out[count] = values[i];
+		count += priority[i] == class_byte;
+	}
+	return count;
+}
+
+static void diff_scalar(const int64_t* values, size_t n, int64_t* out)
+{
+	size_t i;
+	for (i = 0; i + 1 < n; i++)
+		out[i] = values[i + 1] - values[i];
+}
+
+static void range_scalar(const int64_t* values, size_t n, int64_t* min, int64_t* max, int64_t* sum)
+{
+	int64_t low = values[0], high = values[0];
+	uint64_t total = 0;
+	size_t i;
+	for (i = 0; i < n; i++)
+	{
+		low = values[i] < low ? values[i] : low;
+		high = values[i] > high ? values[i] : high;
+		total += (uint64_t) values[i];
+	}
+	*min = low;
+	*max = high;
+	*sum = (int64_t) total;
+}
+
+static size_t count_gaps_scalar(const int32_t* seq, size_t n, int64_t* missing)
+{
+	size_t i, gaps = 0;
+	int64_t skipped = 0;
+	for (i = 0; i + 1 < n; i++)
+	{
+		int64_t jump = (int64_t) seq[i + 1] - seq[i] - 1;
+		gaps += jump != 0;
+		skipped += jump > 0 ? jump : 0;
+	}
+	*missing = skipped;
+	return gaps;
+}
+
+static void bucket_indices_scalar(const int64_t* values, size_t n, int32_t* out)
+{
+	size_t i;
+	for (i = 0; i < n; i++)
+	{
+		if (values[i] >= 0)
+			out[i] = quantile_histogram_bucket((uint64_t) values[i]);
+		else
+			out[i] = -1 - quantile_histogram_bucket(-(uint64_t) values[i]);
+	}
+}
+
+static const struct column_kernels scalar_kernels =
+{
+	"scalar", select_int64_scalar, select_int32_scalar, diff_scalar, range_scalar, count_gaps_scalar,
+	bucket_indices_scalar
+};
+
+/*
+ * Shuffles that move the selected lanes of a vector to its front, for
+ * every mask of selected lanes. Filled once by column_kernels().
+ */
+static uint8_t sse_shuffle_int64[4][16];
+static uint8_t sse_shuffle_int32[16][16];
+static int32_t avx_permute_int64[16][8];
+static int32_t avx_permute_int32[256][8];
+
+static void build_shuffle_tables(void)
+{
+	int mask, lane, byte;
+	for (mask = 0; mask < 256; mask++)
+	{
+		int used = 0;
+		memset(avx_permute_int32[mask], 0, sizeof avx_permute_int32[mask]);
+		for (lane = 0; lane < 8; lane++)
+			if (mask & (1 << lane))
+				avx_permute_int32[mask][used++] = lane;
+	}
+	for (mask = 0; mask < 16; mask++)
+	{
+		int used = 0;
+		memset(avx_permute_int64[mask], 0, sizeof avx_permute_int64[mask]);
+		memset(sse_shuffle_int32[mask], 0x80, sizeof sse_shuffle_int32[mask]);
+		for (lane = 0; lane < 4; lane++)
+		{
+			if (!(mask & (1 << lane)))
+				continue;
+			avx_permute_int64[mask][2 * used] = 2 * lane;
+			avx_permute_int64[mask][2 * used + 1] = 2 * lane + 1;
+			for (byte = 0; byte < 4; byte++)
+				sse_shuffle_int32[mask][4 * used + byte] = (uint8_t) (4 * lane + byte);
+			used++;
+		}
+	}
+	for (mask = 0; mask < 4; mask++)
+	{
+		int used = 0;
+		memset(sse_shuffle_int64[mask], 0x80, sizeof sse_shuffle_int64[mask]);
+		for (lane = 0; lane < 2; lane++)
+		{
+			if (!(mask & (1 << lane)))
+				continue;
+			for (byte = 0; byte < 8; byte++)
+				sse_shuffle_int64[mask][8 * used + byte] = (uint8_t) (8 * lane + byte);
+			used++;
+		}
+	}
+}
+
+/*
+ * SSE4.2
+ */
+
+__attribute__((target("sse4.2")))
+static size_t select_int64_sse42(const char* priority, const int64_t* values, size_t n, char class_byte,
+	int64_t* out)
+{
+	const __m128i wanted = _mm_set1_epi8(class_byte);
+	size_t i, count = 0;
+	for (i = 0; i + 2 <= n; i += 2)
+	{
+		uint16_t pair;
+		memcpy(&pair, priority + i, 2);
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_cvtsi32_si128(pair), wanted)) & 0x3;
+		__m128i lanes = _mm_loadu_si128((const __m128i*) (values + i));
+		__m128i shuffle = _mm_loadu_si128((const __m128i*) sse_shuffle_int64[mask]);
+		_mm_storeu_si128((__m128i*) (out + count), _mm_shuffle_epi8(lanes, shuffle));
+		count += __builtin_popcount(mask);
+	}
+	return count + select_int64_scalar(priority + i, values + i, n - i, class_byte, out + count);
+}
+
+__attribute__((target("sse4.2")))
+static size_t select_int32_sse42(const char* priority, const int32_t* values, size_t n, char class_byte,
+	int32_t* out)
+{
+	const __m128i wanted = _mm_set1_epi8(class_byte);
+	size_t i, count = 0;
+	for (i = 0; i + 4 <= n; i += 4)
+	{
+		int32_t quad;
+		memcpy(&quad, priority + i, 4);
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_cvtsi32_si128(quad), wanted)) & 0xf;
+		__m128i lanes = _mm_loadu_si128((const __m128i*) (values + i));
+		__m128i shuffle = _mm_loadu_si128((const __m128i*) sse_shuffle_int32[mask]);
+		_mm_storeu_si128((__m128i*) (out + count), _mm_shuffle_epi8(lanes, shuffle));
+		count += __builtin_popcount(mask);
+	}
+	return count + select_int32_scalar(priority + i, values + i, n - i, class_byte, out + count);
+}
+
+__attribute__((target("sse4.2")))
+static void diff_sse42(const int64_t* values, size_t n, int64_t* out)
+{
+	size_t i;
+	for (i = 0; i + 3 <= n; i += 2)
+	{
+		__m128i current = _mm_loadu_si128((const __m128i*) (values + i));
+		__m128i next = _mm_loadu_si128((const __m128i*) (values + i + 1));
+		_mm_storeu_si128((__m128i*) (out + i), _mm_sub_epi64(next, current));
+	}
+	diff_scalar(values + i, n - i, out + i);
+}
+
+__attribute__((target("sse4.2")))
+static void range_sse42(const int64_t* values, size_t n, int64_t* min, int64_t* max, int64_t* sum)
+{
+	__m128i low = _mm_set1_epi64x(values[0]);
+	__m128i high = low;
+	__m128i total = _mm_setzero_si128();
+	size_t i;
+	for (i = 0; i + 2 <= n; i += 2)
+	{
+		__m128i lanes = _mm_loadu_si128((const __m128i*) (values + i));
+		low = _mm_blendv_epi8(low, lanes, _mm_cmpgt_epi64(low, lanes));
+		high = _mm_blendv_epi8(high, lanes, _mm_cmpgt_epi64(lanes, high));
+		total = _mm_add_epi64(total, lanes);
+	}
+	int64_t lows[2], highs[2], totals[2];
+	_mm_storeu_si128((__m128i*) lows, low);
+	_mm_storeu_si128((__m128i*) highs, high);
+	_mm_storeu_si128((__m128i*) totals, total);
+	int64_t tail_min = lows[0], tail_max = highs[0], tail_sum = 0;
+	if (i < n)
+		range_scalar(values + i, n - i, &tail_min, &tail_max, &tail_sum);
+	*min = lows[0] < lows[1] ? lows[0] : lows[1];
+	*min = tail_min < *min ? tail_min : *min;
+	*max = highs[0] > highs[1] ? highs[0] : highs[1];
+	*max = tail_max > *max ? tail_max : *max;
+	*sum = (int64_t) ((uint64_t) totals[0] + (uint64_t) totals[1] + (uint64_t) tail_sum);
+}
+
+__attribute__((target("sse4.2")))
+static size_t count_gaps_sse42(const int32_t* seq, size_t n, int64_t* missing)
+{
+	const __m128i one = _mm_set1_epi64x(1);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i skipped = _mm_setzero_si128();
+	size_t i, gaps = 0;
+	for (i = 0; i + 3 <= n; i += 2)
+	{
+		__m128i current = _mm_cvtepi32_epi64(_mm_loadl_epi64((const __m128i*) (seq + i)));
+		__m128i next = _mm_cvtepi32_epi64(_mm_loadl_epi64((const __m128i*) (seq + i + 1)));
+		__m128i jump = _mm_sub_epi64(_mm_sub_epi64(next, current), one);
+		gaps += 2 - __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(jump, zero))));
+		skipped = _mm_add_epi64(skipped, _mm_and_si128(jump, _mm_cmpgt_epi64(jump, zero)));
+	}
+	int64_t lanes[2], tail;
+	_mm_storeu_si128((__m128i*) lanes, skipped);
+	gaps += count_gaps_scalar(seq + i, n - i, &tail);
+	*missing = lanes[0] + lanes[1] + tail;
+	return gaps;
+}
+
+//SSE4.2 has no per lane 64 bit shifts; the buckets stay scalar there
+static const struct column_kernels sse42_kernels =
+{
+	"sse4.2", select_int64_sse42, select_int32_sse42, diff_sse42, range_sse42, count_gaps_sse42,
+	bucket_indices_scalar
+};
+
+/*
+ * AVX2
+ */
+
+__attribute__((target("avx2")))
+static size_t select_int64_avx2(const char* priority, const int64_t* values, size_t n, char class_byte,
+	int64_t* out)
+{
+	const __m128i wanted = _mm_set1_epi8(class_byte);
+	size_t i, count = 0;
+	for (i = 0; i + 4 <= n; i += 4)
+	{
+		int32_t quad;
+		memcpy(&quad, priority + i, 4);
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_cvtsi32_si128(quad), wanted)) & 0xf;
+		__m256i lanes = _mm256_loadu_si256((const __m256i*) (values + i));
+		__m256i permute = _mm256_loadu_si256((const __m256i*) avx_permute_int64[mask]);
+		_mm256_storeu_si256((__m256i*) (out + count), _mm256_permutevar8x32_epi32(lanes, permute));
+		count += __builtin_popcount(mask);
+	}
+	return count + select_int64_scalar(priority + i, values + i, n - i, class_byte, out + count);
+}
+
+__attribute__((target("avx2")))
+static size_t select_int32_avx2(const char* priority, const int32_t* values, size_t n, char class_byte,
+	int32_t* out)
+{
+	const __m128i wanted = _mm_set1_epi8(class_byte);
+	size_t i, count = 0;
+	for (i = 0; i + 8 <= n; i += 8)
+	{
+		int64_t octet;
+		memcpy(&octet, priority + i, 8);
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_cvtsi64_si128(octet), wanted)) & 0xff;
+		__m256i lanes = _mm256_loadu_si256((const __m256i*) (values + i));
+		__m256i permute = _mm256_loadu_si256((const __m256i*) avx_permute_int32[mask]);
+		_mm256_storeu_si256((__m256i*) (out + count), _mm256_permutevar8x32_epi32(lanes, permute));
+		count += __builtin_popcount(mask);
+	}
+	return count + select_int32_scalar(priority + i, values + i, n - i, class_byte, out + count);
+}
+
+__attribute__((target("avx2")))
+static void diff_avx2(const int64_t* values, size_t n, int64_t* out)
+{
+	size_t i;
+	for (i = 0; i + 5 <= n; i += 4)
+	{
+		__m256i current = _mm256_loadu_si256((const __m256i*) (values + i));
+		__m256i next = _mm256_loadu_si256((const __m256i*) (values + i + 1));
+		_mm256_storeu_si256((__m256i*) (out + i), _mm256_sub_epi64(next, current));
+	}
+	diff_scalar(values + i, n - i, out + i);
+}
+
+__attribute__((target("avx2")))
+static void range_avx2(const int64_t* values, size_t n, int64_t* min, int64_t* max, int64_t* sum)
+{
+	__m256i low = _mm256_set1_epi64x(values[0]);
+	__m256i high = low;
+	__m256i total = _mm256_setzero_si256();
+	size_t i;
+	for (i = 0; i + 4 <= n; i += 4)
+	{
+		__m256i lanes = _mm256_loadu_si256((const __m256i*) (values + i));
+		low = _mm256_blendv_epi8(low, lanes, _mm256_cmpgt_epi64(low, lanes));
+		high = _mm256_blendv_epi8(high, lanes, _mm256_cmpgt_epi64(lanes, high));
+		total = _mm256_add_epi64(total, lanes);
+	}
+	int64_t lows[4], highs[4], totals[4];
+	_mm256_storeu_si256((__m256i*) lows, low);
+	_mm256_storeu_si256((__m256i*) highs, high);
+	_mm256_storeu_si256((__m256i*) totals, total);
+	int64_t low_value = lows[0], high_value = highs[0], tail_sum = 0;
+	if (i < n)
+		range_scalar(values + i, n - i, &low_value, &high_value, &tail_sum);
+	uint64_t sum_value = (uint64_t) tail_sum;
+	int lane;
+	for (lane = 0; lane < 4; lane++)
+	{
+		low_value = lows[lane] < low_value ? lows[lane] : low_value;
+		high_value = highs[lane] > high_value ? highs[lane] : high_value;
+		sum_value += (uint64_t) totals[lane];
+	}
+	*min = low_value;
+	*max = high_value;
+	*sum = (int64_t) sum_value;
+}
+
+__attribute__((target("avx2")))
+static size_t count_gaps_avx2(const int32_t* seq, size_t n, int64_t* missing)
+{
+	const __m256i one = _mm256_set1_epi64x(1);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i skipped = _mm256_setzero_si256();
+	size_t i, gaps = 0;
+	for (i = 0; i + 5 <= n; i += 4)
+	{
+		__m256i current = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*) (seq + i)));
+		__m256i next = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*) (seq + i + 1)));
+		__m256i jump = _mm256_sub_epi64(_mm256_sub_epi64(next, current), one);
+		gaps += 4 - __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(jump, zero))));
+		skipped = _mm256_add_epi64(skipped, _mm256_and_si256(jump, _mm256_cmpgt_epi64(jump, zero)));
+	}
+	int64_t lanes[4], tail;
+	_mm256_storeu_si256((__m256i*) lanes, skipped);
+	gaps += count_gaps_scalar(seq + i, n - i, &tail);
+	*missing = lanes[0] + lanes[1] + lanes[2] + lanes[3] + tail;
+	return gaps;
+}
+
+/*
+ * The highest set bit comes from the exponent of the magnitude as a
+ * double, exact since magnitudes are clamped below 2^52. A shift of
+ * max(msb - 6, 0) covers the exact buckets below HISTOGRAM_SUB_BUCKETS.
+ */
+__attribute__((target("avx2")))
+static void bucket_indices_avx2(const int64_t* values, size_t n, int32_t* out)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i max_magnitude = _mm256_set1_epi64x((int64_t) HISTOGRAM_MAX_MAGNITUDE);
+	const __m256i magic = _mm256_set1_epi64x(0x4330000000000000LL);
+	const __m256i exponent_bias = _mm256_set1_epi64x(1023 + HISTOGRAM_SUB_BUCKET_BITS - 1);
+	const __m256i pack = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+	size_t i;
+	for (i = 0; i + 4 <= n; i += 4)
+	{
+		__m256i lanes = _mm256_loadu_si256((const __m256i*) (values + i));
+		__m256i negative = _mm256_cmpgt_epi64(zero, lanes);
+		__m256i magnitude = _mm256_sub_epi64(_mm256_xor_si256(lanes, negative), negative);
+
+		//INT64_MIN stays negative after the negation, and is clamped too
+		__m256i clamp = _mm256_or_si256(_mm256_cmpgt_epi64(magnitude, max_magnitude),
+			_mm256_cmpgt_epi64(zero, magnitude));
+		magnitude = _mm256_blendv_epi8(magnitude, max_magnitude, clamp);
+
+		__m256d as_double = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(magnitude, magic)),
+			_mm256_castsi256_pd(magic));
+		__m256i shift = _mm256_sub_epi64(_mm256_srli_epi64(_mm256_castpd_si256(as_double), 52), exponent_bias);
+		shift = _mm256_andnot_si256(_mm256_cmpgt_epi64(zero, shift), shift);
+
+		__m256i bucket = _mm256_add_epi64(_mm256_slli_epi64(shift, HISTOGRAM_SUB_BUCKET_BITS - 1),
+			_mm256_srlv_epi64(magnitude, shift));
+		bucket = _mm256_xor_si256(bucket, negative);
+		_mm_storeu_si128((__m128i*) (out + i),
+			_mm256_castsi256_si128(_mm256_permutevar8x32_epi32(bucket, pack)));
+	}
+	bucket_indices_scalar(values + i, n - i, out + i);
+}
+
+static const struct column_kernels avx2_kernels =
+{
+	"avx2", select_int64_avx2, select_int32_avx2, diff_avx2, range_avx2, count_gaps_avx2,
+	bucket_indices_avx2
+};
+
+/*
+ * Dispatch
+ */
+
+static const struct column_kernels* supported_kernels(const char* name)
+{
+	if (strcmp(name, "scalar") == 0)
+		return &scalar_kernels;
+	if (strcmp(name, "sse4.2") == 0)
+		return __builtin_cpu_supports("sse4.2") ? &sse42_kernels : NULL;
+	if (strcmp(name, "avx2") == 0)
+		return __builtin_cpu_supports("avx2") ? &avx2_kernels : NULL;
+	return NULL;
+}
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+static const struct column_kernels* chosen_kernels;
+
+static void choose_kernels(void)
+{
+	__builtin_cpu_init();
+	build_shuffle_tables();
+
+	const struct column_kernels* kernels = NULL;
+	const char* forced = getenv("SPQ_KERNELS");
+	if (forced != NULL)
+	{
+		kernels = supported_kernels(forced);
+		if (kernels == NULL)
+			fprintf(stderr, "SPQ_KERNELS=%s is not available, picking the kernels by CPU\n", forced);
+	}
+	if (kernels == NULL)
+		kernels = supported_kernels("avx2");
+	if (kernels == NULL)
+		kernels = supported_kernels("sse4.2");
+	if (kernels == NULL)
+		kernels = &scalar_kernels;
+	chosen_kernels = kernels;
+}
+
+const struct column_kernels* column_kernels_named(const char* name)
+{
+	pthread_once(&kernels_once, choose_kernels);
+	return supported_kernels(name);
+}
+
+const struct column_kernels* column_kernels(void)
+{
+	pthread_once(&kernels_once, choose_kernels);
+	return chosen_kernels;
+}
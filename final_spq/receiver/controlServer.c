@@ -0,0 +1,662 @@
+/*************************************************************
+** Control Channel Server
+** Receiver side of the protocol described in controlChannel.h.
+** Runs inside the receiver daemon's poll loop; every socket is
+** non-blocking so a slow or dead sender never stalls capture.
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "controlServer.h"
+#include "timeUtil.h"
+
+/*
+ * Create a non-blocking TCP listener on port. Returns -1 on failure.
+ */
+static int open_control_listener(int port)
+{
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock == -1)
+		return -1;
+
+	int reuse = 1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *)&reuse, sizeof(int));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+
+	if (bind(sock, (struct sockaddr*) &addr, sizeof addr) == -1 || listen(sock, MAX_CONTROL_CLIENTS) == -1)
+	{
+		close(sock);
+		return -1;
+	}
+	fcntl(sock, F_SETFL, O_NONBLOCK);
+	return sock;
+}
+
+error_t control_server_open(struct control_server* server, const char* output_path)
+{
+	memset(server, 0, sizeof *server);
+	server->output_path = output_path;
+
+	int i;
+	for (i = 0; i < MAX_CONTROL_CLIENTS; i++)
+		server->clients[i].fd = -1;
+
+	server->pre_listen_fd = open_control_listener(PRE_TCP_SERVER_PORT);
+	if (server->pre_listen_fd == -1)
+		fprintf(stderr, "ERROR #%d: Control Port %d Binding Error\n", BIND_ERROR, PRE_TCP_SERVER_PORT);
+
+	server->post_listen_fd = open_control_listener(POST_TCP_SERVER_PORT);
+	if (server->post_listen_fd == -1)
+		fprintf(stderr, "ERROR #%d: Control Port %d Binding Error\n", BIND_ERROR, POST_TCP_SERVER_PORT);
+
+	if (server->pre_listen_fd == -1 && server->post_listen_fd == -1)
+		return BIND_ERROR;
+	return SUCCESS;
+}
+
+static void close_client(struct control_client* client)
+{
+	close(client->fd);
+	client->fd = -1;
+	client->line_len = 0;
+	client->awaiting_drain = 0;
+	client->searching = 0;
+	client->profiling = 0;
+	client->in_stream = 0;
+	client->awaiting_trend = 0;
+	client->awaiting_profile = 0;
+}
+
+void control_server_close(struct control_server* server)
+{
+	int i;
+	for (i = 0; i < MAX_CONTROL_CLIENTS; i++)
+	{
+		if (server->clients[i].fd != -1)
+			close_client(&server->clients[i]);
+	}
+	if (server->pre_listen_fd != -1)
+		close(server->pre_listen_fd);
+	if (server->post_listen_fd != -1)
+		close(server->post_listen_fd);
+}
+
+int control_server_fill_pollfds(struct control_server* server, struct pollfd* fds)
+{
+	int num_fds = 0;
+	if (server->pre_listen_fd != -1)
+	{
+		fds[num_fds].fd = server->pre_listen_fd;
+		fds[num_fds++].events = POLLIN;
+	}
+	if (server->post_listen_fd != -1)
+	{
+		fds[num_fds].fd = server->post_listen_fd;
+		fds[num_fds++].events = POLLIN;
+	}
+
+	int i;
+	for (i = 0; i < MAX_CONTROL_CLIENTS; i++)
+	{
+		if (server->clients[i].fd != -1)
+		{
+			fds[num_fds].fd = server->clients[i].fd;
+			fds[num_fds++].events = POLLIN;
+		}
+	}
+	return num_fds;
+}
+
+static void send_reply(struct control_client* client, const char* reply)
+{
+	//Replies are a few bytes on an otherwise idle connection
+	if (send(client->fd, reply, strlen(reply), MSG_NOSIGNAL) < 0)
+		close_client(client);
+}
+
+static void send_error(struct control_client* client, int code)
+{
+	char reply[32];
+	snprintf(reply, sizeof reply, "ERROR %d\n", code);
+	send_reply(client, reply);
+}
+
+static void handle_request(struct control_server* server, struct control_client* client,
+	char* request, struct capture_slot_pool* pool)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	//Each port serves its own part of the protocol (controlChannel.h)
+	if ((strncmp(request, "FINALIZE", 8) == 0) != client->post)
+	{
+		send_error(client, CONTROL_PROTOCOL_ERROR);
+		return;
+	}
+
+	if (strncmp(request, "HELLO", 5) == 0)
+	{
+		struct experiment_params params;
+		memset(&params, 0, sizeof params);
+		char priority[2] = "";
+		unsigned tag = 0;
+		if (sscanf(request + 5, "%d %d %d %d %1s %u", &params.initial_train_length,
+			&params.seperation_train_length, &params.num_packet_trains,
+			&params.probe_payload_length, priority, &tag) < 5 || tag > UINT16_MAX)
+		{
+			send_error(client, CONTROL_PROTOCOL_ERROR);
+			return;
+		}
+		params.priority = priority[0];
+		client->experiment_tag = (uint16_t) tag;
+
+		//Claim the slot now so the first probe of the train is not lost
+		struct capture_slot* slot = capture_slot_acquire(pool, &client->peer_addr, client->experiment_tag, now);
+		if (slot == NULL)
+		{
+			send_error(client, NO_FREE_CAPTURE_SLOT);
+			return;
+		}
+		slot->params = params;
+		slot->have_params = 1;
+		send_reply(client, "READY\n");
+	}
+	else if (strncmp(request, "PATTERN", 7) == 0)
+	{
+		struct capture_slot* slot = capture_slot_find(pool, &client->peer_addr, client->experiment_tag);
+		if (slot == NULL || !slot->have_params)
+		{
+			send_error(client, UNKNOWN_EXPERIMENT);
+			return;
+		}
+		struct train_layout* layout = capture_slot_next_layout(slot);
+		if (sscanf(request + 7, "%d %d %d", &layout->num_trains, &layout->class_counts[0],
+			&layout->class_counts[1]) != 3 || layout->num_trains < 0 || layout->class_counts[0] < 0 ||
+			layout->class_counts[1] < 0)
+		{
+			slot->params.have_layout = 0;
+			send_error(client, CONTROL_PROTOCOL_ERROR);
+			return;
+		}
+		layout->num_runs[0] = layout->num_runs[1] = 0;
+		slot->params.have_layout = 1;
+		send_reply(client, "OK\n");
+	}
+	else if (strncmp(request, "RUNS", 4) == 0)
+	{
+		struct capture_slot* slot = capture_slot_find(pool, &client->peer_addr, client->experiment_tag);
+		char priority[2] = "";
+		int offset;
+		if (slot == NULL || !slot->params.have_layout || sscanf(request + 4, "%1s%n", priority, &offset) != 1 ||
+			tracked_class_index(priority[0]) < 0)
+		{
+			send_error(client, CONTROL_PROTOCOL_ERROR);
+			return;
+		}
+
+		//Runs come in sequence id order, each within the announced trains
+		struct train_layout* layout = capture_slot_next_layout(slot);
+		int class_index = tracked_class_index(priority[0]);
+		const char* cursor = request + 4 + offset;
+		int first_seq, train, length;
+		while (sscanf(cursor, " %d:%d%n", &first_seq, &train, &length) == 2)
+		{
+			int runs = layout->num_runs[class_index];
+			if (runs == MAX_PATTERN_RUNS || train < 0 || train > layout->num_trains ||
+				(runs > 0 && first_seq <= layout->run_first_seq[class_index][runs - 1]))
+			{
+				layout->num_runs[class_index] = 0;
+				send_error(client, CONTROL_PROTOCOL_ERROR);
+				return;
+			}
+			layout->run_first_seq[class_index][runs] = first_seq;
+			layout->run_train[class_index][runs] = train;
+			layout->num_runs[class_index]++;
+			cursor += length;
+		}
+		send_reply(client, "OK\n");
+	}
+	else if (strcmp(request, "START") == 0)
+	{
+		struct capture_slot* slot = capture_slot_acquire(pool, &client->peer_addr, client->experiment_tag, now);
+		if (slot == NULL)
+		{
+			send_error(client, NO_FREE_CAPTURE_SLOT);
+			return;
+		}
+		capture_slot_begin_phase(slot);
+		client->in_train = 1;
+		client->stop_sent = 0;
+		send_reply(client, "OK\n");
+	}
+	else if (strncmp(request, "END", 3) == 0)
+	{
+		struct capture_slot* slot = capture_slot_find(pool, &client->peer_addr, client->experiment_tag);
+		if (slot == NULL)
+		{
+			send_error(client, UNKNOWN_EXPERIMENT);
+			return;
+		}
+		client->in_train = 0;
+		int sent_per_class[NUM_TRACKED_CLASSES];
+		int trains_sent;
+		client->drain_target = 0;
+		int fields = sscanf(request + 3, "%d %d %d %d", &client->drain_target, &sent_per_class[0],
+			&sent_per_class[1], &trains_sent);
+
+		//A train stopped early is scored against what was actually sent
+		struct train_layout* layout = capture_slot_layout(slot, slot->current_phase);
+		if (layout != NULL && fields == 4)
+		{
+			int class_index;
+			for (class_index = 0; class_index < NUM_TRACKED_CLASSES; class_index++)
+			{
+				if (sent_per_class[class_index] >= 0 &&
+					sent_per_class[class_index] < layout->class_counts[class_index])
+					layout->class_counts[class_index] = sent_per_class[class_index];
+			}
+			if (trains_sent >= 0 && trains_sent < layout->num_trains)
+				layout->num_trains = trains_sent;
+		}
+		else if (layout == NULL && (slot->phase_params_mask & (1u << slot->current_phase)))
+		{
+			struct experiment_params* params = &slot->phase_params[slot->current_phase];
+			trains_sent = (client->drain_target - params->initial_train_length) /
+				(params->seperation_train_length + 1);
+			if (trains_sent >= 0 && trains_sent < params->num_packet_trains)
+				params->num_packet_trains = trains_sent;
+		}
+		client->drain_start = now;
+		client->awaiting_drain = 1;
+	}
+	else if (strncmp(request, "TIME", 4) == 0)
+	{
+		//now is the receive time t2; t3 is taken as late as possible
+		long long t1;
+		if (sscanf(request + 4, "%lld", &t1) != 1)
+		{
+			send_error(client, CONTROL_PROTOCOL_ERROR);
+			return;
+		}
+		struct timespec reply_time;
+		clock_gettime(CLOCK_REALTIME, &reply_time);
+		char reply[96];
+		snprintf(reply, sizeof reply, "TIME %lld %lld %lld\n", t1, (long long) timespec_to_ns(now),
+			(long long) timespec_to_ns(reply_time));
+		send_reply(client, reply);
+	}
+	else if (strncmp(request, "OFFSET", 6) == 0)
+	{
+		struct capture_slot* slot = capture_slot_find(pool, &client->peer_addr, client->experiment_tag);
+		if (slot == NULL)
+		{
+			send_error(client, UNKNOWN_EXPERIMENT);
+			return;
+		}
+		long long offset_ns, delay_ns, at_ns;
+		if (sscanf(request + 6, "%lld %lld %lld", &offset_ns, &delay_ns, &at_ns) != 3)
+		{
+			send_error(client, CONTROL_PROTOCOL_ERROR);
+			return;
+		}
+		struct clock_sync_sample sample = { offset_ns, delay_ns, at_ns };
+		capture_slot_add_clock_sync(slot, &sample);
+		send_reply(client, "OK\n");
+	}
+	else if (strncmp(request, "AVBW", 4) == 0)
+	{
+		char priority[2] = "";
+		double min_bps, max_bps, resolution_bps;
+		int fleet_streams;
+		if (sscanf(request + 4, "%1s %lf %lf %lf %d", priority, &min_bps, &max_bps, &resolution_bps,
+			&fleet_streams) != 5 || tracked_class_index(priority[0]) < 0 || min_bps <= 0 || max_bps <= min_bps ||
+			resolution_bps <= 0 || fleet_streams < 1)
+		{
+			send_error(client, CONTROL_PROTOCOL_ERROR);
+			return;
+		}
+		bandwidth_search_start(&client->search, min_bps, max_bps, resolution_bps, fleet_streams);
+		client->searching = 1;
+		client->profiling = 0;
+		client->search_class = priority[0];
+		char reply[48];
+		snprintf(reply, sizeof reply, "RATE %.0f\n", client->search.rate_bps);
+		send_reply(client, reply);
+	}
+	else if (strncmp(request, "STREAM", 6) == 0)
+	{
+		int probes = atoi(request + 6);
+		if (!((client->searching && !client->search.converged) || client->profiling) || probes < 1 ||
+			probes > RATE_STREAM_MAX_PROBES)
+		{
+			send_error(client, CONTROL_PROTOCOL_ERROR);
+			return;
+		}
+		rate_stream_reset(&client->stream, probes);
+		client->in_stream = 1;
+		send_reply(client, "OK\n");
+	}
+	else if (strncmp(request, "TREND", 5) == 0)
+	{
+		if (!client->in_stream || !client->searching)
+		{
+			send_error(client, CONTROL_PROTOCOL_ERROR);
+			return;
+		}
+		client->trend_target = atoi(request + 5);
+		client->trend_start = now;
+		client->awaiting_trend = 1;
+	}
+	else if (strncmp(request, "BUCKET", 6) == 0)
+	{
+		char priority[2] = "";
+		int packet_bytes;
+		if (sscanf(request + 6, "%1s %d", priority, &packet_bytes) != 2 || tracked_class_index(priority[0]) < 0 ||
+			packet_bytes < 1)
+		{
+			send_error(client, CONTROL_PROTOCOL_ERROR);
+			return;
+		}
+		client->profiling = 1;
+		client->searching = 0;
+		client->search_class = priority[0];
+		client->packet_bytes = packet_bytes;
+		send_reply(client, "OK\n");
+	}
+	else if (strncmp(request, "PROFILE", 7) == 0)
+	{
+		if (!client->in_stream || !client->profiling ||
+			sscanf(request + 7, "%d %lf", &client->trend_target, &client->profile_rate_bps) != 2 ||
+			client->profile_rate_bps <= 0)
+		{
+			send_error(client, CONTROL_PROTOCOL_ERROR);
+			return;
+		}
+		client->trend_start = now;
+		client->awaiting_profile = 1;
+	}
+	else if (strncmp(request, "FINALIZE", 8) == 0)
+	{
+		unsigned tag = 0;
+		if ((request[8] != '\0' && sscanf(request + 8, "%u", &tag) != 1) || tag > UINT16_MAX)
+		{
+			send_error(client, CONTROL_PROTOCOL_ERROR);
+			return;
+		}
+		client->experiment_tag = (uint16_t) tag;
+		struct capture_slot* slot = capture_slot_find(pool, &client->peer_addr, client->experiment_tag);
+		if (slot == NULL)
+		{
+			send_error(client, UNKNOWN_EXPERIMENT);
+			return;
+		}
+		char file_name[MAX_FILENAME_SIZE];
+		int64_t experiment_id;
+		error_t status = capture_slot_finalize(slot, server->output_path, file_name, &experiment_id);
+		if (status != SUCCESS)
+		{
+			send_error(client, status);
+			return;
+		}
+		char reply[MAX_FILENAME_SIZE + 32];
+		if (experiment_id > 0)
+			snprintf(reply, sizeof reply, "DONE %s %lld\n", file_name, (long long) experiment_id);
+		else
+			snprintf(reply, sizeof reply, "DONE %s\n", file_name);
+		send_reply(client, reply);
+	}
+	else
+	{
+		send_error(client, CONTROL_PROTOCOL_ERROR);
+	}
+}
+
+static void read_client(struct control_server* server, struct control_client* client,
+	struct capture_slot_pool* pool)
+{
+	ssize_t recv_bytes = recv(client->fd, client->line + client->line_len,
+		CONTROL_LINE_LENGTH - 1 - client->line_len, 0);
+	if (recv_bytes <= 0)
+	{
+		if (recv_bytes == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+			close_client(client);
+		return;
+	}
+	client->line_len += recv_bytes;
+	client->line[client->line_len] = '\0';
+
+	//Serve every complete line, keep a trailing partial one
+	char* line_start = client->line;
+	char* line_end;
+	while (client->fd != -1 && (line_end = strchr(line_start, '\n')) != NULL)
+	{
+		*line_end = '\0';
+		if (line_end > line_start && line_end[-1] == '\r')
+			line_end[-1] = '\0';
+		handle_request(server, client, line_start, pool);
+		line_start = line_end + 1;
+	}
+	if (client->fd == -1)
+		return;
+
+	client->line_len = strlen(line_start);
+	memmove(client->line, line_start, client->line_len + 1);
+	if (client->line_len == CONTROL_LINE_LENGTH - 1)
+	{
+		send_error(client, CONTROL_PROTOCOL_ERROR);
+		close_client(client);
+	}
+}
+
+static void accept_client(struct control_server* server, int listen_fd)
+{
+	struct sockaddr_in peer_addr;
+	socklen_t peer_len = sizeof peer_addr;
+	int fd = accept(listen_fd, (struct sockaddr*) &peer_addr, &peer_len);
+	if (fd == -1)
+		return;
+
+	int i;
+	for (i = 0; i < MAX_CONTROL_CLIENTS; i++)
+	{
+		struct control_client* client = &server->clients[i];
+		if (client->fd == -1)
+		{
+			fcntl(fd, F_SETFL, O_NONBLOCK);
+			memset(client, 0, sizeof *client);
+			client->fd = fd;
+			client->peer_addr = peer_addr;
+			client->post = listen_fd == server->post_listen_fd;
+			return;
+		}
+	}
+	close(fd);
+}
+
+/*
+ * Answer END once the phase holds every announced probe or the
+ * path has been quiet for CONTROL_DRAIN_TIME_MS
+ */
+static void check_drain(struct control_client* client, struct capture_slot_pool* pool,
+	struct timespec now)
+{
+	struct capture_slot* slot = capture_slot_find(pool, &client->peer_addr, client->experiment_tag);
+	if (slot == NULL)
+	{
+		client->awaiting_drain = 0;
+		send_error(client, UNKNOWN_EXPERIMENT);
+		return;
+	}
+
+	struct timespec last_activity = slot->last_arrival;
+	if (elapsed_ns(last_activity, client->drain_start) > 0)
+		last_activity = client->drain_start;
+
+	if (slot->phase_records >= client->drain_target ||
+		elapsed_ns(last_activity, now) >= (int64_t) CONTROL_DRAIN_TIME_MS * 1000000)
+	{
+		char reply[32];
+		snprintf(reply, sizeof reply, "RECEIVED %d\n", slot->phase_records);
+		client->awaiting_drain = 0;
+		send_reply(client, reply);
+	}
+}
+
+/*
+ * Whether the stream is complete or has been quiet for
+ * RATE_STREAM_DRAIN_MS. Once it has, probes the sender did not get
+ * out are taken off the stream, as they are not losses.
+ */
+static int stream_drained(struct control_client* client, struct timespec now)
+{
+	struct timespec last_activity = client->last_stream_arrival;
+	if (elapsed_ns(last_activity, client->trend_start) > 0)
+		last_activity = client->trend_start;
+	if (client->stream.received < client->trend_target &&
+		elapsed_ns(last_activity, now) < (int64_t) RATE_STREAM_DRAIN_MS * 1000000)
+		return 0;
+
+	if (client->trend_target < client->stream.expected)
+		client->stream.expected = client->trend_target;
+	return 1;
+}
+
+/*
+ * Answer TREND once the stream has drained, and move the search on
+ */
+static void check_trend(struct control_client* client, struct timespec now)
+{
+	if (!stream_drained(client, now))
+		return;
+	double pct, pdt;
+	char trend = rate_stream_trend(&client->stream, &pct, &pdt);
+	client->in_stream = 0;
+	client->awaiting_trend = 0;
+
+	char reply[128];
+	int length = snprintf(reply, sizeof reply, "TREND %c %d %.3f %.3f", trend, client->stream.received, pct, pdt);
+	if (bandwidth_search_add(&client->search, trend))
+	{
+		if (client->search.converged)
+			snprintf(reply + length, sizeof reply - length, " AVAILABLE %.0f %.0f\n", client->search.low_bps,
+				client->search.high_bps);
+		else
+			snprintf(reply + length, sizeof reply - length, " RATE %.0f\n", client->search.rate_bps);
+	}
+	else
+		snprintf(reply + length, sizeof reply - length, "\n");
+	send_reply(client, reply);
+}
+
+/*
+ * Answer PROFILE once the stream has drained, with the token bucket
+ * it fits
+ */
+static void check_profile(struct control_client* client, struct timespec now)
+{
+	if (!stream_drained(client, now))
+		return;
+	struct stream_profile profile;
+	rate_stream_profile(&client->stream, &profile);
+	double bucket_rate_bps, depth_bytes;
+	char kind = token_bucket_infer(&profile, client->profile_rate_bps, client->packet_bytes, &bucket_rate_bps,
+		&depth_bytes);
+	client->in_stream = 0;
+	client->awaiting_profile = 0;
+
+	char reply[160];
+	snprintf(reply, sizeof reply, "PROFILE %c %d %d %d %d %.0f %.0f %.0f\n", kind, profile.received,
+		profile.first_loss, profile.loss_runs, profile.ramp_start, profile.ramp_slope_ns, bucket_rate_bps,
+		depth_bytes);
+	send_reply(client, reply);
+}
+
+int control_server_take_rate_probe(struct control_server* server, const struct sockaddr_in* from,
+	const struct probe_header* header, struct timespec arrival)
+{
+	int i;
+	for (i = 0; i < MAX_CONTROL_CLIENTS; i++)
+	{
+		struct control_client* client = &server->clients[i];
+		if (client->fd == -1 || !client->in_stream || client->search_class != header->priority ||
+			client->peer_addr.sin_addr.s_addr != from->sin_addr.s_addr)
+			continue;
+		if (header->flags & PROBE_FLAG_TX_TIMESTAMP)
+			rate_stream_add(&client->stream, header->seq_id, timespec_to_ns(arrival) - header->tx_time_ns);
+		client->last_stream_arrival = arrival;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Tell a sender in the middle of a train to stop once the phase's
+ * sequential test has reached its verdict
+ */
+static void check_early_stop(struct control_client* client, struct capture_slot_pool* pool)
+{
+	struct capture_slot* slot = capture_slot_find(pool, &client->peer_addr, client->experiment_tag);
+	if (slot == NULL || !slot->sequential_config.early_stop)
+		return;
+
+	int verdict = slot->sequential[slot->current_phase].verdict;
+	if (verdict == SEQUENTIAL_UNDECIDED)
+		return;
+
+	char message[48];
+	snprintf(message, sizeof message, "STOP %s\n", sequential_verdict_name(verdict));
+	client->stop_sent = 1;
+	send_reply(client, message);
+}
+
+void control_server_process(struct control_server* server, struct pollfd* fds, int num_fds,
+	struct capture_slot_pool* pool)
+{
+	int i, j;
+	for (i = 0; i < num_fds; i++)
+	{
+		if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+			continue;
+
+		if (fds[i].fd == server->pre_listen_fd || fds[i].fd == server->post_listen_fd)
+		{
+			accept_client(server, fds[i].fd);
+			continue;
+		}
+
+		for (j = 0; j < MAX_CONTROL_CLIENTS; j++)
+		{
+			if (server->clients[j].fd == fds[i].fd)
+			{
+				read_client(server, &server->clients[j], pool);
+				break;
+			}
+		}
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	for (j = 0; j < MAX_CONTROL_CLIENTS; j++)
+	{
+		if (server->clients[j].fd != -1 && server->clients[j].awaiting_drain)
+			check_drain(&server->clients[j], pool, now);
+		if (server->clients[j].fd != -1 && server->clients[j].awaiting_trend)
+			check_trend(&server->clients[j], now);
+		if (server->clients[j].fd != -1 && server->clients[j].awaiting_profile)
+			check_profile(&server->clients[j], now);
+		if (server->clients[j].fd != -1 && server->clients[j].in_train && !server->clients[j].stop_sent)
+			check_early_stop(&server->clients[j], pool);
+	}
+}
@@ -0,0 +1,316 @@
+/*************************************************************
+** pcapng Writer
+** See pcapngWriter.h for what is written and when.
+**************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "pcapngWriter.h"
+#include "probeHeader.h"
+#include "timeUtil.h"
+
+#define BLOCK_SECTION_HEADER 0x0A0D0D0Au
+#define BLOCK_INTERFACE_DESCRIPTION 1u
+#define BLOCK_INTERFACE_STATISTICS 5u
+#define BLOCK_ENHANCED_PACKET 6u
+#define BYTE_ORDER_MAGIC 0x1A2B3C4Du
+
+#define OPTION_END 0
+#define OPTION_SHB_USERAPPL 4
+#define OPTION_IF_NAME 2
+#define OPTION_IF_TSRESOL 9
+#define OPTION_ISB_IFRECV 4
+#define OPTION_ISB_IFDROP 5
+
+#define LINKTYPE_RAW 101
+#define IP_UDP_HEADER_LENGTH 28
+
+//Interface of the filler entry that sends the reader back to the start of the ring
+#define RING_WRAP 0xffff
+
+struct ring_entry
+{
+	uint32_t entry_length;
+	uint16_t interface;
+	uint16_t captured;
+	uint32_t original_length;
+	uint32_t from_addr;
+	uint32_t local_addr;
+	uint16_t from_port;
+	uint16_t reserved;
+	int64_t arrival_ns;
+};
+
+//A block being put together, lengths are patched in by finish_block
+struct block_buffer
+{
+	size_t length;
+	uint8_t data[64 + IP_UDP_HEADER_LENGTH + MAX_PACKET_SIZE];
+};
+
+static void put_bytes(struct block_buffer* block, const void* bytes, size_t length)
+{
+	memcpy(block->data + block->length, bytes, length);
+	block->length += length;
+	while (block->length % 4 != 0)
+		block->data[block->length++] = 0;
+}
+
+static void put_u32(struct block_buffer* block, uint32_t value)
+{
+	put_bytes(block, &value, sizeof value);
+}
+
+static void put_option(struct block_buffer* block, uint16_t code, const void* value, uint16_t length)
+{
+	uint16_t header[2] = { code, length };
+	memcpy(block->data + block->length, header, sizeof header);
+	block->length += sizeof header;
+	if (length > 0)
+		put_bytes(block, value, length);
+}
+
+static void start_block(struct block_buffer* block, uint32_t type)
+{
+	block->length = 0;
+	put_u32(block, type);
+	put_u32(block, 0);
+}
+
+static void finish_block(struct block_buffer* block, FILE* file)
+{
+	uint32_t total_length = (uint32_t) block->length + 4;
+	memcpy(block->data + 4, &total_length, sizeof total_length);
+	put_u32(block, total_length);
+	fwrite(block->data, 1, block->length, file);
+}
+
+static uint16_t ip_checksum(const uint8_t* header, int length)
+{
+	uint32_t sum = 0;
+	int i;
+	for (i = 0; i < length; i += 2)
+		sum += (uint32_t) (header[i] << 8 | header[i + 1]);
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t) ~sum;
+}
+
+/*
+ * Enhanced Packet Block of one queued probe, with the IPv4 and UDP
+ * headers the socket stripped rebuilt in front of its payload
+ */
+static void write_packet(struct pcapng_writer* writer, const struct ring_entry* entry, struct block_buffer* block)
+{
+	start_block(block, BLOCK_ENHANCED_PACKET);
+	put_u32(block, entry->interface);
+	put_u32(block, (uint32_t) ((uint64_t) entry->arrival_ns >> 32));
+	put_u32(block, (uint32_t) entry->arrival_ns);
+	put_u32(block, IP_UDP_HEADER_LENGTH + entry->captured);
+	put_u32(block, IP_UDP_HEADER_LENGTH + entry->original_length);
+
+	uint8_t* packet = block->data + block->length;
+	uint32_t ip_length = IP_UDP_HEADER_LENGTH + entry->original_length;
+	uint16_t udp_length = htons((uint16_t) (8 + entry->original_length));
+	uint16_t local_port = htons(writer->ports[entry->interface]);
+	memset(packet, 0, IP_UDP_HEADER_LENGTH);
+	packet[0] = 0x45;
+	packet[2] = (uint8_t) (ip_length > 0xffff ? 0xff : ip_length >> 8);
+	packet[3] = (uint8_t) (ip_length > 0xffff ? 0xff : ip_length);
+	packet[8] = 64;
+	packet[9] = IPPROTO_UDP;
+	memcpy(packet + 12, &entry->from_addr, 4);
+	memcpy(packet + 16, &entry->local_addr, 4);
+	uint16_t checksum = htons(ip_checksum(packet, 20));
+	memcpy(packet + 10, &checksum, 2);
+	memcpy(packet + 20, &entry->from_port, 2);
+	memcpy(packet + 22, &local_port, 2);
+	memcpy(packet + 24, &udp_length, 2);
+	block->length += IP_UDP_HEADER_LENGTH;
+	put_bytes(block, entry + 1, entry->captured);
+
+	put_option(block, OPTION_END, NULL, 0);
+	finish_block(block, writer->file);
+}
+
+/*
+ * Write every entry the capture loop has published
+ */
+static void drain_ring(struct pcapng_writer* writer, struct block_buffer* block)
+{
+	uint64_t head = __atomic_load_n(&writer->head, __ATOMIC_ACQUIRE);
+	uint64_t tail = writer->tail;
+	while (tail != head)
+	{
+		size_t offset = tail & (PCAPNG_RING_BYTES - 1);
+		size_t to_end = PCAPNG_RING_BYTES - offset;
+		const struct ring_entry* entry = (const struct ring_entry*) (writer->ring + offset);
+		if (to_end < sizeof(struct ring_entry) || entry->interface == RING_WRAP)
+		{
+			tail += to_end;
+			continue;
+		}
+		write_packet(writer, entry, block);
+		writer->written++;
+		tail += entry->entry_length;
+	}
+	__atomic_store_n(&writer->tail, tail, __ATOMIC_RELEASE);
+}
+
+static void* write_blocks(void* arg)
+{
+	struct pcapng_writer* writer = (struct pcapng_writer*) arg;
+	static struct block_buffer block;
+	struct timespec idle = ns_to_timespec(PCAPNG_IDLE_SLEEP_NS);
+	while (1)
+	{
+		//Whatever was queued before the stop is drained below
+		int running = __atomic_load_n(&writer->running, __ATOMIC_ACQUIRE);
+		drain_ring(writer, &block);
+		if (!running)
+			break;
+		nanosleep(&idle, NULL);
+	}
+	return NULL;
+}
+
+error_t pcapng_writer_open(struct pcapng_writer* writer, const char* path, int snap_length,
+	unsigned class_mask, int header_offset, const uint16_t* ports, int num_interfaces)
+{
+	memset(writer, 0, sizeof *writer);
+	writer->snap_length = snap_length > 0 && snap_length < MAX_PACKET_SIZE ? snap_length : MAX_PACKET_SIZE;
+	writer->class_mask = class_mask;
+	writer->header_offset = header_offset;
+	writer->num_interfaces = num_interfaces < PCAPNG_MAX_INTERFACES ? num_interfaces : PCAPNG_MAX_INTERFACES;
+	memcpy(writer->ports, ports, writer->num_interfaces * sizeof *ports);
+
+	writer->ring = (uint8_t*) malloc(PCAPNG_RING_BYTES);
+	if (writer->ring == NULL)
+		return FAILURE;
+	writer->file = fopen(path, "wb");
+	if (writer->file == NULL)
+	{
+		fprintf(stderr, "ERROR #%d: Cannot create %s\n", FILE_ERROR, path);
+		free(writer->ring);
+		return FILE_ERROR;
+	}
+	setvbuf(writer->file, NULL, _IOFBF, 1 << 20);
+
+	static struct block_buffer block;
+	start_block(&block, BLOCK_SECTION_HEADER);
+	put_u32(&block, BYTE_ORDER_MAGIC);
+	uint16_t version[2] = { 1, 0 };
+	put_bytes(&block, version, sizeof version);
+	int64_t section_length = -1;
+	put_bytes(&block, &section_length, sizeof section_length);
+	const char* application = "unitExperimentReceiver";
+	put_option(&block, OPTION_SHB_USERAPPL, application, (uint16_t) strlen(application));
+	put_option(&block, OPTION_END, NULL, 0);
+	finish_block(&block, writer->file);
+
+	int i;
+	for (i = 0; i < writer->num_interfaces; i++)
+	{
+		start_block(&block, BLOCK_INTERFACE_DESCRIPTION);
+		uint16_t link[2] = { LINKTYPE_RAW, 0 };
+		put_bytes(&block, link, sizeof link);
+		put_u32(&block, IP_UDP_HEADER_LENGTH + writer->snap_length);
+		char name[16];
+		snprintf(name, sizeof name, "udp:%u", (unsigned) writer->ports[i]);
+		put_option(&block, OPTION_IF_NAME, name, (uint16_t) strlen(name));
+		uint8_t nanoseconds = 9;
+		put_option(&block, OPTION_IF_TSRESOL, &nanoseconds, 1);
+		put_option(&block, OPTION_END, NULL, 0);
+		finish_block(&block, writer->file);
+	}
+
+	writer->running = 1;
+	if (pthread_create(&writer->thread, NULL, write_blocks, writer) != 0)
+	{
+		fclose(writer->file);
+		free(writer->ring);
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+void pcapng_writer_capture(struct pcapng_writer* writer, int interface, const uint8_t* payload, int captured,
+	int original_length, struct timespec arrival, const struct sockaddr_in* from, struct in_addr local)
+{
+	//Only the selected classes, their class byte follows the sequence id
+	if (captured < writer->header_offset + 5)
+		return;
+	char priority = (char) payload[writer->header_offset + 4];
+	unsigned class_bit = priority == 'H' ? 1u : (priority == 'L' ? 2u : 0u);
+	if (!(writer->class_mask & class_bit))
+		return;
+	writer->offered[interface]++;
+
+	if (captured > writer->snap_length)
+		captured = writer->snap_length;
+	size_t need = (sizeof(struct ring_entry) + captured + 7) & ~(size_t) 7;
+	uint64_t tail = __atomic_load_n(&writer->tail, __ATOMIC_ACQUIRE);
+	size_t offset = writer->head & (PCAPNG_RING_BYTES - 1);
+	size_t to_end = PCAPNG_RING_BYTES - offset;
+	size_t skip = to_end < need ? to_end : 0;
+	if (writer->head + skip + need - tail > PCAPNG_RING_BYTES)
+	{
+		writer->dropped[interface]++;
+		return;
+	}
+	if (skip > 0 && skip >= sizeof(struct ring_entry))
+		((struct ring_entry*) (writer->ring + offset))->interface = RING_WRAP;
+	uint64_t head = writer->head + skip;
+
+	struct ring_entry* entry = (struct ring_entry*) (writer->ring + (head & (PCAPNG_RING_BYTES - 1)));
+	entry->entry_length = (uint32_t) need;
+	entry->interface = (uint16_t) interface;
+	entry->captured = (uint16_t) captured;
+	entry->original_length = (uint32_t) original_length;
+	entry->from_addr = from->sin_addr.s_addr;
+	entry->local_addr = local.s_addr;
+	entry->from_port = from->sin_port;
+	entry->arrival_ns = timespec_to_ns(arrival);
+	memcpy(entry + 1, payload, captured);
+	__atomic_store_n(&writer->head, head + need, __ATOMIC_RELEASE);
+}
+
+error_t pcapng_writer_close(struct pcapng_writer* writer)
+{
+	__atomic_store_n(&writer->running, 0, __ATOMIC_RELEASE);
+	pthread_join(writer->thread, NULL);
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	int64_t now_ns = timespec_to_ns(now);
+	static struct block_buffer block;
+	long long dropped = 0;
+	int i;
+	for (i = 0; i < writer->num_interfaces; i++)
+	{
+		start_block(&block, BLOCK_INTERFACE_STATISTICS);
+		put_u32(&block, (uint32_t) i);
+		put_u32(&block, (uint32_t) ((uint64_t) now_ns >> 32));
+		put_u32(&block, (uint32_t) now_ns);
+		uint64_t offered = (uint64_t) writer->offered[i];
+		uint64_t ring_dropped = (uint64_t) writer->dropped[i];
+		put_option(&block, OPTION_ISB_IFRECV, &offered, sizeof offered);
+		put_option(&block, OPTION_ISB_IFDROP, &ring_dropped, sizeof ring_dropped);
+		put_option(&block, OPTION_END, NULL, 0);
+		finish_block(&block, writer->file);
+		dropped += writer->dropped[i];
+	}
+
+	int failed = ferror(writer->file);
+	failed |= fclose(writer->file) != 0;
+	free(writer->ring);
+	printf("pcapng: wrote %lld probes, dropped %lld\n", writer->written, dropped);
+	if (failed)
+	{
+		fprintf(stderr, "ERROR #%d: pcapng write failed\n", FWRITE_ERROR);
+		return FWRITE_ERROR;
+	}
+	return SUCCESS;
+}
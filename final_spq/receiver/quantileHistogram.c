@@ -0,0 +1,134 @@
+/*************************************************************
+** Quantile Histogram
+** See quantileHistogram.h for the bucket layout.
+**************************************************************/
+
+#include <string.h>
+#include <math.h>
+
+#include "quantileHistogram.h"
+#include "columnKernels.h"
+
+//Values binned per kernel call
+#define RECORD_BATCH 1024
+
+#define HALF_SUB_BUCKETS (HISTOGRAM_SUB_BUCKETS / 2)
+
+/*
+ * Midpoint of the magnitudes that fall in bucket index
+ */
+static inline uint64_t bucket_value(int index)
+{
+	if (index < HISTOGRAM_SUB_BUCKETS)
+		return (uint64_t) index;
+
+	int shift = index / HALF_SUB_BUCKETS - 1;
+	uint64_t sub_bucket = (uint64_t) (index - shift * HALF_SUB_BUCKETS);
+	return (sub_bucket << shift) + ((1ULL << shift) >> 1);
+}
+
+void quantile_histogram_reset(struct quantile_histogram* histogram)
+{
+	memset(histogram, 0, sizeof *histogram);
+}
+
+void quantile_histogram_record(struct quantile_histogram* histogram, int64_t value)
+{
+	if (histogram->count == 0 || value < histogram->min)
+		histogram->min = value;
+	if (histogram->count == 0 || value > histogram->max)
+		histogram->max = value;
+	histogram->count++;
+	histogram->sum += (double) value;
+
+	if (value < 0)
+		histogram->negative[quantile_histogram_bucket((uint64_t) -value)]++;
+	else
+		histogram->positive[quantile_histogram_bucket((uint64_t) value)]++;
+}
+
+void quantile_histogram_record_batch(struct quantile_histogram* histogram, const int64_t* values, size_t n)
+{
+	const struct column_kernels* kernels = column_kernels();
+	int32_t buckets[RECORD_BATCH];
+	while (n > 0)
+	{
+		size_t batch = n < RECORD_BATCH ? n : RECORD_BATCH;
+		int64_t min, max, sum;
+		kernels->range(values, batch, &min, &max, &sum);
+		if (histogram->count == 0 || min < histogram->min)
+			histogram->min = min;
+		if (histogram->count == 0 || max > histogram->max)
+			histogram->max = max;
+		histogram->count += batch;
+		histogram->sum += (double) sum;
+
+		kernels->bucket_indices(values, batch, buckets);
+		size_t i;
+		for (i = 0; i < batch; i++)
+		{
+			if (buckets[i] >= 0)
+				histogram->positive[buckets[i]]++;
+			else
+				histogram->negative[-1 - buckets[i]]++;
+		}
+		values += batch;
+		n -= batch;
+	}
+}
+
+int64_t quantile_histogram_percentile(const struct quantile_histogram* histogram, double percentile)
+{
+	if (histogram->count == 0)
+		return 0;
+
+	uint64_t rank = (uint64_t) ceil(percentile / 100.0 * (double) histogram->count);
+	if (rank < 1)
+		rank = 1;
+	if (rank > histogram->count)
+		rank = histogram->count;
+
+	int64_t value = histogram->max;
+	uint64_t seen = 0;
+	int i;
+
+	//Most negative values first, then the positive ones
+	for (i = HISTOGRAM_NUM_BUCKETS - 1; i >= 0 && seen < rank; i--)
+	{
+		seen += histogram->negative[i];
+		if (seen >= rank)
+			value = -(int64_t) bucket_value(i);
+	}
+	for (i = 0; i < HISTOGRAM_NUM_BUCKETS && seen < rank; i++)
+	{
+		seen += histogram->positive[i];
+		if (seen >= rank)
+			value = (int64_t) bucket_value(i);
+	}
+
+	//A bucket midpoint can lie outside what was actually recorded
+	if (value < histogram->min)
+		value = histogram->min;
+	if (value > histogram->max)
+		value = histogram->max;
+	return value;
+}
+
+void quantile_histogram_merge(struct quantile_histogram* target, const struct quantile_histogram* source)
+{
+	if (source->count == 0)
+		return;
+	if (target->count == 0 || source->min < target->min)
+		target->min = source->min;
+	if (target->count == 0 || source->max > target->max)
+		target->max = source->max;
+	target->count += source->count;
+	target->sum += source->sum;
+
+	int i;
+	for (i = 0; i < HISTOGRAM_NUM_BUCKETS; i++)
+	{
+		target->positive[i] += source->positive[i];
+		target->negative[i] += source->negative[i];
+	}
+}
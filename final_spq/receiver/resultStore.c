@@ -0,0 +1,383 @@
+/*************************************************************
+** Result Store
+** Segment and index files described in resultStore.h.
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "resultStore.h"
+
+static inline size_t align8(size_t length)
+{
+	return (length + 7) & ~(size_t) 7;
+}
+
+//Bytes taken by the columns of a run of num_records probes
+static inline size_t columns_length(size_t num_records)
+{
+	return align8(num_records * (8 + 8 + 4 + 2 + 1 + 1));
+}
+
+static void point_columns(uint8_t* data, size_t num_records, struct result_columns* columns)
+{
+	columns->num_records = (int) num_records;
+	columns->arrival_ns = (int64_t*) data;
+	columns->tx_time_ns = (int64_t*) (data + num_records * 8);
+	columns->seq_id = (int32_t*) (data + num_records * 16);
+	columns->length = (uint16_t*) (data + num_records * 20);
+	columns->priority = (char*) (data + num_records * 22);
+	columns->phase = data + num_records * 23;
+}
+
+static int write_all(int fd, const void* data, size_t length, off_t offset)
+{
+	const uint8_t* next = (const uint8_t*) data;
+	while (length > 0)
+	{
+		ssize_t written = pwrite(fd, next, length, offset);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return 0;
+		next += written;
+		length -= written;
+		offset += written;
+	}
+	return 1;
+}
+
+static void segment_file_name(const char* path, uint32_t segment, char* file_name)
+{
+	snprintf(file_name, MAX_FILENAME_SIZE, "%.*s/segment_%06u.seg", MAX_FILENAME_SIZE - 24, path, segment);
+}
+
+error_t result_store_open(struct result_store* store, const char* path)
+{
+	memset(store, 0, sizeof *store);
+	store->index_fd = -1;
+	snprintf(store->path, sizeof store->path, "%s", path);
+	if (gethostname(store->receiver, sizeof store->receiver) != 0)
+		strcpy(store->receiver, "-");
+	store->receiver[sizeof store->receiver - 1] = '\0';
+
+	if (mkdir(path, 0755) != 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "ERROR #%d: Could not create result store %s\n", FILE_ERROR, path);
+		return FILE_ERROR;
+	}
+	char index_name[MAX_FILENAME_SIZE];
+	snprintf(index_name, sizeof index_name, "%s/index", path);
+	store->index_fd = open(index_name, O_RDWR | O_CREAT, 0644);
+	if (store->index_fd == -1)
+	{
+		fprintf(stderr, "ERROR #%d: Could not open %s\n", FILE_ERROR, index_name);
+		return FILE_ERROR;
+	}
+
+	//Another writer may be creating the store at the same time
+	error_t result = SUCCESS;
+	flock(store->index_fd, LOCK_EX);
+	struct stat index_stat;
+	uint8_t header[RESULT_INDEX_HEADER_LENGTH];
+	uint32_t version = RESULT_STORE_VERSION;
+	if (fstat(store->index_fd, &index_stat) != 0)
+		result = FREAD_ERROR;
+	else if (index_stat.st_size == 0)
+	{
+		memcpy(header, RESULT_STORE_MAGIC, 4);
+		memcpy(header + 4, &version, 4);
+		if (!write_all(store->index_fd, header, sizeof header, 0))
+			result = FWRITE_ERROR;
+	}
+	else if (pread(store->index_fd, header, sizeof header, 0) != sizeof header ||
+		memcmp(header, RESULT_STORE_MAGIC, 4) != 0 || memcmp(header + 4, &version, 4) != 0)
+	{
+		fprintf(stderr, "ERROR #%d: %s is not a result store\n", FREAD_ERROR, index_name);
+		result = FREAD_ERROR;
+	}
+	flock(store->index_fd, LOCK_UN);
+
+	if (result != SUCCESS)
+	{
+		close(store->index_fd);
+		store->index_fd = -1;
+	}
+	return result;
+}
+
+void result_store_close(struct result_store* store)
+{
+	if (store->index_fd != -1)
+		close(store->index_fd);
+	store->index_fd = -1;
+	free(store->run_buffer);
+	store->run_buffer = NULL;
+	store->run_capacity = 0;
+}
+
+struct result_columns* result_store_begin_run(struct result_store* store, int num_records)
+{
+	size_t length = columns_length((size_t) num_records);
+	if (length > store->run_capacity)
+	{
+		uint8_t* grown = (uint8_t*) realloc(store->run_buffer, length);
+		if (grown == NULL)
+			return NULL;
+		store->run_buffer = grown;
+		store->run_capacity = length;
+	}
+
+	//Padding goes to disk too, keep it deterministic
+	if (length > 0)
+		memset(store->run_buffer + length - 8, 0, 8);
+	point_columns(store->run_buffer, (size_t) num_records, &store->columns);
+	return &store->columns;
+}
+
+error_t result_store_commit_run(struct result_store* store, struct result_entry* entry,
+	int64_t* experiment_id)
+{
+	size_t length = columns_length((size_t) store->columns.num_records);
+	error_t result = SUCCESS;
+	flock(store->index_fd, LOCK_EX);
+
+	//The last entry says where its segment ends. A torn entry at the
+	//end of the index, from a writer that died, is written over.
+	struct stat index_stat;
+	if (fstat(store->index_fd, &index_stat) != 0)
+	{
+		flock(store->index_fd, LOCK_UN);
+		return FREAD_ERROR;
+	}
+	int64_t count = ((int64_t) index_stat.st_size - RESULT_INDEX_HEADER_LENGTH) / RESULT_ENTRY_LENGTH;
+	uint32_t segment = 0;
+	int64_t segment_end = 0;
+	if (count > 0)
+	{
+		struct result_entry last;
+		if (pread(store->index_fd, &last, sizeof last,
+			RESULT_INDEX_HEADER_LENGTH + (count - 1) * RESULT_ENTRY_LENGTH) != sizeof last)
+		{
+			flock(store->index_fd, LOCK_UN);
+			return FREAD_ERROR;
+		}
+		segment = last.segment;
+		segment_end = last.segment_offset + (int64_t) columns_length(last.num_records);
+	}
+	if (segment_end > 0 && segment_end + RESULT_ENTRY_LENGTH + (int64_t) length > RESULT_SEGMENT_SIZE)
+	{
+		segment++;
+		segment_end = 0;
+	}
+
+	entry->experiment_id = count + 1;
+	entry->segment = segment;
+	entry->segment_offset = segment_end + RESULT_ENTRY_LENGTH;
+	entry->num_records = (uint32_t) store->columns.num_records;
+	memcpy(entry->receiver, store->receiver, sizeof entry->receiver);
+
+	char file_name[MAX_FILENAME_SIZE];
+	segment_file_name(store->path, segment, file_name);
+	int segment_fd = open(file_name, O_WRONLY | O_CREAT, 0644);
+	if (segment_fd == -1)
+	{
+		fprintf(stderr, "ERROR #%d: Could not open %s\n", FILE_ERROR, file_name);
+		result = FILE_ERROR;
+	}
+	else
+	{
+		if (!write_all(segment_fd, entry, sizeof *entry, segment_end) ||
+			!write_all(segment_fd, store->run_buffer, length, entry->segment_offset))
+			result = FWRITE_ERROR;
+		close(segment_fd);
+	}
+
+	//The entry goes last: once it is there, so is the run
+	if (result == SUCCESS && !write_all(store->index_fd, entry, sizeof *entry,
+		RESULT_INDEX_HEADER_LENGTH + count * RESULT_ENTRY_LENGTH))
+		result = FWRITE_ERROR;
+	flock(store->index_fd, LOCK_UN);
+
+	if (result == FWRITE_ERROR)
+		fprintf(stderr, "ERROR #%d: File Write Failed\n", FWRITE_ERROR);
+	if (result == SUCCESS && experiment_id != NULL)
+		*experiment_id = entry->experiment_id;
+	return result;
+}
+
+/*
+ * Map a whole file read only. An empty file maps to NULL.
+ */
+static error_t map_file(const char* file_name, const uint8_t** data, size_t* size)
+{
+	*data = NULL;
+	*size = 0;
+	int fd = open(file_name, O_RDONLY);
+	if (fd == -1)
+	{
+		fprintf(stderr, "ERROR #%d: Could not open %s\n", FILE_ERROR, file_name);
+		return FILE_ERROR;
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0)
+	{
+		close(fd);
+		return FREAD_ERROR;
+	}
+	if (file_stat.st_size > 0)
+	{
+		void* mapping = mmap(NULL, (size_t) file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (mapping == MAP_FAILED)
+		{
+			close(fd);
+			fprintf(stderr, "ERROR #%d: Could not map %s\n", FREAD_ERROR, file_name);
+			return FREAD_ERROR;
+		}
+		*data = (const uint8_t*) mapping;
+		*size = (size_t) file_stat.st_size;
+	}
+	close(fd);
+	return SUCCESS;
+}
+
+error_t result_store_open_reader(struct result_store_reader* reader, const char* path)
+{
+	memset(reader, 0, sizeof *reader);
+	snprintf(reader->path, sizeof reader->path, "%s", path);
+
+	char index_name[MAX_FILENAME_SIZE];
+	snprintf(index_name, sizeof index_name, "%s/index", path);
+	error_t result = map_file(index_name, &reader->index_data, &reader->index_size);
+	if (result != SUCCESS)
+		return result;
+
+	uint32_t version = RESULT_STORE_VERSION;
+	if (reader->index_size < RESULT_INDEX_HEADER_LENGTH ||
+		memcmp(reader->index_data, RESULT_STORE_MAGIC, 4) != 0 || memcmp(reader->index_data + 4, &version, 4) != 0)
+	{
+		fprintf(stderr, "ERROR #%d: %s is not a result store\n", FREAD_ERROR, index_name);
+		result_store_close_reader(reader);
+		return FREAD_ERROR;
+	}
+	reader->entries = (const struct result_entry*) (reader->index_data + RESULT_INDEX_HEADER_LENGTH);
+	reader->num_entries = (reader->index_size - RESULT_INDEX_HEADER_LENGTH) / RESULT_ENTRY_LENGTH;
+	return SUCCESS;
+}
+
+void result_store_close_reader(struct result_store_reader* reader)
+{
+	int i;
+	for (i = 0; i < reader->num_mapped; i++)
+		if (reader->mapped[i].data != NULL)
+			munmap((void*) reader->mapped[i].data, reader->mapped[i].size);
+	reader->num_mapped = 0;
+	if (reader->index_data != NULL)
+		munmap((void*) reader->index_data, reader->index_size);
+	reader->index_data = NULL;
+	reader->entries = NULL;
+	reader->num_entries = 0;
+}
+
+const struct result_entry* result_store_entry(const struct result_store_reader* reader, int64_t experiment_id)
+{
+	if (experiment_id < 1 || (size_t) experiment_id > reader->num_entries)
+		return NULL;
+	return &reader->entries[experiment_id - 1];
+}
+
+int result_store_match(const struct result_entry* entry, const struct result_query* query)
+{
+	if (query->experiment_id != 0 && entry->experiment_id != query->experiment_id)
+		return 0;
+	if (query->probe_length != 0 && entry->probe_length != query->probe_length)
+		return 0;
+	if (query->initial_train_length != 0 && entry->initial_train_length != query->initial_train_length)
+		return 0;
+	if (query->seperation_train_length != 0 && entry->seperation_train_length != query->seperation_train_length)
+		return 0;
+	if (query->num_packet_trains != 0 && entry->num_packet_trains != query->num_packet_trains)
+		return 0;
+	if (query->class_set != 0 && entry->class_set != query->class_set)
+		return 0;
+	if (query->receiver != NULL && strncmp(entry->receiver, query->receiver, sizeof entry->receiver) != 0)
+		return 0;
+	if (query->sender != NULL)
+	{
+		char sender[INET_ADDRSTRLEN];
+		struct in_addr addr = { entry->sender_addr };
+		inet_ntop(AF_INET, &addr, sender, sizeof sender);
+		if (strcmp(sender, query->sender) != 0)
+			return 0;
+	}
+	if (query->date != NULL)
+	{
+		char date[16];
+		struct tm start_tm;
+		time_t start = (time_t) entry->start_wall_time;
+		localtime_r(&start, &start_tm);
+		strftime(date, sizeof date, "%Y-%m-%d", &start_tm);
+		if (strcmp(date, query->date) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * The mapping of segment, mapping it in place of the oldest one when
+ * it is not mapped yet
+ */
+static const struct result_segment_mapping* map_segment(struct result_store_reader* reader, uint32_t segment)
+{
+	int i;
+	for (i = 0; i < reader->num_mapped; i++)
+		if (reader->mapped[i].segment == segment)
+			return &reader->mapped[i];
+
+	if (reader->num_mapped == RESULT_MAX_MAPPED_SEGMENTS)
+	{
+		munmap((void*) reader->mapped[0].data, reader->mapped[0].size);
+		memmove(reader->mapped, reader->mapped + 1, (RESULT_MAX_MAPPED_SEGMENTS - 1) * sizeof reader->mapped[0]);
+		reader->num_mapped--;
+	}
+
+	char file_name[MAX_FILENAME_SIZE];
+	segment_file_name(reader->path, segment, file_name);
+	struct result_segment_mapping* mapping = &reader->mapped[reader->num_mapped];
+	if (map_file(file_name, &mapping->data, &mapping->size) != SUCCESS)
+		return NULL;
+	if (mapping->data == NULL)
+		return NULL;
+	madvise((void*) mapping->data, mapping->size, MADV_RANDOM);
+	mapping->segment = segment;
+	reader->num_mapped++;
+	return mapping;
+}
+
+error_t result_store_columns(struct result_store_reader* reader, const struct result_entry* entry,
+	struct result_columns* columns)
+{
+	const struct result_segment_mapping* mapping = map_segment(reader, entry->segment);
+	if (mapping == NULL)
+		return FREAD_ERROR;
+
+	size_t length = columns_length(entry->num_records);
+	if (entry->segment_offset < RESULT_ENTRY_LENGTH || (entry->segment_offset & 7) != 0 ||
+		(size_t) entry->segment_offset + length > mapping->size)
+	{
+		fprintf(stderr, "ERROR #%d: Run %lld is past the end of its segment\n", FREAD_ERROR,
+			(long long) entry->experiment_id);
+		return FREAD_ERROR;
+	}
+	point_columns((uint8_t*) mapping->data + entry->segment_offset, entry->num_records, columns);
+	return SUCCESS;
+}
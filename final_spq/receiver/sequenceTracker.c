@@ -0,0 +1,175 @@
+/*************************************************************
+** Sequence Tracker
+** See sequenceTracker.h for the metrics and their definitions.
+**************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sequenceTracker.h"
+
+void sequence_tracker_reset(struct sequence_tracker* tracker)
+{
+	memset(tracker, 0, sizeof *tracker);
+	tracker->max_seq_id = -1;
+
+	int i;
+	for (i = 0; i < REORDER_WINDOW; i++)
+		tracker->window[i].arrival_index = -1;
+}
+
+/*
+ * RFC 4737 reordering extent: arrivals since the earliest remembered
+ * probe with a higher sequence id. Capped at REORDER_WINDOW.
+ */
+static int reorder_extent(const struct sequence_tracker* tracker, int seq_id, int arrival_index)
+{
+	int earliest = arrival_index;
+	int i;
+	for (i = 0; i < REORDER_WINDOW; i++)
+	{
+		const struct reorder_entry* entry = &tracker->window[i];
+		if (entry->arrival_index >= 0 && entry->seq_id > seq_id && entry->arrival_index < earliest)
+			earliest = entry->arrival_index;
+	}
+
+	//The probe that overtook it has already left the window
+	if (earliest == arrival_index)
+		return REORDER_WINDOW;
+	return arrival_index - earliest;
+}
+
+void sequence_tracker_update(struct sequence_tracker* tracker, int seq_id,
+	int64_t rx_ns, int have_tx, int64_t tx_ns)
+{
+	int arrival_index = tracker->arrival_index++;
+
+	if (seq_id < 0 || seq_id >= MAX_TRACKED_SEQ)
+	{
+		tracker->out_of_range++;
+		return;
+	}
+
+	uint64_t bit = 1ULL << (seq_id & 63);
+	uint64_t* word = &tracker->seen_bitmap[seq_id >> 6];
+	if (*word & bit)
+	{
+		tracker->duplicates++;
+		return;
+	}
+	*word |= bit;
+	tracker->received++;
+	if (seq_id > tracker->max_seq_id)
+		tracker->max_seq_id = seq_id;
+
+	if (seq_id >= tracker->next_expected)
+	{
+		tracker->next_expected = seq_id + 1;
+	}
+	else
+	{
+		tracker->reordered++;
+		int extent = reorder_extent(tracker, seq_id, arrival_index);
+		if (extent > tracker->max_reorder_extent)
+			tracker->max_reorder_extent = extent;
+	}
+
+	struct reorder_entry* entry = &tracker->window[arrival_index % REORDER_WINDOW];
+	entry->seq_id = seq_id;
+	entry->arrival_index = arrival_index;
+
+	if (!have_tx)
+		return;
+
+	//RFC 5481 IPDV between consecutive arrivals, RFC 3550 jitter estimate
+	if (tracker->have_previous)
+	{
+		int64_t ipdv = (rx_ns - tracker->previous_rx_ns) - (tx_ns - tracker->previous_tx_ns);
+		int64_t abs_ipdv = ipdv < 0 ? -ipdv : ipdv;
+		tracker->ipdv_count++;
+		tracker->sum_abs_ipdv_ns += abs_ipdv;
+		if (abs_ipdv > tracker->max_abs_ipdv_ns)
+			tracker->max_abs_ipdv_ns = abs_ipdv;
+		tracker->jitter_ns += (abs_ipdv - tracker->jitter_ns) / 16.0;
+	}
+	tracker->have_previous = 1;
+	tracker->previous_rx_ns = rx_ns;
+	tracker->previous_tx_ns = tx_ns;
+}
+
+void sequence_tracker_summarize(const struct sequence_tracker* tracker, int expected,
+	struct sequence_summary* summary)
+{
+	memset(summary, 0, sizeof *summary);
+
+	if (expected <= 0)
+		expected = tracker->max_seq_id + 1;
+	if (expected > MAX_TRACKED_SEQ)
+		expected = MAX_TRACKED_SEQ;
+
+	summary->expected = expected;
+	summary->duplicates = tracker->duplicates;
+	summary->reordered = tracker->reordered;
+	summary->max_reorder_extent = tracker->max_reorder_extent;
+	summary->out_of_range = tracker->out_of_range;
+
+	//Walk the bitmap a word at a time, only looking at bits of
+	//words that have a hole in them
+	int run = 0;
+	int seq_id = 0;
+	while (seq_id < expected)
+	{
+		uint64_t word = tracker->seen_bitmap[seq_id >> 6];
+		int bits = expected - seq_id < 64 ? expected - seq_id : 64;
+		uint64_t mask = bits == 64 ? ~0ULL : ((1ULL << bits) - 1);
+
+		if ((word & mask) == mask)
+		{
+			summary->received += bits;
+			if (run > 0)
+			{
+				summary->loss_runs++;
+				run = 0;
+			}
+			seq_id += bits;
+			continue;
+		}
+
+		int b;
+		for (b = 0; b < bits; b++)
+		{
+			if ((word >> b) & 1)
+			{
+				summary->received++;
+				if (run > 0)
+				{
+					summary->loss_runs++;
+					run = 0;
+				}
+			}
+			else
+			{
+				summary->lost++;
+				run++;
+				if (run > summary->max_loss_run)
+					summary->max_loss_run = run;
+			}
+		}
+		seq_id += bits;
+	}
+	if (run > 0)
+		summary->loss_runs++;
+
+	if (tracker->ipdv_count > 0)
+	{
+		summary->jitter_ns = tracker->jitter_ns;
+		summary->mean_abs_ipdv_ns = tracker->sum_abs_ipdv_ns / tracker->ipdv_count;
+		summary->max_abs_ipdv_ns = tracker->max_abs_ipdv_ns;
+	}
+	else
+	{
+		summary->jitter_ns = -1;
+		summary->mean_abs_ipdv_ns = -1;
+		summary->max_abs_ipdv_ns = -1;
+	}
+}
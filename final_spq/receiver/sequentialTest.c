@@ -0,0 +1,106 @@
+/*************************************************************
+** Sequential H versus L Test
+** See sequentialTest.h for the pairing and the hypotheses.
+**************************************************************/
+
+#include <string.h>
+#include <math.h>
+
+#include "sequentialTest.h"
+
+void sequential_test_reset(struct sequential_test* test, const struct sequential_test_config* config,
+	int pair_class)
+{
+	memset(test, 0, sizeof *test);
+	test->pair_class = pair_class;
+	test->min_effect_ns = config->min_effect_ns;
+
+	//Wald's approximate boundaries
+	test->upper_bound = log((1 - config->beta) / config->alpha);
+	test->lower_bound = log(config->beta / (1 - config->alpha));
+
+	//Log likelihood ratio steps of one pair against P(X=1) = 0.5
+	test->step_slower = log(config->effect / 0.5);
+	test->step_faster = log((1 - config->effect) / 0.5);
+}
+
+static void add_pair(struct sequential_test* test, int64_t low_minus_high_ns)
+{
+	if (low_minus_high_ns == 0 || (low_minus_high_ns <= test->min_effect_ns &&
+		low_minus_high_ns >= -test->min_effect_ns))
+	{
+		test->ties++;
+		return;
+	}
+	test->pairs++;
+
+	if (low_minus_high_ns > 0)
+	{
+		test->llr_high_favoured += test->step_slower;
+		test->llr_low_favoured += test->step_faster;
+	}
+	else
+	{
+		test->llr_high_favoured += test->step_faster;
+		test->llr_low_favoured += test->step_slower;
+	}
+
+	if (test->pairs < SEQUENTIAL_MIN_PAIRS)
+		return;
+
+	if (test->llr_high_favoured >= test->upper_bound)
+		test->verdict = SEQUENTIAL_HIGH_FAVOURED;
+	else if (test->llr_low_favoured >= test->upper_bound)
+		test->verdict = SEQUENTIAL_LOW_FAVOURED;
+	else if (test->llr_high_favoured <= test->lower_bound && test->llr_low_favoured <= test->lower_bound)
+		test->verdict = SEQUENTIAL_NEUTRAL;
+
+	if (test->verdict != SEQUENTIAL_UNDECIDED)
+		test->decided_at_pair = test->pairs;
+}
+
+int sequential_test_observe(struct sequential_test* test, int class_index, int64_t delay_ns)
+{
+	if (test->verdict != SEQUENTIAL_UNDECIDED)
+		return test->verdict;
+
+	if (class_index == test->pair_class)
+	{
+		//Wait for the other-class probe that follows it
+		if (test->have_before)
+		{
+			test->have_pending = 1;
+			test->pending_delay_ns = delay_ns;
+			test->pending_before_ns = test->before_delay_ns;
+		}
+		return test->verdict;
+	}
+
+	if (test->have_pending)
+	{
+		int64_t bracket_ns = (test->pending_before_ns + delay_ns) / 2;
+		int64_t pair_diff = test->pending_delay_ns - bracket_ns;
+
+		//Orient the difference as 'L' minus 'H'
+		add_pair(test, test->pair_class == 1 ? pair_diff : -pair_diff);
+		test->have_pending = 0;
+	}
+	test->have_before = 1;
+	test->before_delay_ns = delay_ns;
+	return test->verdict;
+}
+
+const char* sequential_verdict_name(int verdict)
+{
+	switch (verdict)
+	{
+	case SEQUENTIAL_NEUTRAL:
+		return "neutral";
+	case SEQUENTIAL_HIGH_FAVOURED:
+		return "high_favoured";
+	case SEQUENTIAL_LOW_FAVOURED:
+		return "low_favoured";
+	default:
+		return "undecided";
+	}
+}
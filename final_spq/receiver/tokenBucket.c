@@ -0,0 +1,110 @@
+/*************************************************************
+** Token Bucket Detection
+** See tokenBucket.h for the profile of a stream and the fit.
+**************************************************************/
+
+#include <string.h>
+
+#include "tokenBucket.h"
+
+void rate_stream_profile(const struct rate_stream* stream, struct stream_profile* profile)
+{
+	memset(profile, 0, sizeof *profile);
+	profile->expected = stream->expected;
+	profile->received = stream->received;
+	profile->first_loss = profile->ramp_start = stream->expected;
+
+	int i, in_run = 0;
+	for (i = 0; i < stream->expected; i++)
+	{
+		if (stream->delay_ns[i] == INT64_MIN)
+		{
+			if (profile->first_loss == stream->expected)
+				profile->first_loss = i;
+			profile->loss_runs += !in_run;
+			in_run = 1;
+		}
+		else
+		{
+			in_run = 0;
+			profile->received_after_loss += i > profile->first_loss;
+		}
+	}
+
+	int64_t base = INT64_MAX;
+	int n = 0;
+	for (i = 0; i < stream->expected && n < TOKEN_BASE_PROBES; i++)
+	{
+		if (stream->delay_ns[i] == INT64_MIN)
+			continue;
+		if (stream->delay_ns[i] < base)
+			base = stream->delay_ns[i];
+		n++;
+	}
+	if (n == 0)
+		return;
+
+	int start = stream->expected, run = 0;
+	for (i = 0; i < stream->expected && run < TOKEN_RAMP_CONFIRM; i++)
+	{
+		if (stream->delay_ns[i] == INT64_MIN)
+			continue;
+		if (stream->delay_ns[i] - base <= TOKEN_RAMP_THRESHOLD_NS)
+			run = 0;
+		else if (run++ == 0)
+			start = i;
+	}
+	if (run < TOKEN_RAMP_CONFIRM)
+		return;
+
+	//Least squares line through the ramp, up to the first loss after it
+	int end = start;
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+	while (end < stream->expected && stream->delay_ns[end] != INT64_MIN)
+	{
+		double x = end, y = (double) (stream->delay_ns[end] - base);
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+		end++;
+	}
+	n = end - start;
+	double spread = n * sxx - sx * sx;
+	if (n < 2 || spread <= 0)
+		return;
+	//A ramp that does not climb past the threshold over its length is jitter
+	double slope = (n * sxy - sx * sy) / spread;
+	if (slope * n <= TOKEN_RAMP_THRESHOLD_NS)
+		return;
+
+	//The threshold is crossed a little after the delay starts to grow
+	double origin = (sy - slope * sx) / n;
+	double rise = -origin / slope;
+	profile->ramp_start = rise < 0 ? 0 : (rise < start ? (int) (rise + 0.5) : start);
+	profile->ramp_probes = end - profile->ramp_start;
+	profile->ramp_slope_ns = slope;
+}
+
+char token_bucket_infer(const struct stream_profile* profile, double rate_bps, int packet_bytes,
+	double* bucket_rate_bps, double* depth_bytes)
+{
+	*bucket_rate_bps = *depth_bytes = 0;
+	if (profile->ramp_probes >= TOKEN_RAMP_MIN_PROBES && profile->ramp_start < profile->first_loss)
+	{
+		double period_ns = packet_bytes * 8 * 1e9 / rate_bps;
+		*bucket_rate_bps = rate_bps * period_ns / (period_ns + profile->ramp_slope_ns);
+		*depth_bytes = profile->ramp_start * packet_bytes * (1 - *bucket_rate_bps / rate_bps);
+		return TOKEN_SHAPER;
+	}
+
+	int tail = profile->expected - profile->first_loss;
+	if (tail > 0 && tail - profile->received_after_loss > TOKEN_LOSS_FRACTION * tail)
+	{
+		//The first lost probe is part of the tail
+		*bucket_rate_bps = rate_bps * profile->received_after_loss / tail;
+		*depth_bytes = profile->first_loss * packet_bytes * (1 - *bucket_rate_bps / rate_bps);
+		return TOKEN_POLICER;
+	}
+	return TOKEN_CONFORMING;
+}
@@ -0,0 +1,142 @@
+/*************************************************************
+** UDP Reflector
+** See udpReflector.h. Runs as ./unitExperimentReceiver -r
+**************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "udpReflector.h"
+#include "probeHeader.h"
+#include "timeUtil.h"
+
+static volatile sig_atomic_t reflector_running = 1;
+
+static void handle_reflector_shutdown(int sig)
+{
+	reflector_running = 0;
+}
+
+/*
+ * Echo everything queued on sock. Returns the number of probes sent back.
+ */
+static int reflect_pending(int sock, unsigned long* num_short)
+{
+	static char buffers[REFLECT_BATCH_SIZE][MAX_PACKET_SIZE];
+	static char control_buffers[REFLECT_BATCH_SIZE][CMSG_SPACE(sizeof(struct timespec))];
+	static struct sockaddr_in from_addrs[REFLECT_BATCH_SIZE];
+	struct iovec iovs[REFLECT_BATCH_SIZE];
+	struct mmsghdr msgs[REFLECT_BATCH_SIZE];
+	int64_t rx_ns[REFLECT_BATCH_SIZE];
+
+	int num_reflected = 0;
+	int i;
+	while (1)
+	{
+		memset(msgs, 0, sizeof msgs);
+		for (i = 0; i < REFLECT_BATCH_SIZE; i++)
+		{
+			iovs[i].iov_base = buffers[i];
+			iovs[i].iov_len = MAX_PACKET_SIZE;
+			msgs[i].msg_hdr.msg_name = &from_addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof from_addrs[i];
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = control_buffers[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof control_buffers[i];
+		}
+
+		int received = recvmmsg(sock, msgs, REFLECT_BATCH_SIZE, MSG_DONTWAIT, NULL);
+		if (received <= 0)
+			return num_reflected;
+
+		for (i = 0; i < received; i++)
+		{
+			rx_ns[i] = timespec_to_ns(kernel_receive_timestamp(&msgs[i].msg_hdr));
+
+			//Echo exactly what was received, and nothing but the address
+			iovs[i].iov_len = msgs[i].msg_len;
+			msgs[i].msg_hdr.msg_control = NULL;
+			msgs[i].msg_hdr.msg_controllen = 0;
+		}
+
+		//Stamp as late as possible so the turnaround excludes the stamping
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		for (i = 0; i < received; i++)
+		{
+			if (!probe_header_reflect(buffers[i], (int) msgs[i].msg_len, rx_ns[i], timespec_to_ns(now)))
+				(*num_short)++;
+		}
+
+		int sent = 0;
+		while (sent < received)
+		{
+			int batch_sent = sendmmsg(sock, msgs + sent, received - sent, 0);
+			if (batch_sent <= 0)
+			{
+				if (batch_sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS))
+				{
+					struct pollfd out = { sock, POLLOUT, 0 };
+					poll(&out, 1, 10);
+					continue;
+				}
+				//Drop the rest of the batch rather than stall the reflector
+				break;
+			}
+			sent += batch_sent;
+		}
+		num_reflected += sent;
+	}
+}
+
+error_t UDPReflector (void)
+{
+	signal(SIGINT, handle_reflector_shutdown);
+	signal(SIGTERM, handle_reflector_shutdown);
+
+	const char* probe_ports[2] = { UDP_PROBE_PORT_NUMBER_HIGH, UDP_PROBE_PORT_NUMBER_LOW };
+	struct pollfd poll_fds[2];
+	int num_sockets = 0;
+	int i;
+	for (i = 0; i < 2; i++)
+	{
+		if (i > 0 && strcmp(probe_ports[i], probe_ports[0]) == 0)
+			continue;
+		int sock = open_probe_socket(probe_ports[i]);
+		if (sock == -1)
+			return SOCKET_SETUP_ERROR;
+		poll_fds[num_sockets].fd = sock;
+		poll_fds[num_sockets].events = POLLIN;
+		num_sockets++;
+	}
+
+	unsigned long num_reflected = 0;
+	unsigned long num_short = 0;
+	while (reflector_running)
+	{
+		if (poll(poll_fds, num_sockets, 100) < 0 && errno != EINTR)
+			break;
+		for (i = 0; i < num_sockets; i++)
+		{
+			if (poll_fds[i].revents & POLLIN)
+				num_reflected += reflect_pending(poll_fds[i].fd, &num_short);
+		}
+	}
+
+	for (i = 0; i < num_sockets; i++)
+		close(poll_fds[i].fd);
+
+	printf("reflected %lu probes", num_reflected);
+	if (num_short > 0)
+		printf(" (%lu too short to carry reflector times)", num_short);
+	printf("\n");
+	return SUCCESS;
+}
@@ -0,0 +1,85 @@
+/**************************************************************************
+** Raw File Refiner
+** Turn the .raw files written by unitExperimentReceiver into per phase
+** .dat files with every lost probe filled in as -1 (see rawRefiner.h).
+**
+** Parameters:
+**  (1) output_path = directory the .dat files are written to, with a
+**      trailing '/'
+**  (2) raw_file... = one or more .raw files, e.g. a whole campaign
+**  Optional flags:
+**  -p names   the sender run of each phase, default "LH" (the order of
+**             experimentRunSender.py); a phase past the names is written
+**             as _<phase>.dat
+**  -s initial_train_length seperation_train_length num_packet_trains
+**             the sender schedule, so losses at the end of a phase are
+**             filled in too
+**  -n num_packets
+**             without a schedule, fill every class up to num_packets
+**             lines, as the old refine script did
+**
+** For every .dat it writes, one line "file class received lost
+** duplicates" is printed.
+**
+** How To Run Code:
+**   ./unitExperimentRefiner [-p names] [-s initial seperation trains]
+**   [-n num_packets] output_path raw_file...
+**
+** Example:
+**   ./unitExperimentRefiner -s 2001 19 200 output_refined/ output_raw/campaign_*.raw
+**************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "taracomConstants.h"
+#include "rawRefiner.h"
+
+int main(int argc, char *argv[])
+{
+  struct refine_options options;
+  memset(&options, 0, sizeof options);
+  options.phase_names = DEFAULT_PHASE_NAMES;
+
+  int arg = 1;
+  while(arg < argc && argv[arg][0] == '-')
+  {
+    if(strcmp(argv[arg], "-p") == 0 && arg + 1 < argc)
+    {
+      options.phase_names = argv[arg + 1];
+      arg += 2;
+    }
+    else if(strcmp(argv[arg], "-s") == 0 && arg + 3 < argc)
+    {
+      options.have_schedule = 1;
+      options.initial_train_length = atoi(argv[arg + 1]);
+      options.seperation_train_length = atoi(argv[arg + 2]);
+      options.num_packet_trains = atoi(argv[arg + 3]);
+      arg += 4;
+    }
+    else if(strcmp(argv[arg], "-n") == 0 && arg + 1 < argc)
+    {
+      options.num_packets = atoi(argv[arg + 1]);
+      arg += 2;
+    }
+    else
+      break;
+  }
+
+  if(argc - arg < 2)
+  {
+    fprintf(stderr,"ERROR #%d: INVALID NUMBER OF ARGUMENTS\n", INVALID_NUMBER_OF_ARGUMENTS);
+    fprintf(stderr, "Usage: ./unitExperimentRefiner [-p names] [-s initial seperation trains] [-n num_packets] output_path raw_file...\n");
+    return INVALID_NUMBER_OF_ARGUMENTS;
+  }
+
+  //Keep going past a bad file so one of them does not stop a campaign
+  const char* output_path = argv[arg++];
+  error_t result = SUCCESS;
+  for(; arg < argc; arg++)
+  {
+    if(refine_raw_file(argv[arg], output_path, &options) != SUCCESS)
+      result = FAILURE;
+  }
+  return result;
+}
@@ -0,0 +1,375 @@
+/*************************************************************
+** Raw File Refiner
+** See rawRefiner.h for the input and output formats.
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rawRefiner.h"
+#include "captureArchive.h"
+
+//Where the arrival text of a probe lies in the mapping; length 0 if lost
+struct arrival_slice
+{
+	size_t offset;
+	int length;
+};
+
+struct class_arrivals
+{
+	int capacity;
+	int max_seq;
+	int duplicates;
+	struct arrival_slice* arrivals;
+};
+
+struct output_buffer
+{
+	FILE* file;
+	size_t used;
+	char data[REFINE_OUTPUT_BUFFER];
+};
+
+static void output_flush(struct output_buffer* out)
+{
+	fwrite(out->data, 1, out->used, out->file);
+	out->used = 0;
+}
+
+static inline void output_append(struct output_buffer* out, const char* text, size_t length)
+{
+	if (out->used + length > REFINE_OUTPUT_BUFFER)
+		output_flush(out);
+	memcpy(out->data + out->used, text, length);
+	out->used += length;
+}
+
+static inline void output_int(struct output_buffer* out, int value)
+{
+	char digits[12];
+	int length = 0;
+	do
+	{
+		digits[sizeof digits - 1 - length++] = (char) ('0' + value % 10);
+		value /= 10;
+	} while (value > 0);
+	output_append(out, digits + sizeof digits - length, length);
+}
+
+/*
+ * Record that probe seq_id of a class arrived at the given text.
+ * Returns 0 if the class table cannot grow to hold it.
+ */
+static int store_arrival(struct class_arrivals* arrivals, int seq_id, size_t offset, int length)
+{
+	if (seq_id >= arrivals->capacity)
+	{
+		int capacity = arrivals->capacity > 0 ? arrivals->capacity : 8192;
+		while (capacity <= seq_id)
+			capacity *= 2;
+		struct arrival_slice* grown = (struct arrival_slice*) realloc(arrivals->arrivals,
+			capacity * sizeof(struct arrival_slice));
+		if (grown == NULL)
+			return 0;
+		memset(grown + arrivals->capacity, 0, (capacity - arrivals->capacity) * sizeof(struct arrival_slice));
+		arrivals->arrivals = grown;
+		arrivals->capacity = capacity;
+	}
+
+	//The first arrival of a duplicated probe is the one that counts
+	struct arrival_slice* slice = &arrivals->arrivals[seq_id];
+	if (slice->length > 0)
+	{
+		arrivals->duplicates++;
+		return 1;
+	}
+	slice->offset = offset;
+	slice->length = length;
+	if (seq_id > arrivals->max_seq)
+		arrivals->max_seq = seq_id;
+	return 1;
+}
+
+/*
+ * Lines the sender scheduled for class_index in a run of the given
+ * priority, following UDPTrainGenerator, or -1 if it is not known
+ */
+static int scheduled_probes(const struct refine_options* options, int class_index, char priority)
+{
+	if (options->have_schedule)
+	{
+		int singles = options->num_packet_trains;
+		int runs = options->num_packet_trains * options->seperation_train_length;
+		if (class_index == 2)
+			return options->initial_train_length + singles + runs;
+		if (priority != 'H' && priority != 'L')
+			return -1;
+		if (class_index == 0)
+			return options->initial_train_length + (priority == 'L' ? runs : singles);
+		return priority == 'L' ? singles : runs;
+	}
+	return options->num_packets > 0 ? options->num_packets : -1;
+}
+
+/*
+ * Write one phase to its .dat file and clear the class tables for the next
+ */
+static error_t write_phase(const char* mapping, struct class_arrivals* classes, int phase,
+	const char* output_base, const struct refine_options* options, struct output_buffer* out)
+{
+	static const char* class_columns[REFINE_NUM_CLASSES] = { "\tH\t", "\tL\t", "\t" };
+	char priority = phase < (int) strlen(options->phase_names) ? options->phase_names[phase] : '\0';
+
+	char file_name[MAX_FILENAME_SIZE];
+	if (priority != '\0')
+		snprintf(file_name, sizeof file_name, "%s_%c.dat", output_base, priority);
+	else
+		snprintf(file_name, sizeof file_name, "%s_%d.dat", output_base, phase);
+
+	out->file = fopen(file_name, "w");
+	if (out->file == NULL)
+	{
+		fprintf(stderr, "ERROR #%d: Could not open %s\n", FILE_ERROR, file_name);
+		return FILE_ERROR;
+	}
+
+	int class_index, seq_id;
+	for (class_index = 0; class_index < REFINE_NUM_CLASSES; class_index++)
+	{
+		struct class_arrivals* arrivals = &classes[class_index];
+		int num_lines = arrivals->max_seq + 1;
+		if (num_lines == 0)
+			continue;
+		int scheduled = scheduled_probes(options, class_index, priority);
+		if (scheduled > num_lines)
+			num_lines = scheduled;
+
+		int received = 0;
+		for (seq_id = 0; seq_id < num_lines; seq_id++)
+		{
+			output_int(out, seq_id);
+			output_append(out, class_columns[class_index], strlen(class_columns[class_index]));
+			if (seq_id < arrivals->capacity && arrivals->arrivals[seq_id].length > 0)
+			{
+				output_append(out, mapping + arrivals->arrivals[seq_id].offset, arrivals->arrivals[seq_id].length);
+				received++;
+			}
+			else
+			{
+				output_append(out, "-1", 2);
+			}
+			output_append(out, "\n", 1);
+		}
+		printf("%s\t%c\t%d\t%d\t%d\n", file_name, class_index < 2 ? class_columns[class_index][1] : '-',
+			received, num_lines - received, arrivals->duplicates);
+
+		memset(arrivals->arrivals, 0, (arrivals->max_seq + 1) * sizeof(struct arrival_slice));
+		arrivals->max_seq = -1;
+		arrivals->duplicates = 0;
+	}
+
+	output_flush(out);
+	error_t result = ferror(out->file) ? FWRITE_ERROR : SUCCESS;
+	fclose(out->file);
+	return result;
+}
+
+int raw_parse_probe_line(const char* line, const char* line_end, int* seq_id, int* class_index,
+	const char** arrival, int* arrival_length)
+{
+	const char* p = line;
+	int value = 0;
+	if (p == line_end || *p < '0' || *p > '9')
+		return 0;
+	while (p < line_end && *p >= '0' && *p <= '9')
+	{
+		value = value * 10 + (*p++ - '0');
+		if (value > MAX_REFINE_SEQ)
+			return 0;
+	}
+	if (p == line_end || *p++ != '\t')
+		return 0;
+
+	*class_index = 2;
+	if (line_end - p >= 2 && (p[0] == 'H' || p[0] == 'L') && p[1] == '\t')
+	{
+		*class_index = p[0] == 'H' ? 0 : 1;
+		p += 2;
+	}
+
+	if (line_end > p && line_end[-1] == '\r')
+		line_end--;
+	if (p == line_end)
+		return 0;
+	*seq_id = value;
+	*arrival = p;
+	*arrival_length = (int) (line_end - p);
+	return 1;
+}
+
+int raw_arrival_ns(const char* arrival, int arrival_length, int64_t* arrival_ns)
+{
+	const char* p = arrival;
+	const char* end = arrival + arrival_length;
+	int64_t seconds = 0;
+	while (p < end && *p >= '0' && *p <= '9')
+		seconds = seconds * 10 + (*p++ - '0');
+	if (p == arrival || end - p != 10 || *p++ != '.')
+		return 0;
+
+	int64_t nanoseconds = 0;
+	while (p < end)
+	{
+		if (*p < '0' || *p > '9')
+			return 0;
+		nanoseconds = nanoseconds * 10 + (*p++ - '0');
+	}
+	*arrival_ns = seconds * 1000000000LL + nanoseconds;
+	return 1;
+}
+
+error_t raw_file_map_bytes(const char* raw_file, struct raw_mapping* mapping)
+{
+	mapping->data = NULL;
+	mapping->size = 0;
+	mapping->decoded = 0;
+
+	int fd = open(raw_file, O_RDONLY);
+	if (fd == -1)
+	{
+		fprintf(stderr, "ERROR #%d: Could not open %s\n", FILE_ERROR, raw_file);
+		return FILE_ERROR;
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) == -1)
+	{
+		close(fd);
+		return FREAD_ERROR;
+	}
+
+	//An empty file cannot be mapped, and has nothing to map
+	mapping->size = (size_t) file_stat.st_size;
+	if (mapping->size > 0)
+	{
+		void* data = mmap(NULL, mapping->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			close(fd);
+			fprintf(stderr, "ERROR #%d: Could not map %s\n", FREAD_ERROR, raw_file);
+			return FREAD_ERROR;
+		}
+		madvise(data, mapping->size, MADV_SEQUENTIAL);
+		mapping->data = (const char*) data;
+	}
+	close(fd);
+	return SUCCESS;
+}
+
+error_t raw_file_map(const char* raw_file, struct raw_mapping* mapping)
+{
+	error_t result = raw_file_map_bytes(raw_file, mapping);
+	if (result != SUCCESS)
+		return result;
+
+	if (archive_is_archive(mapping->data, mapping->size))
+	{
+		char* text;
+		size_t text_length;
+		error_t status = archive_decode_text(mapping->data, mapping->size, &text, &text_length);
+		munmap((void*) mapping->data, mapping->size);
+		mapping->data = NULL;
+		mapping->size = 0;
+		if (status != SUCCESS)
+		{
+			fprintf(stderr, "ERROR #%d: Could not decode %s\n", status, raw_file);
+			return status;
+		}
+		mapping->data = text;
+		mapping->size = text_length;
+		mapping->decoded = 1;
+	}
+	return SUCCESS;
+}
+
+void raw_file_unmap(struct raw_mapping* mapping)
+{
+	if (mapping->decoded)
+		free((void*) mapping->data);
+	else if (mapping->data != NULL)
+		munmap((void*) mapping->data, mapping->size);
+	mapping->data = NULL;
+	mapping->size = 0;
+}
+
+error_t refine_raw_file(const char* raw_file, const char* output_path, const struct refine_options* options)
+{
+	struct raw_mapping raw;
+	error_t result = raw_file_map(raw_file, &raw);
+	if (result != SUCCESS)
+		return result;
+	const char* mapping = raw.data;
+
+	//<output_path><file name without directory and extension>
+	const char* base_name = strrchr(raw_file, '/');
+	base_name = base_name != NULL ? base_name + 1 : raw_file;
+	const char* extension = strrchr(base_name, '.');
+	int base_length = extension != NULL ? (int) (extension - base_name) : (int) strlen(base_name);
+	char output_base[MAX_FILENAME_SIZE];
+	snprintf(output_base, sizeof output_base, "%s%.*s", output_path, base_length, base_name);
+
+	static struct output_buffer out;
+	struct class_arrivals classes[REFINE_NUM_CLASSES];
+	memset(classes, 0, sizeof classes);
+	int class_index;
+	for (class_index = 0; class_index < REFINE_NUM_CLASSES; class_index++)
+		classes[class_index].max_seq = -1;
+
+	int phase = 0;
+	int phase_lines = 0;
+	int skipped = 0;
+	const char* line = mapping;
+	const char* end = mapping + raw.size;
+	while (result == SUCCESS && line < end)
+	{
+		const char* line_end = (const char*) memchr(line, '\n', end - line);
+		if (line_end == NULL)
+			line_end = end;
+
+		if (*line == '*')
+		{
+			result = write_phase(mapping, classes, phase, output_base, options, &out);
+			phase++;
+			phase_lines = 0;
+		}
+		else
+		{
+			int seq_id, length;
+			const char* arrival;
+			if (!raw_parse_probe_line(line, line_end, &seq_id, &class_index, &arrival, &length))
+				skipped += line_end > line;
+			else if (!store_arrival(&classes[class_index], seq_id, arrival - mapping, length))
+				result = FAILURE;
+			else
+				phase_lines++;
+		}
+		line = line_end + 1;
+	}
+
+	//A file that does not end on "*" still has its last phase open
+	if (result == SUCCESS && (phase_lines > 0 || phase == 0))
+		result = write_phase(mapping, classes, phase, output_base, options, &out);
+
+	if (skipped > 0)
+		fprintf(stderr, "%s: skipped %d lines that are not probes\n", raw_file, skipped);
+
+	for (class_index = 0; class_index < REFINE_NUM_CLASSES; class_index++)
+		free(classes[class_index].arrivals);
+	raw_file_unmap(&raw);
+	return result;
+}
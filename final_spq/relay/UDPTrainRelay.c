@@ -0,0 +1,102 @@
+/**************************************************************************
+** Middlebox Relay
+** Stand in for the middlebox of an experiment tree on one machine: a
+** sender aimed at listen_address crosses the relay (middleboxRelay.h)
+** on its way to the receiver at forward_address. On loopback, e.g.
+** 127.0.0.2 and 127.0.0.1, the receiver daemon keeps its wildcard
+** probe ports and sees the relayed probes and the control channel come
+** from the same 127.0.0.1 sender.
+**
+** Parameters:
+**  (1) listen_address  = address the sender is aimed at
+**  (2) forward_address = address of the receiver
+**  Optional flags:
+**  -b mbps          bottleneck rate, default none
+**  -q packets       buffer of each queue, default 1000
+**  -P               strict priority by port: probes to the 'H' port first
+**  -D dscp          strict priority by DSCP: probes marked dscp first
+**  -z               compress payloads, serializing them at their
+**                   compressed size
+**  -t hex offset us delay probes carrying the bytes hex at payload
+**                   offset (-1 for anywhere) by us after the bottleneck
+**
+** Runs until SIGINT or SIGTERM, then prints per class counters.
+**
+** How To Run Code:
+**   ./unitExperimentRelay [-b mbps] [-q packets] [-P | -D dscp] [-z]
+**   [-t hex offset us] listen_address forward_address
+**
+** Examples:
+**   final_spq:   ./unitExperimentRelay -b 50 -P 127.0.0.2 127.0.0.1
+**   Delayer:     ./unitExperimentRelay -t ffffffff 16 1000 127.0.0.2 127.0.0.1
+**   Compression: ./unitExperimentRelay -b 20 -z 127.0.0.2 127.0.0.1
+**************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "taracomConstants.h"
+#include "middleboxRelay.h"
+
+int main(int argc, char *argv[])
+{
+  struct relay_config config;
+  relay_default_config(&config);
+  int valid = 1;
+
+  int arg = 1;
+  while(arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0' && valid)
+  {
+    if(strcmp(argv[arg], "-P") == 0)
+      config.classify = RELAY_CLASSIFY_PORT;
+    else if(strcmp(argv[arg], "-z") == 0)
+      config.compress = 1;
+    else if(strcmp(argv[arg], "-b") == 0 && arg + 1 < argc)
+      config.bottleneck_bps = atof(argv[++arg]) * 1e6;
+    else if(strcmp(argv[arg], "-q") == 0 && arg + 1 < argc)
+      config.buffer_packets = atoi(argv[++arg]);
+    else if(strcmp(argv[arg], "-D") == 0 && arg + 1 < argc)
+    {
+      config.classify = RELAY_CLASSIFY_DSCP;
+      config.high_dscp = atoi(argv[++arg]);
+      valid = config.high_dscp >= 0 && config.high_dscp < 64;
+    }
+    else if(strcmp(argv[arg], "-t") == 0 && arg + 3 < argc)
+    {
+      valid = relay_parse_pattern(&config, argv[arg + 1]);
+      config.pattern_offset = atoi(argv[arg + 2]);
+      config.trigger_delay_ns = (int64_t) (atof(argv[arg + 3]) * 1e3);
+      valid = valid && config.pattern_offset >= RELAY_PATTERN_ANYWHERE && config.trigger_delay_ns >= 0;
+      arg += 3;
+    }
+    else
+      valid = 0;
+    arg++;
+  }
+
+  if(!valid || argc - arg != 2 || config.bottleneck_bps < 0 || config.buffer_packets < 1)
+  {
+    fprintf(stderr,"ERROR #%d: INVALID NUMBER OF ARGUMENTS\n", INVALID_NUMBER_OF_ARGUMENTS);
+    fprintf(stderr, "Usage: ./unitExperimentRelay [-b mbps] [-q packets] [-P | -D dscp] [-z] [-t hex offset us] listen_address forward_address\n");
+    return INVALID_NUMBER_OF_ARGUMENTS;
+  }
+  config.listen_address = argv[arg];
+  config.forward_address = argv[arg + 1];
+
+  struct relay_counters counters;
+  error_t result = middlebox_relay_run(&config, &counters);
+  if(result != SUCCESS)
+    return result;
+
+  const char* class_names[2] = { "H", "L" };
+  printf("#class\treceived\tforwarded\tdropped\ttriggered\tpayload_bytes\tserialized_bytes\n");
+  int c;
+  for(c = 0; c < 2; c++)
+  {
+    printf("%s\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\n", class_names[c], counters.received[c], counters.forwarded[c],
+      counters.dropped[c], counters.triggered[c], counters.payload_bytes[c], counters.serialized_bytes[c]);
+  }
+  if(counters.send_errors > 0)
+    fprintf(stderr, "%llu probes could not be forwarded\n", counters.send_errors);
+  return SUCCESS;
+}
@@ -0,0 +1,141 @@
+/*************************************************************
+** LZ Coder
+** See lzCoder.h for the format.
+**************************************************************/
+
+#include <string.h>
+
+#include "lzCoder.h"
+
+static inline uint32_t read32(const uint8_t* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof value);
+	return value;
+}
+
+static inline int hash32(uint32_t value)
+{
+	return (int) ((value * 2654435761U) >> (32 - LZ_HASH_BITS));
+}
+
+/*
+ * Append a nibble's continuation bytes for a length of at least 15
+ */
+static inline uint8_t* write_length(uint8_t* out, int length)
+{
+	for (length -= 15; length >= 255; length -= 255)
+		*out++ = 255;
+	*out++ = (uint8_t) length;
+	return out;
+}
+
+/*
+ * Emit one sequence: literals, then a match unless match_length is 0
+ */
+static uint8_t* write_sequence(uint8_t* out, const uint8_t* literals, int num_literals, int offset, int match_length)
+{
+	int match_code = match_length > 0 ? match_length - LZ_MIN_MATCH : 0;
+	*out++ = (uint8_t) ((num_literals < 15 ? num_literals : 15) << 4 | (match_code < 15 ? match_code : 15));
+	if (num_literals >= 15)
+		out = write_length(out, num_literals);
+	memcpy(out, literals, num_literals);
+	out += num_literals;
+	if (match_length > 0)
+	{
+		*out++ = (uint8_t) (offset & 0xFF);
+		*out++ = (uint8_t) (offset >> 8);
+		if (match_code >= 15)
+			out = write_length(out, match_code);
+	}
+	return out;
+}
+
+int lz_compress(const uint8_t* input, int length, uint8_t* output, int capacity)
+{
+	if (length < 0 || capacity < LZ_MAX_COMPRESSED_LENGTH(length))
+		return -1;
+
+	int table[1 << LZ_HASH_BITS];
+	memset(table, 0xFF, sizeof table);
+
+	uint8_t* out = output;
+	int anchor = 0;
+	int position = 0;
+	while (position + LZ_MIN_MATCH <= length)
+	{
+		uint32_t sequence = read32(input + position);
+		int slot = hash32(sequence);
+		int candidate = table[slot];
+		table[slot] = position;
+		if (candidate < 0 || position - candidate > 0xFFFF || read32(input + candidate) != sequence)
+		{
+			position++;
+			continue;
+		}
+
+		int match_length = LZ_MIN_MATCH;
+		while (position + match_length < length && input[candidate + match_length] == input[position + match_length])
+			match_length++;
+		out = write_sequence(out, input + anchor, position - anchor, position - candidate, match_length);
+		position += match_length;
+		anchor = position;
+	}
+	out = write_sequence(out, input + anchor, length - anchor, 0, 0);
+	return (int) (out - output);
+}
+
+/*
+ * Read a nibble's continuation bytes. Returns -1 past the end of input.
+ */
+static inline int read_length(const uint8_t** in, const uint8_t* end, int length)
+{
+	uint8_t byte;
+	do
+	{
+		if (*in >= end)
+			return -1;
+		byte = *(*in)++;
+		length += byte;
+	} while (byte == 255);
+	return length;
+}
+
+int lz_decompress(const uint8_t* input, int length, uint8_t* output, int capacity)
+{
+	const uint8_t* in = input;
+	const uint8_t* end = input + length;
+	int position = 0;
+	while (in < end)
+	{
+		uint8_t token = *in++;
+		int num_literals = token >> 4;
+		if (num_literals == 15 && (num_literals = read_length(&in, end, num_literals)) < 0)
+			return -1;
+		if (num_literals > end - in || num_literals > capacity - position)
+			return -1;
+		memcpy(output + position, in, num_literals);
+		in += num_literals;
+		position += num_literals;
+
+		//The last sequence has no match
+		if (in == end)
+			break;
+		if (end - in < 2)
+			return -1;
+		int offset = in[0] | in[1] << 8;
+		in += 2;
+		int match_length = token & 0x0F;
+		if (match_length == 15 && (match_length = read_length(&in, end, match_length)) < 0)
+			return -1;
+		match_length += LZ_MIN_MATCH;
+		if (offset == 0 || offset > position || match_length > capacity - position)
+			return -1;
+
+		//Byte by byte, matches may overlap the bytes they produce
+		int i;
+		for (i = 0; i < match_length; i++, position++)
+			output[position] = output[position - offset];
+	}
+	return position;
+}
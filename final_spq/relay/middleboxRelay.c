@@ -0,0 +1,608 @@
+/*************************************************************
+** Middlebox Relay
+** See middleboxRelay.h for the behaviours.
+**************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <netinet/in.h>
+
+#include "middleboxRelay.h"
+#include "lzCoder.h"
+#include "probeHeader.h"
+#include "timeUtil.h"
+
+//Room for the compressed form of the largest datagram
+#define RELAY_SLOT_SIZE LZ_MAX_COMPRESSED_LENGTH(MAX_PACKET_SIZE)
+
+#define RELAY_CONTROL_SIZE (CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(int)))
+
+struct relay_packet
+{
+	int64_t arrival_ns;
+	int64_t release_ns;
+	int length;
+	int stored_length;
+	int compressed;
+	int port_index;
+	int tos;
+	int class_index;
+	int triggered;
+	uint8_t* data;
+};
+
+//Probes read from one listen socket, not yet admitted
+struct receive_batch
+{
+	int count;
+	int next;
+	int64_t arrivals[RELAY_BATCH_SIZE];
+	struct mmsghdr msgs[RELAY_BATCH_SIZE];
+	struct iovec iovs[RELAY_BATCH_SIZE];
+	char control_buffers[RELAY_BATCH_SIZE][RELAY_CONTROL_SIZE];
+	uint8_t buffers[RELAY_BATCH_SIZE][MAX_PACKET_SIZE];
+};
+
+//Indices into the packet pool, oldest first
+struct packet_ring
+{
+	int head;
+	int count;
+	int capacity;
+	int* items;
+};
+
+struct relay_state
+{
+	const struct relay_config* config;
+	struct relay_counters* counters;
+
+	int num_packets;
+	struct relay_packet* packets;
+	uint8_t* storage;
+	int* free_packets;
+	int num_free;
+
+	//The bottleneck queues by class, then the delay line in two parts
+	//that are each in release order: untriggered and triggered packets
+	struct packet_ring queues[2];
+	struct packet_ring delay_lines[2];
+	int64_t link_free_ns;
+
+	int listen_sockets[2];
+	struct receive_batch batches[2];
+	int send_socket;
+	struct sockaddr_in forward_addrs[2];
+};
+
+static volatile sig_atomic_t relay_stopping = 0;
+
+static void handle_relay_shutdown(int signal_number)
+{
+	relay_stopping = 1;
+}
+
+static int ring_init(struct packet_ring* ring, int capacity)
+{
+	ring->head = 0;
+	ring->count = 0;
+	ring->capacity = capacity;
+	ring->items = (int*) malloc(capacity * sizeof(int));
+	return ring->items != NULL;
+}
+
+static inline int ring_push(struct packet_ring* ring, int item)
+{
+	if (ring->count == ring->capacity)
+		return 0;
+	ring->items[(ring->head + ring->count++) % ring->capacity] = item;
+	return 1;
+}
+
+static inline int ring_front(const struct packet_ring* ring)
+{
+	return ring->items[ring->head];
+}
+
+static inline int ring_pop(struct packet_ring* ring)
+{
+	int item = ring->items[ring->head];
+	ring->head = (ring->head + 1) % ring->capacity;
+	ring->count--;
+	return item;
+}
+
+static inline int64_t serialization_ns(int bytes, double bps)
+{
+	return bps > 0 ? (int64_t) (bytes * 8.0 * NSEC_PER_SEC / bps) : 0;
+}
+
+static inline int64_t now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return timespec_to_ns(now);
+}
+
+void relay_default_config(struct relay_config* config)
+{
+	memset(config, 0, sizeof *config);
+	config->classify = RELAY_CLASSIFY_NONE;
+	config->buffer_packets = 1000;
+	config->pattern_offset = PROBE_HEADER_LENGTH;
+}
+
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+int relay_parse_pattern(struct relay_config* config, const char* hex)
+{
+	size_t length = strlen(hex);
+	if (length == 0 || length % 2 != 0 || length / 2 > RELAY_MAX_PATTERN_LENGTH)
+		return 0;
+	size_t i;
+	for (i = 0; i < length / 2; i++)
+	{
+		int high = hex_digit(hex[2 * i]), low = hex_digit(hex[2 * i + 1]);
+		if (high < 0 || low < 0)
+			return 0;
+		config->pattern[i] = (uint8_t) (high << 4 | low);
+	}
+	config->pattern_length = (int) (length / 2);
+	return 1;
+}
+
+static int matches_pattern(const struct relay_config* config, const uint8_t* payload, int length)
+{
+	if (config->pattern_length == 0)
+		return 0;
+	if (config->pattern_offset == RELAY_PATTERN_ANYWHERE)
+		return memmem(payload, length, config->pattern, config->pattern_length) != NULL;
+	return config->pattern_offset + config->pattern_length <= length &&
+		memcmp(payload + config->pattern_offset, config->pattern, config->pattern_length) == 0;
+}
+
+/*
+ * Non-blocking UDP socket bound to address:port that records kernel
+ * receive times and the TOS byte. Returns -1 on failure.
+ */
+static int open_listen_socket(const char* address, const char* port)
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	struct addrinfo* addr_info;
+	if (getaddrinfo(address, port, &hints, &addr_info) != 0)
+	{
+		fprintf(stderr, "ERROR #%d: Address Information Error\n", ADDRINFO_ERROR);
+		return -1;
+	}
+
+	int sock = socket(addr_info->ai_family, addr_info->ai_socktype, addr_info->ai_protocol);
+	if (sock == -1)
+	{
+		fprintf(stderr, "ERROR #%d: Socket Setup Error\n", SOCKET_SETUP_ERROR);
+		freeaddrinfo(addr_info);
+		return -1;
+	}
+	fcntl(sock, F_SETFL, O_NONBLOCK);
+
+	//The receiver daemon holds the wildcard address of the same ports
+	int enable = 1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *)&enable, sizeof(int));
+	setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, (char *)&enable, sizeof(int));
+	setsockopt(sock, IPPROTO_IP, IP_RECVTOS, (char *)&enable, sizeof(int));
+	int recv_buffer_size = PROBE_SOCKET_RCVBUF;
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char *)&recv_buffer_size, sizeof(int));
+
+	if (bind(sock, addr_info->ai_addr, addr_info->ai_addrlen) == -1)
+	{
+		fprintf(stderr, "ERROR #%d: Binding Error on %s:%s\n", BIND_ERROR, address, port);
+		close(sock);
+		freeaddrinfo(addr_info);
+		return -1;
+	}
+	freeaddrinfo(addr_info);
+	return sock;
+}
+
+static int resolve_forward_addr(const char* address, const char* port, struct sockaddr_in* addr)
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	struct addrinfo* addr_info;
+	if (getaddrinfo(address, port, &hints, &addr_info) != 0)
+	{
+		fprintf(stderr, "ERROR #%d: Address Information Error\n", ADDRINFO_ERROR);
+		return 0;
+	}
+	memcpy(addr, addr_info->ai_addr, sizeof *addr);
+	freeaddrinfo(addr_info);
+	return 1;
+}
+
+static int received_tos(struct msghdr* msg)
+{
+	struct cmsghdr* cmsg;
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
+	{
+		if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_TOS)
+			return *(uint8_t*) CMSG_DATA(cmsg);
+	}
+	return 0;
+}
+
+/*
+ * Take one received datagram into the queue of its class, or drop it
+ */
+static void admit_packet(struct relay_state* relay, int port_index, const uint8_t* payload, int length,
+	int64_t arrival_ns, int tos)
+{
+	const struct relay_config* config = relay->config;
+	//Counted by port unless DSCP decides; one FIFO queue unless classified
+	int class_index = port_index;
+	if (config->classify == RELAY_CLASSIFY_DSCP)
+		class_index = (tos >> 2) == config->high_dscp ? 0 : 1;
+
+	relay->counters->received[class_index]++;
+	relay->counters->payload_bytes[class_index] += length;
+	struct packet_ring* queue = &relay->queues[config->classify == RELAY_CLASSIFY_NONE ? 0 : class_index];
+	if (relay->num_free == 0 || queue->count == queue->capacity)
+	{
+		relay->counters->dropped[class_index]++;
+		return;
+	}
+
+	int index = relay->free_packets[--relay->num_free];
+	struct relay_packet* packet = &relay->packets[index];
+	packet->arrival_ns = arrival_ns;
+	packet->length = length;
+	packet->port_index = port_index;
+	packet->tos = tos;
+	packet->class_index = class_index;
+	packet->triggered = matches_pattern(config, payload, length);
+	packet->compressed = 0;
+	if (config->compress)
+	{
+		packet->stored_length = lz_compress(payload, length, packet->data, RELAY_SLOT_SIZE);
+		packet->compressed = packet->stored_length >= 0;
+	}
+	if (!packet->compressed)
+	{
+		memcpy(packet->data, payload, length);
+		packet->stored_length = length;
+	}
+	ring_push(queue, index);
+}
+
+static void serve_bottleneck(struct relay_state* relay, int64_t now);
+
+/*
+ * Refill a port's batch with one recvmmsg call once it is used up.
+ * Returns the probes left in it.
+ */
+static int fill_batch(struct relay_state* relay, int port_index)
+{
+	struct receive_batch* batch = &relay->batches[port_index];
+	if (batch->next < batch->count)
+		return batch->count - batch->next;
+
+	int i;
+	memset(batch->msgs, 0, sizeof batch->msgs);
+	for (i = 0; i < RELAY_BATCH_SIZE; i++)
+	{
+		batch->iovs[i].iov_base = batch->buffers[i];
+		batch->iovs[i].iov_len = MAX_PACKET_SIZE;
+		batch->msgs[i].msg_hdr.msg_iov = &batch->iovs[i];
+		batch->msgs[i].msg_hdr.msg_iovlen = 1;
+		batch->msgs[i].msg_hdr.msg_control = batch->control_buffers[i];
+		batch->msgs[i].msg_hdr.msg_controllen = RELAY_CONTROL_SIZE;
+	}
+	int received = recvmmsg(relay->listen_sockets[port_index], batch->msgs, RELAY_BATCH_SIZE, MSG_DONTWAIT, NULL);
+	batch->next = 0;
+	batch->count = received > 0 ? received : 0;
+	for (i = 0; i < batch->count; i++)
+		batch->arrivals[i] = timespec_to_ns(kernel_receive_timestamp(&batch->msgs[i].msg_hdr));
+	return batch->count;
+}
+
+/*
+ * Admit everything waiting on both ports, merged into kernel receive
+ * order. Every probe finds the queues as they were when it arrived,
+ * however late it is read.
+ */
+static void receive_pending(struct relay_state* relay)
+{
+	while (1)
+	{
+		int high = fill_batch(relay, 0), low = fill_batch(relay, 1);
+		if (high == 0 && low == 0)
+			return;
+		int port_index = low == 0 || (high > 0 &&
+			relay->batches[0].arrivals[relay->batches[0].next] <= relay->batches[1].arrivals[relay->batches[1].next]) ? 0 : 1;
+
+		struct receive_batch* batch = &relay->batches[port_index];
+		int i = batch->next++;
+		serve_bottleneck(relay, batch->arrivals[i]);
+		admit_packet(relay, port_index, batch->buffers[i], (int) batch->msgs[i].msg_len, batch->arrivals[i],
+			received_tos(&batch->msgs[i].msg_hdr));
+	}
+}
+
+/*
+ * Start every packet the bottleneck can have started by now, in strict
+ * priority, and move it to the delay line at the time it is through
+ */
+static void serve_bottleneck(struct relay_state* relay, int64_t now)
+{
+	const struct relay_config* config = relay->config;
+	while (relay->queues[0].count > 0 || relay->queues[1].count > 0)
+	{
+		//The link picks among what had arrived when it became free
+		int64_t earliest = INT64_MAX;
+		int q;
+		for (q = 0; q < 2; q++)
+		{
+			if (relay->queues[q].count > 0 && relay->packets[ring_front(&relay->queues[q])].arrival_ns < earliest)
+				earliest = relay->packets[ring_front(&relay->queues[q])].arrival_ns;
+		}
+		int64_t start = relay->link_free_ns > earliest ? relay->link_free_ns : earliest;
+		if (start > now)
+			return;
+		q = relay->queues[0].count > 0 && relay->packets[ring_front(&relay->queues[0])].arrival_ns <= start ? 0 : 1;
+
+		int index = ring_pop(&relay->queues[q]);
+		struct relay_packet* packet = &relay->packets[index];
+		int serialized = packet->stored_length + RELAY_PACKET_OVERHEAD;
+		relay->counters->serialized_bytes[packet->class_index] += serialized;
+		relay->link_free_ns = start + serialization_ns(serialized, config->bottleneck_bps);
+		packet->release_ns = relay->link_free_ns;
+		if (packet->triggered)
+		{
+			packet->release_ns += config->trigger_delay_ns;
+			relay->counters->triggered[packet->class_index]++;
+		}
+
+		//Each part of the delay line holds up to the whole pool
+		ring_push(&relay->delay_lines[packet->triggered ? 1 : 0], index);
+	}
+}
+
+/*
+ * Index of the delay line whose front is due first, or -1 if both are
+ * empty; its release time goes to release_ns
+ */
+static int next_release(const struct relay_state* relay, int64_t* release_ns)
+{
+	int line = -1;
+	int d;
+	for (d = 0; d < 2; d++)
+	{
+		if (relay->delay_lines[d].count == 0)
+			continue;
+		int64_t release = relay->packets[ring_front(&relay->delay_lines[d])].release_ns;
+		if (line < 0 || release < *release_ns)
+		{
+			line = d;
+			*release_ns = release;
+		}
+	}
+	return line;
+}
+
+static void send_batch(struct relay_state* relay, struct mmsghdr* msgs, const int* indices, int count)
+{
+	int sent = 0;
+	while (sent < count)
+	{
+		int batch_sent = sendmmsg(relay->send_socket, msgs + sent, count - sent, 0);
+		if (batch_sent > 0)
+		{
+			int i;
+			for (i = sent; i < sent + batch_sent; i++)
+				relay->counters->forwarded[relay->packets[indices[i]].class_index]++;
+			sent += batch_sent;
+			continue;
+		}
+		if (batch_sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS))
+		{
+			struct pollfd out = { relay->send_socket, POLLOUT, 0 };
+			poll(&out, 1, 10);
+			continue;
+		}
+
+		//The first message of the rest failed on its own, skip it
+		relay->counters->send_errors++;
+		sent++;
+	}
+
+	int i;
+	for (i = 0; i < count; i++)
+		relay->free_packets[relay->num_free++] = indices[i];
+}
+
+/*
+ * Forward everything due by now in sendmmsg batches, in release order
+ */
+static void release_due(struct relay_state* relay, int64_t now)
+{
+	static uint8_t buffers[RELAY_BATCH_SIZE][MAX_PACKET_SIZE];
+	static char control_buffers[RELAY_BATCH_SIZE][CMSG_SPACE(sizeof(int))];
+	struct iovec iovs[RELAY_BATCH_SIZE];
+	struct mmsghdr msgs[RELAY_BATCH_SIZE];
+	int indices[RELAY_BATCH_SIZE];
+	int count = 0;
+
+	int64_t release_ns;
+	int line;
+	while ((line = next_release(relay, &release_ns)) >= 0 && release_ns <= now)
+	{
+		int index = ring_pop(&relay->delay_lines[line]);
+		struct relay_packet* packet = &relay->packets[index];
+		memset(&msgs[count], 0, sizeof msgs[count]);
+		if (packet->compressed)
+		{
+			int length = lz_decompress(packet->data, packet->stored_length, buffers[count], MAX_PACKET_SIZE);
+			iovs[count].iov_base = buffers[count];
+			iovs[count].iov_len = length > 0 ? length : 0;
+		}
+		else
+		{
+			iovs[count].iov_base = packet->data;
+			iovs[count].iov_len = packet->length;
+		}
+		msgs[count].msg_hdr.msg_name = &relay->forward_addrs[packet->port_index];
+		msgs[count].msg_hdr.msg_namelen = sizeof relay->forward_addrs[packet->port_index];
+		msgs[count].msg_hdr.msg_iov = &iovs[count];
+		msgs[count].msg_hdr.msg_iovlen = 1;
+
+		//Keep the DSCP for whatever classifies after the relay
+		msgs[count].msg_hdr.msg_control = control_buffers[count];
+		msgs[count].msg_hdr.msg_controllen = sizeof control_buffers[count];
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msgs[count].msg_hdr);
+		cmsg->cmsg_level = IPPROTO_IP;
+		cmsg->cmsg_type = IP_TOS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &packet->tos, sizeof(int));
+
+		indices[count++] = index;
+		if (count == RELAY_BATCH_SIZE)
+		{
+			send_batch(relay, msgs, indices, count);
+			count = 0;
+		}
+	}
+	if (count > 0)
+		send_batch(relay, msgs, indices, count);
+}
+
+static error_t relay_open(struct relay_state* relay, const struct relay_config* config, struct relay_counters* counters)
+{
+	memset(relay, 0, sizeof *relay);
+	relay->config = config;
+	relay->counters = counters;
+	relay->listen_sockets[0] = relay->listen_sockets[1] = relay->send_socket = -1;
+
+	relay->num_packets = 2 * config->buffer_packets + RELAY_DELAY_LINE_PACKETS;
+	relay->packets = (struct relay_packet*) calloc(relay->num_packets, sizeof(struct relay_packet));
+	relay->storage = (uint8_t*) malloc((size_t) relay->num_packets * RELAY_SLOT_SIZE);
+	relay->free_packets = (int*) malloc(relay->num_packets * sizeof(int));
+	if (relay->packets == NULL || relay->storage == NULL || relay->free_packets == NULL ||
+		!ring_init(&relay->queues[0], config->buffer_packets) || !ring_init(&relay->queues[1], config->buffer_packets) ||
+		!ring_init(&relay->delay_lines[0], relay->num_packets) || !ring_init(&relay->delay_lines[1], relay->num_packets))
+	{
+		fprintf(stderr, "ERROR #%d: Could not allocate %d relay packets\n", FAILURE, relay->num_packets);
+		return FAILURE;
+	}
+	int i;
+	for (i = 0; i < relay->num_packets; i++)
+	{
+		relay->packets[i].data = relay->storage + (size_t) i * RELAY_SLOT_SIZE;
+		relay->free_packets[i] = relay->num_packets - 1 - i;
+	}
+	relay->num_free = relay->num_packets;
+
+	const char* probe_ports[2] = { UDP_PROBE_PORT_NUMBER_HIGH, UDP_PROBE_PORT_NUMBER_LOW };
+	for (i = 0; i < 2; i++)
+	{
+		relay->listen_sockets[i] = open_listen_socket(config->listen_address, probe_ports[i]);
+		if (relay->listen_sockets[i] == -1 || !resolve_forward_addr(config->forward_address, probe_ports[i], &relay->forward_addrs[i]))
+			return SOCKET_SETUP_ERROR;
+	}
+	relay->send_socket = socket(AF_INET, SOCK_DGRAM, 0);
+	if (relay->send_socket == -1)
+	{
+		fprintf(stderr, "ERROR #%d: Socket Setup Error\n", SOCKET_SETUP_ERROR);
+		return SOCKET_SETUP_ERROR;
+	}
+	fcntl(relay->send_socket, F_SETFL, O_NONBLOCK);
+	int send_buffer_size = PROBE_SOCKET_RCVBUF;
+	setsockopt(relay->send_socket, SOL_SOCKET, SO_SNDBUF, (char *)&send_buffer_size, sizeof(int));
+	return SUCCESS;
+}
+
+static void relay_close(struct relay_state* relay)
+{
+	int i;
+	for (i = 0; i < 2; i++)
+	{
+		if (relay->listen_sockets[i] != -1)
+			close(relay->listen_sockets[i]);
+		free(relay->queues[i].items);
+		free(relay->delay_lines[i].items);
+	}
+	if (relay->send_socket != -1)
+		close(relay->send_socket);
+	free(relay->packets);
+	free(relay->storage);
+	free(relay->free_packets);
+}
+
+error_t middlebox_relay_run(const struct relay_config* config, struct relay_counters* counters)
+{
+	memset(counters, 0, sizeof *counters);
+	static struct relay_state relay;
+	error_t status = relay_open(&relay, config, counters);
+	if (status != SUCCESS)
+	{
+		relay_close(&relay);
+		return status;
+	}
+
+	//No SA_RESTART, so a signal ends the wait for the next packet
+	struct sigaction action;
+	memset(&action, 0, sizeof action);
+	action.sa_handler = handle_relay_shutdown;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	//Departures are timed to the microsecond, not to the default 50 us slack
+	prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+
+	struct pollfd poll_fds[2] = { { relay.listen_sockets[0], POLLIN, 0 }, { relay.listen_sockets[1], POLLIN, 0 } };
+	while (!relay_stopping)
+	{
+		receive_pending(&relay);
+		int64_t now = now_ns();
+		serve_bottleneck(&relay, now);
+		release_due(&relay, now);
+
+		//Wake up for the next departure, the bottleneck's or the delay line's
+		int64_t next_ns = INT64_MAX;
+		int64_t release_ns;
+		if (next_release(&relay, &release_ns) >= 0)
+			next_ns = release_ns;
+		if ((relay.queues[0].count > 0 || relay.queues[1].count > 0) && relay.link_free_ns < next_ns)
+			next_ns = relay.link_free_ns;
+
+		now = now_ns();
+		if (next_ns - now < RELAY_SPIN_NS)
+			continue;
+		struct timespec timeout = ns_to_timespec(next_ns - now - RELAY_SPIN_NS / 2);
+		ppoll(poll_fds, 2, next_ns == INT64_MAX ? NULL : &timeout, NULL);
+	}
+
+	relay_close(&relay);
+	return SUCCESS;
+}
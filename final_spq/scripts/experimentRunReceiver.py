@@ -16,53 +16,20 @@ import datetime
 import time
 import ConfigParser
 
-def refine_live_experiment_outputfile(filename, number_of_packets, refined_results_file_path):
-    # break raw experiment file into two subfiles at the asterisk
-    input = open(filename, 'r')
-    data = input.readlines()
-    input.close()
-    A = []
-    B = []
-    # Extract the pure filename (no extension) for writing purposes
-    fname = os.path.splitext(filename)[0]
-    fname = fname.split('/')[1]
-    outputA = open(refined_results_file_path+fname + "_L.dat", 'w') # Open the "_A.dat" file
-
-    ###################################
-    # If asterisk, split into two files
-    ###################################
-    splitchar = "*\n"
-    # If the file contains an asterisk, split into A and B lists
-    if splitchar in data:
-        outputB = open(refined_results_file_path+fname + "_H.dat", 'w') # We'll need to also open a "_B.dat" file
-        s_index = data.index(splitchar)
-        # Go up until the asterisk...
-        for i in range(0, s_index):
-            A.append(data[i])
-        # Start one past the asterisk, go until the end
-        for i in range(s_index + 1, len(data)):
-            B.append(data[i])
-    else: # No asterisk => just the A list
-        for i in range(0, len(data)):
-            A.append(data[i])
-
-    ###################################
-    # Fill in with "-1" up to "number_of_packets"
-    ###################################
-    filelists = [A]
-    if len(B): filelists.append(B) # Only add B to the list if it has data
-    for x in filelists:
-        for j in range(len(x), number_of_packets):
-            # We will not go inside this loop if len(x) >= number_of_packets
-            x.append(str(j) + "\t-1\n")
-
-    if len(A):
-        outputA.write("".join(A))
-        # print "_A.dat was successful"
-
-    if len(B):
-        outputB.write("".join(B))
-        # print "_B.dat was successful"
+def refine_live_experiment_outputfile(filename, number_of_packets, refined_results_file_path, schedule=None):
+    # Refining is done by the native ./unitExperimentRefiner, which writes
+    # one .dat per phase (_L.dat for the first run, _H.dat for the second)
+    # with every lost probe filled in as -1 at its place in the sequence.
+    # schedule = (initial_train_length, seperation_train_length, num_packet_trains)
+    # also fills the losses at the end of a run; without it every class is
+    # filled up to number_of_packets lines.
+    args = ["./unitExperimentRefiner"]
+    if schedule:
+        args += ["-s"] + [str(x) for x in schedule]
+    else:
+        args += ["-n", str(number_of_packets)]
+    args += [refined_results_file_path, filename]
+    return subprocess.call(args)
 
 
 #Open Config File to Extract Values
@@ -82,6 +49,10 @@ raw_results_file_path = config.get('DEFAULT', 'raw_results_file_path') #receive
 refined_results_file_path = config.get('DEFAULT', 'refined_results_file_path') #receive from config file
 temp_results_file_path = config.get('DEFAULT', 'temp_results_file_path') #receive from config file
 experiment_scenario_id = config.getint('DEFAULT', 'experiment_scenario_id') #receive from config file
+refine_schedule = None
+if config.has_option('DEFAULT', 'initial_num_of_packets'):
+	refine_schedule = (config.getint('DEFAULT', 'initial_num_of_packets'),
+		config.getint('DEFAULT', 'seperation_train_length'), config.getint('DEFAULT', 'num_packet_trains'))
 
 # Close config file
 config_file.close()
@@ -118,12 +89,15 @@ os.system(args)
 #refine_live_experiment_outputfile("", 1, "./")
 
 # #get raw file name
+# The single-shot receiver above captures one experiment per process, so temp/
+# holds exactly its file. Overlapping experiments need the daemon (-d) with
+# tagged senders (-E) and a result store (-S), which this script does not drive.
 temp_files = os.listdir(temp_results_file_path)
 if (len(temp_files) == 1):
 	temp_file = temp_results_file_path + temp_files[0]
 
 	# # Refine the raw file and store in new refined file
-	refine_live_experiment_outputfile(temp_file, num_of_packets, refined_results_file_path)
+	refine_live_experiment_outputfile(temp_file, num_of_packets, refined_results_file_path, refine_schedule)
 
 	# Move raw file to raw file path
 	raw_file = raw_results_file_path + temp_file.split('/')[1]
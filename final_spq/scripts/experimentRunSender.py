@@ -29,6 +29,12 @@ inter_experiment_sleep_time = config.getint('DEFAULT', 'inter_experiment_sleep_t
 experiment_scenario_id = config.getint('DEFAULT', 'experiment_scenario_id') #receive from config file
 log_file_path = config.get('DEFAULT', 'log_file_path') #receive from config file
 
+#With the control channel the receiver daemon is told where each run starts
+#and ends, so there is no need to sleep between runs
+use_control_channel = 0
+if config.has_option('DEFAULT', 'use_control_channel'):
+	use_control_channel = config.getint('DEFAULT', 'use_control_channel')
+
 #set time stamp
 current_time = datetime.datetime.now() #formatted time from python
 current_timestamp_string = current_time.strftime("%Y-%m-%d--%H-%M")
@@ -43,6 +49,8 @@ log_file = open(log_data_file, 'w+')
 
 #arguments to be given to subprocess
 args = ["./unitExperimentSender",initial_num_of_packets, seperation_train_length, num_packet_trains, probe_packet_length, compression_node_addr, priority]
+if use_control_channel:
+	args.insert(1, "-c")
 str_args = [ str(x) for x in args ] #convert args to string
 
 # Execute the following command in terminal
@@ -57,7 +65,8 @@ log_file.close()
 
 ############################################################################
 # Wait 1 minute after first unitExperiment is done
-time.sleep(inter_experiment_sleep_time)
+if not use_control_channel:
+	time.sleep(inter_experiment_sleep_time)
 ############################################################################
 
 # Run for low priority
@@ -70,6 +79,8 @@ log_file = open(log_data_file, 'w+')
 
 #arguments to be given to subprocess
 args = ["./unitExperimentSender",initial_num_of_packets, seperation_train_length, num_packet_trains, probe_packet_length, compression_node_addr, priority]
+if use_control_channel:
+	args.insert(1, "-F")
 str_args = [ str(x) for x in args ] #convert args to string
 
 # Execute the following command in terminal
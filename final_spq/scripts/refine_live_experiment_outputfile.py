@@ -16,70 +16,33 @@
 # to break the output file into two subfiles, using the asterisk as
 # the breakpoint.
 #
-# If the original outputfile contains less than "number_of_packets"
-# packets, then we need to fill out the rest of the outputfile with
-# -1's, to account for those packets that were lost.
+# Every lost packet is filled in with a -1 at its place in the sequence,
+# and each class is filled up to "number_of_packets" lines.
 #
-# OUTPUT: Two experiment output files, broken apart at the asterisk.
-# originalname.raw --> originalname_A.dat & originalname_B.dat
-
-# If there is no asterisk in the input file, then we'll only produce
-# the _A.dat file.
-# originalname.raw --> originalname_A.dat
+# OUTPUT: One experiment output file per chunk, named after the sender
+# run that produced it (the 'L' run comes first, then the 'H' run).
+# originalname.raw --> originalname_L.dat & originalname_H.dat
 #
 # Example:  (VAHAB)
-# refine_live_experiment_outputfile("131.179.192.201_2014-03-25_17_53_47.raw", 10100)
+# refine_live_experiment_outputfile("131.179.192.201_2014-03-25_17_53_47.raw", 10100, "output_refined/")
 #
 
+# The refining itself is now done by the native ./unitExperimentRefiner
+# (refine/), which streams the raw file instead of reading it whole and
+# fills losses at their true sequence gaps. This wrapper keeps the old
+# entry point for scripts that still import it.
+#
+# Usage: python refine_live_experiment_outputfile.py raw_file number_of_packets refined_results_file_path
 
-import os
+import subprocess
+import sys
 
 def refine_live_experiment_outputfile(filename, number_of_packets, refined_results_file_path):
-    # break raw experiment file into two subfiles at the asterisk
-    input = open(filename, 'rU')
-    data = input.readlines()
-    input.close()
-    A = []
-    B = []
-    # Extract the pure filename (no extension) for writing purposes
-    fname = os.path.splitext(filename)[0]
-    outputA = open(refined_results_file_path+fname + "_A.dat", 'w') # Open the "_A.dat" file
-
-    ###################################
-    # If asterisk, split into two files
-    ###################################
-    splitchar = "*\n"
-    # If the file contains an asterisk, split into A and B lists
-    if splitchar in data:
-        outputB = open(fname + "_B.dat", 'w') # We'll need to also open a "_B.dat" file
-        s_index = data.index(splitchar)
-        # Go up until the asterisk...
-        for i in range(0, s_index):
-            A.append(data[i])
-        # Start one past the asterisk, go until the end
-        for i in range(s_index + 1, len(data)):
-            B.append(data[i])
-    else: # No asterisk => just the A list
-        for i in range(0, len(data)):
-            A.append(data[i])
-
-    ###################################
-    # Fill in with "-1" up to "number_of_packets"
-    ###################################
-    filelists = [A]
-    if len(B): filelists.append(B) # Only add B to the list if it has data
-    for x in filelists:
-        for j in range(len(x), number_of_packets):
-            # We will not go inside this loop if len(x) >= number_of_packets
-            x.append(str(j) + "\t-1\n")
-
-    if len(A):
-        outputA.write("".join(A))
-        # print "_A.dat was successful"
-
-    if len(B):
-        outputB.write("".join(B))
-        # print "_B.dat was successful"
-
-
-refine_live_experiment_outputfile(temp_file, num_of_packets, refined_results_file_path)
\ No newline at end of file
+    return subprocess.call(["./unitExperimentRefiner", "-n", str(number_of_packets),
+        refined_results_file_path, filename])
+
+if __name__ == "__main__":
+    if len(sys.argv) != 4:
+        print "Usage: python refine_live_experiment_outputfile.py raw_file number_of_packets refined_results_file_path"
+        sys.exit(1)
+    sys.exit(refine_live_experiment_outputfile(sys.argv[1], int(sys.argv[2]), sys.argv[3]))
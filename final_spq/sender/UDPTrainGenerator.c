@@ -22,14 +22,71 @@
 **  (4) probe_payload_length = Size of each packet. [0,1500] in bytes.
 **  (5) receiver_address = ip4 address of compression node X??.X??.X??.X??
 **  (6) priority = priority either 'H' or 'L'
+**  Optional flags, before (1)-(6):
+**  -c  announce the train to the receiver daemon over the control channel
+**  -F  also tell the receiver to finalize the experiment afterwards
+**      (implies -c, use it on the last run of an experiment)
+**  -R  the receiver is a reflector (unitExperimentReceiver -r): collect
+**      the echoes, report round trip and reverse path delays and
+**      write them to ./temp/
+**  -P pattern
+**      send the train pattern (trainPattern.h) instead of the schedule
+**      of (1)-(3), e.g. "2001H (1L 4H 1L 14H)x200"; (1)-(3) are still
+**      what the receiver is told on the control channel
+**
+**  -T template_file
+**      dress the probes up as an application protocol (probeTemplate.h),
+**      e.g. templates/rtp.tmpl; the probe header moves to the template's
+**      probe_offset, which the receiver daemon has to be given with -T
+**
+**  -r trace.pcap
+**      replay a captured trace (pcapTrace.h) with its timing and sizes
+**      as probes of priority, with a control flow of the other class
+**      interleaved; prints how late the probes left against the trace
+**  -W  rewrite the trace payloads to start with the probe header, so
+**      the receiver measures the trace flow too
+**  -C interval_us
+**      control flow interval, 10000 by default, 0 for none
+**
+**  -X load
+**      run background cross traffic next to the probes (crossTraffic.h),
+**      e.g. "rate=50M,class=L,threads=2,on=pareto:20ms,off=exp:10ms";
+**      it starts its lead time before the first probe and its achieved
+**      rate is printed at the end
+**
+**  -A min_mbps:max_mbps[:resolution_mbps]
+**      instead of an experiment, search the available bandwidth of the
+**      'H' and then the 'L' class with the receiver daemon, pathload
+**      style (bandwidthSearch.h): fleets of periodic streams, the next
+**      rate chosen by the receiver from their one-way delay trends
+**
+**  -B min_mbps:max_mbps[:rate_steps]
+**      instead of an experiment, look for a token bucket policer or
+**      shaper on the 'H' and then the 'L' class (tokenBucket.h):
+**      streams of 100, 300 and 1000 probes at rate_steps rates (4 by
+**      default) from min_mbps to max_mbps; the receiver fits a bucket
+**      rate and depth to each stream's losses and delay ramp
+**
+**  -E tag
+**      experiment tag (1 to 65535) carried in every probe header and
+**      in HELLO/FINALIZE, so the receiver daemon keeps overlapping
+**      experiments of this host apart; use a different tag per run
+**
+** Whatever the schedule, it is compiled once into a flat array of
+** probes and sent in batches of the probes that are due, each probe
+** with a header in a call of its own (send_pattern).
 **
 ** How To Run Code:
-**   ./unitExperimentSender initial_train_length seperation_train_length 
+**   ./unitExperimentSender [-c] [-F] [-R] [-P pattern] [-T template_file]
+**   [-r trace.pcap [-W] [-C interval_us]] [-X load] [-A min_mbps:max_mbps[:resolution_mbps]]
+**   [-B min_mbps:max_mbps[:rate_steps]] [-E tag] initial_train_length seperation_train_length
 **   num_packet_trains probe_payload_length receiver_address priority
+**   (options are read with getopt and go before the six arguments)
 **
 ** Example: 
 **   ./unitExperimentSender 2001 19 200 100 131.179.192.60 H
 **************************************************************************/
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,8 +96,67 @@
 #include <unistd.h>
 #include <netdb.h>
 #include <time.h>
+#include <sys/prctl.h>
+#include <math.h>
+#include <poll.h>
+#include <errno.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
 
 #include "taracomConstants.h"
+#include "controlClient.h"
+#include "probeHeader.h"
+#include "timeUtil.h"
+#include "reflectionCollector.h"
+#include "trainSchedule.h"
+#include "trainPattern.h"
+#include "probeTemplate.h"
+#include "pcapTrace.h"
+#include "quantileHistogram.h"
+#include "crossTraffic.h"
+#include "tokenBucket.h"
+
+//Due probes prepared per pass of the send loop
+#define SEND_BATCH_SIZE 32
+
+//Control flow of a replay without -C: a probe every 10 ms
+#define REPLAY_CONTROL_INTERVAL_NS 10000000
+
+//Available bandwidth search (-A): probes per stream, streams per fleet
+#define AVBW_STREAM_PROBES 100
+#define AVBW_FLEET_STREAMS 6
+
+//Resolution of -A without one, as a fraction of its maximum rate
+#define AVBW_DEFAULT_RESOLUTION 0.02
+
+struct bandwidth_options
+{
+  double min_bps;
+  double max_bps;
+  double resolution_bps;
+};
+
+//Token bucket sweep (-B): probes per stream at each rate, and rates without a count
+#define TOKEN_BURST_STEPS 3
+#define TOKEN_BURST_LADDER { 100, 300, 1000 }
+#define TOKEN_DEFAULT_RATE_STEPS 4
+#define TOKEN_MAX_RATE_STEPS 16
+
+//Longest idle time between the streams of a sweep, for the bucket to fill up
+#define TOKEN_MAX_PAUSE_NS 2000000000LL
+
+struct bucket_options
+{
+  double min_bps;
+  double max_bps;
+  int rate_steps;
+};
+
+//Sleep until this close to a departure, then spin on the clock
+#define SEND_SPIN_NS 20000
+
+//How long the transmit stamps of the last probes may trail their call
+#define TX_STAMP_DRAIN_MS 20
 
 /***************************************************************
  * Function used to return a timespec that holds the difference
@@ -59,140 +175,1206 @@ struct timespec diff(struct timespec start, struct timespec end)
   return temp;
 }
 
+static inline int64_t current_time_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return timespec_to_ns(now);
+}
+
+/***************************************************************
+ * Have the kernel stamp every datagram sent on send_socket as it
+ * is handed to the device, and queue the stamp on the error
+ * queue keyed by the number of datagrams sent before it
+ ***************************************************************/
+static void set_tx_stamps(int send_socket, int enable)
+{
+  int flags = enable ? SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID |
+    SOF_TIMESTAMPING_OPT_TSONLY : 0;
+  setsockopt(send_socket, SOL_SOCKET, SO_TIMESTAMPING, (char *)&flags, sizeof(int));
+}
+
+/***************************************************************
+ * Move the transmit stamps queued on send_socket into left_ns by
+ * their key, dropping keys from num_keys on. Returns how many
+ * were stored.
+ ***************************************************************/
+static int read_tx_stamps(int send_socket, int64_t* left_ns, int num_keys)
+{
+  char control[CMSG_SPACE(sizeof(struct scm_timestamping)) + CMSG_SPACE(sizeof(struct sock_extended_err) +
+    sizeof(struct sockaddr_in))];
+  int stored = 0;
+  while (1)
+  {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    if (recvmsg(send_socket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+      return stored;
+
+    int64_t stamp_ns = 0;
+    int64_t key = -1;
+    struct cmsghdr* cmsg;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING)
+      {
+        struct scm_timestamping stamps;
+        memcpy(&stamps, CMSG_DATA(cmsg), sizeof stamps);
+        stamp_ns = timespec_to_ns(stamps.ts[0]);
+      }
+      else if (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+      {
+        struct sock_extended_err error;
+        memcpy(&error, CMSG_DATA(cmsg), sizeof error);
+        if (error.ee_errno == ENOMSG && error.ee_origin == SO_EE_ORIGIN_TIMESTAMPING)
+          key = error.ee_data;
+      }
+    }
+    if (stamp_ns != 0 && key >= 0 && key < num_keys)
+    {
+      left_ns[key] = stamp_ns;
+      stored++;
+    }
+  }
+}
+
+/***************************************************************
+ * Bytes a probe template of the pattern needs: its longest probe,
+ * and never less than the header at header_offset
+ ***************************************************************/
+static int pattern_template_length(const struct train_pattern* pattern, int probe_payload_length,
+  int header_offset)
+{
+  int length = probe_payload_length > pattern->max_length ? probe_payload_length : pattern->max_length;
+  return length > header_offset + PROBE_HEADER_LENGTH ? length : header_offset + PROBE_HEADER_LENGTH;
+}
+
+/***************************************************************
+ * Send a compiled pattern in batches of the probes that are due.
+ * Destination and payload template are looked up by class, so
+ * filling a batch does not branch on the probe. A probe with a
+ * header goes out in a call of its own, stamped right before it;
+ * runs of probes without one share a sendmmsg call. Probes
+ * the pattern gives a size to go out at that size, the others at
+ * probe_payload_length; templates hold the longest of them.
+ * With a probe_template the probe header sits at its probe_offset
+ * and its fields are written into every probe after the stamp.
+ * With a trace its captured payloads replace the template of
+ * their probes, and only the control flow gets a probe header
+ * unless the trace is rewritten. lateness, if given, gets how
+ * long after its departure each probe left, by the kernel's
+ * transmit stamp, or by the clock right after its call returned
+ * where the kernel gave none.
+ * A stop request on control_socket ends the run after the current
+ * train. Returns the probes the kernel accepted; sent_per_class
+ * gets them per class, num_trains_sent the completed trains with
+ * at least one accepted probe and num_refused the probes the kernel
+ * refused, which count as neither. reflection, if given, is told
+ * which probes were refused.
+ ***************************************************************/
+static int send_pattern(int send_socket, const struct train_pattern* pattern, uint8_t* templates[2],
+  struct probe_template* probe_template, const struct pcap_trace* trace, int probe_payload_length,
+  struct addrinfo* destinations[2], int control_socket, struct quantile_histogram* lateness,
+  struct reflection_collector* reflection, int* sent_per_class, int* num_trains_sent, int* num_refused)
+{
+  sent_per_class[0] = sent_per_class[1] = 0;
+  *num_trains_sent = 0;
+  *num_refused = 0;
+  int accepted = 0;
+  int train_accepted = 0;
+
+  //Room for the header even in shorter probes, only their length goes out
+  int header_offset = probe_template != NULL ? probe_template->probe_offset : 0;
+  int stride = pattern_template_length(pattern, probe_payload_length, header_offset);
+  uint8_t* buffers = (uint8_t*) malloc((size_t) SEND_BATCH_SIZE * stride);
+  if (buffers == NULL)
+    return 0;
+
+  //When each accepted probe was due and left. A refused call may still
+  //use up a stamp key, so keys from the first refusal on are not trusted
+  int64_t* due_ns = NULL;
+  int64_t* left_ns = NULL;
+  int handed = 0;
+  int trusted_keys = pattern->length;
+  int num_stamps = 0;
+  if (lateness != NULL)
+  {
+    due_ns = (int64_t*) malloc((pattern->length + 1) * sizeof(int64_t));
+    left_ns = (int64_t*) malloc((pattern->length + 1) * sizeof(int64_t));
+    if (due_ns == NULL || left_ns == NULL)
+    {
+      free(due_ns);
+      free(left_ns);
+      free(buffers);
+      return 0;
+    }
+    set_tx_stamps(send_socket, 1);
+  }
+  struct mmsghdr msgs[SEND_BATCH_SIZE];
+  struct iovec iovs[SEND_BATCH_SIZE];
+  uint8_t refused[SEND_BATCH_SIZE];
+  uint8_t stamped[SEND_BATCH_SIZE];
+  memset(msgs, 0, sizeof msgs);
+
+  const struct pattern_probe* probes = pattern->probes;
+  int next = 0;
+  int end = pattern->length;
+  int64_t start_ns = current_time_ns();
+  while (next < end)
+  {
+    int64_t elapsed_ns = current_time_ns() - start_ns;
+    int count = 0;
+    while (count < SEND_BATCH_SIZE && next + count < end && probes[next + count].departure_ns <= elapsed_ns)
+      count++;
+    if (count == 0)
+    {
+      //The wakeup is late by the timer slack and scheduling; spin the rest
+      int64_t wake_ns = start_ns + probes[next].departure_ns - SEND_SPIN_NS;
+      if (wake_ns > start_ns + elapsed_ns)
+      {
+        struct timespec departure = ns_to_timespec(wake_ns);
+        clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &departure, NULL);
+      }
+      continue;
+    }
+
+    int i;
+    for (i = 0; i < count; i++)
+    {
+      const struct pattern_probe* probe = &probes[next + i];
+      uint8_t* buffer = buffers + (size_t) i * stride;
+      int length = probe->length > 0 ? probe->length : probe_payload_length;
+      if (trace != NULL && trace->payload_offsets[next + i] != PCAP_NO_PAYLOAD)
+        memcpy(buffer, trace->payloads + trace->payload_offsets[next + i], length);
+      else
+        memcpy(buffer, templates[probe->class_index], length);
+      stamped[i] = trace == NULL || trace->rewrite || trace->payload_offsets[next + i] == PCAP_NO_PAYLOAD;
+      if (stamped[i])
+      {
+        memcpy(buffer + header_offset, &probe->seq_id, sizeof probe->seq_id);
+        if (length >= header_offset + PROBE_HEADER_LENGTH)
+          memcpy(buffer + header_offset + 6, templates[probe->class_index] + header_offset + 6, 2);
+      }
+      iovs[i].iov_base = buffer;
+      iovs[i].iov_len = length;
+      msgs[i].msg_hdr.msg_name = destinations[probe->class_index]->ai_addr;
+      msgs[i].msg_hdr.msg_namelen = destinations[probe->class_index]->ai_addrlen;
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    //A stamp read before a call that takes several probes would be an
+    //estimate for all but the first, so stamped probes go one per call.
+    //The kernel takes a prefix of a run; a probe it refuses is skipped
+    //and not counted as sent
+    int sent = 0;
+    int prepared = 0;
+    memset(refused, 0, count);
+    while (sent < count)
+    {
+      int run = 1;
+      while (!stamped[sent] && sent + run < count && !stamped[sent + run])
+        run++;
+      int64_t tx_time_ns = current_time_ns();
+      for (i = prepared; i < sent + run; i++)
+      {
+        uint8_t* buffer = buffers + (size_t) i * stride;
+        if (stamped[i])
+          probe_header_stamp(buffer + header_offset, (int) iovs[i].iov_len - header_offset, tx_time_ns);
+        if (probe_template != NULL)
+          probe_template_apply(probe_template, buffer, (int) iovs[i].iov_len, probes[next + i].seq_id, next + i,
+            tx_time_ns);
+      }
+      if (sent + run > prepared)
+        prepared = sent + run;
+
+      int batch_sent = sendmmsg(send_socket, msgs + sent, run, 0);
+      if (batch_sent > 0)
+      {
+        if (left_ns != NULL)
+        {
+          int64_t returned_ns = current_time_ns();
+          for (i = sent; i < sent + batch_sent; i++, handed++)
+          {
+            due_ns[handed] = start_ns + probes[next + i].departure_ns;
+            left_ns[handed] = returned_ns;
+          }
+        }
+        sent += batch_sent;
+      }
+      else
+      {
+        refused[sent++] = 1;
+        if (trusted_keys > handed)
+          trusted_keys = handed;
+      }
+    }
+    if (left_ns != NULL)
+      num_stamps += read_tx_stamps(send_socket, left_ns, handed < trusted_keys ? handed : trusted_keys);
+
+    for (i = 0; i < count; i++)
+    {
+      const struct pattern_probe* probe = &probes[next + i];
+      if (refused[i])
+      {
+        (*num_refused)++;
+        if (reflection != NULL)
+          reflection_collector_refuse(reflection, probe->class_index, probe->seq_id);
+      }
+      else
+      {
+        sent_per_class[probe->class_index]++;
+        accepted++;
+        train_accepted = 1;
+      }
+      if (probe->ends_train)
+      {
+        *num_trains_sent += train_accepted & (probe->train > 0);
+        train_accepted = 0;
+      }
+    }
+    next += count;
+
+    //Asked to stop: finish the train in progress
+    if (control_socket != -1 && end == pattern->length && next < end && control_stop_requested(control_socket))
+    {
+      end = next;
+      while (end < pattern->length && !probes[end - 1].ends_train)
+        end++;
+    }
+  }
+
+  if (left_ns != NULL)
+  {
+    int expected = handed < trusted_keys ? handed : trusted_keys;
+    struct pollfd poll_fd = { send_socket, 0, 0 };
+    if (num_stamps < expected && poll(&poll_fd, 1, TX_STAMP_DRAIN_MS) > 0)
+      read_tx_stamps(send_socket, left_ns, expected);
+    set_tx_stamps(send_socket, 0);
+    int k;
+    for (k = 0; k < handed; k++)
+      quantile_histogram_record(lateness, left_ns[k] - due_ns[k]);
+  }
+  free(due_ns);
+  free(left_ns);
+  free(buffers);
+  return accepted;
+}
+
+/***************************************************************
+ * Tell the receiver the layout of the compiled run with PATTERN
+ * and RUNS (controlChannel.h), so it scores the probes and trains
+ * of any pattern and not just the classic schedule of HELLO.
+ * A class with more runs than MAX_PATTERN_RUNS is announced with
+ * its probe count only.
+ ***************************************************************/
+static error_t announce_pattern(int control_socket, const struct train_pattern* pattern)
+{
+  char request[CONTROL_LINE_LENGTH];
+  char reply[CONTROL_LINE_LENGTH];
+  snprintf(request, sizeof request, "PATTERN %d %d %d", pattern->num_trains, pattern->class_counts[0],
+    pattern->class_counts[1]);
+  if (control_request(control_socket, request, reply, sizeof reply) != SUCCESS)
+    return CONTROL_PROTOCOL_ERROR;
+
+  int c, i;
+  for (c = 0; c < 2; c++)
+  {
+    int runs = 0, train = -1;
+    for (i = 0; i < pattern->length; i++)
+    {
+      if (pattern->probes[i].class_index == c && pattern->probes[i].train != train)
+      {
+        runs++;
+        train = pattern->probes[i].train;
+      }
+    }
+    if (runs == 0 || runs > MAX_PATTERN_RUNS)
+      continue;
+
+    //As many first_seq:train pairs per line as fit, the newline included
+    int header = snprintf(request, sizeof request, "RUNS %c", c == 0 ? 'H' : 'L');
+    int length = header;
+    train = -1;
+    for (i = 0; i < pattern->length; i++)
+    {
+      const struct pattern_probe* probe = &pattern->probes[i];
+      if (probe->class_index != c || probe->train == train)
+        continue;
+      train = probe->train;
+      char run[24];
+      int run_length = snprintf(run, sizeof run, " %d:%d", probe->seq_id, probe->train);
+      if (length + run_length >= CONTROL_LINE_LENGTH - 1)
+      {
+        if (control_request(control_socket, request, reply, sizeof reply) != SUCCESS)
+          return CONTROL_PROTOCOL_ERROR;
+        length = header;
+      }
+      memcpy(request + length, run, run_length + 1);
+      length += run_length;
+    }
+    if (control_request(control_socket, request, reply, sizeof reply) != SUCCESS)
+      return CONTROL_PROTOCOL_ERROR;
+  }
+  return SUCCESS;
+}
+
 /***************************************************************
  * This is the main function of the file.
  * It creates the packet with a given entropy and sends it to the
  * the compression node address. 
  ***************************************************************/
 error_t UDPTrainGenerator (int initial_train_length, int seperation_train_length, int num_packet_trains, 
-  int probe_payload_length, char* receiver_address, char priority)
+  int probe_payload_length, char* receiver_address, char priority, int use_control_channel,
+  int use_reflector, const char* pattern_text, struct probe_template* probe_template,
+  const struct replay_options* replay, const struct cross_traffic_config* cross, uint16_t experiment_tag)
 {
+  //The run, compiled or read from the trace before anything is announced
+  struct train_pattern pattern;
+  struct pcap_trace trace;
+  memset(&trace, 0, sizeof trace);
+  error_t status;
+  char schedule_text[128];
+  if (replay != NULL)
+  {
+    status = pcap_trace_load(replay, priority == 'H' ? 0 : 1, &pattern, &trace);
+    if (status != SUCCESS)
+      return status;
+    printf("%c: replaying %lld of %lld packets of %s over %.3f s (%lld skipped, %lld clamped, %lld padded), "
+      "%d control probes\n", priority, trace.replayed, trace.packets, replay->path,
+      (double) trace.duration_ns / NSEC_PER_SEC, trace.skipped, trace.clamped, trace.padded,
+      pattern.class_counts[priority == 'H' ? 1 : 0]);
+  }
+  else if (pattern_text == NULL)
+  {
+    if (!train_pattern_format(schedule_text, sizeof schedule_text, initial_train_length, seperation_train_length,
+      num_packet_trains, priority))
+      return FAILURE;
+    pattern_text = schedule_text;
+  }
+  if (replay == NULL)
+  {
+    status = train_pattern_compile(pattern_text, &pattern);
+    if (status != SUCCESS)
+      return status;
+  }
+
+  //Every probe has to hold the sequence id and class after the template
+  int header_offset = probe_template != NULL ? probe_template->probe_offset : 0;
+  int i;
+  for (i = 0; i < pattern.length && probe_template != NULL; i++)
+  {
+    int length = pattern.probes[i].length > 0 ? pattern.probes[i].length : probe_payload_length;
+    if (length < header_offset + PROBE_HEADER_MIN_LENGTH)
+    {
+      fprintf(stderr, "ERROR #%d: Template %s needs probes of at least %d bytes\n", INVALID_NUMBER_OF_ARGUMENTS,
+        probe_template->name, header_offset + PROBE_HEADER_MIN_LENGTH);
+      train_pattern_free(&pattern);
+      pcap_trace_free(&trace);
+      return INVALID_NUMBER_OF_ARGUMENTS;
+    }
+  }
+
   // Set up high priority send_socket
   struct addrinfo hints;
   memset(&hints, 0, sizeof hints);
   hints.ai_family = AF_INET;
   hints.ai_socktype = SOCK_DGRAM;
 
-  //Fill data structure with address and port number of high priority destination
+  //Fill data structures with address and port number of both destinations
   struct addrinfo* dest_addr_info;
-  int status = getaddrinfo(receiver_address, UDP_PROBE_PORT_NUMBER_HIGH, &hints, &dest_addr_info);
+  struct addrinfo* low_addr_info;
+  status = getaddrinfo(receiver_address, UDP_PROBE_PORT_NUMBER_HIGH, &hints, &dest_addr_info);
+  if (status != 0)
+  {
+    train_pattern_free(&pattern);
+    pcap_trace_free(&trace);
+    fprintf(stderr, "ERROR #%d: Address Information Error\n", ADDRINFO_ERROR);
+    return ADDRINFO_ERROR;
+  }
+  status = getaddrinfo(receiver_address, UDP_PROBE_PORT_NUMBER_LOW, &hints, &low_addr_info);
   if (status != 0)
   {
+    freeaddrinfo(dest_addr_info);
+    train_pattern_free(&pattern);
+    pcap_trace_free(&trace);
     fprintf(stderr, "ERROR #%d: Address Information Error\n", ADDRINFO_ERROR);
     return ADDRINFO_ERROR;
   }
 
-  //Set up socket to send packets to host with udp for high priority packets
+  //Set up socket to send packets to host with udp for both priorities
   int send_socket = socket(dest_addr_info->ai_family, dest_addr_info->ai_socktype, dest_addr_info->ai_protocol);
   if (send_socket == -1)
   {
+    freeaddrinfo(dest_addr_info);
+    freeaddrinfo(low_addr_info);
+    train_pattern_free(&pattern);
+    pcap_trace_free(&trace);
     fprintf(stderr, "ERROR #%d: Socket Setup Error\n", SOCKET_SETUP_ERROR);
     return SOCKET_SETUP_ERROR;
   }
 
-  // Set up packet_data and fill it with zeros
+  //Echoes come back to the send socket while the train is still going out
+  static struct reflection_collector reflection;
+  if (use_reflector)
+  {
+    if (reflection_collector_start(&reflection, send_socket, pattern.class_counts[0], pattern.class_counts[1]) != SUCCESS)
+    {
+      freeaddrinfo(dest_addr_info);
+      freeaddrinfo(low_addr_info);
+      train_pattern_free(&pattern);
+      pcap_trace_free(&trace);
+      close(send_socket);
+      return FAILURE;
+    }
+  }
+
+  // Set up packet_data and fill it with zeros, with room for the header
+  // and the longest probe of the pattern, or with the application template
+  int template_length = pattern_template_length(&pattern, probe_payload_length, header_offset);
   uint8_t* packet_data;
-  packet_data = (uint8_t*) calloc (probe_payload_length, 1);
+  packet_data = (uint8_t*) calloc (template_length, 1);
   uint8_t* packet_data_low;
-  packet_data_low = (uint8_t*) calloc (probe_payload_length, 1);
-    
-
-  //Set the first packet sequence number
-  int packet_seq_id_high = 0;
-  int packet_seq_id_low = 0;
-  *((int*) packet_data) = packet_seq_id_high;
-  *((int*) packet_data_low) = packet_seq_id_low;
-  ((char*) packet_data)[4] = 'H';
-  ((char*) packet_data_low)[4] = 'L';
-
-  //Send initial packet train of High Priority
-  int num_packets_sent = 0;
-  while (num_packets_sent < initial_train_length)
+  packet_data_low = (uint8_t*) calloc (template_length, 1);
+  if (packet_data == NULL || packet_data_low == NULL)
   {
-    sendto(send_socket, packet_data, probe_payload_length, 0, dest_addr_info->ai_addr, dest_addr_info->ai_addrlen);
-    packet_seq_id_high++;
-    *((int*) packet_data) = packet_seq_id_high;
-
-    num_packets_sent++;
+    if (use_reflector)
+    {
+      reflection_collector_finish(&reflection, 0, 0);
+      reflection_collector_free(&reflection);
+    }
+    free(packet_data);
+    free(packet_data_low);
+    freeaddrinfo(dest_addr_info);
+    freeaddrinfo(low_addr_info);
+    train_pattern_free(&pattern);
+    pcap_trace_free(&trace);
+    close(send_socket);
+    fprintf(stderr, "ERROR #%d: Out of memory\n", FAILURE);
+    return FAILURE;
+  }
+  if (probe_template != NULL)
+  {
+    probe_template_fill(probe_template, packet_data, template_length);
+    probe_template_fill(probe_template, packet_data_low, template_length);
   }
 
-  //Send prioritized packet trains based on prioirty parameter
-  int zero_tos = 0;
-  if( priority == 'L'){
-    int num_trains_sent = 0;
-    while(num_trains_sent < num_packet_trains){
-      num_packets_sent = 0;
-
-      getaddrinfo(receiver_address, UDP_PROBE_PORT_NUMBER_LOW, &hints, &dest_addr_info);
-      sendto(send_socket, packet_data_low, probe_payload_length, 0, dest_addr_info->ai_addr, dest_addr_info->ai_addrlen);
-      packet_seq_id_low++;
-      *((int*) packet_data_low) = packet_seq_id_low;
+  ((char*) packet_data)[header_offset + 4] = 'H';
+  ((char*) packet_data_low)[header_offset + 4] = 'L';
+  memcpy(packet_data + header_offset + 6, &experiment_tag, sizeof experiment_tag);
+  memcpy(packet_data_low + header_offset + 6, &experiment_tag, sizeof experiment_tag);
 
-      getaddrinfo(receiver_address, UDP_PROBE_PORT_NUMBER_HIGH, &hints, &dest_addr_info);
+  //Send the compiled run. Between batches, check whether the receiver
+  //has already reached its verdict and asked us to stop.
+  uint8_t* templates[2] = { packet_data, packet_data_low };
 
-      while (num_packets_sent < seperation_train_length)
+  //Background load, started first so the queue is already standing
+  static struct cross_traffic traffic;
+  if (cross != NULL)
+  {
+    status = cross_traffic_start(&traffic, cross, receiver_address);
+    if (status != SUCCESS)
+    {
+      if (use_reflector)
       {
-        sendto(send_socket, packet_data, probe_payload_length, 0, dest_addr_info->ai_addr, dest_addr_info->ai_addrlen);
-        packet_seq_id_high++;
-        *((int*) packet_data) = packet_seq_id_high;
-        num_packets_sent++;  
+        reflection_collector_finish(&reflection, 0, 0);
+        reflection_collector_free(&reflection);
       }
-      num_trains_sent++;
+      freeaddrinfo(dest_addr_info);
+      freeaddrinfo(low_addr_info);
+      free(packet_data);
+      free(packet_data_low);
+      close(send_socket);
+      train_pattern_free(&pattern);
+      pcap_trace_free(&trace);
+      return status;
     }
   }
-  else if( priority == 'H'){
-    int num_trains_sent = 0;
-    while(num_trains_sent < num_packet_trains){
-      num_packets_sent = 0;
 
-      getaddrinfo(receiver_address, UDP_PROBE_PORT_NUMBER_HIGH, &hints, &dest_addr_info);
-      sendto(send_socket, packet_data, probe_payload_length, 0, dest_addr_info->ai_addr, dest_addr_info->ai_addrlen);
-      packet_seq_id_high++;
-      *((int*) packet_data) = packet_seq_id_high;
-
-      getaddrinfo(receiver_address, UDP_PROBE_PORT_NUMBER_LOW, &hints, &dest_addr_info);
-      while (num_packets_sent < seperation_train_length)
+  //Announce the train and wait until the receiver is ready for it. Any
+  //load is already standing, so the phase never opens on a ramping queue
+  //and a load that fails to start never leaves the receiver a slot open
+  int control_socket = -1;
+  char request[CONTROL_LINE_LENGTH];
+  char reply[CONTROL_LINE_LENGTH];
+  if (use_control_channel)
+  {
+    control_socket = control_connect(receiver_address, PRE_TCP_SERVER_PORT);
+    status = control_socket == -1 ? CONNECT_ERROR : SUCCESS;
+    if (status == SUCCESS)
+    {
+      int length = snprintf(request, sizeof request, "HELLO %d %d %d %d %c", initial_train_length,
+        seperation_train_length, num_packet_trains, probe_payload_length, priority);
+      if (experiment_tag != 0)
+        snprintf(request + length, sizeof request - length, " %u", (unsigned) experiment_tag);
+      if (control_request(control_socket, request, reply, sizeof reply) != SUCCESS ||
+        announce_pattern(control_socket, &pattern) != SUCCESS ||
+        control_request(control_socket, "START", reply, sizeof reply) != SUCCESS ||
+        control_sync_clock(control_socket) != SUCCESS)
+      {
+        close(control_socket);
+        status = CONTROL_PROTOCOL_ERROR;
+      }
+    }
+    if (status != SUCCESS)
+    {
+      if (cross != NULL)
+        cross_traffic_stop(&traffic);
+      if (use_reflector)
       {
-        sendto(send_socket, packet_data_low, probe_payload_length, 0, dest_addr_info->ai_addr, dest_addr_info->ai_addrlen);
-        packet_seq_id_low++;
-        *((int*) packet_data_low) = packet_seq_id_low;
-        num_packets_sent++;  
+        reflection_collector_finish(&reflection, 0, 0);
+        reflection_collector_free(&reflection);
       }
-      num_trains_sent++;
+      freeaddrinfo(dest_addr_info);
+      freeaddrinfo(low_addr_info);
+      free(packet_data);
+      free(packet_data_low);
+      close(send_socket);
+      train_pattern_free(&pattern);
+      pcap_trace_free(&trace);
+      return status;
     }
-  }  
+  }
+
+  struct addrinfo* destinations[2] = { dest_addr_info, low_addr_info };
+  int sent_per_class[2];
+  int num_trains_sent;
+  int num_refused;
+  static struct quantile_histogram lateness;
+  quantile_histogram_reset(&lateness);
+  int packets_sent = send_pattern(send_socket, &pattern, templates, probe_template,
+    replay != NULL ? &trace : NULL, probe_payload_length, destinations, control_socket,
+    replay != NULL ? &lateness : NULL, use_reflector ? &reflection : NULL, sent_per_class, &num_trains_sent,
+    &num_refused);
+  if (cross != NULL)
+    cross_traffic_stop(&traffic);
+  if (num_refused > 0)
+    fprintf(stderr, "%c: the kernel refused %d probes, not counted as sent\n", priority, num_refused);
+  int packet_seq_id_high = sent_per_class[0];
+  int packet_seq_id_low = sent_per_class[1];
+
+  if (use_reflector)
+  {
+    reflection_collector_finish(&reflection, packet_seq_id_high, packet_seq_id_low);
+    status = reflection_collector_report(&reflection, "./temp/", receiver_address, priority);
+    reflection_collector_free(&reflection);
+  }
 
   //Free structs, ptrs, and close socket
   freeaddrinfo (dest_addr_info);
+  freeaddrinfo (low_addr_info);
   free (packet_data);
   free (packet_data_low);
   close (send_socket);
+  int num_trains = pattern.num_trains;
+
+  //How far the replay strayed from the trace's timing
+  if (replay != NULL)
+    printf("%c: replayed %d of %d probes, lateness p50 %lld ns, p99 %lld ns, max %lld ns\n", priority,
+      packets_sent, pattern.length, (long long) quantile_histogram_percentile(&lateness, 50),
+      (long long) quantile_histogram_percentile(&lateness, 99), (long long) lateness.max);
+  train_pattern_free(&pattern);
+  pcap_trace_free(&trace);
+
+  //Tell the receiver the train is over and wait for it to drain
+  if (use_control_channel)
+  {
+    snprintf(request, sizeof request, "END %d %d %d %d", packets_sent, packet_seq_id_high, packet_seq_id_low,
+      num_trains_sent);
+    error_t ended = control_request(control_socket, request, reply, sizeof reply);
 
+    //A second offset after the train lets the receiver check its skew fit
+    if (ended == SUCCESS)
+      ended = control_sync_clock(control_socket);
+    close(control_socket);
+    if (ended != SUCCESS)
+      return ended;
+    printf("%c: sent %d of %d trains, %s\n", priority, num_trains_sent, num_trains, reply);
+  }
+
+  return status;
+}
+
+/***************************************************************
+ * Sockets and probe templates of the rate probing modes (-A, -B)
+ ***************************************************************/
+struct rate_probing
+{
+  int control_socket;
+  int send_socket;
+  struct addrinfo* destinations[2];
+  uint8_t* templates[2];
+};
+
+static void close_rate_probing(struct rate_probing* probing)
+{
+  free(probing->templates[0]);
+  free(probing->templates[1]);
+  if (probing->send_socket != -1)
+    close(probing->send_socket);
+  if (probing->destinations[0] != NULL)
+    freeaddrinfo(probing->destinations[0]);
+  if (probing->destinations[1] != NULL)
+    freeaddrinfo(probing->destinations[1]);
+  if (probing->control_socket != -1)
+    close(probing->control_socket);
+}
+
+static error_t open_rate_probing(struct rate_probing* probing, int probe_payload_length, char* receiver_address,
+  struct probe_template* probe_template)
+{
+  memset(probing, 0, sizeof *probing);
+  probing->send_socket = -1;
+  probing->control_socket = control_connect(receiver_address, PRE_TCP_SERVER_PORT);
+  if (probing->control_socket == -1)
+    return CONNECT_ERROR;
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  if (getaddrinfo(receiver_address, UDP_PROBE_PORT_NUMBER_HIGH, &hints, &probing->destinations[0]) != 0 ||
+    getaddrinfo(receiver_address, UDP_PROBE_PORT_NUMBER_LOW, &hints, &probing->destinations[1]) != 0)
+  {
+    close_rate_probing(probing);
+    fprintf(stderr, "ERROR #%d: Address Information Error\n", ADDRINFO_ERROR);
+    return ADDRINFO_ERROR;
+  }
+  probing->send_socket = socket(probing->destinations[0]->ai_family, probing->destinations[0]->ai_socktype,
+    probing->destinations[0]->ai_protocol);
+
+  //Stream probes are flagged so the receiver keeps them out of the capture
+  int header_offset = probe_template != NULL ? probe_template->probe_offset : 0;
+  int template_length = probe_payload_length > header_offset + PROBE_HEADER_LENGTH ? probe_payload_length :
+    header_offset + PROBE_HEADER_LENGTH;
+  int c;
+  for (c = 0; c < 2; c++)
+  {
+    probing->templates[c] = (uint8_t*) calloc(template_length, 1);
+    if (probing->templates[c] != NULL && probe_template != NULL)
+      probe_template_fill(probe_template, probing->templates[c], template_length);
+    if (probing->templates[c] != NULL)
+    {
+      probing->templates[c][header_offset + 4] = c == 0 ? 'H' : 'L';
+      probing->templates[c][header_offset + 5] = PROBE_FLAG_RATE_STREAM;
+    }
+  }
+  if (probing->send_socket == -1 || probing->templates[0] == NULL || probing->templates[1] == NULL)
+  {
+    close_rate_probing(probing);
+    return SOCKET_SETUP_ERROR;
+  }
+  return SUCCESS;
+}
+
+/***************************************************************
+ * Lay out a periodic stream of probes of one class, one IP
+ * packet time at rate_bps apart, in a pattern with room for them.
+ * Returns the packet time.
+ ***************************************************************/
+static int64_t set_rate_stream(struct train_pattern* stream, int probes, int class_index, int probe_payload_length,
+  double rate_bps)
+{
+  int64_t period_ns = (int64_t) ((probe_payload_length + 28) * 8 * 1e9 / rate_bps);
+  stream->length = probes;
+  stream->num_trains = 1;
+  stream->class_counts[class_index] = probes;
+  stream->class_counts[1 - class_index] = 0;
+  int i;
+  for (i = 0; i < probes; i++)
+  {
+    stream->probes[i].seq_id = i;
+    stream->probes[i].train = 1;
+    stream->probes[i].class_index = (uint8_t) class_index;
+    stream->probes[i].departure_ns = i * period_ns;
+    stream->probes[i].ends_train = i == probes - 1;
+  }
+  return period_ns;
+}
+
+/***************************************************************
+ * Search the available bandwidth of one class with the receiver
+ * (bandwidthSearch.h): fleets of periodic streams at the rate it
+ * asks for, until it reports the bracket. A pause as long as the
+ * stream lets the queue drain before the next one.
+ ***************************************************************/
+static error_t search_class_bandwidth(struct rate_probing* probing, struct probe_template* probe_template,
+  int probe_payload_length, int class_index, const struct bandwidth_options* options, double* low_bps,
+  double* high_bps, int* fleets)
+{
+  char request[CONTROL_LINE_LENGTH];
+  char reply[CONTROL_LINE_LENGTH];
+  char priority = class_index == 0 ? 'H' : 'L';
+  snprintf(request, sizeof request, "AVBW %c %.0f %.0f %.0f %d", priority, options->min_bps, options->max_bps,
+    options->resolution_bps, AVBW_FLEET_STREAMS);
+  double rate_bps;
+  if (control_request(probing->control_socket, request, reply, sizeof reply) != SUCCESS ||
+    sscanf(reply, "RATE %lf", &rate_bps) != 1)
+    return CONTROL_PROTOCOL_ERROR;
+
+  struct train_pattern stream;
+  memset(&stream, 0, sizeof stream);
+  stream.probes = (struct pattern_probe*) calloc(AVBW_STREAM_PROBES, sizeof(struct pattern_probe));
+  if (stream.probes == NULL)
+    return FAILURE;
+  stream.capacity = AVBW_STREAM_PROBES;
+
+  *fleets = 0;
+  error_t status = SUCCESS;
+  while (status == SUCCESS)
+  {
+    int64_t period_ns = set_rate_stream(&stream, AVBW_STREAM_PROBES, class_index, probe_payload_length, rate_bps);
+
+    snprintf(request, sizeof request, "STREAM %d", AVBW_STREAM_PROBES);
+    int sent_per_class[2];
+    int num_trains_sent;
+    int num_refused;
+    if (control_request(probing->control_socket, request, reply, sizeof reply) != SUCCESS)
+    {
+      status = CONTROL_PROTOCOL_ERROR;
+      break;
+    }
+    int sent = send_pattern(probing->send_socket, &stream, probing->templates, probe_template, NULL,
+      probe_payload_length, probing->destinations, -1, NULL, NULL, sent_per_class, &num_trains_sent,
+      &num_refused);
+    snprintf(request, sizeof request, "TREND %d", sent);
+    if (control_request(probing->control_socket, request, reply, sizeof reply) != SUCCESS)
+    {
+      status = CONTROL_PROTOCOL_ERROR;
+      break;
+    }
+
+    const char* next = strstr(reply, " RATE ");
+    const char* available = strstr(reply, " AVAILABLE ");
+    if (next != NULL || available != NULL)
+    {
+      (*fleets)++;
+      printf("%c: fleet %d at %.2f Mbit/s, last stream %s\n", priority, *fleets, rate_bps / 1e6, reply + 6);
+    }
+    if (available != NULL)
+    {
+      if (sscanf(available, " AVAILABLE %lf %lf", low_bps, high_bps) != 2)
+        status = CONTROL_PROTOCOL_ERROR;
+      break;
+    }
+    if (next != NULL && sscanf(next, " RATE %lf", &rate_bps) != 1)
+      status = CONTROL_PROTOCOL_ERROR;
+
+    struct timespec pause = ns_to_timespec(AVBW_STREAM_PROBES * period_ns);
+    nanosleep(&pause, NULL);
+  }
+  free(stream.probes);
+  return status;
+}
+
+/***************************************************************
+ * Adaptive available bandwidth probing: search the 'H' and then
+ * the 'L' class and print what each can carry, to size the load
+ * of the strict priority experiment by.
+ ***************************************************************/
+error_t AvailableBandwidthSearch (int probe_payload_length, char* receiver_address,
+  const struct bandwidth_options* options, struct probe_template* probe_template)
+{
+  struct rate_probing probing;
+  error_t status = open_rate_probing(&probing, probe_payload_length, receiver_address, probe_template);
+  if (status != SUCCESS)
+    return status;
+
+  double low_bps[2], high_bps[2];
+  int fleets[2];
+  int c;
+  for (c = 0; c < 2 && status == SUCCESS; c++)
+    status = search_class_bandwidth(&probing, probe_template, probe_payload_length, c, options, &low_bps[c],
+      &high_bps[c], &fleets[c]);
+  for (c = 0; c < 2 && status == SUCCESS; c++)
+    printf("%c: available bandwidth %.2f-%.2f Mbit/s after %d fleets\n", c == 0 ? 'H' : 'L', low_bps[c] / 1e6,
+      high_bps[c] / 1e6, fleets[c]);
+
+  close_rate_probing(&probing);
+  return status;
+}
+
+//Token bucket the receiver fitted to one stream
+struct bucket_fit
+{
+  char kind;
+  double rate_bps;
+  double depth_bytes;
+};
+
+static int compare_fit_rates(const void* a, const void* b)
+{
+  double x = ((const struct bucket_fit*) a)->rate_bps, y = ((const struct bucket_fit*) b)->rate_bps;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/***************************************************************
+ * Sweep one class over the ladder of rates and burst lengths and
+ * print the token bucket the receiver fits to each stream
+ * (tokenBucket.h), then the median of the fits. After each stream
+ * the sender idles as long as the stream took, at most
+ * TOKEN_MAX_PAUSE_NS, so a bucket at least half the step's rate
+ * is full again for the next one.
+ ***************************************************************/
+static error_t sweep_class_bucket(struct rate_probing* probing, struct probe_template* probe_template,
+  int probe_payload_length, int class_index, const struct bucket_options* options)
+{
+  char request[CONTROL_LINE_LENGTH];
+  char reply[CONTROL_LINE_LENGTH];
+  char priority = class_index == 0 ? 'H' : 'L';
+  int packet_bytes = probe_payload_length + 28;
+  snprintf(request, sizeof request, "BUCKET %c %d", priority, packet_bytes);
+  if (control_request(probing->control_socket, request, reply, sizeof reply) != SUCCESS)
+    return CONTROL_PROTOCOL_ERROR;
+
+  static const int bursts[TOKEN_BURST_STEPS] = TOKEN_BURST_LADDER;
+  struct train_pattern stream;
+  memset(&stream, 0, sizeof stream);
+  stream.probes = (struct pattern_probe*) calloc(bursts[TOKEN_BURST_STEPS - 1], sizeof(struct pattern_probe));
+  if (stream.probes == NULL)
+    return FAILURE;
+  stream.capacity = bursts[TOKEN_BURST_STEPS - 1];
+
+  struct bucket_fit fits[TOKEN_MAX_RATE_STEPS * TOKEN_BURST_STEPS];
+  int num_fits = 0, policed = 0, shaped = 0;
+  error_t status = SUCCESS;
+  int r, b;
+  for (r = 0; r < options->rate_steps && status == SUCCESS; r++)
+  {
+    //Geometric ladder from min_bps to max_bps
+    double rate_bps = options->rate_steps == 1 ? options->max_bps :
+      options->min_bps * pow(options->max_bps / options->min_bps, (double) r / (options->rate_steps - 1));
+    for (b = 0; b < TOKEN_BURST_STEPS && status == SUCCESS; b++)
+    {
+      int64_t period_ns = set_rate_stream(&stream, bursts[b], class_index, probe_payload_length, rate_bps);
+      snprintf(request, sizeof request, "STREAM %d", bursts[b]);
+      if (control_request(probing->control_socket, request, reply, sizeof reply) != SUCCESS)
+      {
+        status = CONTROL_PROTOCOL_ERROR;
+        break;
+      }
+      int sent_per_class[2];
+      int num_trains_sent;
+      int num_refused;
+      int sent = send_pattern(probing->send_socket, &stream, probing->templates, probe_template, NULL,
+        probe_payload_length, probing->destinations, -1, NULL, NULL, sent_per_class, &num_trains_sent,
+        &num_refused);
+      snprintf(request, sizeof request, "PROFILE %d %.0f", sent, rate_bps);
+      char kind;
+      int received, first_loss, loss_runs, ramp_start;
+      double slope_ns, bucket_rate_bps, depth_bytes;
+      if (control_request(probing->control_socket, request, reply, sizeof reply) != SUCCESS ||
+        sscanf(reply, "PROFILE %c %d %d %d %d %lf %lf %lf", &kind, &received, &first_loss, &loss_runs, &ramp_start,
+          &slope_ns, &bucket_rate_bps, &depth_bytes) != 8)
+      {
+        status = CONTROL_PROTOCOL_ERROR;
+        break;
+      }
+
+      printf("%c: %.2f Mbit/s x %d probes: received %d", priority, rate_bps / 1e6, sent, received);
+      if (num_refused > 0)
+        printf(", %d refused by the kernel", num_refused);
+      if (first_loss < sent)
+        printf(", first loss at %d in %d runs", first_loss, loss_runs);
+      if (ramp_start < sent)
+        printf(", delay ramp from %d at %+.0f ns/probe", ramp_start, slope_ns);
+      if (kind == TOKEN_CONFORMING)
+        printf(": conforming\n");
+      else
+      {
+        printf(": %s at %.2f Mbit/s, depth %.0f bytes\n", kind == TOKEN_POLICER ? "policed" : "shaped",
+          bucket_rate_bps / 1e6, depth_bytes);
+        fits[num_fits].kind = kind;
+        fits[num_fits].rate_bps = bucket_rate_bps;
+        fits[num_fits].depth_bytes = depth_bytes;
+        num_fits++;
+        policed += kind == TOKEN_POLICER;
+        shaped += kind == TOKEN_SHAPER;
+      }
+
+      int64_t idle_ns = sent * period_ns;
+      struct timespec pause = ns_to_timespec(idle_ns < TOKEN_MAX_PAUSE_NS ? idle_ns : TOKEN_MAX_PAUSE_NS);
+      nanosleep(&pause, NULL);
+    }
+  }
+  free(stream.probes);
+  if (status != SUCCESS)
+    return status;
+
+  if (num_fits == 0)
+    printf("%c: no token bucket up to %.2f Mbit/s\n", priority, options->max_bps / 1e6);
+  else
+  {
+    //Only fits of the kind most streams saw, and the rate and depth of
+    //one stream, so the reported bucket is one that was actually fitted
+    char kind = policed >= shaped ? TOKEN_POLICER : TOKEN_SHAPER;
+    int kept = 0, i;
+    for (i = 0; i < num_fits; i++)
+      if (fits[i].kind == kind)
+        fits[kept++] = fits[i];
+    qsort(fits, kept, sizeof *fits, compare_fit_rates);
+    printf("%c: %s, token rate %.2f Mbit/s, bucket depth %.0f bytes (median rate of %d of %d streams)\n",
+      priority, kind == TOKEN_POLICER ? "policer" : "shaper", fits[kept / 2].rate_bps / 1e6,
+      fits[kept / 2].depth_bytes, kept, options->rate_steps * TOKEN_BURST_STEPS);
+  }
   return SUCCESS;
 }
 
+/***************************************************************
+ * Token bucket detection: sweep the 'H' and then the 'L' class
+ * in one session and print the policed or shaped rate and the
+ * bucket depth of each.
+ ***************************************************************/
+error_t TokenBucketSweep (int probe_payload_length, char* receiver_address, const struct bucket_options* options,
+  struct probe_template* probe_template)
+{
+  struct rate_probing probing;
+  error_t status = open_rate_probing(&probing, probe_payload_length, receiver_address, probe_template);
+  if (status != SUCCESS)
+    return status;
+
+  int c;
+  for (c = 0; c < 2 && status == SUCCESS; c++)
+    status = sweep_class_bucket(&probing, probe_template, probe_payload_length, c, options);
+
+  close_rate_probing(&probing);
+  return status;
+}
+
+/***************************************************************
+ * Ask the receiver to write out the experiment right away
+ * instead of waiting for its idle timeout.
+ ***************************************************************/
+error_t FinalizeExperiment (char* receiver_address, uint16_t experiment_tag)
+{
+  int control_socket = control_connect(receiver_address, POST_TCP_SERVER_PORT);
+  if (control_socket == -1)
+    return CONNECT_ERROR;
+
+  char request[CONTROL_LINE_LENGTH];
+  char reply[CONTROL_LINE_LENGTH];
+  if (experiment_tag != 0)
+    snprintf(request, sizeof request, "FINALIZE %u", (unsigned) experiment_tag);
+  else
+    snprintf(request, sizeof request, "FINALIZE");
+  error_t status = control_request(control_socket, request, reply, sizeof reply);
+  close(control_socket);
+  if (status == SUCCESS)
+    printf("%s\n", reply);
+  return status;
+}
+
 
 int main(int argc, char *argv[])
 {
 
-  //Sender takes in 6 arguments
-  // ./unitExperimentSender initial_train_length seperation_train_length 
-  // num_packet_trains probe_payload_length receiver_address priority
-  if(argc != 7)
+  //Sender takes optional flags and then 6 arguments
+  // ./unitExperimentSender [-c] [-F] [-R] [-P pattern] [-T template_file] [-r trace.pcap [-W] [-C interval_us]]
+  // [-X load] [-A min_mbps:max_mbps[:resolution_mbps]] [-B min_mbps:max_mbps[:rate_steps]] [-E tag]
+  // initial_train_length seperation_train_length num_packet_trains probe_payload_length receiver_address priority
+  int use_control_channel = 0;
+  int finalize_experiment = 0;
+  int use_reflector = 0;
+  const char* pattern_text = NULL;
+  const char* template_path = NULL;
+  const char* cross_text = NULL;
+  const char* bandwidth_text = NULL;
+  const char* bucket_text = NULL;
+  int experiment_tag = 0;
+  struct replay_options replay;
+  memset(&replay, 0, sizeof replay);
+  replay.control_interval_ns = REPLAY_CONTROL_INTERVAL_NS;
+  int valid = 1;
+  int option;
+  while((option = getopt(argc, argv, "cFRWP:T:r:C:X:A:B:E:")) != -1)
+  {
+    switch(option)
+    {
+    case 'c':
+      use_control_channel = 1;
+      break;
+    case 'F':
+      use_control_channel = finalize_experiment = 1;
+      break;
+    case 'R':
+      use_reflector = 1;
+      break;
+    case 'W':
+      replay.rewrite = 1;
+      break;
+    case 'P':
+      pattern_text = optarg;
+      break;
+    case 'T':
+      template_path = optarg;
+      break;
+    case 'r':
+      replay.path = optarg;
+      break;
+    case 'C':
+      replay.control_interval_ns = atoll(optarg) * 1000;
+      break;
+    case 'X':
+      cross_text = optarg;
+      break;
+    case 'A':
+      bandwidth_text = optarg;
+      break;
+    case 'B':
+      bucket_text = optarg;
+      break;
+    case 'E':
+      experiment_tag = atoi(optarg);
+      break;
+    default:
+      valid = 0;
+    }
+  }
+  if(!valid || argc - optind != 6)
   {
     fprintf(stderr,"ERROR #%d: INVALID NUMBER OF ARGUMENTS\n", INVALID_NUMBER_OF_ARGUMENTS);
-    fprintf(stderr, "Usage: ./unitExperimentSender initial_train_length seperation_train_length num_packet_trains probe_payload_length receiver_address priority\n");
+    fprintf(stderr, "Usage: ./unitExperimentSender [-c] [-F] [-R] [-P pattern] [-T template_file] [-r trace.pcap [-W] [-C interval_us]] [-X load] [-A min_mbps:max_mbps[:resolution_mbps]] [-B min_mbps:max_mbps[:rate_steps]] [-E tag] initial_train_length seperation_train_length num_packet_trains probe_payload_length receiver_address priority\n");
+    return INVALID_NUMBER_OF_ARGUMENTS;
+  }
+  char** arguments = argv + optind;
+  int initial_train_length = atoi(arguments[0]); //Number of Initial High Priority Packets
+  int seperation_train_length = atoi(arguments[1]); //Number of Packets Per Train
+  int num_packet_trains = atoi(arguments[2]); //Number of Packet Trains
+  int probe_payload_length = atoi(arguments[3]); //[0,1500] in bytes
+  char* receiver_address = arguments[4]; //ip address of compression node X??.X??.X??.X??   TODO? must be IPv4 address?
+  char* priority = arguments[5];//priority either 'H' or 'L'
+
+  //The tag sits in the two bytes after the class and flags
+  if(experiment_tag < 0 || experiment_tag > UINT16_MAX)
+  {
+    fprintf(stderr, "ERROR #%d: -E takes a tag of 1 to %d\n", INVALID_NUMBER_OF_ARGUMENTS, UINT16_MAX);
+    return INVALID_NUMBER_OF_ARGUMENTS;
+  }
+
+  //The reflector needs room in the header for its two timestamps
+  if(use_reflector && probe_payload_length < PROBE_REFLECTED_HEADER_LENGTH)
+  {
+    fprintf(stderr, "ERROR #%d: -R needs probe_payload_length of at least %d\n", INVALID_NUMBER_OF_ARGUMENTS,
+      PROBE_REFLECTED_HEADER_LENGTH);
+    return INVALID_NUMBER_OF_ARGUMENTS;
+  }
+
+  //The reflector reads and stamps the header at the start of the probe
+  if(use_reflector && template_path != NULL)
+  {
+    fprintf(stderr, "ERROR #%d: -T cannot be used with -R\n", INVALID_NUMBER_OF_ARGUMENTS);
+    return INVALID_NUMBER_OF_ARGUMENTS;
+  }
+  //A replay has its own payloads and schedule
+  if(replay.path != NULL && (template_path != NULL || pattern_text != NULL))
+  {
+    fprintf(stderr, "ERROR #%d: -r cannot be used with -P or -T\n", INVALID_NUMBER_OF_ARGUMENTS);
+    return INVALID_NUMBER_OF_ARGUMENTS;
+  }
+  if(replay.path != NULL && replay.control_interval_ns < 0)
+  {
+    fprintf(stderr, "ERROR #%d: -C needs an interval of 0 or more microseconds\n", INVALID_NUMBER_OF_ARGUMENTS);
     return INVALID_NUMBER_OF_ARGUMENTS;
   }
-  int initial_train_length = atoi(argv[1]); //Number of Initial High Priority Packets
-  int seperation_train_length = atoi(argv[2]); //Number of Packets Per Train
-  int num_packet_trains = atoi(argv[3]); //Number of Packet Trains
-  int probe_payload_length = atoi(argv[4]); //[0,1500] in bytes
-  char* receiver_address = argv[5]; //ip address of compression node X??.X??.X??.X??   TODO? must be IPv4 address?
-  char* priority = argv[6];//priority either 'H' or 'L'
+
+  //Departures are timed to the microsecond; the default 50 us timer slack would blur them
+  prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+
+  static struct probe_template probe_template;
+  if(template_path != NULL && probe_template_load(template_path, &probe_template) != SUCCESS)
+    return INVALID_NUMBER_OF_ARGUMENTS;
+
+  static struct cross_traffic_config cross;
+  if(cross_text != NULL)
+  {
+    if(cross_traffic_parse(cross_text, &cross) != SUCCESS)
+      return INVALID_NUMBER_OF_ARGUMENTS;
+    cross.header_offset = template_path != NULL ? probe_template.probe_offset : 0;
+  }
+
+  //Available bandwidth search instead of an experiment
+  if(bandwidth_text != NULL)
+  {
+    struct bandwidth_options bandwidth = { 0, 0, 0 };
+    int fields = sscanf(bandwidth_text, "%lf:%lf:%lf", &bandwidth.min_bps, &bandwidth.max_bps,
+      &bandwidth.resolution_bps);
+    if(fields < 2 || bandwidth.min_bps <= 0 || bandwidth.max_bps <= bandwidth.min_bps ||
+      (fields == 3 && bandwidth.resolution_bps <= 0))
+    {
+      fprintf(stderr, "ERROR #%d: -A takes min_mbps:max_mbps[:resolution_mbps]\n", INVALID_NUMBER_OF_ARGUMENTS);
+      return INVALID_NUMBER_OF_ARGUMENTS;
+    }
+    if(use_reflector || replay.path != NULL || pattern_text != NULL || cross_text != NULL || bucket_text != NULL)
+    {
+      fprintf(stderr, "ERROR #%d: -A cannot be used with -R, -r, -P, -X or -B\n", INVALID_NUMBER_OF_ARGUMENTS);
+      return INVALID_NUMBER_OF_ARGUMENTS;
+    }
+    int header_offset = template_path != NULL ? probe_template.probe_offset : 0;
+    if(probe_payload_length < header_offset + PROBE_HEADER_LENGTH)
+    {
+      fprintf(stderr, "ERROR #%d: -A needs probe_payload_length of at least %d\n", INVALID_NUMBER_OF_ARGUMENTS,
+        header_offset + PROBE_HEADER_LENGTH);
+      return INVALID_NUMBER_OF_ARGUMENTS;
+    }
+    if(fields == 2)
+      bandwidth.resolution_bps = AVBW_DEFAULT_RESOLUTION * bandwidth.max_bps;
+    bandwidth.min_bps *= 1e6;
+    bandwidth.max_bps *= 1e6;
+    bandwidth.resolution_bps *= 1e6;
+    if(AvailableBandwidthSearch(probe_payload_length, receiver_address, &bandwidth,
+      template_path != NULL ? &probe_template : NULL) != SUCCESS)
+    {
+      fprintf(stderr, "ERROR #%d: UDP Train Generator Error\n", UDP_TRAIN_GENERATOR_FAILED);
+      return UDP_TRAIN_GENERATOR_FAILED;
+    }
+    return SUCCESS;
+  }
+
+  //Token bucket sweep instead of an experiment
+  if(bucket_text != NULL)
+  {
+    struct bucket_options bucket = { 0, 0, TOKEN_DEFAULT_RATE_STEPS };
+    int fields = sscanf(bucket_text, "%lf:%lf:%d", &bucket.min_bps, &bucket.max_bps, &bucket.rate_steps);
+    if(fields < 2 || bucket.min_bps <= 0 || bucket.max_bps < bucket.min_bps || bucket.rate_steps < 1 ||
+      bucket.rate_steps > TOKEN_MAX_RATE_STEPS)
+    {
+      fprintf(stderr, "ERROR #%d: -B takes min_mbps:max_mbps[:rate_steps] with 1 to %d steps\n",
+        INVALID_NUMBER_OF_ARGUMENTS, TOKEN_MAX_RATE_STEPS);
+      return INVALID_NUMBER_OF_ARGUMENTS;
+    }
+    if(use_reflector || replay.path != NULL || pattern_text != NULL || cross_text != NULL)
+    {
+      fprintf(stderr, "ERROR #%d: -B cannot be used with -R, -r, -P or -X\n", INVALID_NUMBER_OF_ARGUMENTS);
+      return INVALID_NUMBER_OF_ARGUMENTS;
+    }
+    int header_offset = template_path != NULL ? probe_template.probe_offset : 0;
+    if(probe_payload_length < header_offset + PROBE_HEADER_LENGTH)
+    {
+      fprintf(stderr, "ERROR #%d: -B needs probe_payload_length of at least %d\n", INVALID_NUMBER_OF_ARGUMENTS,
+        header_offset + PROBE_HEADER_LENGTH);
+      return INVALID_NUMBER_OF_ARGUMENTS;
+    }
+    bucket.min_bps *= 1e6;
+    bucket.max_bps *= 1e6;
+    if(TokenBucketSweep(probe_payload_length, receiver_address, &bucket,
+      template_path != NULL ? &probe_template : NULL) != SUCCESS)
+    {
+      fprintf(stderr, "ERROR #%d: UDP Train Generator Error\n", UDP_TRAIN_GENERATOR_FAILED);
+      return UDP_TRAIN_GENERATOR_FAILED;
+    }
+    return SUCCESS;
+  }
 
   /*Call UDP Connection to Send Data to Receiver*/
-  if(UDPTrainGenerator(initial_train_length, seperation_train_length, num_packet_trains, probe_payload_length, receiver_address, priority[0]) != SUCCESS)
+  if(UDPTrainGenerator(initial_train_length, seperation_train_length, num_packet_trains, probe_payload_length, receiver_address, priority[0], use_control_channel, use_reflector, pattern_text, template_path != NULL ? &probe_template : NULL, replay.path != NULL ? &replay : NULL, cross_text != NULL ? &cross : NULL, (uint16_t) experiment_tag) != SUCCESS)
+  {
+    fprintf(stderr, "ERROR #%d: UDP Train Generator Error\n", UDP_TRAIN_GENERATOR_FAILED);
+    return UDP_TRAIN_GENERATOR_FAILED;
+  }
+
+  if(finalize_experiment && FinalizeExperiment(receiver_address, (uint16_t) experiment_tag) != SUCCESS)
   {
     fprintf(stderr, "ERROR #%d: UDP Train Generator Error\n", UDP_TRAIN_GENERATOR_FAILED);
     return UDP_TRAIN_GENERATOR_FAILED;
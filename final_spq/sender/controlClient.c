@@ -0,0 +1,149 @@
+/***************************************************************
+** Control Channel Client
+** Sender side of the protocol described in controlChannel.h.
+***************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <time.h>
+
+#include "controlClient.h"
+#include "timeUtil.h"
+
+int control_connect(const char* receiver_address, int port)
+{
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+
+  char port_string[8];
+  snprintf(port_string, sizeof port_string, "%d", port);
+
+  struct addrinfo* control_addr_info;
+  if (getaddrinfo(receiver_address, port_string, &hints, &control_addr_info) != 0)
+  {
+    fprintf(stderr, "ERROR #%d: Address Information Error\n", ADDRINFO_ERROR);
+    return -1;
+  }
+
+  int control_socket = socket(control_addr_info->ai_family, control_addr_info->ai_socktype, control_addr_info->ai_protocol);
+  if (control_socket == -1)
+  {
+    fprintf(stderr, "ERROR #%d: Socket Setup Error\n", SOCKET_SETUP_ERROR);
+    freeaddrinfo(control_addr_info);
+    return -1;
+  }
+
+  if (connect(control_socket, control_addr_info->ai_addr, control_addr_info->ai_addrlen) == -1)
+  {
+    fprintf(stderr, "ERROR #%d: Control Channel Connect Error\n", CONNECT_ERROR);
+    close(control_socket);
+    freeaddrinfo(control_addr_info);
+    return -1;
+  }
+  freeaddrinfo(control_addr_info);
+
+  //Requests are single short lines, do not let Nagle hold them back
+  int nodelay = 1;
+  setsockopt(control_socket, IPPROTO_TCP, TCP_NODELAY, (char *)&nodelay, sizeof(int));
+
+  struct timeval timeout = { CONTROL_REPLY_TIMEOUT, 0 };
+  setsockopt(control_socket, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof timeout);
+
+  return control_socket;
+}
+
+error_t control_request(int control_socket, const char* request, char* reply, size_t reply_size)
+{
+  char line[CONTROL_LINE_LENGTH];
+  int line_len = snprintf(line, sizeof line, "%s\n", request);
+  if (send(control_socket, line, line_len, MSG_NOSIGNAL) != line_len)
+  {
+    fprintf(stderr, "ERROR #%d: Control Channel Send Error\n", SEND_ERROR);
+    return CONTROL_PROTOCOL_ERROR;
+  }
+
+  //Replies are read a byte at a time; they are short and rare
+  do
+  {
+    size_t reply_len = 0;
+    while (reply_len < reply_size - 1)
+    {
+      char c;
+      if (recv(control_socket, &c, 1, 0) != 1)
+      {
+        fprintf(stderr, "ERROR #%d: Control Channel Receive Error\n", RECEIVE_ERROR);
+        return CONTROL_PROTOCOL_ERROR;
+      }
+      if (c == '\n')
+        break;
+      reply[reply_len++] = c;
+    }
+    reply[reply_len] = '\0';
+  } while (strncmp(reply, "STOP", 4) == 0);
+
+  if (strncmp(reply, "ERROR", 5) == 0)
+  {
+    fprintf(stderr, "ERROR #%d: Receiver Rejected \"%s\": %s\n", CONTROL_PROTOCOL_ERROR, request, reply);
+    return CONTROL_PROTOCOL_ERROR;
+  }
+  return SUCCESS;
+}
+
+error_t control_sync_clock(int control_socket)
+{
+  char request[CONTROL_LINE_LENGTH];
+  char reply[CONTROL_LINE_LENGTH];
+  int64_t best_offset = 0, best_delay = INT64_MAX, best_at = 0;
+  int i;
+  for (i = 0; i < CLOCK_SYNC_EXCHANGES; i++)
+  {
+    struct timespec send_time, receive_time;
+    clock_gettime(CLOCK_REALTIME, &send_time);
+    int64_t t1 = timespec_to_ns(send_time);
+    snprintf(request, sizeof request, "TIME %lld", (long long) t1);
+    if (control_request(control_socket, request, reply, sizeof reply) != SUCCESS)
+      return CONTROL_PROTOCOL_ERROR;
+    clock_gettime(CLOCK_REALTIME, &receive_time);
+    int64_t t4 = timespec_to_ns(receive_time);
+
+    long long echoed_t1, t2, t3;
+    if (sscanf(reply, "TIME %lld %lld %lld", &echoed_t1, &t2, &t3) != 3 || echoed_t1 != t1)
+      return CONTROL_PROTOCOL_ERROR;
+
+    //The least delayed exchange has the least asymmetric queuing
+    int64_t delay = (t4 - t1) - (t3 - t2);
+    if (delay < best_delay)
+    {
+      best_delay = delay;
+      best_offset = ((t2 - t1) + (t3 - t4)) / 2;
+      best_at = t1 + (t4 - t1) / 2;
+    }
+  }
+
+  snprintf(request, sizeof request, "OFFSET %lld %lld %lld", (long long) best_offset,
+    (long long) best_delay, (long long) best_at);
+  return control_request(control_socket, request, reply, sizeof reply);
+}
+
+int control_stop_requested(int control_socket)
+{
+  char peek[5];
+  ssize_t peek_len = recv(control_socket, peek, 4, MSG_PEEK | MSG_DONTWAIT);
+  if (peek_len != 4 || strncmp(peek, "STOP", 4) != 0)
+    return 0;
+
+  //Consume the rest of the line
+  char c;
+  while (recv(control_socket, &c, 1, 0) == 1 && c != '\n')
+    ;
+  return 1;
+}
@@ -0,0 +1,376 @@
+/*************************************************************
+** Cross Traffic
+** See crossTraffic.h for the load description.
+**************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "crossTraffic.h"
+#include "probeHeader.h"
+#include "timeUtil.h"
+
+//Bytes of IPv4 and UDP header counted into the rate
+#define CROSS_IP_UDP_HEADER_LENGTH 28
+
+#define PARETO_SHAPE 1.5
+
+static const char* distribution_names[3] = { "const", "exp", "pareto" };
+
+static int64_t now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return timespec_to_ns(now);
+}
+
+/*
+ * Parse a time like 20ms; a bare number is in ms
+ */
+static int parse_time(const char* text, int64_t* ns)
+{
+	char* unit;
+	double value = strtod(text, &unit);
+	double scale;
+	if (unit == text || value < 0)
+		return 0;
+	if (*unit == '\0' || strcmp(unit, "ms") == 0)
+		scale = 1e6;
+	else if (strcmp(unit, "us") == 0)
+		scale = 1e3;
+	else if (strcmp(unit, "ns") == 0)
+		scale = 1;
+	else if (strcmp(unit, "s") == 0)
+		scale = 1e9;
+	else
+		return 0;
+	*ns = (int64_t) (value * scale);
+	return 1;
+}
+
+/*
+ * Parse <distribution>:<mean time>
+ */
+static int parse_period(const char* text, struct cross_period* period)
+{
+	const char* colon = strchr(text, ':');
+	if (colon == NULL)
+		return 0;
+	int d;
+	for (d = 0; d < 3; d++)
+	{
+		if ((size_t) (colon - text) == strlen(distribution_names[d]) &&
+			strncmp(text, distribution_names[d], colon - text) == 0)
+			break;
+	}
+	if (d == 3)
+		return 0;
+	period->distribution = d;
+	return parse_time(colon + 1, &period->mean_ns) && period->mean_ns > 0;
+}
+
+error_t cross_traffic_parse(const char* text, struct cross_traffic_config* config)
+{
+	memset(config, 0, sizeof *config);
+	config->priority = 'L';
+	config->num_threads = 1;
+	config->payload_length = CROSS_DEFAULT_SIZE;
+	config->lead_ns = CROSS_DEFAULT_LEAD_NS;
+
+	char copy[256];
+	if (strlen(text) >= sizeof copy)
+	{
+		fprintf(stderr, "ERROR #%d: Cross traffic description is too long\n", INVALID_NUMBER_OF_ARGUMENTS);
+		return INVALID_NUMBER_OF_ARGUMENTS;
+	}
+	strcpy(copy, text);
+
+	char* save;
+	char* setting;
+	for (setting = strtok_r(copy, ",", &save); setting != NULL; setting = strtok_r(NULL, ",", &save))
+	{
+		char* value = strchr(setting, '=');
+		int valid;
+		if (value != NULL)
+			*value++ = '\0';
+		if (value == NULL)
+			valid = 0;
+		else if (strcmp(setting, "rate") == 0)
+		{
+			char* unit;
+			config->rate_bps = strtod(value, &unit);
+			double scale = 1;
+			if (*unit != '\0')
+				scale = unit[1] != '\0' ? 0 : (*unit == 'k' ? 1e3 : (*unit == 'M' ? 1e6 : (*unit == 'G' ? 1e9 : 0)));
+			config->rate_bps *= scale;
+			valid = unit != value && config->rate_bps > 0;
+		}
+		else if (strcmp(setting, "class") == 0)
+		{
+			valid = (strcmp(value, "H") == 0 || strcmp(value, "L") == 0);
+			config->priority = value[0];
+		}
+		else if (strcmp(setting, "port") == 0)
+		{
+			valid = atoi(value) > 0 && atoi(value) < 65536 && strlen(value) < sizeof config->port;
+			if (valid)
+				strcpy(config->port, value);
+		}
+		else if (strcmp(setting, "threads") == 0)
+		{
+			config->num_threads = atoi(value);
+			valid = config->num_threads >= 1 && config->num_threads <= CROSS_MAX_THREADS;
+		}
+		else if (strcmp(setting, "size") == 0)
+		{
+			config->payload_length = atoi(value);
+			valid = config->payload_length >= PROBE_HEADER_MIN_LENGTH && config->payload_length <= MAX_PACKET_SIZE;
+		}
+		else if (strcmp(setting, "on") == 0)
+			valid = parse_period(value, &config->on);
+		else if (strcmp(setting, "off") == 0)
+			valid = parse_period(value, &config->off);
+		else if (strcmp(setting, "lead") == 0)
+			valid = parse_time(value, &config->lead_ns);
+		else
+			valid = 0;
+
+		if (!valid)
+		{
+			fprintf(stderr, "ERROR #%d: Cross traffic setting %s is not valid\n", INVALID_NUMBER_OF_ARGUMENTS,
+				setting);
+			return INVALID_NUMBER_OF_ARGUMENTS;
+		}
+	}
+	if (config->rate_bps <= 0)
+	{
+		fprintf(stderr, "ERROR #%d: Cross traffic needs a rate\n", INVALID_NUMBER_OF_ARGUMENTS);
+		return INVALID_NUMBER_OF_ARGUMENTS;
+	}
+	if ((config->off.mean_ns > 0) != (config->on.mean_ns > 0))
+	{
+		fprintf(stderr, "ERROR #%d: Cross traffic on and off periods go together\n",
+			INVALID_NUMBER_OF_ARGUMENTS);
+		return INVALID_NUMBER_OF_ARGUMENTS;
+	}
+	return SUCCESS;
+}
+
+/*
+ * Length of a period drawn from its distribution
+ */
+static int64_t draw_period(struct cross_source* source, const struct cross_period* period)
+{
+	//xorshift64, uniform in (0, 1]
+	source->random_state ^= source->random_state << 13;
+	source->random_state ^= source->random_state >> 7;
+	source->random_state ^= source->random_state << 17;
+	double uniform = ((source->random_state >> 11) + 1) * (1.0 / 9007199254740992.0);
+
+	switch (period->distribution)
+	{
+	case CROSS_EXPONENTIAL:
+		return (int64_t) (-log(uniform) * period->mean_ns);
+	case CROSS_PARETO:
+		return (int64_t) (period->mean_ns * (PARETO_SHAPE - 1) / PARETO_SHAPE * pow(uniform, -1 / PARETO_SHAPE));
+	default:
+		return period->mean_ns;
+	}
+}
+
+/*
+ * Sleep until deadline, but no longer than CROSS_MAX_SLEEP_NS so a
+ * stop is noticed
+ */
+static void sleep_until(int64_t deadline_ns, int64_t now)
+{
+	if (deadline_ns - now > CROSS_MAX_SLEEP_NS)
+		deadline_ns = now + CROSS_MAX_SLEEP_NS;
+	struct timespec deadline = ns_to_timespec(deadline_ns);
+	clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &deadline, NULL);
+}
+
+static void* run_source(void* arg)
+{
+	struct cross_source* source = (struct cross_source*) arg;
+	struct cross_traffic* traffic = source->traffic;
+	const struct cross_traffic_config* config = &traffic->config;
+
+	//Packets of the source follow each other at its share of the rate
+	double share_bps = config->rate_bps / traffic->num_sources;
+	int64_t gap_ns = (int64_t) ((config->payload_length + CROSS_IP_UDP_HEADER_LENGTH) * 8 * 1e9 / share_bps);
+	if (gap_ns < 1)
+		gap_ns = 1;
+
+	uint8_t* buffers = (uint8_t*) calloc(CROSS_BATCH_SIZE, config->payload_length);
+	if (buffers == NULL)
+		return NULL;
+	struct mmsghdr msgs[CROSS_BATCH_SIZE];
+	struct iovec iovs[CROSS_BATCH_SIZE];
+	memset(msgs, 0, sizeof msgs);
+	int i;
+	for (i = 0; i < CROSS_BATCH_SIZE; i++)
+	{
+		uint8_t* buffer = buffers + (size_t) i * config->payload_length;
+		buffer[4] = PROBE_CLASS_CROSS;
+		if (config->header_offset + 4 < config->payload_length)
+			buffer[config->header_offset + 4] = PROBE_CLASS_CROSS;
+		iovs[i].iov_base = buffer;
+		iovs[i].iov_len = config->payload_length;
+		msgs[i].msg_hdr.msg_name = traffic->destination->ai_addr;
+		msgs[i].msg_hdr.msg_namelen = traffic->destination->ai_addrlen;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	int always_on = config->off.mean_ns == 0;
+	int64_t on_start_ns = now_ns();
+	int64_t on_end_ns = always_on ? INT64_MAX : on_start_ns + draw_period(source, &config->on);
+	int64_t next_ns = on_start_ns;
+	int32_t seq_id = 0;
+	while (!__atomic_load_n(&traffic->stopping, __ATOMIC_ACQUIRE))
+	{
+		int64_t now = now_ns();
+		if (now >= on_end_ns)
+		{
+			//Off until the end of a drawn period, then on again
+			source->on_ns += on_end_ns - on_start_ns;
+			int64_t off_end_ns = on_end_ns + draw_period(source, &config->off);
+			while (!__atomic_load_n(&traffic->stopping, __ATOMIC_ACQUIRE) && (now = now_ns()) < off_end_ns)
+				sleep_until(off_end_ns, now);
+			on_start_ns = off_end_ns;
+			on_end_ns = off_end_ns + draw_period(source, &config->on);
+			next_ns = off_end_ns;
+			if (now < off_end_ns)
+			{
+				//Stopped while off
+				on_start_ns = on_end_ns = now;
+				break;
+			}
+			continue;
+		}
+
+		if (now < next_ns)
+		{
+			sleep_until(next_ns < on_end_ns ? next_ns : on_end_ns, now);
+			continue;
+		}
+
+		//Fell behind by more than a batch: the shortfall shows in the achieved rate
+		if (now - next_ns > CROSS_BATCH_SIZE * gap_ns)
+			next_ns = now - CROSS_BATCH_SIZE * gap_ns;
+		int count = (int) ((now - next_ns) / gap_ns) + 1;
+		if (count > CROSS_BATCH_SIZE)
+			count = CROSS_BATCH_SIZE;
+		for (i = 0; i < count; i++)
+		{
+			memcpy(buffers + (size_t) i * config->payload_length, &seq_id, sizeof seq_id);
+			seq_id++;
+		}
+		int sent = sendmmsg(source->socket, msgs, count, 0);
+		if (sent < 0)
+			sent = 0;
+		source->packets += sent;
+		source->bytes += (long long) sent * (config->payload_length + CROSS_IP_UDP_HEADER_LENGTH);
+		source->send_errors += count - sent;
+		next_ns += count * gap_ns;
+	}
+
+	free(buffers);
+	int64_t stop_ns = now_ns();
+	source->on_ns += (on_end_ns < stop_ns ? on_end_ns : stop_ns) - on_start_ns;
+	return NULL;
+}
+
+error_t cross_traffic_start(struct cross_traffic* traffic, const struct cross_traffic_config* config,
+	const char* receiver_address)
+{
+	memset(traffic, 0, sizeof *traffic);
+	traffic->config = *config;
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	const char* port = config->port[0] != '\0' ? config->port :
+		(config->priority == 'H' ? UDP_PROBE_PORT_NUMBER_HIGH : UDP_PROBE_PORT_NUMBER_LOW);
+	if (getaddrinfo(receiver_address, port, &hints, &traffic->destination) != 0)
+	{
+		fprintf(stderr, "ERROR #%d: Address Information Error\n", ADDRINFO_ERROR);
+		return ADDRINFO_ERROR;
+	}
+
+	traffic->start_ns = now_ns();
+	traffic->num_sources = config->num_threads;
+	int started;
+	for (started = 0; started < traffic->num_sources; started++)
+	{
+		struct cross_source* source = &traffic->sources[started];
+		source->traffic = traffic;
+		source->random_state = ((uint64_t) traffic->start_ns * 1000000007ULL) ^
+			(0x9e3779b97f4a7c15ULL * (started + 1));
+		source->socket = socket(traffic->destination->ai_family, traffic->destination->ai_socktype,
+			traffic->destination->ai_protocol);
+		if (source->socket == -1)
+			break;
+		if (pthread_create(&source->thread, NULL, run_source, source) != 0)
+		{
+			close(source->socket);
+			break;
+		}
+	}
+	if (started < traffic->num_sources)
+	{
+		//Stop whatever started
+		fprintf(stderr, "ERROR #%d: Socket Setup Error\n", SOCKET_SETUP_ERROR);
+		__atomic_store_n(&traffic->stopping, 1, __ATOMIC_RELEASE);
+		int i;
+		for (i = 0; i < started; i++)
+		{
+			pthread_join(traffic->sources[i].thread, NULL);
+			close(traffic->sources[i].socket);
+		}
+		freeaddrinfo(traffic->destination);
+		return SOCKET_SETUP_ERROR;
+	}
+
+	//Let the queue build before the first probe
+	struct timespec lead = ns_to_timespec(traffic->start_ns + config->lead_ns);
+	clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &lead, NULL);
+	return SUCCESS;
+}
+
+void cross_traffic_stop(struct cross_traffic* traffic)
+{
+	__atomic_store_n(&traffic->stopping, 1, __ATOMIC_RELEASE);
+	long long packets = 0, bytes = 0, send_errors = 0;
+	int64_t on_ns = 0;
+	int i;
+	for (i = 0; i < traffic->num_sources; i++)
+	{
+		pthread_join(traffic->sources[i].thread, NULL);
+		close(traffic->sources[i].socket);
+		packets += traffic->sources[i].packets;
+		bytes += traffic->sources[i].bytes;
+		send_errors += traffic->sources[i].send_errors;
+		on_ns += traffic->sources[i].on_ns;
+	}
+	traffic->stop_ns = now_ns();
+	freeaddrinfo(traffic->destination);
+
+	//Sources are on for different stretches; their mean share is the duty cycle
+	const struct cross_traffic_config* config = &traffic->config;
+	double duration_s = (double) (traffic->stop_ns - traffic->start_ns) / NSEC_PER_SEC;
+	double on_fraction = duration_s > 0 ? (double) on_ns / traffic->num_sources / NSEC_PER_SEC / duration_s : 0;
+	double achieved_bps = duration_s > 0 ? bytes * 8.0 / duration_s : 0;
+	printf("X: cross traffic %c, %d sources, target %.2f Mbit/s while on, on %.1f%% of %.3f s\n",
+		config->priority, traffic->num_sources, config->rate_bps / 1e6, 100 * on_fraction, duration_s);
+	printf("X: achieved %.2f Mbit/s overall, %.2f Mbit/s while on, %lld packets, %lld send errors\n",
+		achieved_bps / 1e6, on_fraction > 0 ? achieved_bps / on_fraction / 1e6 : 0.0, packets, send_errors);
+}
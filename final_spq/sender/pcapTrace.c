@@ -0,0 +1,372 @@
+/*************************************************************
+** pcap Trace Replay
+** See pcapTrace.h for what is replayed.
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcapTrace.h"
+#include "probeHeader.h"
+#include "timeUtil.h"
+
+#define PCAP_MAGIC_MICROSECONDS 0xa1b2c3d4u
+#define PCAP_MAGIC_NANOSECONDS 0xa1b23c4du
+#define PCAP_GLOBAL_HEADER_LENGTH 24
+#define PCAP_RECORD_HEADER_LENGTH 16
+
+//Largest record accepted, beyond any snaplen in use
+#define PCAP_MAX_RECORD_LENGTH 262144
+
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_IPV6 0x86dd
+#define ETHERTYPE_VLAN 0x8100
+
+#define IP_PROTOCOL_TCP 6
+#define IP_PROTOCOL_UDP 17
+
+struct trace_packet
+{
+	int64_t departure_ns;
+	uint32_t payload_offset;
+	uint16_t length;
+};
+
+static uint32_t read_u32(const uint8_t* bytes, int swapped)
+{
+	uint32_t value;
+	memcpy(&value, bytes, sizeof value);
+	return swapped ? __builtin_bswap32(value) : value;
+}
+
+static uint16_t read_be16(const uint8_t* bytes)
+{
+	return (uint16_t) (bytes[0] << 8 | bytes[1]);
+}
+
+/*
+ * Offset of the IP header in a frame of the link type, -1 if the frame
+ * does not carry IP
+ */
+static int ip_header_offset(const uint8_t* frame, int length, uint32_t link_type)
+{
+	int offset;
+	uint16_t ethertype;
+	switch (link_type)
+	{
+	case LINKTYPE_NULL:
+		//Address family in the capturing host's byte order, IP is told by its version
+		return length >= 4 ? 4 : -1;
+	case LINKTYPE_RAW:
+	case LINKTYPE_IPV4:
+	case LINKTYPE_IPV6:
+		return 0;
+	case LINKTYPE_ETHERNET:
+		if (length < 14)
+			return -1;
+		offset = 14;
+		ethertype = read_be16(frame + 12);
+		while (ethertype == ETHERTYPE_VLAN && length >= offset + 4)
+		{
+			ethertype = read_be16(frame + offset + 2);
+			offset += 4;
+		}
+		break;
+	case LINKTYPE_LINUX_SLL:
+		if (length < 16)
+			return -1;
+		offset = 16;
+		ethertype = read_be16(frame + 14);
+		break;
+	case LINKTYPE_LINUX_SLL2:
+		if (length < 20)
+			return -1;
+		offset = 20;
+		ethertype = read_be16(frame);
+		break;
+	default:
+		return -1;
+	}
+	return ethertype == ETHERTYPE_IPV4 || ethertype == ETHERTYPE_IPV6 ? offset : -1;
+}
+
+/*
+ * Find the UDP or TCP payload of the IP packet at ip. Returns its
+ * original length (0 if there is none) and sets the offset of its
+ * first captured byte.
+ */
+static int transport_payload(const uint8_t* ip, int captured, int* payload_offset)
+{
+	if (captured < 1)
+		return 0;
+	int version = ip[0] >> 4;
+	int protocol, header_length, total_length;
+	if (version == 4)
+	{
+		if (captured < 20)
+			return 0;
+		header_length = (ip[0] & 0x0f) * 4;
+		total_length = read_be16(ip + 2);
+		protocol = ip[9];
+
+		//Only the first fragment has the transport header
+		if ((read_be16(ip + 6) & 0x1fff) != 0)
+			return 0;
+	}
+	else if (version == 6)
+	{
+		if (captured < 40)
+			return 0;
+		header_length = 40;
+		total_length = 40 + read_be16(ip + 4);
+		protocol = ip[6];
+	}
+	else
+		return 0;
+
+	int transport_length;
+	if (protocol == IP_PROTOCOL_UDP)
+	{
+		if (captured < header_length + 8)
+			return 0;
+		*payload_offset = header_length + 8;
+		return read_be16(ip + header_length + 4) - 8;
+	}
+	if (protocol == IP_PROTOCOL_TCP)
+	{
+		if (captured < header_length + 13)
+			return 0;
+		transport_length = (ip[header_length + 12] >> 4) * 4;
+		*payload_offset = header_length + transport_length;
+		return total_length - header_length - transport_length;
+	}
+	return 0;
+}
+
+/*
+ * Read every replayable packet of the trace into packets and
+ * trace->payloads. Returns the number of packets, -1 on error.
+ */
+static long long read_trace(FILE* file, const char* path, int rewrite, int class_index,
+	struct trace_packet** packets_out, struct pcap_trace* trace)
+{
+	uint8_t header[PCAP_GLOBAL_HEADER_LENGTH];
+	if (fread(header, 1, sizeof header, file) != sizeof header)
+	{
+		fprintf(stderr, "ERROR #%d: %s is too short for a pcap file\n", FREAD_ERROR, path);
+		return -1;
+	}
+	uint32_t magic;
+	memcpy(&magic, header, sizeof magic);
+	int swapped = magic == __builtin_bswap32(PCAP_MAGIC_MICROSECONDS) ||
+		magic == __builtin_bswap32(PCAP_MAGIC_NANOSECONDS);
+	magic = swapped ? __builtin_bswap32(magic) : magic;
+	if (magic != PCAP_MAGIC_MICROSECONDS && magic != PCAP_MAGIC_NANOSECONDS)
+	{
+		fprintf(stderr, "ERROR #%d: %s is not a classic pcap file\n", FILE_ERROR, path);
+		return -1;
+	}
+	int64_t fraction_ns = magic == PCAP_MAGIC_NANOSECONDS ? 1 : 1000;
+	uint32_t link_type = read_u32(header + 20, swapped) & 0x0fffffff;
+
+	static uint8_t frame[PCAP_MAX_RECORD_LENGTH];
+	long long capacity = 0, count = 0;
+	size_t payload_capacity = 0, payload_bytes = 0;
+	struct trace_packet* packets = NULL;
+	int64_t first_ns = 0, previous_ns = 0;
+	uint8_t record[PCAP_RECORD_HEADER_LENGTH];
+	while (fread(record, 1, sizeof record, file) == sizeof record)
+	{
+		uint32_t captured = read_u32(record + 8, swapped);
+		if (captured > PCAP_MAX_RECORD_LENGTH || fread(frame, 1, captured, file) != captured)
+		{
+			fprintf(stderr, "ERROR #%d: %s is cut short or corrupt after %lld packets\n", FREAD_ERROR, path,
+				trace->packets);
+			free(packets);
+			return -1;
+		}
+		trace->packets++;
+		int64_t timestamp_ns = (int64_t) read_u32(record, swapped) * NSEC_PER_SEC +
+			(int64_t) read_u32(record + 4, swapped) * fraction_ns;
+
+		int payload_offset = 0;
+		int ip_offset = ip_header_offset(frame, (int) captured, link_type);
+		int length = ip_offset < 0 ? 0 :
+			transport_payload(frame + ip_offset, (int) captured - ip_offset, &payload_offset);
+		if (length <= 0)
+		{
+			trace->skipped++;
+			continue;
+		}
+		payload_offset += ip_offset;
+		if (length > MAX_PACKET_SIZE)
+		{
+			length = MAX_PACKET_SIZE;
+			trace->clamped++;
+		}
+		if (rewrite && length < PROBE_HEADER_MIN_LENGTH)
+		{
+			length = PROBE_HEADER_MIN_LENGTH;
+			trace->padded++;
+		}
+
+		if (count == capacity)
+		{
+			capacity = capacity ? 2 * capacity : 4096;
+			struct trace_packet* grown = (struct trace_packet*) realloc(packets, capacity * sizeof *packets);
+			if (grown == NULL || capacity > TRAIN_PATTERN_MAX_PROBES)
+			{
+				fprintf(stderr, "ERROR #%d: %s has too many packets\n", FAILURE, path);
+				free(grown != NULL ? grown : packets);
+				return -1;
+			}
+			packets = grown;
+		}
+		if (payload_bytes + length > payload_capacity)
+		{
+			payload_capacity = payload_capacity ? 2 * payload_capacity : 1 << 20;
+			while (payload_bytes + length > payload_capacity)
+				payload_capacity *= 2;
+			//Offsets into the payloads are 32 bit; check before growing so a
+			//failure leaves trace->payloads valid for pcap_trace_free
+			uint8_t* grown = payload_capacity > UINT32_MAX ? NULL :
+				(uint8_t*) realloc(trace->payloads, payload_capacity);
+			if (grown == NULL)
+			{
+				fprintf(stderr, "ERROR #%d: %s is too large to replay\n", FAILURE, path);
+				free(packets);
+				return -1;
+			}
+			trace->payloads = grown;
+		}
+
+		//Captured bytes, zeros for what the snaplen cut off
+		uint8_t* payload = trace->payloads + payload_bytes;
+		int available = (int) captured - payload_offset;
+		available = available < 0 ? 0 : (available < length ? available : length);
+		memcpy(payload, frame + payload_offset, available);
+		memset(payload + available, 0, length - available);
+		if (rewrite)
+		{
+			//The sender writes the sequence id and stamp, the class and flags are fixed
+			payload[4] = class_index == 0 ? 'H' : 'L';
+			memset(payload + 5, 0, (length < 8 ? length : 8) - 5);
+		}
+
+		//Captures can be slightly out of order; never depart before the previous packet
+		if (count == 0)
+			first_ns = previous_ns = timestamp_ns;
+		if (timestamp_ns < previous_ns)
+			timestamp_ns = previous_ns;
+		previous_ns = timestamp_ns;
+
+		packets[count].departure_ns = timestamp_ns - first_ns;
+		packets[count].payload_offset = (uint32_t) payload_bytes;
+		packets[count].length = (uint16_t) length;
+		payload_bytes += length;
+		count++;
+	}
+	trace->replayed = count;
+	trace->duration_ns = count > 0 ? packets[count - 1].departure_ns : 0;
+	*packets_out = packets;
+	return count;
+}
+
+error_t pcap_trace_load(const struct replay_options* options, int class_index, struct train_pattern* pattern,
+	struct pcap_trace* trace)
+{
+	memset(pattern, 0, sizeof *pattern);
+	memset(trace, 0, sizeof *trace);
+	trace->rewrite = options->rewrite;
+
+	FILE* file = fopen(options->path, "rb");
+	if (file == NULL)
+	{
+		fprintf(stderr, "ERROR #%d: Cannot open trace %s\n", FILE_ERROR, options->path);
+		return FILE_ERROR;
+	}
+	struct trace_packet* packets = NULL;
+	long long num_packets = read_trace(file, options->path, options->rewrite, class_index, &packets, trace);
+	fclose(file);
+	if (num_packets <= 0)
+	{
+		if (num_packets == 0)
+			fprintf(stderr, "ERROR #%d: %s has no UDP or TCP payloads to replay\n", FAILURE, options->path);
+		pcap_trace_free(trace);
+		return num_packets == 0 ? FAILURE : FREAD_ERROR;
+	}
+
+	long long num_control = options->control_interval_ns > 0 ?
+		trace->duration_ns / options->control_interval_ns + 1 : 0;
+	long long length = num_packets + num_control;
+	if (length > TRAIN_PATTERN_MAX_PROBES)
+	{
+		fprintf(stderr, "ERROR #%d: The control flow makes the replay too long\n", INVALID_NUMBER_OF_ARGUMENTS);
+		free(packets);
+		pcap_trace_free(trace);
+		return INVALID_NUMBER_OF_ARGUMENTS;
+	}
+	pattern->probes = (struct pattern_probe*) calloc(length, sizeof(struct pattern_probe));
+	trace->payload_offsets = (uint32_t*) malloc(length * sizeof(uint32_t));
+	if (pattern->probes == NULL || trace->payload_offsets == NULL)
+	{
+		free(packets);
+		train_pattern_free(pattern);
+		pcap_trace_free(trace);
+		return FAILURE;
+	}
+
+	//Merge the trace and the control flow by departure, control first on ties
+	long long t = 0, c = 0;
+	int32_t next_seq_id[2] = { 0, 0 };
+	while (t < num_packets || c < num_control)
+	{
+		struct pattern_probe* probe = &pattern->probes[pattern->length];
+		if (c < num_control && (t == num_packets || c * options->control_interval_ns <= packets[t].departure_ns))
+		{
+			probe->departure_ns = c * options->control_interval_ns;
+			probe->class_index = (uint8_t) (1 - class_index);
+			trace->payload_offsets[pattern->length] = PCAP_NO_PAYLOAD;
+			c++;
+		}
+		else
+		{
+			probe->departure_ns = packets[t].departure_ns;
+			probe->class_index = (uint8_t) class_index;
+			probe->length = packets[t].length;
+			trace->payload_offsets[pattern->length] = packets[t].payload_offset;
+			if (probe->length > pattern->max_length)
+				pattern->max_length = probe->length;
+			t++;
+		}
+		probe->seq_id = next_seq_id[probe->class_index]++;
+		probe->train = 1;
+		pattern->length++;
+	}
+	pattern->capacity = pattern->length;
+
+	//The whole replay is one train
+	pattern->num_trains = 1;
+	pattern->probes[pattern->length - 1].ends_train = 1;
+	pattern->class_counts[0] = next_seq_id[0];
+	pattern->class_counts[1] = next_seq_id[1];
+	free(packets);
+	return SUCCESS;
+}
+
+void pcap_trace_free(struct pcap_trace* trace)
+{
+	free(trace->payloads);
+	free(trace->payload_offsets);
+	trace->payloads = NULL;
+	trace->payload_offsets = NULL;
+}
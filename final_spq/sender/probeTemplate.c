@@ -0,0 +1,183 @@
+/*************************************************************
+** Probe Templates
+** See probeTemplate.h for the file format.
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "probeTemplate.h"
+
+#define TEMPLATE_LINE_LENGTH 1024
+
+static const char* source_names[4] = { "seq", "counter", "clock", "random" };
+
+/*
+ * Parse the unsigned number in token, decimal or 0x hex
+ */
+static int parse_number(const char* token, unsigned long long max, unsigned long long* value)
+{
+	char* end;
+	if (token == NULL || *token < '0' || *token > '9')
+		return 0;
+	*value = strtoull(token, &end, 0);
+	return *end == '\0' && *value <= max;
+}
+
+/*
+ * Parse the rest of a "bytes" line: a hex byte per token. Marks the
+ * offsets it sets in written.
+ */
+static int parse_bytes(struct probe_template* probe_template, uint8_t* written, char** save)
+{
+	unsigned long long offset;
+	if (!parse_number(strtok_r(NULL, " \t", save), PROBE_TEMPLATE_MAX_BYTES - 1, &offset))
+		return 0;
+	char* token;
+	int count = 0;
+	while ((token = strtok_r(NULL, " \t", save)) != NULL)
+	{
+		char* end;
+		unsigned long byte = strtoul(token, &end, 16);
+		if (*end != '\0' || end - token != 2 || offset + count >= PROBE_TEMPLATE_MAX_BYTES)
+			return 0;
+		written[offset + count] = 1;
+		probe_template->bytes[offset + count++] = (uint8_t) byte;
+	}
+	if (count == 0)
+		return 0;
+	if ((int) (offset + count) > probe_template->length)
+		probe_template->length = (int) (offset + count);
+	return 1;
+}
+
+/*
+ * Parse the rest of a "field" line
+ */
+static int parse_field(struct probe_template* probe_template, char** save)
+{
+	if (probe_template->num_fields == PROBE_TEMPLATE_MAX_FIELDS)
+		return 0;
+	struct template_field* field = &probe_template->fields[probe_template->num_fields];
+	unsigned long long offset, width;
+	if (!parse_number(strtok_r(NULL, " \t", save), MAX_PACKET_SIZE - 1, &offset) ||
+		!parse_number(strtok_r(NULL, " \t", save), 8, &width) ||
+		(width != 1 && width != 2 && width != 4 && width != 8))
+		return 0;
+	field->offset = (uint16_t) offset;
+	field->width = (uint8_t) width;
+
+	const char* order = strtok_r(NULL, " \t", save);
+	if (order == NULL || (strcmp(order, "be") != 0 && strcmp(order, "le") != 0))
+		return 0;
+	field->big_endian = strcmp(order, "be") == 0;
+
+	const char* source = strtok_r(NULL, " \t", save);
+	int s;
+	for (s = 0; s < 4 && source != NULL && strcmp(source, source_names[s]) != 0; s++)
+		;
+	if (s == 4 || source == NULL)
+		return 0;
+	field->source = (uint8_t) s;
+
+	//seq and counter step by 1 unless told otherwise, clock needs its rate
+	const char* argument = strtok_r(NULL, " \t", save);
+	unsigned long long value = 1;
+	if (argument != NULL && (s == TEMPLATE_SOURCE_RANDOM || !parse_number(argument, UINT32_MAX, &value)))
+		return 0;
+	if (s == TEMPLATE_SOURCE_CLOCK && (argument == NULL || value == 0))
+		return 0;
+	field->argument = value;
+	probe_template->num_fields++;
+	return strtok_r(NULL, " \t", save) == NULL;
+}
+
+error_t probe_template_load(const char* path, struct probe_template* probe_template)
+{
+	memset(probe_template, 0, sizeof *probe_template);
+	FILE* file = fopen(path, "r");
+	if (file == NULL)
+	{
+		fprintf(stderr, "ERROR #%d: Cannot open template %s\n", FILE_ERROR, path);
+		return FILE_ERROR;
+	}
+
+	char line[TEMPLATE_LINE_LENGTH];
+	uint8_t written[PROBE_TEMPLATE_MAX_BYTES] = { 0 };
+	int line_number = 0;
+	int valid = 1;
+	while (valid && fgets(line, sizeof line, file) != NULL)
+	{
+		line_number++;
+		line[strcspn(line, "#\r\n")] = '\0';
+		char* save;
+		char* keyword = strtok_r(line, " \t", &save);
+		if (keyword == NULL)
+			continue;
+
+		if (strcmp(keyword, "name") == 0)
+		{
+			const char* name = strtok_r(NULL, " \t", &save);
+			valid = name != NULL && strlen(name) < PROBE_TEMPLATE_NAME_LENGTH;
+			if (valid)
+				strcpy(probe_template->name, name);
+		}
+		else if (strcmp(keyword, "bytes") == 0)
+			valid = parse_bytes(probe_template, written, &save);
+		else if (strcmp(keyword, "field") == 0)
+			valid = parse_field(probe_template, &save);
+		else if (strcmp(keyword, "probe_offset") == 0)
+		{
+			unsigned long long offset = 0;
+			valid = parse_number(strtok_r(NULL, " \t", &save), PROBE_TEMPLATE_MAX_OFFSET, &offset);
+			probe_template->probe_offset = (int) offset;
+		}
+		else
+			valid = 0;
+	}
+	fclose(file);
+	if (!valid)
+	{
+		fprintf(stderr, "ERROR #%d: Template %s, line %d is not valid\n", INVALID_NUMBER_OF_ARGUMENTS, path,
+			line_number);
+		return INVALID_NUMBER_OF_ARGUMENTS;
+	}
+
+	//The probe header must not overwrite a field or a fixed byte
+	int b;
+	for (b = probe_template->probe_offset; b < probe_template->probe_offset + PROBE_HEADER_LENGTH; b++)
+	{
+		if (written[b])
+		{
+			fprintf(stderr, "ERROR #%d: Template %s has fixed bytes inside the probe header at %d\n",
+				INVALID_NUMBER_OF_ARGUMENTS, path, probe_template->probe_offset);
+			return INVALID_NUMBER_OF_ARGUMENTS;
+		}
+	}
+	int f;
+	for (f = 0; f < probe_template->num_fields; f++)
+	{
+		const struct template_field* field = &probe_template->fields[f];
+		if (field->offset < probe_template->probe_offset + PROBE_HEADER_LENGTH &&
+			field->offset + field->width > probe_template->probe_offset)
+		{
+			fprintf(stderr, "ERROR #%d: Template %s has a field inside the probe header at %d\n",
+				INVALID_NUMBER_OF_ARGUMENTS, path, probe_template->probe_offset);
+			return INVALID_NUMBER_OF_ARGUMENTS;
+		}
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	probe_template->random_state = ((uint64_t) now.tv_sec * 1000000007ULL) ^ (uint64_t) now.tv_nsec ^
+		0x9e3779b97f4a7c15ULL;
+	return SUCCESS;
+}
+
+void probe_template_fill(const struct probe_template* probe_template, uint8_t* payload, int length)
+{
+	int copy = probe_template->length < length ? probe_template->length : length;
+	memcpy(payload, probe_template->bytes, copy);
+}
@@ -0,0 +1,262 @@
+/*************************************************************
+** Reflection Collector
+** See reflectionCollector.h for the quantities measured.
+**************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "reflectionCollector.h"
+#include "probeHeader.h"
+#include "timeUtil.h"
+
+static void store_echo(struct reflection_collector* collector, const struct probe_header* header,
+	int64_t rx_ns)
+{
+	if (!(header->flags & PROBE_FLAG_REFLECTED) || (header->priority != 'H' && header->priority != 'L'))
+		return;
+
+	struct reflection_class* echo_class = &collector->classes[header->priority == 'L'];
+	if (header->seq_id < 0 || header->seq_id >= echo_class->capacity)
+		return;
+
+	struct reflection_record* record = &echo_class->records[header->seq_id];
+	if (record->rx_ns != 0)
+	{
+		echo_class->duplicates++;
+		return;
+	}
+	record->rx_ns = rx_ns;
+	record->tx_ns = header->tx_time_ns;
+	record->reflector_rx_ns = header->reflector_rx_ns;
+	record->reflector_tx_ns = header->reflector_tx_ns;
+	echo_class->echoed++;
+
+	if (header->reflector_tx_ns < echo_class->latest_reflector_tx_ns)
+		echo_class->reverse_reordered++;
+	else
+		echo_class->latest_reflector_tx_ns = header->reflector_tx_ns;
+}
+
+/*
+ * Read every echo queued on the socket
+ */
+static void receive_echoes(struct reflection_collector* collector)
+{
+	static char snap_buffers[ECHO_BATCH_SIZE][PROBE_REFLECTED_HEADER_LENGTH];
+	static char control_buffers[ECHO_BATCH_SIZE][CMSG_SPACE(sizeof(struct timespec))];
+	struct iovec iovs[ECHO_BATCH_SIZE];
+	struct mmsghdr msgs[ECHO_BATCH_SIZE];
+	int i;
+
+	while (1)
+	{
+		memset(msgs, 0, sizeof msgs);
+		for (i = 0; i < ECHO_BATCH_SIZE; i++)
+		{
+			iovs[i].iov_base = snap_buffers[i];
+			iovs[i].iov_len = PROBE_REFLECTED_HEADER_LENGTH;
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = control_buffers[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof control_buffers[i];
+		}
+
+		int received = recvmmsg(collector->socket, msgs, ECHO_BATCH_SIZE, MSG_DONTWAIT, NULL);
+		if (received <= 0)
+			return;
+
+		for (i = 0; i < received; i++)
+		{
+			struct probe_header header;
+			if (probe_header_read(snap_buffers[i], (int) msgs[i].msg_len, &header))
+				store_echo(collector, &header, timespec_to_ns(kernel_receive_timestamp(&msgs[i].msg_hdr)));
+		}
+	}
+}
+
+static void* collect_echoes(void* arg)
+{
+	struct reflection_collector* collector = (struct reflection_collector*) arg;
+	struct pollfd poll_fd = { collector->socket, POLLIN, 0 };
+
+	while (1)
+	{
+		poll(&poll_fd, 1, 50);
+		receive_echoes(collector);
+
+		if (!__atomic_load_n(&collector->sending_done, __ATOMIC_ACQUIRE))
+			continue;
+
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		if ((collector->classes[0].echoed >= collector->classes[0].sent &&
+			collector->classes[1].echoed >= collector->classes[1].sent) ||
+			elapsed_ns(collector->done_time, now) >= (int64_t) ECHO_DRAIN_TIME_MS * 1000000)
+			break;
+	}
+	return NULL;
+}
+
+error_t reflection_collector_start(struct reflection_collector* collector, int send_socket,
+	int capacity_high, int capacity_low)
+{
+	memset(collector, 0, sizeof *collector);
+	collector->socket = send_socket;
+	collector->classes[0].capacity = capacity_high;
+	collector->classes[1].capacity = capacity_low;
+
+	int c;
+	for (c = 0; c < 2; c++)
+	{
+		collector->classes[c].latest_reflector_tx_ns = INT64_MIN;
+		int capacity = collector->classes[c].capacity > 0 ? collector->classes[c].capacity : 1;
+		collector->classes[c].records = (struct reflection_record*) calloc(capacity,
+			sizeof(struct reflection_record));
+		collector->classes[c].refused_seq = (uint8_t*) calloc(capacity, 1);
+		if (collector->classes[c].records == NULL || collector->classes[c].refused_seq == NULL)
+		{
+			reflection_collector_free(collector);
+			return FAILURE;
+		}
+	}
+
+	int enable = 1;
+	setsockopt(send_socket, SOL_SOCKET, SO_TIMESTAMPNS, (char *)&enable, sizeof(int));
+	int recv_buffer_size = PROBE_SOCKET_RCVBUF;
+	setsockopt(send_socket, SOL_SOCKET, SO_RCVBUF, (char *)&recv_buffer_size, sizeof(int));
+
+	if (pthread_create(&collector->thread, NULL, collect_echoes, collector) != 0)
+	{
+		reflection_collector_free(collector);
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+void reflection_collector_refuse(struct reflection_collector* collector, int class_index, int32_t seq_id)
+{
+	struct reflection_class* echo_class = &collector->classes[class_index];
+	if (seq_id < 0 || seq_id >= echo_class->capacity || echo_class->refused_seq[seq_id])
+		return;
+	echo_class->refused_seq[seq_id] = 1;
+	echo_class->refused++;
+}
+
+void reflection_collector_finish(struct reflection_collector* collector, int sent_high, int sent_low)
+{
+	collector->classes[0].sent = sent_high;
+	collector->classes[1].sent = sent_low;
+	clock_gettime(CLOCK_REALTIME, &collector->done_time);
+	__atomic_store_n(&collector->sending_done, 1, __ATOMIC_RELEASE);
+	pthread_join(collector->thread, NULL);
+}
+
+static void print_percentiles(const char* metric, const struct quantile_histogram* histogram)
+{
+	printf("  %-10s min %lld  p50 %lld  p90 %lld  p99 %lld  max %lld ns\n", metric,
+		(long long) histogram->min,
+		(long long) quantile_histogram_percentile(histogram, 50),
+		(long long) quantile_histogram_percentile(histogram, 90),
+		(long long) quantile_histogram_percentile(histogram, 99),
+		(long long) histogram->max);
+}
+
+error_t reflection_collector_report(struct reflection_collector* collector, const char* output_path,
+	const char* receiver_address, char priority)
+{
+	char file_name[MAX_FILENAME_SIZE];
+	char date[32];
+	time_t now = time(NULL);
+	strftime(date, sizeof date, "%Y-%m-%d_%H:%M:%S", localtime(&now));
+	snprintf(file_name, sizeof file_name, "%s%s_%s_%c.rtt", output_path, receiver_address, date, priority);
+
+	FILE* file = fopen(file_name, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "ERROR #%d: Could not open %s\n", FILE_ERROR, file_name);
+		return FILE_ERROR;
+	}
+	fprintf(file, "#seq\tclass\trtt_ns\tforward_ns\treverse_ns\tturnaround_ns\n");
+
+	//rtt, forward, reverse and turnaround of one class at a time
+	struct quantile_histogram* histograms = (struct quantile_histogram*) malloc(4 * sizeof *histograms);
+	if (histograms == NULL)
+	{
+		fclose(file);
+		return FAILURE;
+	}
+
+	const char class_names[2] = { 'H', 'L' };
+	int c, seq, h;
+	for (c = 0; c < 2; c++)
+	{
+		struct reflection_class* echo_class = &collector->classes[c];
+		for (h = 0; h < 4; h++)
+			quantile_histogram_reset(&histograms[h]);
+
+		//Seq ids run in send order, so the accepted and refused probes
+		//together are the ones handed to the kernel
+		int attempted = echo_class->sent + echo_class->refused;
+		if (attempted > echo_class->capacity)
+			attempted = echo_class->capacity;
+		for (seq = 0; seq < attempted; seq++)
+		{
+			const struct reflection_record* record = &echo_class->records[seq];
+			if (echo_class->refused_seq[seq])
+			{
+				fprintf(file, "%d\t%c\trefused\t-\t-\t-\n", seq, class_names[c]);
+				continue;
+			}
+			if (record->rx_ns == 0)
+			{
+				fprintf(file, "%d\t%c\t-\t-\t-\t-\n", seq, class_names[c]);
+				continue;
+			}
+			int64_t turnaround = record->reflector_tx_ns - record->reflector_rx_ns;
+			int64_t rtt = record->rx_ns - record->tx_ns - turnaround;
+			int64_t forward = record->reflector_rx_ns - record->tx_ns;
+			int64_t reverse = record->rx_ns - record->reflector_tx_ns;
+			quantile_histogram_record(&histograms[0], rtt);
+			quantile_histogram_record(&histograms[1], forward);
+			quantile_histogram_record(&histograms[2], reverse);
+			quantile_histogram_record(&histograms[3], turnaround);
+			fprintf(file, "%d\t%c\t%lld\t%lld\t%lld\t%lld\n", seq, class_names[c], (long long) rtt,
+				(long long) forward, (long long) reverse, (long long) turnaround);
+		}
+
+		if (attempted == 0)
+			continue;
+		printf("%c: %d sent, %d echoed, %d lost, %d refused, %d duplicate, %d reordered on the reverse path\n",
+			class_names[c], echo_class->sent, echo_class->echoed, echo_class->sent - echo_class->echoed,
+			echo_class->refused, echo_class->duplicates, echo_class->reverse_reordered);
+		if (echo_class->echoed == 0)
+			continue;
+		print_percentiles("rtt", &histograms[0]);
+		print_percentiles("forward", &histograms[1]);
+		print_percentiles("reverse", &histograms[2]);
+		print_percentiles("turnaround", &histograms[3]);
+	}
+
+	free(histograms);
+	fclose(file);
+	printf("%s\n", file_name);
+	return SUCCESS;
+}
+
+void reflection_collector_free(struct reflection_collector* collector)
+{
+	int c;
+	for (c = 0; c < 2; c++)
+	{
+		free(collector->classes[c].records);
+		free(collector->classes[c].refused_seq);
+		collector->classes[c].records = NULL;
+		collector->classes[c].refused_seq = NULL;
+	}
+}
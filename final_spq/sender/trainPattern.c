@@ -0,0 +1,318 @@
+/*************************************************************
+** Train Pattern
+** See trainPattern.h for the language.
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trainPattern.h"
+
+struct pattern_parser
+{
+	const char* text;
+	const char* cursor;
+	struct train_pattern* pattern;
+
+	//Departure of the next probe
+	int64_t clock_ns;
+	const char* error;
+};
+
+static void skip_spaces(struct pattern_parser* parser)
+{
+	while (*parser->cursor == ' ' || *parser->cursor == '\t' || *parser->cursor == '\n')
+		parser->cursor++;
+}
+
+static int fail(struct pattern_parser* parser, const char* message)
+{
+	if (parser->error == NULL)
+		parser->error = message;
+	return 0;
+}
+
+/*
+ * Read a decimal count; missing gives default_count
+ */
+static int read_count(struct pattern_parser* parser, long long default_count, long long* count)
+{
+	if (*parser->cursor < '0' || *parser->cursor > '9')
+	{
+		*count = default_count;
+		return 1;
+	}
+	*count = 0;
+	while (*parser->cursor >= '0' && *parser->cursor <= '9')
+	{
+		*count = *count * 10 + (*parser->cursor++ - '0');
+		if (*count > TRAIN_PATTERN_MAX_PROBES)
+			return fail(parser, "count too large");
+	}
+	return 1;
+}
+
+static int reserve_probes(struct pattern_parser* parser, long long extra)
+{
+	struct train_pattern* pattern = parser->pattern;
+	if (pattern->length + extra > TRAIN_PATTERN_MAX_PROBES)
+		return fail(parser, "too many probes");
+	if (pattern->length + extra <= pattern->capacity)
+		return 1;
+	long long capacity = pattern->capacity ? pattern->capacity : 1024;
+	while (capacity < pattern->length + extra)
+		capacity *= 2;
+	struct pattern_probe* probes = (struct pattern_probe*) realloc(pattern->probes,
+		capacity * sizeof(struct pattern_probe));
+	if (probes == NULL)
+		return fail(parser, "out of memory");
+	pattern->probes = probes;
+	pattern->capacity = (int) capacity;
+	return 1;
+}
+
+static int parse_pause(struct pattern_parser* parser)
+{
+	static const char* units[4] = { "ns", "us", "ms", "s" };
+	static const int64_t scales[4] = { 1, 1000, 1000000, 1000000000 };
+	long long count;
+	if (*parser->cursor < '0' || *parser->cursor > '9' || !read_count(parser, 0, &count))
+		return fail(parser, "expected a pause like +2ms");
+	int u;
+	for (u = 0; u < 4; u++)
+	{
+		size_t unit_length = strlen(units[u]);
+		if (strncmp(parser->cursor, units[u], unit_length) == 0)
+		{
+			parser->cursor += unit_length;
+			parser->clock_ns += count * scales[u];
+			return 1;
+		}
+	}
+	return fail(parser, "expected a unit of ns, us, ms or s");
+}
+
+/*
+ * Read an optional size after a run or group: none leaves both bounds 0
+ */
+static int parse_size(struct pattern_parser* parser, long long* first_length, long long* last_length)
+{
+	*first_length = *last_length = 0;
+	if (*parser->cursor != '@')
+		return 1;
+	parser->cursor++;
+	if (*parser->cursor < '0' || *parser->cursor > '9' || !read_count(parser, 0, first_length))
+		return fail(parser, "expected a size like @1400 or @64-1472");
+	*last_length = *first_length;
+	if (*parser->cursor == '-')
+	{
+		parser->cursor++;
+		if (*parser->cursor < '0' || *parser->cursor > '9' || !read_count(parser, 0, last_length))
+			return fail(parser, "expected the last size of the range");
+	}
+	if (*first_length < TRAIN_PATTERN_MIN_LENGTH || *first_length > TRAIN_PATTERN_MAX_LENGTH ||
+		*last_length < TRAIN_PATTERN_MIN_LENGTH || *last_length > TRAIN_PATTERN_MAX_LENGTH)
+		return fail(parser, "size out of range");
+	if (*last_length > parser->pattern->max_length)
+		parser->pattern->max_length = (int) *last_length;
+	if (*first_length > parser->pattern->max_length)
+		parser->pattern->max_length = (int) *first_length;
+	return 1;
+}
+
+/*
+ * Size of step index of steps from first_length to last_length
+ */
+static uint16_t step_length(long long first_length, long long last_length, long long index, long long steps)
+{
+	if (steps <= 1)
+		return (uint16_t) first_length;
+	return (uint16_t) (first_length + (last_length - first_length) * index / (steps - 1));
+}
+
+static int parse_sequence(struct pattern_parser* parser, int depth);
+
+/*
+ * Mark each of the repetitions that start at first as a train of its own
+ */
+static void mark_trains(struct train_pattern* pattern, int first, int repetition_length, long long repetitions)
+{
+	long long r;
+	for (r = 0; r < repetitions && repetition_length > 0; r++)
+	{
+		int start = first + (int) r * repetition_length;
+		int i;
+		pattern->num_trains++;
+		for (i = start; i < start + repetition_length; i++)
+			pattern->probes[i].train = pattern->num_trains;
+		pattern->probes[start + repetition_length - 1].ends_train = 1;
+	}
+}
+
+static int parse_group(struct pattern_parser* parser, int depth)
+{
+	struct train_pattern* pattern = parser->pattern;
+	int first = pattern->length;
+	int64_t start_ns = parser->clock_ns;
+	if (!parse_sequence(parser, depth + 1))
+		return 0;
+	if (*parser->cursor != ')')
+		return fail(parser, "expected )");
+	parser->cursor++;
+
+	long long repetitions = 1;
+	if (*parser->cursor == 'x')
+	{
+		parser->cursor++;
+		if (*parser->cursor < '0' || *parser->cursor > '9')
+			return fail(parser, "expected a repetition count after x");
+		if (!read_count(parser, 1, &repetitions))
+			return 0;
+	}
+
+	//The group was compiled once, the rest are shifted copies
+	int repetition_length = pattern->length - first;
+	int64_t duration_ns = parser->clock_ns - start_ns;
+	if (repetitions == 0)
+		pattern->length = first;
+	else if (!reserve_probes(parser, (repetitions - 1) * repetition_length))
+		return 0;
+	long long r;
+	for (r = 1; r < repetitions; r++)
+	{
+		int i;
+		for (i = 0; i < repetition_length; i++)
+		{
+			struct pattern_probe* probe = &pattern->probes[pattern->length++];
+			*probe = pattern->probes[first + i];
+			probe->departure_ns += r * duration_ns;
+		}
+	}
+	parser->clock_ns = start_ns + repetitions * duration_ns;
+
+	//The group's size goes to the probes that were given none
+	long long first_length, last_length;
+	if (!parse_size(parser, &first_length, &last_length))
+		return 0;
+	if (first_length > 0)
+	{
+		for (r = 0; r < repetitions; r++)
+		{
+			uint16_t length = step_length(first_length, last_length, r, repetitions);
+			int i;
+			for (i = first + (int) r * repetition_length; i < first + (int) (r + 1) * repetition_length; i++)
+			{
+				if (pattern->probes[i].length == 0)
+					pattern->probes[i].length = length;
+			}
+		}
+	}
+
+	if (depth == 0)
+		mark_trains(pattern, first, repetition_length, repetitions);
+	return 1;
+}
+
+static int parse_run(struct pattern_parser* parser, int depth)
+{
+	struct train_pattern* pattern = parser->pattern;
+	long long count;
+	if (!read_count(parser, 1, &count))
+		return 0;
+	skip_spaces(parser);
+	if (*parser->cursor != 'H' && *parser->cursor != 'L')
+		return fail(parser, "expected H or L");
+	uint8_t class_index = *parser->cursor++ == 'H' ? 0 : 1;
+	long long first_length, last_length;
+	if (!parse_size(parser, &first_length, &last_length) || !reserve_probes(parser, count))
+		return 0;
+
+	long long i;
+	for (i = 0; i < count; i++)
+	{
+		struct pattern_probe* probe = &pattern->probes[pattern->length++];
+		probe->departure_ns = parser->clock_ns;
+		probe->seq_id = 0;
+		probe->train = 0;
+		probe->length = step_length(first_length, last_length, i, count);
+		probe->class_index = class_index;
+		probe->ends_train = 0;
+	}
+	if (depth == 0 && count > 0)
+		pattern->probes[pattern->length - 1].ends_train = 1;
+	return 1;
+}
+
+static int parse_sequence(struct pattern_parser* parser, int depth)
+{
+	while (1)
+	{
+		skip_spaces(parser);
+		char c = *parser->cursor;
+		if (c == '\0' || c == ')')
+			return 1;
+		int parsed;
+		if (c == '(')
+		{
+			parser->cursor++;
+			parsed = parse_group(parser, depth);
+		}
+		else if (c == '+')
+		{
+			parser->cursor++;
+			parsed = parse_pause(parser);
+		}
+		else
+			parsed = parse_run(parser, depth);
+		if (!parsed)
+			return 0;
+	}
+}
+
+error_t train_pattern_compile(const char* text, struct train_pattern* pattern)
+{
+	memset(pattern, 0, sizeof *pattern);
+	struct pattern_parser parser;
+	parser.text = parser.cursor = text;
+	parser.pattern = pattern;
+	parser.clock_ns = 0;
+	parser.error = NULL;
+
+	if (parse_sequence(&parser, 0) && *parser.cursor == ')')
+		fail(&parser, "unmatched )");
+	if (parser.error != NULL)
+	{
+		fprintf(stderr, "ERROR #%d: Pattern error at column %d of \"%s\": %s\n", INVALID_NUMBER_OF_ARGUMENTS,
+			(int) (parser.cursor - text) + 1, text, parser.error);
+		train_pattern_free(pattern);
+		return INVALID_NUMBER_OF_ARGUMENTS;
+	}
+
+	//Sequence ids in send order, per class
+	int32_t next_seq_id[2] = { 0, 0 };
+	int i;
+	for (i = 0; i < pattern->length; i++)
+		pattern->probes[i].seq_id = next_seq_id[pattern->probes[i].class_index]++;
+	pattern->class_counts[0] = next_seq_id[0];
+	pattern->class_counts[1] = next_seq_id[1];
+	return SUCCESS;
+}
+
+void train_pattern_free(struct train_pattern* pattern)
+{
+	free(pattern->probes);
+	pattern->probes = NULL;
+	pattern->length = pattern->capacity = 0;
+}
+
+int train_pattern_format(char* text, size_t size, int initial_train_length, int seperation_train_length,
+	int num_packet_trains, char priority)
+{
+	char single = priority == 'L' ? 'L' : 'H';
+	char other = single == 'H' ? 'L' : 'H';
+	int written = snprintf(text, size, "%dH (1%c %d%c)x%d", initial_train_length > 0 ? initial_train_length : 0,
+		single, seperation_train_length > 0 ? seperation_train_length : 0, other,
+		num_packet_trains > 0 ? num_packet_trains : 0);
+	return written >= 0 && (size_t) written < size;
+}
@@ -0,0 +1,43 @@
+/*************************************************************
+** Train Schedule
+** See trainSchedule.h for the order of the probes.
+**************************************************************/
+
+#include <string.h>
+
+#include "trainSchedule.h"
+
+error_t train_schedule_init(struct train_schedule* schedule, int initial_train_length,
+	int seperation_train_length, int num_packet_trains, char priority)
+{
+	char text[128];
+	memset(schedule, 0, sizeof *schedule);
+	if (!train_pattern_format(text, sizeof text, initial_train_length, seperation_train_length,
+		num_packet_trains, priority))
+		return FAILURE;
+	return train_pattern_compile(text, &schedule->pattern);
+}
+
+void train_schedule_free(struct train_schedule* schedule)
+{
+	train_pattern_free(&schedule->pattern);
+}
+
+int train_schedule_next(struct train_schedule* schedule, struct scheduled_probe* probe)
+{
+	if (schedule->position >= schedule->pattern.length)
+		return 0;
+	const struct pattern_probe* next = &schedule->pattern.probes[schedule->position++];
+	probe->seq_id = next->seq_id;
+	probe->priority = next->class_index == 0 ? 'H' : 'L';
+	probe->train = next->train;
+	probe->ends_train = next->ends_train;
+	probe->length = next->length;
+	schedule->next_seq_id[next->class_index] = next->seq_id + 1;
+	return 1;
+}
+
+int train_schedule_length(const struct train_schedule* schedule)
+{
+	return schedule->pattern.length;
+}
@@ -0,0 +1,253 @@
+/**************************************************************************
+** Experiment Simulator
+** Run many simulated experiments (middleboxSimulator.h) through the
+** receiver's sequential H versus L test ("sequential") and the rank
+** test of unitExperimentVerdict -i ("rank") and count the verdicts, to
+** see how often each detector is right for a given middlebox and
+** schedule.
+** With -o every experiment is also written as the daemon would write
+** it, for unitExperimentRefiner, unitExperimentAnalyzer and
+** unitExperimentVerdict.
+**
+** Parameters:
+**  (1) scenario        = neutral, priority, compression or delayer
+**  (2) num_experiments = experiments to simulate
+**  Optional flags:
+**  -s initial_train_length seperation_train_length num_packet_trains
+**                   the sender schedule, default 2001 19 200 as in
+**                   experimentReceiver.config
+**  -l probe_length  payload bytes, default 100
+**  -p names         the sender run of each phase, default "LH"
+**  -b mbps          bottleneck rate, default 100
+**  -q packets       buffer of each queue, default 1000
+**  -d ms            propagation delay, default 10
+**  -e probability   random loss on the bottleneck, default 0
+**  -A mbps          sender access rate, default 1000
+**  -J ns            mean extra gap between sends, default 500
+**  -x mbps          Poisson cross traffic, default 0
+**  -X fraction      share of the cross traffic in class 'H', default 0.5
+**  -y bytes         cross traffic packet size, default 1000
+**  -c class         class the middlebox treats differently, default 'L'
+**                   for compression and 'H' otherwise
+**  -z fraction      compressed size of a zero payload, default 0.05
+**  -t us            delay of a triggering probe, default 1000
+**  -a alpha         significance of both tests, default 0.01
+**  -B iterations    bootstrap resamples of the rank test, default 0
+**  -j threads       worker threads, default the number of processors
+**  -r seed          first seed; experiment i uses a seed derived from it
+**  -o output_path   write sim_<scenario>_<i>.raw and .owd there
+**
+** One row per phase, detector and verdict with its count and share is
+** printed, with the mean pairs the sequential test used.
+**
+** How To Run Code:
+**   ./unitExperimentSimulator [options] scenario num_experiments
+**
+** Example:
+**   ./unitExperimentSimulator -b 50 -x 40 priority 10000
+**************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "taracomConstants.h"
+#include "middleboxSimulator.h"
+#include "sequentialTest.h"
+#include "differentiationTest.h"
+#include "workStealingPool.h"
+#include "timeUtil.h"
+
+#define NUM_VERDICTS 4
+#define NUM_DETECTORS 2
+
+static const char* detector_names[NUM_DETECTORS] = { "sequential", "rank" };
+
+struct worker_tally
+{
+  struct sim_capture capture;
+  long long verdicts[NUM_DETECTORS][SIM_MAX_PHASES][NUM_VERDICTS];
+  long long pairs[SIM_MAX_PHASES];
+  error_t status;
+};
+
+struct simulation
+{
+  const struct middlebox_config* config;
+  const struct sim_experiment* experiment;
+  struct sequential_test_config test_config;
+  struct differentiation_config rank_config;
+  uint64_t seed;
+  const char* output_path;
+  struct worker_tally* tallies;
+};
+
+static void simulate_task(int task, int worker, void* context)
+{
+  struct simulation* simulation = (struct simulation*) context;
+  struct worker_tally* tally = &simulation->tallies[worker];
+  uint64_t seed = simulation->seed ^ ((uint64_t) (task + 1) * 0x9e3779b97f4a7c15ULL);
+  if(simulate_experiment(simulation->config, simulation->experiment, seed, &tally->capture) != SUCCESS)
+  {
+    tally->status = FAILURE;
+    return;
+  }
+
+  int verdicts[SIM_MAX_PHASES], rank_verdicts[SIM_MAX_PHASES], pairs[SIM_MAX_PHASES];
+  sim_capture_verdicts(&tally->capture, simulation->experiment, &simulation->test_config, verdicts, pairs);
+  if(sim_capture_rank_verdicts(&tally->capture, simulation->experiment, &simulation->rank_config, rank_verdicts) != SUCCESS)
+  {
+    tally->status = FAILURE;
+    return;
+  }
+  int phase;
+  for(phase = 0; phase < tally->capture.num_phases; phase++)
+  {
+    tally->verdicts[0][phase][verdicts[phase]]++;
+    tally->verdicts[1][phase][rank_verdicts[phase]]++;
+    tally->pairs[phase] += pairs[phase];
+  }
+
+  if(simulation->output_path != NULL)
+  {
+    char raw_file[MAX_FILENAME_SIZE];
+    snprintf(raw_file, sizeof raw_file, "%ssim_%s_%d.raw", simulation->output_path,
+      middlebox_scenario_name(simulation->config->scenario), task);
+    if(sim_capture_write(&tally->capture, raw_file) != SUCCESS)
+      tally->status = FWRITE_ERROR;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  struct middlebox_config config;
+  middlebox_default_config(&config, SIM_NEUTRAL);
+  struct sim_experiment experiment = { 2001, 19, 200, 100, "LH", 1000000000LL };
+  int num_workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  double alpha = SEQUENTIAL_DEFAULT_ALPHA;
+  int iterations = 0;
+  uint64_t seed = 1;
+  const char* output_path = NULL;
+  char affected_class = 0;
+
+  int arg = 1;
+  while(arg + 1 < argc && argv[arg][0] == '-' && argv[arg][1] != '\0' && argv[arg][2] == '\0')
+  {
+    const char* value = argv[arg + 1];
+    switch(argv[arg][1])
+    {
+    case 's':
+      if(arg + 3 >= argc)
+        break;
+      experiment.initial_train_length = atoi(argv[arg + 1]);
+      experiment.seperation_train_length = atoi(argv[arg + 2]);
+      experiment.num_packet_trains = atoi(argv[arg + 3]);
+      arg += 2;
+      break;
+    case 'l': experiment.probe_length = atoi(value); break;
+    case 'p': experiment.phase_names = value; break;
+    case 'b': config.bottleneck_bps = atof(value) * 1e6; break;
+    case 'q': config.buffer_packets = atoi(value); break;
+    case 'd': config.propagation_ns = (int64_t) (atof(value) * 1e6); break;
+    case 'e': config.loss_probability = atof(value); break;
+    case 'A': config.access_bps = atof(value) * 1e6; break;
+    case 'J': config.send_jitter_ns = atoll(value); break;
+    case 'x': config.cross_bps = atof(value) * 1e6; break;
+    case 'X': config.cross_high_fraction = atof(value); break;
+    case 'y': config.cross_length = atoi(value); break;
+    case 'c': affected_class = value[0]; break;
+    case 'z': config.compressed_fraction = atof(value); break;
+    case 't': config.trigger_delay_ns = (int64_t) (atof(value) * 1e3); break;
+    case 'a': alpha = atof(value); break;
+    case 'B': iterations = atoi(value); break;
+    case 'j': num_workers = atoi(value); break;
+    case 'r': seed = strtoull(value, NULL, 0); break;
+    case 'o': output_path = value; break;
+    default: arg = argc; break;
+    }
+    arg += 2;
+  }
+
+  int scenario = argc - arg == 2 ? middlebox_scenario(argv[arg]) : -1;
+  int num_experiments = scenario >= 0 ? atoi(argv[arg + 1]) : 0;
+  if(scenario < 0 || num_experiments < 1 || num_workers < 1 || alpha <= 0 || alpha >= 0.5 || iterations < 0 ||
+    config.bottleneck_bps <= 0 || config.access_bps <= 0 || experiment.probe_length < 1 ||
+    strlen(experiment.phase_names) == 0 || strlen(experiment.phase_names) > SIM_MAX_PHASES)
+  {
+    fprintf(stderr,"ERROR #%d: INVALID NUMBER OF ARGUMENTS\n", INVALID_NUMBER_OF_ARGUMENTS);
+    fprintf(stderr, "Usage: ./unitExperimentSimulator [-s initial seperation trains] [-l probe_length] [-p names] [-b mbps] [-q packets] [-d ms] [-e loss] [-A mbps] [-J ns] [-x mbps] [-X fraction] [-y bytes] [-c class] [-z fraction] [-t us] [-a alpha] [-B iterations] [-j threads] [-r seed] [-o output_path] neutral|priority|compression|delayer num_experiments\n");
+    return INVALID_NUMBER_OF_ARGUMENTS;
+  }
+
+  //Scenario defaults first, then what was given on the command line
+  struct middlebox_config defaults;
+  middlebox_default_config(&defaults, scenario);
+  config.scenario = scenario;
+  config.affected_class = affected_class != 0 ? affected_class : defaults.affected_class;
+
+  struct simulation simulation;
+  simulation.config = &config;
+  simulation.experiment = &experiment;
+  simulation.test_config.alpha = alpha;
+  simulation.test_config.beta = alpha;
+  simulation.test_config.effect = SEQUENTIAL_DEFAULT_EFFECT;
+  simulation.test_config.early_stop = 0;
+  simulation.test_config.min_effect_ns = 0;
+
+  //Experiments already run in parallel, the bootstrap of each stays on its worker
+  differentiation_default_config(&simulation.rank_config);
+  simulation.rank_config.alpha = alpha;
+  simulation.rank_config.iterations = iterations;
+  simulation.seed = seed;
+  simulation.output_path = output_path;
+  if(num_workers > MAX_POOL_WORKERS)
+    num_workers = MAX_POOL_WORKERS;
+  simulation.tallies = (struct worker_tally*) calloc(num_workers, sizeof(struct worker_tally));
+  if(simulation.tallies == NULL)
+    return FAILURE;
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  error_t result = work_pool_run(num_experiments, num_workers, simulate_task, &simulation);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  //Fold the workers' counts together
+  long long verdicts[NUM_DETECTORS][SIM_MAX_PHASES][NUM_VERDICTS];
+  long long pairs[SIM_MAX_PHASES];
+  memset(verdicts, 0, sizeof verdicts);
+  memset(pairs, 0, sizeof pairs);
+  int w, detector, phase, verdict;
+  for(w = 0; w < num_workers; w++)
+  {
+    struct worker_tally* tally = &simulation.tallies[w];
+    if(tally->status != SUCCESS)
+      result = tally->status;
+    for(phase = 0; phase < SIM_MAX_PHASES; phase++)
+    {
+      for(detector = 0; detector < NUM_DETECTORS; detector++)
+        for(verdict = 0; verdict < NUM_VERDICTS; verdict++)
+          verdicts[detector][phase][verdict] += tally->verdicts[detector][phase][verdict];
+      pairs[phase] += tally->pairs[phase];
+    }
+    sim_capture_free(&tally->capture);
+  }
+  free(simulation.tallies);
+
+  printf("#scenario\tphase\trun\tdetector\tverdict\texperiments\tshare\tmean_pairs\n");
+  int num_phases = (int) strlen(experiment.phase_names);
+  for(phase = 0; phase < num_phases; phase++)
+  {
+    for(detector = 0; detector < NUM_DETECTORS; detector++)
+      for(verdict = 0; verdict < NUM_VERDICTS; verdict++)
+        printf("%s\t%d\t%c\t%s\t%s\t%lld\t%.4f\t%.1f\n", middlebox_scenario_name(scenario), phase,
+          experiment.phase_names[phase], detector_names[detector], sequential_verdict_name(verdict),
+          verdicts[detector][phase][verdict], (double) verdicts[detector][phase][verdict] / num_experiments,
+          detector == 0 ? (double) pairs[phase] / num_experiments : 0.0);
+  }
+
+  double seconds = elapsed_ns(start, end) / 1e9;
+  fprintf(stderr, "%d experiments in %.2f s, %.0f per hour\n", num_experiments, seconds,
+    seconds > 0 ? num_experiments * 3600.0 / seconds : 0);
+  return result;
+}
@@ -0,0 +1,389 @@
+/*************************************************************
+** Middlebox Simulator
+** See middleboxSimulator.h for the model.
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "middleboxSimulator.h"
+#include "trainSchedule.h"
+#include "timeUtil.h"
+
+static const char* scenario_names[SIM_NUM_SCENARIOS] = { "neutral", "priority", "compression", "delayer" };
+
+//A packet waiting for the bottleneck; priority is 0 for cross traffic
+struct queued_packet
+{
+	int64_t service_ns;
+	int64_t tx_time_ns;
+	int32_t seq_id;
+	char priority;
+};
+
+struct packet_queue
+{
+	int head;
+	int count;
+	int capacity;
+	struct queued_packet* packets;
+};
+
+static inline uint64_t splitmix64(uint64_t* state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+//Uniform in [0, 1)
+static inline double uniform(uint64_t* state)
+{
+	return (double) (splitmix64(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline int64_t exponential_ns(uint64_t* state, double mean_ns)
+{
+	return (int64_t) (-mean_ns * log(1.0 - uniform(state)));
+}
+
+static inline int64_t serialization_ns(int bytes, double bps)
+{
+	return (int64_t) (bytes * 8.0 * NSEC_PER_SEC / bps);
+}
+
+static int queue_push(struct packet_queue* queue, struct queued_packet packet)
+{
+	if (queue->count == queue->capacity)
+		return 0;
+	queue->packets[(queue->head + queue->count++) % queue->capacity] = packet;
+	return 1;
+}
+
+static struct queued_packet queue_pop(struct packet_queue* queue)
+{
+	struct queued_packet packet = queue->packets[queue->head];
+	queue->head = (queue->head + 1) % queue->capacity;
+	queue->count--;
+	return packet;
+}
+
+static int compare_records(const void* a, const void* b)
+{
+	const struct sim_record* x = (const struct sim_record*) a;
+	const struct sim_record* y = (const struct sim_record*) b;
+	if (x->arrival_ns != y->arrival_ns)
+		return x->arrival_ns < y->arrival_ns ? -1 : 1;
+	return (x->tx_time_ns > y->tx_time_ns) - (x->tx_time_ns < y->tx_time_ns);
+}
+
+void middlebox_default_config(struct middlebox_config* config, int scenario)
+{
+	memset(config, 0, sizeof *config);
+	config->scenario = scenario;
+	config->bottleneck_bps = 100e6;
+	config->buffer_packets = 1000;
+	config->propagation_ns = 10000000;
+	config->access_bps = 1e9;
+	config->send_jitter_ns = 500;
+	config->cross_length = 1000;
+	config->cross_high_fraction = 0.5;
+	config->affected_class = scenario == SIM_COMPRESSION ? 'L' : 'H';
+	config->compressed_fraction = 0.05;
+	config->trigger_delay_ns = 1000000;
+}
+
+int middlebox_scenario(const char* name)
+{
+	int scenario;
+	for (scenario = 0; scenario < SIM_NUM_SCENARIOS; scenario++)
+	{
+		if (strcmp(name, scenario_names[scenario]) == 0)
+			return scenario;
+	}
+	return -1;
+}
+
+const char* middlebox_scenario_name(int scenario)
+{
+	return scenario >= 0 && scenario < SIM_NUM_SCENARIOS ? scenario_names[scenario] : "unknown";
+}
+
+static int reserve_records(struct sim_capture* capture, int num_records)
+{
+	if (num_records <= capture->capacity)
+		return 1;
+	struct sim_record* records = (struct sim_record*) realloc(capture->records, num_records * sizeof(struct sim_record));
+	if (records == NULL)
+		return 0;
+	capture->records = records;
+	capture->capacity = num_records;
+	return 1;
+}
+
+/*
+ * Bottleneck time of a probe of priority, after the scenario
+ */
+static int64_t probe_service_ns(const struct middlebox_config* config, int probe_length, char priority)
+{
+	int bytes = probe_length;
+	if (config->scenario == SIM_COMPRESSION && priority == config->affected_class && probe_length > 16)
+		bytes = 16 + (int) ((probe_length - 16) * config->compressed_fraction);
+	return serialization_ns(bytes + SIM_PACKET_OVERHEAD, config->bottleneck_bps);
+}
+
+/*
+ * Start the bottleneck on packet at start_ns: deliver it if it is a
+ * probe that survives the link, and return when the link is free again
+ */
+static int64_t serve(const struct middlebox_config* config, struct sim_capture* capture, int phase,
+	struct queued_packet packet, int64_t start_ns, uint64_t* state)
+{
+	int64_t done_ns = start_ns + packet.service_ns;
+	if (packet.priority == 0)
+		return done_ns;
+	if (config->loss_probability > 0 && uniform(state) < config->loss_probability)
+		return done_ns;
+
+	struct sim_record* record = &capture->records[capture->num_records++];
+	record->arrival_ns = done_ns + config->propagation_ns;
+	if (config->scenario == SIM_DELAYER && packet.priority == config->affected_class)
+		record->arrival_ns += config->trigger_delay_ns;
+	record->tx_time_ns = packet.tx_time_ns;
+	record->seq_id = packet.seq_id;
+	record->priority = packet.priority;
+	record->phase = (uint8_t) phase;
+	return done_ns;
+}
+
+/*
+ * Simulate the run of phase starting at start_ns. Returns when its last
+ * packet left the bottleneck.
+ */
+static int64_t simulate_run(const struct middlebox_config* config, const struct sim_experiment* experiment,
+	int phase, struct train_schedule* schedule, int64_t start_ns, struct packet_queue* queues, uint64_t* state,
+	struct sim_capture* capture)
+{
+	struct scheduled_probe probe;
+
+	int first = capture->num_records;
+	double cross_mean_ns = config->cross_bps > 0 ?
+		config->cross_length * 8.0 * NSEC_PER_SEC / config->cross_bps : 0;
+	int64_t cross_service_ns = serialization_ns(config->cross_length + SIM_PACKET_OVERHEAD, config->bottleneck_bps);
+
+	int have_probe = train_schedule_next(schedule, &probe);
+	int64_t probe_ns = start_ns;
+	int64_t cross_ns = cross_mean_ns > 0 ? start_ns + exponential_ns(state, cross_mean_ns) : INT64_MAX;
+	int64_t free_ns = start_ns;
+	int separate_queues = config->scenario == SIM_PRIORITY;
+	while (1)
+	{
+		int64_t arrival_ns = have_probe ? (probe_ns < cross_ns ? probe_ns : cross_ns) : INT64_MAX;
+		int waiting = queues[0].count + queues[1].count;
+		if (waiting > 0 && free_ns <= arrival_ns)
+		{
+			//The favoured queue goes first; without priority queue 1 is unused
+			struct packet_queue* next = queues[0].count > 0 ? &queues[0] : &queues[1];
+			free_ns = serve(config, capture, phase, queue_pop(next), free_ns, state);
+			continue;
+		}
+		if (!have_probe)
+			break;
+
+		struct queued_packet packet;
+		int queue_index = 0;
+		if (probe_ns <= cross_ns)
+		{
+			int probe_length = probe.length > 0 ? probe.length : experiment->probe_length;
+			capture->sent[phase][probe.priority == 'H' ? 0 : 1]++;
+			packet.tx_time_ns = probe_ns;
+			packet.seq_id = probe.seq_id;
+			packet.priority = probe.priority;
+			packet.service_ns = probe_service_ns(config, probe_length, probe.priority);
+			queue_index = separate_queues && probe.priority != config->affected_class;
+
+			have_probe = train_schedule_next(schedule, &probe);
+			probe_ns += serialization_ns(probe_length + SIM_PACKET_OVERHEAD, config->access_bps);
+			if (config->send_jitter_ns > 0)
+				probe_ns += exponential_ns(state, (double) config->send_jitter_ns);
+		}
+		else
+		{
+			memset(&packet, 0, sizeof packet);
+			packet.service_ns = cross_service_ns;
+			char cross_class = uniform(state) < config->cross_high_fraction ? 'H' : 'L';
+			queue_index = separate_queues && cross_class != config->affected_class;
+			cross_ns += exponential_ns(state, cross_mean_ns);
+		}
+
+		if (waiting == 0 && free_ns <= arrival_ns)
+			free_ns = serve(config, capture, phase, packet, arrival_ns, state);
+		else
+			queue_push(&queues[queue_index], packet);
+	}
+
+	qsort(capture->records + first, capture->num_records - first, sizeof(struct sim_record), compare_records);
+	return free_ns;
+}
+
+error_t simulate_experiment(const struct middlebox_config* config, const struct sim_experiment* experiment,
+	uint64_t seed, struct sim_capture* capture)
+{
+	int num_phases = (int) strlen(experiment->phase_names);
+	if (num_phases > SIM_MAX_PHASES)
+		num_phases = SIM_MAX_PHASES;
+	int run_length = experiment->initial_train_length +
+		experiment->num_packet_trains * (experiment->seperation_train_length + 1);
+	if (!reserve_records(capture, num_phases * run_length + 1))
+		return FAILURE;
+	capture->num_records = 0;
+	capture->num_phases = num_phases;
+	memset(capture->sent, 0, sizeof capture->sent);
+
+	int buffer_packets = config->buffer_packets > 0 ? config->buffer_packets : 1;
+	struct packet_queue queues[2];
+	struct queued_packet* packets = (struct queued_packet*) malloc(2 * buffer_packets * sizeof(struct queued_packet));
+	if (packets == NULL)
+		return FAILURE;
+	int i;
+	for (i = 0; i < 2; i++)
+	{
+		queues[i].head = 0;
+		queues[i].count = 0;
+		queues[i].capacity = buffer_packets;
+		queues[i].packets = packets + i * buffer_packets;
+	}
+
+	uint64_t state = seed;
+	int64_t start_ns = 0;
+	int phase;
+	for (phase = 0; phase < num_phases; phase++)
+	{
+		struct train_schedule schedule;
+		if (train_schedule_init(&schedule, experiment->initial_train_length, experiment->seperation_train_length,
+			experiment->num_packet_trains, experiment->phase_names[phase]) != SUCCESS)
+		{
+			free(packets);
+			return FAILURE;
+		}
+		int64_t done_ns = simulate_run(config, experiment, phase, &schedule, start_ns, queues, &state, capture);
+		train_schedule_free(&schedule);
+		start_ns = done_ns + config->propagation_ns + config->trigger_delay_ns + experiment->phase_gap_ns;
+	}
+	free(packets);
+	return SUCCESS;
+}
+
+void sim_capture_free(struct sim_capture* capture)
+{
+	free(capture->records);
+	memset(capture, 0, sizeof *capture);
+}
+
+error_t sim_capture_write(const struct sim_capture* capture, const char* raw_file)
+{
+	char owd_file[MAX_FILENAME_SIZE];
+	const char* extension = strrchr(raw_file, '.');
+	int base_length = extension != NULL && strchr(extension, '/') == NULL ?
+		(int) (extension - raw_file) : (int) strlen(raw_file);
+	snprintf(owd_file, sizeof owd_file, "%.*s.owd", base_length, raw_file);
+
+	FILE* raw = fopen(raw_file, "w");
+	FILE* owd = fopen(owd_file, "w");
+	if (raw == NULL || owd == NULL)
+	{
+		fprintf(stderr, "ERROR #%d: File Open Failed\n", FILE_ERROR);
+		if (raw != NULL)
+			fclose(raw);
+		if (owd != NULL)
+			fclose(owd);
+		return FILE_ERROR;
+	}
+
+	fprintf(owd, "#phase\tseq\tclass\towd_ns\tcorrected_owd_ns\n");
+	int i, phase = 0;
+	for (i = 0; i < capture->num_records; i++)
+	{
+		const struct sim_record* record = &capture->records[i];
+		while (phase < record->phase)
+		{
+			fputs("*\n", raw);
+			phase++;
+		}
+		struct timespec ts = ns_to_timespec(record->arrival_ns);
+		fprintf(raw, "%d\t%c\t%d.%.9ld\n", record->seq_id, record->priority, (int) ts.tv_sec, ts.tv_nsec);
+
+		//The simulated clocks agree, so the delays need no correction
+		long long owd_ns = (long long) (record->arrival_ns - record->tx_time_ns);
+		fprintf(owd, "%d\t%d\t%c\t%lld\t%lld\n", record->phase, record->seq_id, record->priority, owd_ns, owd_ns);
+	}
+
+	error_t result = ferror(raw) || ferror(owd) ? FWRITE_ERROR : SUCCESS;
+	fclose(raw);
+	fclose(owd);
+	return result;
+}
+
+void sim_capture_verdicts(const struct sim_capture* capture, const struct sim_experiment* experiment,
+	const struct sequential_test_config* config, int* verdicts, int* pairs)
+{
+	struct sequential_test tests[SIM_MAX_PHASES];
+	int phase;
+	for (phase = 0; phase < capture->num_phases; phase++)
+		sequential_test_reset(&tests[phase], config, experiment->phase_names[phase] == 'H' ? 0 : 1);
+
+	int i;
+	for (i = 0; i < capture->num_records; i++)
+	{
+		const struct sim_record* record = &capture->records[i];
+		sequential_test_observe(&tests[record->phase], record->priority == 'H' ? 0 : 1,
+			record->arrival_ns - record->tx_time_ns);
+	}
+
+	for (phase = 0; phase < capture->num_phases; phase++)
+	{
+		verdicts[phase] = tests[phase].verdict;
+		pairs[phase] = tests[phase].verdict != SEQUENTIAL_UNDECIDED ? tests[phase].decided_at_pair : tests[phase].pairs;
+	}
+}
+
+error_t sim_capture_rank_verdicts(const struct sim_capture* capture, const struct sim_experiment* experiment,
+	const struct differentiation_config* config, int* verdicts)
+{
+	double* high = (double*) malloc((capture->num_records + 1) * sizeof(double));
+	double* low = (double*) malloc((capture->num_records + 1) * sizeof(double));
+	if (high == NULL || low == NULL)
+	{
+		free(high);
+		free(low);
+		return FAILURE;
+	}
+
+	//Records are grouped by phase
+	error_t status = SUCCESS;
+	int i = 0, phase;
+	for (phase = 0; phase < capture->num_phases && status == SUCCESS; phase++)
+	{
+		size_t num_high = 0, num_low = 0;
+		for (; i < capture->num_records && capture->records[i].phase == phase; i++)
+		{
+			const struct sim_record* record = &capture->records[i];
+			if (record->priority == 'H' && record->seq_id < experiment->initial_train_length)
+				continue;
+			double delay_ns = (double) (record->arrival_ns - record->tx_time_ns);
+			if (record->priority == 'H')
+				high[num_high++] = delay_ns;
+			else
+				low[num_low++] = delay_ns;
+		}
+		struct differentiation_result result;
+		status = differentiation_test(high, num_high, low, num_low, config, &result);
+		verdicts[phase] = result.verdict;
+	}
+	free(high);
+	free(low);
+	return status;
+}
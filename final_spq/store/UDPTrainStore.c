@@ -0,0 +1,331 @@
+/**************************************************************************
+** Result Store Tool
+** Find experiments in a result store (resultStore.h) written by the
+** receiver daemon (-S store) and hand them to the .raw based tools.
+** Runs are read straight from the mapped segments, without parsing.
+**
+** Commands:
+**  list store [key=value...]
+**      one line per matching run: id, sender, tag, receiver, start, probes,
+**      phases, the sender run of each phase, parameters and the probes
+**      received per class. Keys: id, sender, receiver, date (YYYY-MM-DD),
+**      length, initial, seperation, trains, classes (e.g. HL)
+**  summary store [key=value...]
+**      per matching run, phase and class: probes received, sequence gaps,
+**      ids missing from in order runs, dispersion (last minus first
+**      arrival), inter-arrival min/p50/p99/max and the least and largest
+**      probe length. Computed over the mapped columns with the column
+**      kernels (columnKernels.h).
+**  export store experiment_id raw_file
+**      write the run as .raw text ("-" for stdout), for the refiner and
+**      the analyzer
+**
+** Example:
+**   ./unitExperimentStore list results/ date=2014-03-25 length=100
+**   ./unitExperimentStore summary results/ classes=HL
+**   ./unitExperimentStore export results/ 42 temp/run_42.raw
+**************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "taracomConstants.h"
+#include "resultStore.h"
+#include "timeUtil.h"
+#include "columnKernels.h"
+#include "quantileHistogram.h"
+
+/*
+ * Set the query field named by a key=value argument. Returns 0 for an
+ * unknown key.
+ */
+static int parse_query_argument(char* argument, struct result_query* query)
+{
+  char* value = strchr(argument, '=');
+  if(value == NULL)
+    return 0;
+  *value++ = '\0';
+
+  if(strcmp(argument, "id") == 0)
+    query->experiment_id = atoll(value);
+  else if(strcmp(argument, "sender") == 0)
+    query->sender = value;
+  else if(strcmp(argument, "receiver") == 0)
+    query->receiver = value;
+  else if(strcmp(argument, "date") == 0)
+    query->date = value;
+  else if(strcmp(argument, "length") == 0)
+    query->probe_length = atoi(value);
+  else if(strcmp(argument, "initial") == 0)
+    query->initial_train_length = atoi(value);
+  else if(strcmp(argument, "seperation") == 0)
+    query->seperation_train_length = atoi(value);
+  else if(strcmp(argument, "trains") == 0)
+    query->num_packet_trains = atoi(value);
+  else if(strcmp(argument, "classes") == 0)
+  {
+    for(; *value != '\0'; value++)
+      query->class_set |= *value == 'H' ? RESULT_CLASS_HIGH : (*value == 'L' ? RESULT_CLASS_LOW : RESULT_CLASS_OTHER);
+  }
+  else
+    return 0;
+  return 1;
+}
+
+static void class_set_string(uint32_t class_set, char* out)
+{
+  if(class_set & RESULT_CLASS_HIGH)
+    *out++ = 'H';
+  if(class_set & RESULT_CLASS_LOW)
+    *out++ = 'L';
+  if(class_set & RESULT_CLASS_OTHER)
+    *out++ = '?';
+  *out = '\0';
+}
+
+static error_t list_runs(struct result_store_reader* reader, const struct result_query* query)
+{
+  printf("#id\tsender\ttag\treceiver\tstart\tprobes\tphases\truns\tlength\tinitial\tseperation\ttrains\tclasses\treceived_H\treceived_L\n");
+  size_t i;
+  for(i = 0; i < reader->num_entries; i++)
+  {
+    const struct result_entry* entry = &reader->entries[i];
+    if(!result_store_match(entry, query))
+      continue;
+
+    //Counted from the mapped priority column
+    struct result_columns columns;
+    int received[2] = { 0, 0 };
+    if(result_store_columns(reader, entry, &columns) == SUCCESS)
+    {
+      int record;
+      for(record = 0; record < columns.num_records; record++)
+      {
+        received[0] += columns.priority[record] == 'H';
+        received[1] += columns.priority[record] == 'L';
+      }
+    }
+
+    char sender[INET_ADDRSTRLEN];
+    struct in_addr addr = { entry->sender_addr };
+    inet_ntop(AF_INET, &addr, sender, sizeof sender);
+    char start[24];
+    struct tm start_tm;
+    time_t start_time = (time_t) entry->start_wall_time;
+    localtime_r(&start_time, &start_tm);
+    strftime(start, sizeof start, "%Y-%m-%d_%H:%M:%S", &start_tm);
+    char classes[4];
+    class_set_string(entry->class_set, classes);
+    int num_runs = entry->num_phases < RESULT_MAX_PHASES ? (int) entry->num_phases : RESULT_MAX_PHASES;
+
+    printf("%lld\t%s\t%u\t%.*s\t%s\t%u\t%u\t%.*s\t%d\t%d\t%d\t%d\t%s\t%d\t%d\n",
+      (long long) entry->experiment_id, sender, (unsigned) entry->experiment_tag, RESULT_HOST_LENGTH,
+      entry->receiver, start,
+      entry->num_records, entry->num_phases, num_runs, entry->phase_priorities, entry->probe_length,
+      entry->initial_train_length, entry->seperation_train_length, entry->num_packet_trains,
+      classes, received[0], received[1]);
+  }
+  return ferror(stdout) ? FWRITE_ERROR : SUCCESS;
+}
+
+struct summary_buffers
+{
+  size_t capacity;
+  int64_t* arrivals;
+  int64_t* differences;
+  int32_t* seq_ids;
+  struct quantile_histogram interarrival;
+};
+
+static int reserve_buffers(struct summary_buffers* buffers, size_t num_records)
+{
+  if(num_records <= buffers->capacity)
+    return 1;
+  free(buffers->arrivals);
+  free(buffers->differences);
+  free(buffers->seq_ids);
+  buffers->arrivals = (int64_t*) malloc(num_records * sizeof(int64_t));
+  buffers->differences = (int64_t*) malloc(num_records * sizeof(int64_t));
+  buffers->seq_ids = (int32_t*) malloc(num_records * sizeof(int32_t));
+  buffers->capacity = buffers->arrivals && buffers->differences && buffers->seq_ids ? num_records : 0;
+  return buffers->capacity > 0;
+}
+
+/*
+ * Rows of the probes [first, last) of one phase of a run
+ */
+static void summarize_phase(const struct result_entry* entry, const struct result_columns* columns,
+  size_t first, size_t last, struct summary_buffers* buffers)
+{
+  const struct column_kernels* kernels = column_kernels();
+  int phase = columns->phase[first];
+  char run = phase < RESULT_MAX_PHASES ? entry->phase_priorities[phase] : '-';
+  const char class_names[2] = { 'H', 'L' };
+  int class_index;
+  for(class_index = 0; class_index < 2; class_index++)
+  {
+    size_t count = kernels->select_int64(columns->priority + first, columns->arrival_ns + first, last - first,
+      class_names[class_index], buffers->arrivals);
+    if(count == 0)
+      continue;
+    kernels->select_int32(columns->priority + first, columns->seq_id + first, last - first,
+      class_names[class_index], buffers->seq_ids);
+
+    int64_t missing;
+    size_t gaps = kernels->count_gaps(buffers->seq_ids, count, &missing);
+    quantile_histogram_reset(&buffers->interarrival);
+    if(count > 1)
+    {
+      kernels->diff(buffers->arrivals, count, buffers->differences);
+      quantile_histogram_record_batch(&buffers->interarrival, buffers->differences, count - 1);
+    }
+
+    //Sizes vary within a run only with a sized pattern, a plain pass is enough
+    int min_length = UINT16_MAX, max_length = 0;
+    size_t row;
+    for(row = first; row < last; row++)
+    {
+      if(columns->priority[row] != class_names[class_index])
+        continue;
+      if(columns->length[row] < min_length)
+        min_length = columns->length[row];
+      if(columns->length[row] > max_length)
+        max_length = columns->length[row];
+    }
+
+    printf("%lld\t%d\t%c\t%c\t%zu\t%zu\t%lld\t%lld\t%lld\t%lld\t%lld\t%lld\t%d\t%d\n",
+      (long long) entry->experiment_id, phase, run, class_names[class_index], count, gaps, (long long) missing,
+      (long long) (buffers->arrivals[count - 1] - buffers->arrivals[0]),
+      (long long) buffers->interarrival.min,
+      (long long) quantile_histogram_percentile(&buffers->interarrival, 50),
+      (long long) quantile_histogram_percentile(&buffers->interarrival, 99),
+      (long long) buffers->interarrival.max, min_length, max_length);
+  }
+}
+
+static error_t summarize_runs(struct result_store_reader* reader, const struct result_query* query)
+{
+  struct summary_buffers* buffers = (struct summary_buffers*) calloc(1, sizeof *buffers);
+  if(buffers == NULL)
+    return FAILURE;
+
+  printf("#id\tphase\trun\tclass\treceived\tgaps\tmissing\tdispersion_ns\tinterarrival_min_ns\tinterarrival_p50_ns\tinterarrival_p99_ns\tinterarrival_max_ns\tlength_min\tlength_max\n");
+  error_t status = SUCCESS;
+  size_t i;
+  for(i = 0; i < reader->num_entries && status == SUCCESS; i++)
+  {
+    const struct result_entry* entry = &reader->entries[i];
+    struct result_columns columns;
+    if(!result_store_match(entry, query) || result_store_columns(reader, entry, &columns) != SUCCESS)
+      continue;
+    if(!reserve_buffers(buffers, (size_t) columns.num_records))
+    {
+      status = FAILURE;
+      break;
+    }
+
+    //Phases are contiguous in arrival order
+    size_t first = 0;
+    while(first < (size_t) columns.num_records)
+    {
+      size_t last = first + 1;
+      while(last < (size_t) columns.num_records && columns.phase[last] == columns.phase[first])
+        last++;
+      summarize_phase(entry, &columns, first, last, buffers);
+      first = last;
+    }
+  }
+
+  free(buffers->arrivals);
+  free(buffers->differences);
+  free(buffers->seq_ids);
+  free(buffers);
+  if(status == SUCCESS && ferror(stdout))
+    status = FWRITE_ERROR;
+  return status;
+}
+
+/*
+ * Write a run as the daemon writes a .raw file
+ */
+static error_t export_run(struct result_store_reader* reader, long long experiment_id, const char* raw_file)
+{
+  const struct result_entry* entry = result_store_entry(reader, experiment_id);
+  if(entry == NULL)
+  {
+    fprintf(stderr, "ERROR #%d: No experiment %lld in %s\n", UNKNOWN_EXPERIMENT, experiment_id, reader->path);
+    return UNKNOWN_EXPERIMENT;
+  }
+  struct result_columns columns;
+  error_t status = result_store_columns(reader, entry, &columns);
+  if(status != SUCCESS)
+    return status;
+
+  FILE* file = strcmp(raw_file, "-") == 0 ? stdout : fopen(raw_file, "w");
+  if(file == NULL)
+  {
+    fprintf(stderr, "ERROR #%d: File Open Failed\n", FILE_ERROR);
+    return FILE_ERROR;
+  }
+  int i;
+  int phase = 0;
+  for(i = 0; i < columns.num_records; i++)
+  {
+    while(phase < columns.phase[i])
+    {
+      fputs("*\n", file);
+      phase++;
+    }
+    fprintf(file, "%d\t%c\t%lld.%.9lld\n", columns.seq_id[i], columns.priority[i],
+      (long long) (columns.arrival_ns[i] / NSEC_PER_SEC), (long long) (columns.arrival_ns[i] % NSEC_PER_SEC));
+  }
+
+  status = ferror(file) ? FWRITE_ERROR : SUCCESS;
+  if(file != stdout)
+    fclose(file);
+  if(status != SUCCESS)
+    fprintf(stderr, "ERROR #%d: File Write Failed\n", FWRITE_ERROR);
+  return status;
+}
+
+int main(int argc, char *argv[])
+{
+  int is_list = argc >= 3 && strcmp(argv[1], "list") == 0;
+  int is_summary = argc >= 3 && strcmp(argv[1], "summary") == 0;
+  int is_export = argc == 5 && strcmp(argv[1], "export") == 0;
+  if(!is_list && !is_summary && !is_export)
+  {
+    fprintf(stderr,"ERROR #%d: INVALID NUMBER OF ARGUMENTS\n", INVALID_NUMBER_OF_ARGUMENTS);
+    fprintf(stderr, "Usage: ./unitExperimentStore list store [key=value...]\n");
+    fprintf(stderr, "       ./unitExperimentStore summary store [key=value...]\n");
+    fprintf(stderr, "       ./unitExperimentStore export store experiment_id raw_file\n");
+    return INVALID_NUMBER_OF_ARGUMENTS;
+  }
+
+  struct result_query query;
+  memset(&query, 0, sizeof query);
+  int i;
+  for(i = 3; !is_export && i < argc; i++)
+  {
+    if(!parse_query_argument(argv[i], &query))
+    {
+      fprintf(stderr, "ERROR #%d: Unknown query %s\n", INVALID_NUMBER_OF_ARGUMENTS, argv[i]);
+      return INVALID_NUMBER_OF_ARGUMENTS;
+    }
+  }
+
+  struct result_store_reader reader;
+  error_t status = result_store_open_reader(&reader, argv[2]);
+  if(status != SUCCESS)
+    return status;
+  if(is_list)
+    status = list_runs(&reader, &query);
+  else if(is_summary)
+    status = summarize_runs(&reader, &query);
+  else
+    status = export_run(&reader, atoll(argv[3]), argv[4]);
+  result_store_close_reader(&reader);
+  return status;
+}
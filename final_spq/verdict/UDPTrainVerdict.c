@@ -0,0 +1,286 @@
+/**************************************************************************
+** Differentiation Verdict
+** Decide per experiment and phase whether the 'H' or the 'L' probes were
+** favoured, from the two class distributions of a finished experiment,
+** with the rank, Kolmogorov-Smirnov and bootstrap tests of
+** differentiationTest.h.
+**
+** Inputs:
+**  .owd   the corrected one-way delays the receiver daemon writes, per
+**         phase ("delay" rows)
+**  .dat   a refined phase (unitExperimentRefiner): the arrival gaps of
+**         consecutive sequence ids of each class ("interarrival" rows).
+**         Under the default schedule one class sends a single probe per
+**         train, so its gaps span whole trains; the .dat comparison is
+**         meant for schedules that spread both classes alike.
+**  other  a .raw or .rawz file is replaced by its .owd sibling
+**
+** Parameters:
+**  (1) file... = the experiments to decide
+**  Optional flags:
+**  -j threads     bootstrap threads, default the number of processors
+**  -b iterations  bootstrap resamples, default 10000
+**  -q percentile  percentile compared next to the median, default 90
+**  -a alpha       significance, default 0.01
+**  -e difference  smallest median difference (ns) that favours a class,
+**                 default 1000
+**  -r seed        bootstrap seed, so verdicts can be reproduced
+**  -p names       the sender run of each .owd phase, default "LH"
+**  -i initial_train_length
+**                 leave the initial 'H' train out of the .owd delays; it
+**                 meets a queue that is still filling up, which makes
+**                 'H' look favoured behind any bottleneck
+**
+** One row per file and phase goes to stdout; differences are 'L' minus
+** 'H', so positive ones mean the 'L' probes were slower.
+**
+** How To Run Code:
+**   ./unitExperimentVerdict [-j threads] [-b iterations] [-q percentile]
+**   [-a alpha] [-e difference] [-r seed] [-p names] [-i initial] file...
+**
+** Example:
+**   ./unitExperimentVerdict -b 20000 output_raw/131.179.*.owd
+**************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "taracomConstants.h"
+#include "differentiationTest.h"
+#include "sequentialTest.h"
+#include "rawRefiner.h"
+
+#define VERDICT_HEADER "#file\tphase\trun\tmetric\treceived_H\treceived_L\tmedian_H\tmedian_L\t" \
+  "median_diff\tmedian_diff_low\tmedian_diff_high\tpercentile\tpercentile_diff\tpercentile_diff_low\t" \
+  "percentile_diff_high\tks_d\tks_p\tu_effect\tu_p\tbootstrap_p\tverdict\tp_value\n"
+
+//Phases of one .owd file that are decided
+#define VERDICT_MAX_PHASES 16
+
+struct sample
+{
+  size_t count;
+  size_t capacity;
+  double* values;
+};
+
+struct phase_samples
+{
+  //Class index 0 = 'H', 1 = 'L'
+  struct sample classes[2];
+};
+
+static int sample_add(struct sample* sample, double value)
+{
+  if(sample->count == sample->capacity)
+  {
+    size_t capacity = sample->capacity ? 2 * sample->capacity : 1024;
+    double* values = (double*) realloc(sample->values, capacity * sizeof(double));
+    if(values == NULL)
+      return 0;
+    sample->values = values;
+    sample->capacity = capacity;
+  }
+  sample->values[sample->count++] = value;
+  return 1;
+}
+
+/*
+ * "<sec>.<nsec>" as written by the receiver, in nanoseconds
+ */
+static int parse_arrival_ns(const char* text, long long* arrival_ns)
+{
+  char* end;
+  long long seconds = strtoll(text, &end, 10);
+  if(end == text || *end != '.' || seconds < 0)
+    return 0;
+  long long nanoseconds = 0;
+  int digits = 0;
+  for(end++; *end >= '0' && *end <= '9' && digits < 9; end++, digits++)
+    nanoseconds = nanoseconds * 10 + (*end - '0');
+  for(; digits < 9; digits++)
+    nanoseconds *= 10;
+  *arrival_ns = seconds * 1000000000LL + nanoseconds;
+  return 1;
+}
+
+/*
+ * Corrected delays per phase and class of a .owd file. Returns the
+ * number of phases, or -1 on error.
+ */
+static int read_owd(FILE* file, int initial_train_length, struct phase_samples* phases)
+{
+  char line[256];
+  int num_phases = 0;
+  while(fgets(line, sizeof line, file) != NULL)
+  {
+    int phase, seq_id;
+    char priority;
+    long long owd_ns;
+    double corrected_ns;
+    if(line[0] == '#' || sscanf(line, "%d\t%d\t%c\t%lld\t%lf", &phase, &seq_id, &priority, &owd_ns,
+      &corrected_ns) != 5 || phase < 0 || phase >= VERDICT_MAX_PHASES || (priority != 'H' && priority != 'L') ||
+      (priority == 'H' && seq_id < initial_train_length))
+      continue;
+    if(!sample_add(&phases[phase].classes[priority == 'H' ? 0 : 1], corrected_ns))
+      return -1;
+    if(phase >= num_phases)
+      num_phases = phase + 1;
+  }
+  return num_phases;
+}
+
+/*
+ * Arrival gaps of consecutive sequence ids per class of a .dat file
+ */
+static int read_dat(FILE* file, struct phase_samples* phase)
+{
+  char line[256];
+  int previous_seq[2] = { -2, -2 };
+  long long previous_arrival[2] = { 0, 0 };
+  while(fgets(line, sizeof line, file) != NULL)
+  {
+    int seq_id;
+    char priority;
+    char arrival[64];
+    if(sscanf(line, "%d\t%c\t%63s", &seq_id, &priority, arrival) != 3 || (priority != 'H' && priority != 'L'))
+      continue;
+    int class_index = priority == 'H' ? 0 : 1;
+    long long arrival_ns;
+    if(!parse_arrival_ns(arrival, &arrival_ns))
+    {
+      //Lost probe (-1)
+      previous_seq[class_index] = -2;
+      continue;
+    }
+    if(previous_seq[class_index] == seq_id - 1 &&
+      !sample_add(&phase->classes[class_index], (double) (arrival_ns - previous_arrival[class_index])))
+      return -1;
+    previous_seq[class_index] = seq_id;
+    previous_arrival[class_index] = arrival_ns;
+  }
+  return 1;
+}
+
+static int has_suffix(const char* text, const char* suffix)
+{
+  size_t length = strlen(text), suffix_length = strlen(suffix);
+  return length >= suffix_length && strcmp(text + length - suffix_length, suffix) == 0;
+}
+
+static error_t decide_file(const char* path, const struct differentiation_config* config, const char* phase_names,
+  int initial_train_length)
+{
+  //A capture is decided from the delays the daemon wrote next to it
+  char owd_path[MAX_FILENAME_SIZE];
+  const char* extension = strrchr(path, '.');
+  int is_dat = has_suffix(path, ".dat");
+  if(!is_dat && !has_suffix(path, ".owd") && extension != NULL)
+  {
+    snprintf(owd_path, sizeof owd_path, "%.*s.owd", (int) (extension - path), path);
+    path = owd_path;
+  }
+
+  FILE* file = fopen(path, "r");
+  if(file == NULL)
+  {
+    fprintf(stderr, "ERROR #%d: Could not open %s\n", FILE_ERROR, path);
+    return FILE_ERROR;
+  }
+  struct phase_samples* phases = (struct phase_samples*) calloc(VERDICT_MAX_PHASES, sizeof *phases);
+  if(phases == NULL)
+  {
+    fclose(file);
+    return FAILURE;
+  }
+  int num_phases = is_dat ? read_dat(file, phases) : read_owd(file, initial_train_length, phases);
+  fclose(file);
+
+  error_t status = num_phases < 0 ? FAILURE : SUCCESS;
+  int phase;
+  for(phase = 0; phase < num_phases && status == SUCCESS; phase++)
+  {
+    struct sample* high = &phases[phase].classes[0];
+    struct sample* low = &phases[phase].classes[1];
+    if(high->count == 0 && low->count == 0)
+      continue;
+
+    //A refined phase is named by its file, x_H.dat or x_L.dat
+    char run = '-';
+    if(is_dat && strlen(path) >= 6 && path[strlen(path) - 6] == '_')
+      run = path[strlen(path) - 5];
+    else if(!is_dat && phase < (int) strlen(phase_names))
+      run = phase_names[phase];
+
+    struct differentiation_result result;
+    status = differentiation_test(high->values, high->count, low->values, low->count, config, &result);
+    if(status != SUCCESS)
+      break;
+    printf("%s\t%d\t%c\t%s\t%zu\t%zu\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\t%g\t%.0f\t%.0f\t%.0f\t%.4f\t%.3g\t%.4f\t%.3g\t%.3g\t%s\t%.3g\n",
+      path, phase, run, is_dat ? "interarrival" : "delay", result.num_high, result.num_low,
+      result.median_high, result.median_low, result.median_difference.estimate, result.median_difference.low,
+      result.median_difference.high, config->percentile, result.percentile_difference.estimate,
+      result.percentile_difference.low, result.percentile_difference.high, result.ks.statistic,
+      result.ks.p_value, result.rank.effect, result.rank.p_value, result.median_difference.p_value,
+      sequential_verdict_name(result.verdict), result.p_value);
+  }
+
+  for(phase = 0; phase < VERDICT_MAX_PHASES; phase++)
+  {
+    free(phases[phase].classes[0].values);
+    free(phases[phase].classes[1].values);
+  }
+  free(phases);
+  return status;
+}
+
+int main(int argc, char *argv[])
+{
+  struct differentiation_config config;
+  differentiation_default_config(&config);
+  config.num_workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  const char* phase_names = DEFAULT_PHASE_NAMES;
+  int initial_train_length = 0;
+
+  int arg = 1;
+  while(arg + 1 < argc && argv[arg][0] == '-' && argv[arg][1] != '\0')
+  {
+    if(strcmp(argv[arg], "-j") == 0)
+      config.num_workers = atoi(argv[arg + 1]);
+    else if(strcmp(argv[arg], "-b") == 0)
+      config.iterations = atoi(argv[arg + 1]);
+    else if(strcmp(argv[arg], "-q") == 0)
+      config.percentile = atof(argv[arg + 1]);
+    else if(strcmp(argv[arg], "-a") == 0)
+      config.alpha = atof(argv[arg + 1]);
+    else if(strcmp(argv[arg], "-e") == 0)
+      config.min_difference = atof(argv[arg + 1]);
+    else if(strcmp(argv[arg], "-r") == 0)
+      config.seed = strtoull(argv[arg + 1], NULL, 0);
+    else if(strcmp(argv[arg], "-p") == 0)
+      phase_names = argv[arg + 1];
+    else if(strcmp(argv[arg], "-i") == 0)
+      initial_train_length = atoi(argv[arg + 1]);
+    else
+      break;
+    arg += 2;
+  }
+
+  if(arg >= argc || config.num_workers < 1 || config.iterations < 0 || config.alpha <= 0 || config.alpha >= 0.5 ||
+    config.percentile <= 0 || config.percentile > 100 || config.min_difference < 0)
+  {
+    fprintf(stderr,"ERROR #%d: INVALID NUMBER OF ARGUMENTS\n", INVALID_NUMBER_OF_ARGUMENTS);
+    fprintf(stderr, "Usage: ./unitExperimentVerdict [-j threads] [-b iterations] [-q percentile] [-a alpha] [-e difference] [-r seed] [-p names] [-i initial] file...\n");
+    return INVALID_NUMBER_OF_ARGUMENTS;
+  }
+
+  printf(VERDICT_HEADER);
+  error_t result = SUCCESS;
+  for(; arg < argc; arg++)
+  {
+    if(decide_file(argv[arg], &config, phase_names, initial_train_length) != SUCCESS)
+      result = FAILURE;
+  }
+  return result;
+}